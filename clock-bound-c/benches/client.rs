@@ -0,0 +1,152 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use clock_bound_c::classify::Classification;
+use clock_bound_c::{Bound, ClientAddress, ClockBoundCachingClient, ClockBoundClient};
+use criterion::{black_box, criterion_group, criterion_main, Criterion, Throughput};
+use std::os::unix::net::UnixDatagram;
+use std::path::PathBuf;
+use std::time::{Duration, SystemTime};
+
+/// A fixed Clock Error Bound of 50 microseconds.
+const CEB_NANOS: u64 = 50_000;
+
+fn epoch_nanos() -> u64 {
+    SystemTime::now()
+        .duration_since(SystemTime::UNIX_EPOCH)
+        .unwrap()
+        .as_nanos() as u64
+}
+
+/// Start a thread answering requests the way ClockBoundD does, with a fixed Clock Error Bound
+/// around the current system time, so that the client can be benchmarked without ClockBoundD or
+/// chronyd. Returns the path of its socket.
+fn start_responder() -> PathBuf {
+    let path = std::env::temp_dir().join(format!("clockboundc-bench-{}.sock", std::process::id()));
+    let _ = std::fs::remove_file(&path);
+    let socket = UnixDatagram::bind(&path).unwrap();
+
+    std::thread::spawn(move || {
+        let mut request = [0; 1024];
+        let mut response = [0; 64];
+        loop {
+            let (size, client) = match socket.recv_from(&mut request) {
+                Ok(received) => received,
+                Err(_) => continue,
+            };
+            // Echo the header of the request, including the request id of a version 2 request
+            let header_size = if request[0] == 2 { 8 } else { 4 };
+            if size < header_size {
+                continue;
+            }
+            response[..header_size].copy_from_slice(&request[..header_size]);
+
+            let now = epoch_nanos();
+            let (earliest, latest) = (now - CEB_NANOS, now + CEB_NANOS);
+            let body = &mut response[header_size..];
+            let body_size = match request[1] {
+                1 => {
+                    body[0..8].copy_from_slice(&earliest.to_be_bytes());
+                    body[8..16].copy_from_slice(&latest.to_be_bytes());
+                    16
+                }
+                2 | 3 => {
+                    body[0] = 0;
+                    1
+                }
+                4 => {
+                    body[0..8].copy_from_slice(&earliest.to_be_bytes());
+                    body[8..16].copy_from_slice(&latest.to_be_bytes());
+                    body[16..36].fill(0);
+                    36
+                }
+                8 => {
+                    body[0..8].copy_from_slice(&earliest.to_be_bytes());
+                    body[8..16].copy_from_slice(&latest.to_be_bytes());
+                    body[16..18].fill(0);
+                    18
+                }
+                _ => 0,
+            };
+            let _ = socket.send_to_addr(&response[..header_size + body_size], &client);
+        }
+    });
+    path
+}
+
+fn bench_client(c: &mut Criterion) {
+    let path = start_responder();
+    let client = ClockBoundClient::new_with_path(path.clone()).unwrap();
+    let times: Vec<u64> = (0..64).map(|i| epoch_nanos() + i).collect();
+
+    let mut group = c.benchmark_group("client");
+    group.bench_function("now", |b| b.iter(|| client.now().unwrap()));
+    group.bench_function("before", |b| {
+        b.iter(|| client.before(black_box(0)).unwrap())
+    });
+    group.bench_function("after", |b| {
+        b.iter(|| client.after(black_box(u64::MAX)).unwrap())
+    });
+    group.bench_function("compare", |b| {
+        b.iter(|| client.compare(black_box(0)).unwrap())
+    });
+    group.bench_function("before_many_64", |b| {
+        b.iter(|| client.before_many(black_box(&times)).unwrap())
+    });
+    group.finish();
+
+    // The cost of setting up and tearing down a client for a single request
+    let mut group = c.benchmark_group("client_new");
+    for (name, address) in [
+        ("file", ClientAddress::File),
+        ("autobind", ClientAddress::Autobind),
+    ] {
+        group.bench_function(name, |b| {
+            b.iter(|| ClockBoundClient::new_with_address(path.clone(), address).unwrap())
+        });
+    }
+    group.bench_function("pool_now", |b| {
+        b.iter(|| clock_bound_c::pool::with_client_at(&path, |client| client.now()).unwrap())
+    });
+    group.finish();
+
+    // Answered from the cached bounds, without a request to the responder
+    let caching = ClockBoundCachingClient::new_with_path(
+        path,
+        Duration::from_secs(1),
+        Duration::from_secs(1),
+    )
+    .unwrap();
+    c.bench_function("caching_client_now", |b| b.iter(|| caching.now().unwrap()));
+}
+
+/// Classifying a million timestamps spread around a bound, with and without error margins.
+fn bench_classify(c: &mut Criterion) {
+    const COUNT: usize = 1 << 20;
+    let now = epoch_nanos();
+    let bound = Bound {
+        earliest: now - CEB_NANOS,
+        latest: now + CEB_NANOS,
+    };
+    let epochs: Vec<u64> = (0..COUNT as u64)
+        .map(|i| now - 4 * CEB_NANOS + (i * 7919) % (8 * CEB_NANOS))
+        .collect();
+    let margins: Vec<u64> = (0..COUNT as u64).map(|i| i % CEB_NANOS).collect();
+    let mut classification = Classification::new();
+
+    let mut group = c.benchmark_group("classify");
+    group.throughput(Throughput::Elements(COUNT as u64));
+    group.bench_function("classify_1m", |b| {
+        b.iter(|| classification.classify(&bound, black_box(&epochs)))
+    });
+    group.bench_function("classify_with_margin_1m", |b| {
+        b.iter(|| {
+            classification
+                .classify_with_margin(&bound, black_box(&epochs), black_box(&margins))
+                .unwrap()
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, bench_client, bench_classify);
+criterion_main!(benches);
@@ -0,0 +1,32 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use clock_bound_c::ClockBoundAsyncClient;
+use std::env;
+
+#[tokio::main(flavor = "current_thread")]
+async fn main() {
+    let args: Vec<String> = env::args().collect();
+    let clock_bound_d_socket = &args[1];
+
+    let client = match ClockBoundAsyncClient::new_with_path(std::path::PathBuf::from(
+        clock_bound_d_socket,
+    )) {
+        Ok(client) => client,
+        Err(e) => {
+            println!("Could not create client: {}", e);
+            return;
+        }
+    };
+
+    // Both requests are in flight on the client's socket at the same time
+    let (first, second) = tokio::join!(client.now(), client.now());
+    for response in [first, second] {
+        match response {
+            Ok(response) => println!(
+                "In nanoseconds since the Unix epoch: ({:?},{:?})",
+                response.bound.earliest, response.bound.latest
+            ),
+            Err(e) => println!("Could not complete now request: {}", e),
+        }
+    }
+}
@@ -0,0 +1,373 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+//! Drive load against ClockBoundD from many clients and report the achieved throughput, error
+//! responses and latency percentiles.
+//!
+//! ```text
+//! cargo run --release --example load /run/clockboundd/clockboundd.sock \
+//!     --threads 8 --rate 100000 --duration 10 --mix 8:1:1 --shards 4
+//! ```
+//!
+//! * `--threads` - The number of threads, each with its own ClockBoundClient. Default 1.
+//! * `--rate` - The target number of requests per second across all threads. 0, the default,
+//! runs a closed loop: each thread sends its next request as soon as the previous response is
+//! received.
+//! * `--duration` - How long to run for, in seconds. Default 10.
+//! * `--mix` - The relative weights of Now, Before and After requests. Default 1:0:0.
+//! * `--shards` - Spread the threads across the shard sockets of a ClockBoundD started with
+//! `--workers`. Default 1, which sends every request to the given socket.
+//!
+//! With a target rate, the requests of each thread are paced to the rate, but a thread still waits
+//! for the response to one request before it sends the next. The latency of a request is measured
+//! from the time it was due to be sent, so that a stalled ClockBoundD shows up in the percentiles
+//! rather than lowering the rate.
+//!
+//! A request that is not answered within RECEIVE_TIMEOUT counts as a failure, and its thread
+//! continues with a new client so that the late response is not taken for the next one.
+use clock_bound_c::{ClockBoundClient, RECEIVE_TIMEOUT};
+use std::env;
+use std::path::{Path, PathBuf};
+use std::process;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// The request types, in the order of their weights in `--mix`.
+const REQUEST_TYPES: [&str; 3] = ["now", "before", "after"];
+
+/// A histogram of latencies in nanoseconds, with buckets spaced logarithmically and split
+/// linearly into SUB_BUCKETS, so that every recorded value is within 1/64 of its bucket.
+struct Histogram {
+    counts: Vec<u64>,
+    total: u64,
+    max: u64,
+}
+
+/// The number of buckets of one nanosecond, and the number of linear sub-buckets per power of two
+/// above them, times two.
+const SUB_BUCKETS: u64 = 128;
+
+impl Histogram {
+    fn new() -> Histogram {
+        Histogram {
+            counts: vec![0; Histogram::index(u64::MAX) + 1],
+            total: 0,
+            max: 0,
+        }
+    }
+
+    fn index(value: u64) -> usize {
+        if value < SUB_BUCKETS {
+            return value as usize;
+        }
+        let shift = 63 - value.leading_zeros() as u64 - 6;
+        let sub = (value >> shift) - SUB_BUCKETS / 2;
+        (SUB_BUCKETS + (shift - 1) * SUB_BUCKETS / 2 + sub) as usize
+    }
+
+    /// The highest value recorded in a bucket.
+    fn value(index: usize) -> u64 {
+        let index = index as u64;
+        if index < SUB_BUCKETS {
+            return index;
+        }
+        let shift = (index - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+        let sub = (index - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+        ((sub + 1) << shift).wrapping_sub(1)
+    }
+
+    fn record(&mut self, latency: Duration) {
+        let value = latency.as_nanos().min(u64::MAX as u128) as u64;
+        self.counts[Histogram::index(value)] += 1;
+        self.total += 1;
+        self.max = self.max.max(value);
+    }
+
+    fn merge(&mut self, other: &Histogram) {
+        for (count, other) in self.counts.iter_mut().zip(&other.counts) {
+            *count += other;
+        }
+        self.total += other.total;
+        self.max = self.max.max(other.max);
+    }
+
+    fn percentile(&self, percentile: f64) -> Duration {
+        let rank = ((self.total as f64 * percentile / 100.0).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (index, count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Duration::from_nanos(Histogram::value(index).min(self.max));
+            }
+        }
+        Duration::from_nanos(self.max)
+    }
+}
+
+/// What one thread observed.
+struct Report {
+    latencies: Vec<Histogram>,
+    /// Responses with the error (0) response type, one count per request type.
+    error_responses: Vec<u64>,
+    /// Requests that failed to be sent or received, one count per request type.
+    failures: Vec<u64>,
+}
+
+impl Report {
+    fn new() -> Report {
+        Report {
+            latencies: REQUEST_TYPES.iter().map(|_| Histogram::new()).collect(),
+            error_responses: vec![0; REQUEST_TYPES.len()],
+            failures: vec![0; REQUEST_TYPES.len()],
+        }
+    }
+
+    fn merge(&mut self, other: &Report) {
+        for i in 0..REQUEST_TYPES.len() {
+            self.latencies[i].merge(&other.latencies[i]);
+            self.error_responses[i] += other.error_responses[i];
+            self.failures[i] += other.failures[i];
+        }
+    }
+}
+
+struct Options {
+    socket: PathBuf,
+    threads: usize,
+    rate: u64,
+    duration: Duration,
+    mix: Vec<u64>,
+    shards: usize,
+}
+
+fn usage() -> ! {
+    println!(
+        "Usage: load <clockboundd.sock> [--threads N] [--rate QPS] [--duration SECONDS] \
+         [--mix NOW:BEFORE:AFTER] [--shards N]"
+    );
+    process::exit(1);
+}
+
+fn parse_options() -> Options {
+    let args: Vec<String> = env::args().skip(1).collect();
+    if args.is_empty() {
+        usage();
+    }
+    let mut options = Options {
+        socket: PathBuf::from(&args[0]),
+        threads: 1,
+        rate: 0,
+        duration: Duration::from_secs(10),
+        mix: vec![1, 0, 0],
+        shards: 1,
+    };
+
+    let mut i = 1;
+    while i < args.len() {
+        let value = args.get(i + 1).unwrap_or_else(|| usage());
+        let number = || value.parse::<u64>().unwrap_or_else(|_| usage());
+        match args[i].as_str() {
+            "--threads" => options.threads = number().max(1) as usize,
+            "--rate" => options.rate = number(),
+            "--duration" => options.duration = Duration::from_secs(number()),
+            "--mix" => {
+                options.mix = value
+                    .split(':')
+                    .map(|w| w.parse::<u64>().unwrap_or_else(|_| usage()))
+                    .collect();
+                if options.mix.len() != REQUEST_TYPES.len() || options.mix.iter().sum::<u64>() == 0
+                {
+                    usage();
+                }
+            }
+            "--shards" => options.shards = number().max(1) as usize,
+            _ => usage(),
+        }
+        i += 2;
+    }
+    options
+}
+
+/// Get the path of a ClockBoundD shard socket. Shard 0 is the clockboundd.sock socket itself,
+/// every other shard n is the clockboundd-<n>.sock socket next to it.
+fn shard_socket_path(socket: &Path, shard: usize) -> PathBuf {
+    if shard == 0 {
+        return socket.to_path_buf();
+    }
+    socket.with_file_name(format!("clockboundd-{}.sock", shard))
+}
+
+fn epoch_nanos() -> u64 {
+    match SystemTime::now().duration_since(UNIX_EPOCH) {
+        Ok(d) => d.as_nanos() as u64,
+        Err(_) => 0,
+    }
+}
+
+/// Create a client that fails a request not answered within RECEIVE_TIMEOUT.
+fn connect(path: &Path) -> Result<ClockBoundClient, String> {
+    let client = ClockBoundClient::new_with_path(path.to_path_buf())
+        .map_err(|e| format!("Could not create client for {}: {}", path.display(), e))?;
+    client
+        .set_receive_timeout(Some(RECEIVE_TIMEOUT))
+        .map_err(|e| format!("Could not set the receive timeout: {}", e))?;
+    Ok(client)
+}
+
+/// Send requests from one client until the deadline.
+///
+/// # Arguments
+///
+/// * `client` - The client to send requests from.
+/// * `path` - The socket the client is connected to, that a new client is connected to after a
+/// request fails.
+/// * `mix` - The relative weights of each request type.
+/// * `interval` - The time between two requests, or None to send each request as soon as the
+/// previous response is received.
+/// * `start` - The time the load started.
+/// * `deadline` - The time to stop sending requests.
+fn run_client(
+    mut client: ClockBoundClient,
+    path: &Path,
+    mix: &[u64],
+    interval: Option<Duration>,
+    start: Instant,
+    deadline: Instant,
+) -> Report {
+    let mut report = Report::new();
+    // Cycle through the request types in proportion to their weights
+    let schedule: Vec<usize> = mix
+        .iter()
+        .enumerate()
+        .flat_map(|(request_type, weight)| std::iter::repeat(request_type).take(*weight as usize))
+        .collect();
+
+    let mut sent: u32 = 0;
+    loop {
+        let due = match interval {
+            Some(interval) => start + interval * sent,
+            None => Instant::now(),
+        };
+        if due >= deadline {
+            break;
+        }
+        let now = Instant::now();
+        if due > now {
+            std::thread::sleep(due - now);
+        }
+
+        let request_type = schedule[sent as usize % schedule.len()];
+        let response_type = match request_type {
+            0 => client.now().map(|r| r.header.response_type),
+            1 => client.before(epoch_nanos()).map(|r| r.header.response_type),
+            _ => client.after(epoch_nanos()).map(|r| r.header.response_type),
+        };
+        let latency = due.elapsed();
+
+        match response_type {
+            Ok(0) => report.error_responses[request_type] += 1,
+            Ok(_) => {}
+            Err(_) => {
+                report.failures[request_type] += 1;
+                // A response that arrives late must not be taken for the next request's
+                if let Ok(new_client) = connect(path) {
+                    client = new_client;
+                }
+            }
+        }
+        report.latencies[request_type].record(latency);
+        sent = sent.wrapping_add(1);
+    }
+    report
+}
+
+fn main() {
+    let options = parse_options();
+    let interval = match options.rate {
+        0 => None,
+        rate => Some(Duration::from_nanos(
+            (1_000_000_000 * options.threads as u64 / rate).max(1),
+        )),
+    };
+
+    let clients: Vec<(ClockBoundClient, PathBuf)> = (0..options.threads)
+        .map(|thread| {
+            let path = shard_socket_path(&options.socket, thread % options.shards);
+            match connect(&path) {
+                Ok(client) => (client, path),
+                Err(e) => {
+                    println!("{}", e);
+                    process::exit(1);
+                }
+            }
+        })
+        .collect();
+
+    let start = Instant::now();
+    let deadline = start + options.duration;
+    let threads: Vec<_> = clients
+        .into_iter()
+        .map(|(client, path)| {
+            let mix = options.mix.clone();
+            std::thread::spawn(move || run_client(client, &path, &mix, interval, start, deadline))
+        })
+        .collect();
+
+    let mut report = Report::new();
+    for thread in threads {
+        report.merge(&thread.join().unwrap());
+    }
+    let elapsed = start.elapsed().as_secs_f64();
+
+    let mut total = Histogram::new();
+    for latencies in &report.latencies {
+        total.merge(latencies);
+    }
+    println!(
+        "{} threads, {} shards, target rate {}, {:.1} s",
+        options.threads,
+        options.shards,
+        match options.rate {
+            0 => String::from("closed loop"),
+            rate => format!("{} requests/s", rate),
+        },
+        elapsed
+    );
+    println!(
+        "{:<8} {:>10} {:>12} {:>8} {:>8} {:>10} {:>10} {:>10} {:>10} {:>10}",
+        "type", "requests", "requests/s", "errors", "failures", "p50", "p90", "p99", "p999", "max"
+    );
+    let rows = REQUEST_TYPES
+        .iter()
+        .enumerate()
+        .map(|(i, name)| {
+            (
+                *name,
+                &report.latencies[i],
+                report.error_responses[i],
+                report.failures[i],
+            )
+        })
+        .chain(std::iter::once((
+            "total",
+            &total,
+            report.error_responses.iter().sum(),
+            report.failures.iter().sum(),
+        )));
+    for (name, latencies, errors, failures) in rows {
+        if latencies.total == 0 {
+            continue;
+        }
+        println!(
+            "{:<8} {:>10} {:>12.0} {:>8} {:>8} {:>10} {:>10} {:>10} {:>10} {:>10}",
+            name,
+            latencies.total,
+            latencies.total as f64 / elapsed,
+            errors,
+            failures,
+            format!("{:?}", latencies.percentile(50.0)),
+            format!("{:?}", latencies.percentile(90.0)),
+            format!("{:?}", latencies.percentile(99.0)),
+            format!("{:?}", latencies.percentile(99.9)),
+            format!("{:?}", Duration::from_nanos(latencies.max)),
+        );
+    }
+}
@@ -0,0 +1,69 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use clock_bound_c::{ClockBoundClient, LatencyStats};
+use std::env;
+use std::time::Duration;
+
+fn print_latency(name: &str, latency: &LatencyStats) {
+    println!(
+        "{:<14} p50 {:?} p99 {:?} p999 {:?} max {:?}",
+        name,
+        Duration::from_nanos(latency.p50),
+        Duration::from_nanos(latency.p99),
+        Duration::from_nanos(latency.p999),
+        Duration::from_nanos(latency.max)
+    );
+}
+
+fn main() {
+    let args: Vec<String> = env::args().collect();
+    let clock_bound_d_socket = &args[1];
+
+    let client =
+        match ClockBoundClient::new_with_path(std::path::PathBuf::from(clock_bound_d_socket)) {
+            Ok(client) => client,
+            Err(e) => {
+                println!("Could not create client: {}", e);
+                return;
+            }
+        };
+
+    let response = match client.stats() {
+        Ok(response) => response,
+        Err(e) => {
+            println!("Could not complete stats request: {}", e);
+            return;
+        }
+    };
+    if response.header.response_type == 0 {
+        println!("ClockBoundD does not support stats requests");
+        return;
+    }
+
+    println!("Uptime: {:?}", response.uptime);
+    let names = [
+        "invalid",
+        "now",
+        "before",
+        "after",
+        "batch",
+        "subscribe",
+        "",
+        "stats",
+        "compare",
+    ];
+    for (name, count) in names.iter().zip(response.requests.iter()) {
+        if !name.is_empty() {
+            println!("{:<14} {}", name, count);
+        }
+    }
+    println!("{:<14} {}", "error flag", response.error_flag_responses);
+    println!("{:<14} {}", "send failures", response.send_failures);
+    println!(
+        "{:<14} {} ({} failed)",
+        "polls", response.polls, response.poll_failures
+    );
+    print_latency("service time", &response.service_time);
+    print_latency("snapshot age", &response.snapshot_age);
+    print_latency("poll latency", &response.poll_latency);
+}
@@ -0,0 +1,31 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use clock_bound_c::ClockBoundSubscriber;
+use std::env;
+use std::time::Duration;
+
+fn main() {
+    let args: Vec<String> = env::args().collect();
+    let clock_bound_d_socket = &args[1];
+
+    let subscriber =
+        match ClockBoundSubscriber::new_with_path(std::path::PathBuf::from(clock_bound_d_socket)) {
+            Ok(subscriber) => subscriber,
+            Err(e) => {
+                println!("Could not create subscriber: {}", e);
+                return;
+            }
+        };
+
+    // The bounds are calculated locally from the latest model pushed by ClockBoundD
+    for _ in 0..5 {
+        match subscriber.now() {
+            Ok(response) => println!(
+                "In nanoseconds since the Unix epoch: ({:?},{:?})",
+                response.bound.earliest, response.bound.latest
+            ),
+            Err(e) => println!("Could not complete now request: {}", e),
+        }
+        std::thread::sleep(Duration::from_secs(1));
+    }
+}
@@ -0,0 +1,496 @@
+/*
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The C ABI of ClockBoundC, for C and C++ programs.
+ *
+ * The clockbound_client functions send requests to ClockBoundD, and are exported by the cdylib
+ * (libclock_bound_c.so) and staticlib (libclock_bound_c.a) of clock-bound-c. Times are
+ * nanoseconds since the Unix Epoch.
+ *
+ * The clockbound_shm functions are defined inline in this header. They read the shared memory
+ * segment published by ClockBoundD and calculate the bounds from the system time, without a call
+ * into the library or a system call, so they can be used without linking clock-bound-c. They use
+ * the GCC and Clang atomic builtins, POSIX.1-2008 (for example -std=gnu99, or _POSIX_C_SOURCE
+ * defined as 200809L with -std=c99) and round() and ceil() from the math library.
+ *
+ * Every function returns CLOCKBOUND_OK (0) on success, or one of the negative CLOCKBOUND_ERR_*
+ * statuses, with errno set to the error from the operating system if there was one. A panic in
+ * the library is returned as CLOCKBOUND_ERR_OTHER.
+ */
+#ifndef CLOCKBOUND_H
+#define CLOCKBOUND_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The default Unix Datagram Socket file that is generated by ClockBoundD. */
+#define CLOCKBOUND_SOCKET_PATH "/run/clockboundd/clockboundd.sock"
+
+/* The default shared memory segment file that is generated by ClockBoundD. */
+#define CLOCKBOUND_SHM_PATH "/run/clockboundd/clockboundd.shm"
+
+/* The statuses returned by every function. */
+#define CLOCKBOUND_OK 0
+#define CLOCKBOUND_ERR_INVALID_ARGUMENT -1
+#define CLOCKBOUND_ERR_CONNECT -2
+#define CLOCKBOUND_ERR_BIND -3
+#define CLOCKBOUND_ERR_SET_PERMISSIONS -4
+#define CLOCKBOUND_ERR_SEND -5
+#define CLOCKBOUND_ERR_RECEIVE -6
+#define CLOCKBOUND_ERR_WRITE_REQUEST -7
+#define CLOCKBOUND_ERR_INVALID_TIMESTAMP_COUNT -8
+#define CLOCKBOUND_ERR_SHM_OPEN -9
+#define CLOCKBOUND_ERR_SHM_MAP -10
+#define CLOCKBOUND_ERR_SHM_INVALID -11
+#define CLOCKBOUND_ERR_SHM_BUSY -12
+#define CLOCKBOUND_ERR_OTHER -13
+#define CLOCKBOUND_ERR_BOUND_UNAVAILABLE -14
+
+/* The version of the ClockBound protocol of a response header. See PROTOCOL.md. */
+#define CLOCKBOUND_RESPONSE_VERSION 1
+
+/* The response types of a header. See PROTOCOL.md. */
+#define CLOCKBOUND_RESPONSE_ERROR 0
+#define CLOCKBOUND_RESPONSE_NOW 1
+#define CLOCKBOUND_RESPONSE_BEFORE 2
+#define CLOCKBOUND_RESPONSE_AFTER 3
+#define CLOCKBOUND_RESPONSE_BATCH 4
+#define CLOCKBOUND_RESPONSE_COMPARE 8
+
+/* The maximum number of timestamps tested by clockbound_before_many and clockbound_after_many. */
+#define CLOCKBOUND_MAX_BATCH_TIMESTAMPS 64
+
+/*
+ * The header of a response. A response_type of CLOCKBOUND_RESPONSE_ERROR means that ClockBoundD
+ * could not answer the request, or could not get tracking data on its last poll to Chrony.
+ * unsynchronized is 1 if Chrony is reporting as unsynchronized.
+ */
+struct clockbound_header {
+    uint8_t response_version;
+    uint8_t response_type;
+    uint8_t unsynchronized;
+};
+
+/* The bounds of the current time: the system time minus and plus the Clock Error Bound. */
+struct clockbound_bound {
+    uint64_t earliest;
+    uint64_t latest;
+};
+
+/* The result of clockbound_now. timestamp is the system time the bounds are around. */
+struct clockbound_now_result {
+    struct clockbound_header header;
+    struct clockbound_bound bound;
+    uint64_t timestamp;
+};
+
+/* The result of clockbound_before. before is 1 if the time is before the earliest bound. */
+struct clockbound_before_result {
+    struct clockbound_header header;
+    uint8_t before;
+};
+
+/* The result of clockbound_after. after is 1 if the time is after the latest bound. */
+struct clockbound_after_result {
+    struct clockbound_header header;
+    uint8_t after;
+};
+
+/* The result of clockbound_compare: the bounds, and both results of testing the time against
+ * them. */
+struct clockbound_compare_result {
+    struct clockbound_header header;
+    struct clockbound_bound bound;
+    uint8_t before;
+    uint8_t after;
+};
+
+/*
+ * The result of clockbound_before_many and clockbound_after_many. Bit i of bits is set if the ith
+ * timestamp is before (or after) the bounds.
+ */
+struct clockbound_many_result {
+    struct clockbound_header header;
+    struct clockbound_bound bound;
+    uint64_t bits;
+};
+
+/* The result of clockbound_timing_finish, in nanoseconds. */
+struct clockbound_timing_result {
+    /* The timed work began no earlier than this time. */
+    uint64_t earliest_start;
+    /* The timed work finished no later than this time. */
+    uint64_t latest_finish;
+    /* No less than this amount of time elapsed while the work was timed. */
+    uint64_t min_execution_time;
+    /* No more than this amount of time elapsed while the work was timed. */
+    uint64_t max_execution_time;
+};
+
+/* A client of ClockBoundD. A client must not be used by two threads at the same time. */
+typedef struct clockbound_client clockbound_client;
+
+/* A timer started by clockbound_timing_start. */
+typedef struct clockbound_timer clockbound_timer;
+
+/* Returns a static description of a status. */
+const char *clockbound_strerror(int status);
+
+/* Create a client connected to CLOCKBOUND_SOCKET_PATH. */
+int clockbound_client_new(clockbound_client **client);
+
+/* Create a client connected to a ClockBoundD socket path. */
+int clockbound_client_new_with_path(const char *path, clockbound_client **client);
+
+/* Close a client. A null client is ignored. */
+void clockbound_client_free(clockbound_client *client);
+
+/* Get the bounds of the current time. */
+int clockbound_now(const clockbound_client *client, struct clockbound_now_result *result);
+
+/* Test whether a time is before the earliest bound. */
+int clockbound_before(const clockbound_client *client, uint64_t before_time,
+                      struct clockbound_before_result *result);
+
+/* Test whether a time is after the latest bound. */
+int clockbound_after(const clockbound_client *client, uint64_t after_time,
+                     struct clockbound_after_result *result);
+
+/* Test a time against both bounds, and get the bounds it was tested against, in one request. */
+int clockbound_compare(const clockbound_client *client, uint64_t time,
+                       struct clockbound_compare_result *result);
+
+/* Test between 1 and CLOCKBOUND_MAX_BATCH_TIMESTAMPS times against the earliest bound in one
+ * request. */
+int clockbound_before_many(const clockbound_client *client, const uint64_t *times, size_t count,
+                           struct clockbound_many_result *result);
+
+/* Test between 1 and CLOCKBOUND_MAX_BATCH_TIMESTAMPS times against the latest bound in one
+ * request. */
+int clockbound_after_many(const clockbound_client *client, const uint64_t *times, size_t count,
+                          struct clockbound_many_result *result);
+
+/*
+ * Start a timer from the bounds of the current time. Finishing it does not send a request: the
+ * time elapsed is measured with the monotonic clock. Every started timer must be finished.
+ */
+int clockbound_timing_start(const clockbound_client *client, clockbound_timer **timer);
+
+/* Stop a timer and free it. */
+int clockbound_timing_finish(clockbound_timer *timer, struct clockbound_timing_result *result);
+
+/*
+ * Classify times against a bound locally, without a request to ClockBoundD. Bit i % 64 of word
+ * i / 64 of before is set if the ith time is definitely before the bound, and of after if it is
+ * definitely after. margins is either null or holds an error margin in nanoseconds for each time.
+ * before and after must each have room for (count + 63) / 64 words.
+ */
+int clockbound_classify(const struct clockbound_bound *bound, const uint64_t *times,
+                        const uint64_t *margins, size_t count, uint64_t *before, uint64_t *after);
+
+/*
+ * The inline reader of the shared memory segment. The layout and the calculation of the bounds
+ * are described in PROTOCOL.md. A clockbound_shm can be used by many threads at the same time.
+ */
+
+#define CLOCKBOUND_SHM_MAGIC 0x434c4b42u
+#define CLOCKBOUND_SHM_VERSION 1u
+
+/* The number of times a read is retried while ClockBoundD is updating the segment. */
+#define CLOCKBOUND_SHM_READ_RETRIES 1000000
+
+/* The layout of the shared memory segment. The f64 fields are held as their bits. */
+struct clockbound_shm_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seq;
+    uint64_t ref_time;
+    uint64_t root_dispersion;
+    uint64_t current_correction;
+    uint64_t root_delay;
+    uint64_t skew_ppm;
+    uint64_t resid_freq_ppm;
+    uint64_t max_clock_error;
+    uint32_t leap_status;
+    uint32_t error_flag;
+};
+
+/* A mapping of the shared memory segment. */
+struct clockbound_shm {
+    const struct clockbound_shm_segment *segment;
+};
+
+/* Map the shared memory segment at a path, such as CLOCKBOUND_SHM_PATH. */
+static inline int clockbound_shm_open(struct clockbound_shm *shm, const char *path)
+{
+    struct stat st;
+    void *ptr;
+    int fd;
+    int saved_errno;
+
+    if (shm == NULL || path == NULL) {
+        return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return CLOCKBOUND_ERR_SHM_OPEN;
+    }
+    if (fstat(fd, &st) < 0) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return CLOCKBOUND_ERR_SHM_OPEN;
+    }
+    if ((size_t)st.st_size < sizeof(struct clockbound_shm_segment)) {
+        close(fd);
+        return CLOCKBOUND_ERR_SHM_INVALID;
+    }
+    ptr = mmap(NULL, sizeof(struct clockbound_shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+    saved_errno = errno;
+    /* The mapping stays valid once the file is closed */
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        errno = saved_errno;
+        return CLOCKBOUND_ERR_SHM_MAP;
+    }
+
+    shm->segment = (const struct clockbound_shm_segment *)ptr;
+    if (__atomic_load_n(&shm->segment->magic, __ATOMIC_ACQUIRE) != CLOCKBOUND_SHM_MAGIC ||
+        __atomic_load_n(&shm->segment->version, __ATOMIC_RELAXED) != CLOCKBOUND_SHM_VERSION) {
+        munmap(ptr, sizeof(struct clockbound_shm_segment));
+        shm->segment = NULL;
+        return CLOCKBOUND_ERR_SHM_INVALID;
+    }
+    return CLOCKBOUND_OK;
+}
+
+/* Unmap the shared memory segment. */
+static inline void clockbound_shm_close(struct clockbound_shm *shm)
+{
+    if (shm != NULL && shm->segment != NULL) {
+        munmap((void *)shm->segment, sizeof(struct clockbound_shm_segment));
+        shm->segment = NULL;
+    }
+}
+
+/* Load a f64 field of the segment from its bits. */
+static inline double clockbound__load_f64(const uint64_t *field)
+{
+    uint64_t bits = __atomic_load_n(field, __ATOMIC_RELAXED);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Convert a double to a u64 the way Rust casts do: NaN and negative values are 0, and values too
+ * large saturate. */
+static inline uint64_t clockbound__f64_to_u64(double value)
+{
+    if (!(value > 0.0)) {
+        return 0;
+    }
+    if (value >= 18446744073709551616.0) {
+        return UINT64_MAX;
+    }
+    return (uint64_t)value;
+}
+
+static inline uint64_t clockbound__saturating_add(uint64_t a, uint64_t b)
+{
+    uint64_t sum;
+    return __builtin_add_overflow(a, b, &sum) ? UINT64_MAX : sum;
+}
+
+static inline uint64_t clockbound__saturating_mul(uint64_t a, uint64_t b)
+{
+    uint64_t product;
+    return __builtin_mul_overflow(a, b, &product) ? UINT64_MAX : product;
+}
+
+/*
+ * Read the segment and the system time, and calculate the header and bounds of the current time
+ * with the same saturating integer arithmetic as ClockBoundD.
+ */
+static inline int clockbound_shm_bound(const struct clockbound_shm *shm,
+                                       struct clockbound_header *header,
+                                       struct clockbound_bound *bound)
+{
+    const uint64_t nanos_per_sec = 1000000000u;
+    const struct clockbound_shm_segment *segment;
+    uint64_t seq, ref_time, base_ceb, growth_ppb, time_nanos, elapsed, growth, ceb, root_delay;
+    double root_dispersion, current_correction, root_delay_secs, rate_ppm;
+    uint32_t leap_status, error_flag;
+    struct timespec ts;
+    int retries;
+
+    if (shm == NULL || shm->segment == NULL || header == NULL || bound == NULL) {
+        return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+    }
+    segment = shm->segment;
+
+    /* Take a consistent copy of the tracking data using the segment's seqlock */
+    for (retries = 0;; retries++) {
+        if (retries == CLOCKBOUND_SHM_READ_RETRIES) {
+            return CLOCKBOUND_ERR_SHM_BUSY;
+        }
+        seq = __atomic_load_n(&segment->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            ref_time = __atomic_load_n(&segment->ref_time, __ATOMIC_RELAXED);
+            root_dispersion = clockbound__load_f64(&segment->root_dispersion);
+            current_correction = clockbound__load_f64(&segment->current_correction);
+            root_delay_secs = clockbound__load_f64(&segment->root_delay);
+            rate_ppm = clockbound__load_f64(&segment->max_clock_error) +
+                       clockbound__load_f64(&segment->skew_ppm) +
+                       clockbound__load_f64(&segment->resid_freq_ppm);
+            leap_status = __atomic_load_n(&segment->leap_status, __ATOMIC_RELAXED);
+            error_flag = __atomic_load_n(&segment->error_flag, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&segment->seq, __ATOMIC_RELAXED) == seq) {
+                break;
+            }
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    time_nanos = (uint64_t)ts.tv_sec * nanos_per_sec + (uint64_t)ts.tv_nsec;
+
+    /*
+     * Mirror the response header ClockBoundD would have sent. An error response type indicates
+     * that ClockBoundD could not get tracking data on its last poll to Chrony, in which case the
+     * bounds keep growing from the last tracking data received.
+     */
+    header->response_version = CLOCKBOUND_RESPONSE_VERSION;
+    header->response_type = error_flag ? CLOCKBOUND_RESPONSE_ERROR : CLOCKBOUND_RESPONSE_NOW;
+    header->unsynchronized = leap_status == 3;
+
+    /* Clock Error Bound = |System time offset| + Root dispersion + (Root delay / 2), at the time
+     * of Chrony's last update */
+    root_delay = clockbound__f64_to_u64(round(root_delay_secs * 1e9));
+    base_ceb = clockbound__saturating_add(
+        clockbound__saturating_add(clockbound__f64_to_u64(round(fabs(current_correction) * 1e9)),
+                                   clockbound__f64_to_u64(round(root_dispersion * 1e9))),
+        root_delay / 2 + root_delay % 2);
+
+    /* The root dispersion grows at the error rate per second since Chrony's last update */
+    growth_ppb = clockbound__f64_to_u64(ceil(rate_ppm * 1000.0));
+    if (growth_ppb > nanos_per_sec) {
+        growth_ppb = nanos_per_sec;
+    }
+    /* The bound can not be extrapolated backwards, ClockBoundD answers an error response */
+    if (time_nanos < ref_time) {
+        return CLOCKBOUND_ERR_BOUND_UNAVAILABLE;
+    }
+    elapsed = time_nanos - ref_time;
+    /* Split into whole seconds so that the product stays within 64 bits */
+    growth = clockbound__saturating_add(
+        clockbound__saturating_mul(elapsed / nanos_per_sec, growth_ppb),
+        ((elapsed % nanos_per_sec) * growth_ppb + nanos_per_sec - 1) / nanos_per_sec);
+    ceb = clockbound__saturating_add(base_ceb, growth);
+
+    bound->earliest = time_nanos > ceb ? time_nanos - ceb : 0;
+    bound->latest = clockbound__saturating_add(time_nanos, ceb);
+    return CLOCKBOUND_OK;
+}
+
+/* Get the bounds of the current time from the shared memory segment. */
+static inline int clockbound_shm_now(const struct clockbound_shm *shm,
+                                     struct clockbound_now_result *result)
+{
+    int status;
+
+    if (result == NULL) {
+        return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+    }
+    status = clockbound_shm_bound(shm, &result->header, &result->bound);
+    if (status == CLOCKBOUND_OK) {
+        result->timestamp =
+            result->bound.latest - ((result->bound.latest - result->bound.earliest) / 2);
+    }
+    return status;
+}
+
+/* Test whether a time is before the earliest bound, calculated from the shared memory segment. */
+static inline int clockbound_shm_before(const struct clockbound_shm *shm, uint64_t before_time,
+                                        struct clockbound_before_result *result)
+{
+    struct clockbound_bound bound;
+    int status;
+
+    if (result == NULL) {
+        return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+    }
+    status = clockbound_shm_bound(shm, &result->header, &bound);
+    if (status == CLOCKBOUND_OK) {
+        if (result->header.response_type != CLOCKBOUND_RESPONSE_ERROR) {
+            result->header.response_type = CLOCKBOUND_RESPONSE_BEFORE;
+        }
+        result->before = before_time < bound.earliest;
+    }
+    return status;
+}
+
+/* Test whether a time is after the latest bound, calculated from the shared memory segment. */
+static inline int clockbound_shm_after(const struct clockbound_shm *shm, uint64_t after_time,
+                                       struct clockbound_after_result *result)
+{
+    struct clockbound_bound bound;
+    int status;
+
+    if (result == NULL) {
+        return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+    }
+    status = clockbound_shm_bound(shm, &result->header, &bound);
+    if (status == CLOCKBOUND_OK) {
+        if (result->header.response_type != CLOCKBOUND_RESPONSE_ERROR) {
+            result->header.response_type = CLOCKBOUND_RESPONSE_AFTER;
+        }
+        result->after = after_time > bound.latest;
+    }
+    return status;
+}
+
+/* Test a time against both bounds, calculated from the shared memory segment. */
+static inline int clockbound_shm_compare(const struct clockbound_shm *shm, uint64_t time,
+                                         struct clockbound_compare_result *result)
+{
+    int status;
+
+    if (result == NULL) {
+        return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+    }
+    status = clockbound_shm_bound(shm, &result->header, &result->bound);
+    if (status == CLOCKBOUND_OK) {
+        if (result->header.response_type != CLOCKBOUND_RESPONSE_ERROR) {
+            result->header.response_type = CLOCKBOUND_RESPONSE_COMPARE;
+        }
+        result->before = time < result->bound.earliest;
+        result->after = time > result->bound.latest;
+    }
+    return status;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLOCKBOUND_H */
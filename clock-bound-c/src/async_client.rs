@@ -0,0 +1,488 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use crate::error::ClockBoundCError;
+use crate::protocol::{self, ResponseV2};
+use crate::{
+    connect_socket, timing_result, ClientAddress, ResponseAfter, ResponseAfterMany, ResponseBefore,
+    ResponseBeforeMany, ResponseCompare, ResponseNow, TimingResult,
+    CLOCKBOUNDD_SOCKET_ADDRESS_PATH, RECEIVE_TIMEOUT,
+};
+use std::collections::HashMap;
+use std::future::Future;
+use std::io;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard, PoisonError};
+use tokio::net::UnixDatagram;
+use tokio::sync::oneshot;
+use tokio::task::JoinHandle;
+
+/// The requests waiting on a response.
+#[derive(Default)]
+struct Pending {
+    /// The sender waiting on the response to each request id in flight.
+    responses: HashMap<u32, oneshot::Sender<Result<ResponseV2, io::Error>>>,
+    /// Set once receiving from the socket has failed. No more responses will be received.
+    error: Option<io::ErrorKind>,
+}
+
+/// An asynchronous client to communicate with ClockBoundD, built on Tokio.
+///
+/// Requests are sent with version 2 of the protocol, which carries a request id that ClockBoundD
+/// echoes back, so many requests can be in flight on the client's single socket. A task spawned
+/// when the client is created receives the responses and hands each one to the request with the
+/// matching request id.
+///
+/// A request fails with ReceiveMessageError if its response is not received within
+/// RECEIVE_TIMEOUT. A response without a request id, such as the version 1 error response of a
+/// ClockBoundD that does not support version 2, can not be matched to a request, so it fails every
+/// request in flight.
+pub struct ClockBoundAsyncClient {
+    socket: Arc<UnixDatagram>,
+    /// The client socket file, removed when the client is dropped.
+    path: Option<PathBuf>,
+    next_request_id: AtomicU32,
+    pending: Arc<Mutex<Pending>>,
+    receiver: JoinHandle<()>,
+}
+
+impl ClockBoundAsyncClient {
+    /// Create a new ClockBoundAsyncClient using the default clockboundd.sock path at
+    /// "/run/clockboundd/clockboundd.sock".
+    ///
+    /// Must be called from within a Tokio runtime.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundAsyncClient;
+    /// # #[tokio::main(flavor = "current_thread")]
+    /// # async fn main() {
+    /// let client = match ClockBoundAsyncClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// # }
+    /// ```
+    pub fn new() -> Result<ClockBoundAsyncClient, ClockBoundCError> {
+        ClockBoundAsyncClient::new_with_path(PathBuf::from(CLOCKBOUNDD_SOCKET_ADDRESS_PATH))
+    }
+
+    /// Create a new ClockBoundAsyncClient using a defined clockboundd.sock path.
+    ///
+    /// Must be called from within a Tokio runtime.
+    ///
+    /// # Arguments
+    ///
+    /// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+    pub fn new_with_path(
+        clock_bound_d_socket: PathBuf,
+    ) -> Result<ClockBoundAsyncClient, ClockBoundCError> {
+        let sock = connect_socket(clock_bound_d_socket, ClientAddress::File)?;
+        let path = sock
+            .local_addr()
+            .ok()
+            .and_then(|addr| addr.as_pathname().map(PathBuf::from));
+
+        let socket = match sock
+            .set_nonblocking(true)
+            .and_then(|_| UnixDatagram::from_std(sock))
+        {
+            Ok(socket) => Arc::new(socket),
+            Err(e) => {
+                if let Some(path) = &path {
+                    let _ = std::fs::remove_file(path);
+                }
+                return Err(ClockBoundCError::ConnectError(e));
+            }
+        };
+
+        let pending = Arc::new(Mutex::new(Pending::default()));
+        let receiver = tokio::spawn(receive_responses(socket.clone(), pending.clone()));
+
+        Ok(ClockBoundAsyncClient {
+            socket,
+            path,
+            next_request_id: AtomicU32::new(0),
+            pending,
+            receiver,
+        })
+    }
+
+    /// Returns the bounds of the current system time +/- the error calculated from chrony.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundAsyncClient;
+    /// # #[tokio::main(flavor = "current_thread")]
+    /// # async fn main() {
+    /// let client = match ClockBoundAsyncClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let response = match client.now().await{
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete now request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// # }
+    /// ```
+    pub async fn now(&self) -> Result<ResponseNow, ClockBoundCError> {
+        let response = self.request(protocol::REQUEST_TYPE_NOW, &[]).await?;
+        let bound = protocol::decode_bound(response.body());
+        // Since the bounds are the system time +/- the Clock Error Bound, the system time
+        // timestamp can be calculated with the below formula.
+        let timestamp = bound.latest - ((bound.latest - bound.earliest) / 2);
+        Ok(ResponseNow {
+            header: response.header(),
+            bound,
+            timestamp,
+        })
+    }
+
+    /// Returns true if the provided timestamp is before the earliest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the earliest error bound.
+    pub async fn before(&self, before_time: u64) -> Result<ResponseBefore, ClockBoundCError> {
+        let mut body: [u8; 8] = [0; 8];
+        protocol::encode_before_after_body(before_time, &mut body);
+        let response = self.request(protocol::REQUEST_TYPE_BEFORE, &body).await?;
+        Ok(ResponseBefore {
+            header: response.header(),
+            before: protocol::decode_flag(response.body()),
+        })
+    }
+
+    /// Returns true if the provided timestamp is after the latest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the latest error bound.
+    pub async fn after(&self, after_time: u64) -> Result<ResponseAfter, ClockBoundCError> {
+        let mut body: [u8; 8] = [0; 8];
+        protocol::encode_before_after_body(after_time, &mut body);
+        let response = self.request(protocol::REQUEST_TYPE_AFTER, &body).await?;
+        Ok(ResponseAfter {
+            header: response.header(),
+            after: protocol::decode_flag(response.body()),
+        })
+    }
+
+    /// Tests the provided timestamp against both error bounds. See ClockBoundClient::compare.
+    ///
+    /// # Arguments
+    ///
+    /// * `time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is tested
+    /// against the error bounds.
+    pub async fn compare(&self, time: u64) -> Result<ResponseCompare, ClockBoundCError> {
+        let mut body: [u8; 8] = [0; 8];
+        protocol::encode_before_after_body(time, &mut body);
+        let response = self.request(protocol::REQUEST_TYPE_COMPARE, &body).await?;
+        let (bound, before, after) = protocol::decode_compare(response.body());
+        Ok(ResponseCompare {
+            header: response.header(),
+            bound,
+            before,
+            after,
+        })
+    }
+
+    /// Tests each of the provided timestamps against the earliest error bound. See
+    /// ClockBoundClient::before_many.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_times` - Between 1 and 64 timestamps, represented as nanoseconds since the Unix
+    /// Epoch, that are tested against the earliest error bound.
+    pub async fn before_many(
+        &self,
+        before_times: &[u64],
+    ) -> Result<ResponseBeforeMany, ClockBoundCError> {
+        let response = self.batch(before_times).await?;
+        let (bound, before, _) = protocol::decode_batch(response.body());
+        Ok(ResponseBeforeMany {
+            header: response.header(),
+            bound,
+            before,
+        })
+    }
+
+    /// Tests each of the provided timestamps against the latest error bound. See
+    /// ClockBoundClient::after_many.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_times` - Between 1 and 64 timestamps, represented as nanoseconds since the Unix
+    /// Epoch, that are tested against the latest error bound.
+    pub async fn after_many(
+        &self,
+        after_times: &[u64],
+    ) -> Result<ResponseAfterMany, ClockBoundCError> {
+        let response = self.batch(after_times).await?;
+        let (bound, _, after) = protocol::decode_batch(response.body());
+        Ok(ResponseAfterMany {
+            header: response.header(),
+            bound,
+            after,
+        })
+    }
+
+    /// Await `f` and return bounds on its execution time.
+    ///
+    /// The execution time includes any time the future spends waiting to be polled.
+    ///
+    /// # Arguments
+    ///
+    /// * `f` - The future to time.
+    pub async fn timing<A, F>(
+        &self,
+        f: F,
+    ) -> Result<(TimingResult, A), (ClockBoundCError, Result<A, F>)>
+    where
+        F: Future<Output = A>,
+    {
+        // Get the first timestamps
+        let start = match self.now().await {
+            Ok(response) => response.bound,
+            Err(e) => return Err((e, Err(f))),
+        };
+
+        // Await the provided future, f
+        let output = f.await;
+
+        // Get the second timestamps
+        let finish = match self.now().await {
+            Ok(response) => response.bound,
+            Err(e) => return Err((e, Ok(output))),
+        };
+
+        Ok((
+            timing_result(start.earliest, start.latest, finish.earliest, finish.latest),
+            output,
+        ))
+    }
+
+    /// Send a batch request and wait for its response.
+    async fn batch(&self, times: &[u64]) -> Result<ResponseV2, ClockBoundCError> {
+        if times.is_empty() || times.len() > protocol::MAX_BATCH_TIMESTAMPS {
+            return Err(ClockBoundCError::InvalidTimestampCount(times.len()));
+        }
+        let mut body: [u8; protocol::BATCH_BODY_SIZE] = [0; protocol::BATCH_BODY_SIZE];
+        let body_size = protocol::encode_batch_body(times, &mut body);
+        self.request(protocol::REQUEST_TYPE_BATCH, &body[..body_size])
+            .await
+    }
+
+    /// Send a request with a new request id and wait for the response with the same id.
+    ///
+    /// # Arguments
+    ///
+    /// * `request_type` - The request type: Now (1), Before (2), After (3), Batch (4) or
+    /// Compare (8).
+    /// * `body` - The encoded body of the request.
+    async fn request(&self, request_type: u8, body: &[u8]) -> Result<ResponseV2, ClockBoundCError> {
+        let request_id = self.next_request_id.fetch_add(1, Ordering::Relaxed);
+        let mut request: [u8; protocol::REQUEST_BUFFER_SIZE_V2] =
+            [0; protocol::REQUEST_BUFFER_SIZE_V2];
+        let request_size =
+            protocol::encode_request_v2(request_type, request_id, body, &mut request);
+
+        // Register the request before sending it, so that the receiving task knows it is still
+        // wanted
+        let (tx, rx) = oneshot::channel();
+        {
+            let mut pending = lock(&self.pending);
+            if let Some(kind) = pending.error {
+                return Err(ClockBoundCError::ReceiveMessageError(io::Error::from(kind)));
+            }
+            pending.responses.insert(request_id, tx);
+        }
+        // Deregister the request if it is dropped before its response is received
+        let _registration = Registration {
+            pending: &self.pending,
+            request_id,
+        };
+
+        if let Err(e) = self.socket.send(&request[..request_size]).await {
+            return Err(ClockBoundCError::SendMessageError(e));
+        }
+
+        match tokio::time::timeout(RECEIVE_TIMEOUT, rx).await {
+            // The registration removes the request from the pending requests
+            Err(_) => Err(ClockBoundCError::ReceiveMessageError(io::Error::new(
+                io::ErrorKind::TimedOut,
+                "No response was received from ClockBoundD",
+            ))),
+            Ok(Ok(response)) => response.map_err(ClockBoundCError::ReceiveMessageError),
+            Ok(Err(_)) => {
+                let kind = lock(&self.pending)
+                    .error
+                    .unwrap_or(io::ErrorKind::BrokenPipe);
+                Err(ClockBoundCError::ReceiveMessageError(io::Error::from(kind)))
+            }
+        }
+    }
+}
+
+impl Drop for ClockBoundAsyncClient {
+    /// Stop receiving responses and remove the client socket file when a ClockBoundAsyncClient is
+    /// dropped.
+    fn drop(&mut self) {
+        self.receiver.abort();
+        if let Some(path) = &self.path {
+            let _ = std::fs::remove_file(path);
+        }
+    }
+}
+
+/// A request waiting on its response. Removes the request from the pending requests when dropped.
+struct Registration<'a> {
+    pending: &'a Mutex<Pending>,
+    request_id: u32,
+}
+
+impl Drop for Registration<'_> {
+    fn drop(&mut self) {
+        lock(self.pending).responses.remove(&self.request_id);
+    }
+}
+
+/// Receive responses from ClockBoundD and hand each one to the request with the matching request
+/// id, until receiving from the socket fails.
+///
+/// # Arguments
+///
+/// * `socket` - The client socket connected to ClockBoundD.
+/// * `pending` - The requests waiting on a response.
+async fn receive_responses(socket: Arc<UnixDatagram>, pending: Arc<Mutex<Pending>>) {
+    loop {
+        let mut response = ResponseV2 {
+            buffer: [0; protocol::RESPONSE_BUFFER_SIZE_V2],
+        };
+        match socket.recv(&mut response.buffer).await {
+            Ok(size) => match response.request_id(size) {
+                Some(id) => {
+                    // Responses to requests that are no longer waiting are dropped
+                    if let Some(tx) = lock(&pending).responses.remove(&id) {
+                        let _ = tx.send(Ok(response));
+                    }
+                }
+                None => {
+                    for (_, tx) in lock(&pending).responses.drain() {
+                        let _ = tx.send(Err(io::Error::new(
+                            io::ErrorKind::InvalidData,
+                            "Received a response without a request id from ClockBoundD",
+                        )));
+                    }
+                }
+            },
+            Err(e) => {
+                let mut pending = lock(&pending);
+                pending.error = Some(e.kind());
+                // Dropping the senders fails every request still waiting
+                pending.responses.clear();
+                return;
+            }
+        }
+    }
+}
+
+fn lock(pending: &Mutex<Pending>) -> MutexGuard<'_, Pending> {
+    pending.lock().unwrap_or_else(PoisonError::into_inner)
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::async_client::lock;
+    use crate::error::ClockBoundCError;
+    use crate::mock::{compare_response, MockClockBoundD};
+    use crate::{ClockBoundAsyncClient, RECEIVE_TIMEOUT};
+    use std::time::Instant;
+
+    #[tokio::test]
+    async fn test_routes_by_request_id() {
+        let mock = MockClockBoundD::new();
+        let client = ClockBoundAsyncClient::new_with_path(mock.path.clone()).unwrap();
+
+        // Answer both requests in the reverse order they were received in
+        let responder = std::thread::spawn(move || {
+            let first = mock.recv();
+            let second = mock.recv();
+            mock.send(&compare_response(&second.0), &second.1);
+            mock.send(&compare_response(&first.0), &first.1);
+            mock
+        });
+        let (first, second) = tokio::join!(client.compare(1), client.compare(2));
+        assert_eq!(1, first.unwrap().bound.earliest);
+        assert_eq!(2, second.unwrap().bound.earliest);
+        let _mock = responder.join().unwrap();
+    }
+
+    #[tokio::test]
+    async fn test_response_without_request_id() {
+        let mock = MockClockBoundD::new();
+        let client = ClockBoundAsyncClient::new_with_path(mock.path.clone()).unwrap();
+
+        // A version 1 error response, as sent by a ClockBoundD without version 2, fails every
+        // request in flight
+        let responder = std::thread::spawn(move || {
+            let _ = mock.recv();
+            let (_, addr) = mock.recv();
+            mock.send(&[1, 0, 0, 0], &addr);
+            mock
+        });
+        let start = Instant::now();
+        let (first, second) = tokio::join!(client.now(), client.now());
+        for result in [first, second] {
+            match result {
+                Err(ClockBoundCError::ReceiveMessageError(_)) => {}
+                Err(e) => panic!("Unexpected error: {}", e),
+                Ok(_) => panic!("A response without a request id was accepted"),
+            }
+        }
+        assert!(start.elapsed() < RECEIVE_TIMEOUT);
+        let mock = responder.join().unwrap();
+
+        // A later request is still answered
+        let responder = std::thread::spawn(move || {
+            let (request, addr) = mock.recv();
+            mock.send(&compare_response(&request), &addr);
+            mock
+        });
+        assert_eq!(3, client.compare(3).await.unwrap().bound.earliest);
+        let _mock = responder.join().unwrap();
+    }
+
+    #[tokio::test]
+    async fn test_receive_timeout() {
+        let mock = MockClockBoundD::new();
+        let client = ClockBoundAsyncClient::new_with_path(mock.path.clone()).unwrap();
+
+        let start = Instant::now();
+        match client.now().await {
+            Err(ClockBoundCError::ReceiveMessageError(e)) => {
+                assert_eq!(std::io::ErrorKind::TimedOut, e.kind())
+            }
+            Err(e) => panic!("Unexpected error: {}", e),
+            Ok(_) => panic!("A request was answered"),
+        }
+        assert!(start.elapsed() >= RECEIVE_TIMEOUT);
+        // The request that timed out is no longer pending
+        assert!(lock(&client.pending).responses.is_empty());
+    }
+}
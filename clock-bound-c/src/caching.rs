@@ -0,0 +1,328 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use crate::ceb;
+use crate::error::ClockBoundCError;
+use crate::protocol;
+use crate::{
+    frequency_error_nanos, Bound, ClockBoundClient, ResponseAfter, ResponseBefore, ResponseHeader,
+    ResponseNow, CLOCKBOUNDD_SOCKET_ADDRESS_PATH,
+};
+use std::cell::Cell;
+use std::path::PathBuf;
+use std::time::{Duration, Instant};
+
+/// The rate the cached bounds widen at for ClockBoundD's Clock Error Bound growing since it
+/// answered, in parts per billion. A now response does not carry the rate ClockBoundD models, the
+/// maximum clock error plus the skew and residual frequency chronyd reports, so a conservative
+/// 2000 ppm is assumed: twice chronyd's default maxupdateskew of 1000 ppm, above which chronyd
+/// discards updates, and well above the 501 ppm of ClockBoundD's kernel tracking source.
+pub const CACHED_GROWTH_PPB: u64 = 2_000_000;
+
+/// The bounds of the last now response received from ClockBoundD.
+#[derive(Clone, Copy, Debug)]
+struct Cached {
+    response_version: u8,
+    unsynchronized_flag: bool,
+    earliest: u64,
+    latest: u64,
+    /// The time the now request was sent. The bounds were calculated no earlier than this.
+    sent: Instant,
+    /// The time the now response was received. The bounds were calculated no later than this.
+    received: Instant,
+}
+
+impl Cached {
+    /// Extrapolate the cached bounds to a later point in time.
+    ///
+    /// The bounds move forward by the monotonic time elapsed since they were calculated, and
+    /// widen over that time by CACHED_GROWTH_PPB, as ClockBoundD's Clock Error Bound keeps growing,
+    /// plus FREQUENCY_ERROR to allow for the monotonic clock running fast or slow. Since the exact
+    /// time ClockBoundD calculated the bounds is unknown, the earliest bound moves from the time
+    /// the response was received and the latest bound from the time the request was sent. The
+    /// bounds returned are never tighter than ClockBoundD's.
+    ///
+    /// # Arguments
+    ///
+    /// * `now` - The current monotonic time.
+    fn bound_at(&self, now: Instant) -> Bound {
+        let elapsed_min = now.saturating_duration_since(self.received).as_nanos() as u64;
+        let elapsed_max = now.saturating_duration_since(self.sent).as_nanos() as u64;
+        let drift = frequency_error_nanos(elapsed_max)
+            .saturating_add(ceb::growth_nanos(elapsed_max, CACHED_GROWTH_PPB));
+        Bound {
+            earliest: self
+                .earliest
+                .saturating_add(elapsed_min)
+                .saturating_sub(drift),
+            latest: self
+                .latest
+                .saturating_add(elapsed_max)
+                .saturating_add(drift),
+        }
+    }
+}
+
+/// A client to communicate with ClockBoundD that answers requests locally from the last bounds
+/// received.
+///
+/// After a now request to ClockBoundD the bounds are extrapolated with the monotonic clock,
+/// widening by CACHED_GROWTH_PPB and FREQUENCY_ERROR over the time elapsed. A new now request is
+/// only sent once the extrapolated Clock Error Bound exceeds a maximum error, or the cached bounds
+/// reach a maximum age. Error responses are never cached, and if ClockBoundD's own Clock Error
+/// Bound is above the maximum error every call is sent to ClockBoundD.
+///
+/// Like ClockBoundClient, a ClockBoundCachingClient expects one request at a time.
+pub struct ClockBoundCachingClient {
+    client: ClockBoundClient,
+    max_error: u64,
+    max_age: Duration,
+    cached: Cell<Option<Cached>>,
+}
+
+impl ClockBoundCachingClient {
+    /// Create a new ClockBoundCachingClient using the default clockboundd.sock path at
+    /// "/run/clockboundd/clockboundd.sock".
+    ///
+    /// # Arguments
+    ///
+    /// * `max_error` - The largest Clock Error Bound, half the width of the bounds, that is
+    /// answered from the cached bounds before refreshing them from ClockBoundD.
+    /// * `max_age` - The longest time the cached bounds are used before refreshing them from
+    /// ClockBoundD.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundCachingClient;
+    /// use std::time::Duration;
+    /// let client = match ClockBoundCachingClient::new(Duration::from_millis(1), Duration::from_secs(1)){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new(
+        max_error: Duration,
+        max_age: Duration,
+    ) -> Result<ClockBoundCachingClient, ClockBoundCError> {
+        ClockBoundCachingClient::new_with_path(
+            PathBuf::from(CLOCKBOUNDD_SOCKET_ADDRESS_PATH),
+            max_error,
+            max_age,
+        )
+    }
+
+    /// Create a new ClockBoundCachingClient using a defined clockboundd.sock path.
+    ///
+    /// # Arguments
+    ///
+    /// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+    /// * `max_error` - The largest Clock Error Bound, half the width of the bounds, that is
+    /// answered from the cached bounds before refreshing them from ClockBoundD.
+    /// * `max_age` - The longest time the cached bounds are used before refreshing them from
+    /// ClockBoundD.
+    pub fn new_with_path(
+        clock_bound_d_socket: PathBuf,
+        max_error: Duration,
+        max_age: Duration,
+    ) -> Result<ClockBoundCachingClient, ClockBoundCError> {
+        Ok(ClockBoundCachingClient {
+            client: ClockBoundClient::new_with_path(clock_bound_d_socket)?,
+            max_error: max_error.as_nanos() as u64,
+            max_age,
+            cached: Cell::new(None),
+        })
+    }
+
+    /// Get the bounds of the current system time, from the cached bounds if they are still
+    /// within the maximum error and age, otherwise from ClockBoundD.
+    fn bound(&self) -> Result<(ResponseHeader, Bound), ClockBoundCError> {
+        let now = Instant::now();
+        if let Some(cached) = self.cached.get() {
+            let bound = cached.bound_at(now);
+            if now.saturating_duration_since(cached.sent) <= self.max_age
+                && (bound.latest - bound.earliest) / 2 <= self.max_error
+            {
+                let header = ResponseHeader {
+                    response_version: cached.response_version,
+                    response_type: protocol::REQUEST_TYPE_NOW,
+                    unsynchronized_flag: cached.unsynchronized_flag,
+                };
+                return Ok((header, bound));
+            }
+        }
+
+        let sent = Instant::now();
+        let response = self.client.now()?;
+        let received = Instant::now();
+        self.cached.set(match response.header.response_type {
+            protocol::REQUEST_TYPE_NOW => Some(Cached {
+                response_version: response.header.response_version,
+                unsynchronized_flag: response.header.unsynchronized_flag,
+                earliest: response.bound.earliest,
+                latest: response.bound.latest,
+                sent,
+                received,
+            }),
+            _ => None,
+        });
+        Ok((response.header, response.bound))
+    }
+
+    /// Returns the bounds of the current system time +/- the error calculated from chrony.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundCachingClient;
+    /// use std::time::Duration;
+    /// let client = match ClockBoundCachingClient::new(Duration::from_millis(1), Duration::from_secs(1)){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let response = match client.now(){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete now request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn now(&self) -> Result<ResponseNow, ClockBoundCError> {
+        let (header, bound) = self.bound()?;
+        let timestamp = bound.latest - ((bound.latest - bound.earliest) / 2);
+        Ok(ResponseNow {
+            header,
+            bound,
+            timestamp,
+        })
+    }
+
+    /// Returns true if the provided timestamp is before the earliest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the earliest error bound.
+    pub fn before(&self, before_time: u64) -> Result<ResponseBefore, ClockBoundCError> {
+        let (mut header, bound) = self.bound()?;
+        if header.response_type != 0 {
+            header.response_type = protocol::REQUEST_TYPE_BEFORE;
+        }
+        Ok(ResponseBefore {
+            header,
+            before: before_time < bound.earliest,
+        })
+    }
+
+    /// Returns true if the provided timestamp is after the latest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the latest error bound.
+    pub fn after(&self, after_time: u64) -> Result<ResponseAfter, ClockBoundCError> {
+        let (mut header, bound) = self.bound()?;
+        if header.response_type != 0 {
+            header.response_type = protocol::REQUEST_TYPE_AFTER;
+        }
+        Ok(ResponseAfter {
+            header,
+            after: after_time > bound.latest,
+        })
+    }
+
+    /// Drop the cached bounds, so that the next call refreshes them from ClockBoundD.
+    pub fn invalidate(&self) {
+        self.cached.set(None);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::caching::{Cached, CACHED_GROWTH_PPB};
+    use crate::ceb;
+    use std::time::{Duration, Instant};
+
+    #[test]
+    fn bound_at_contains_fresh_bound() {
+        // A model as ClockBoundD would evaluate it: the Chrony source at its default maximum
+        // clock error, the kernel tracking source, and a source at chronyd's maxupdateskew
+        let ref_time_nanos = 1_000_000_000_000_000_000;
+        let base_ceb_nanos = 50_000;
+        let answered_nanos = ref_time_nanos + 3_000_000_000;
+        for growth_ppb in [1_000, 501_000, 1_001_000, CACHED_GROWTH_PPB] {
+            let answered_ceb =
+                ceb::ceb_nanos_at(ref_time_nanos, base_ceb_nanos, growth_ppb, answered_nanos)
+                    .unwrap();
+            let answered = ceb::bound_at(answered_ceb, answered_nanos);
+            let sent = Instant::now();
+            let cached = Cached {
+                response_version: 1,
+                unsynchronized_flag: false,
+                earliest: answered.earliest,
+                latest: answered.latest,
+                sent,
+                received: sent,
+            };
+
+            for elapsed in [
+                Duration::from_nanos(1),
+                Duration::from_millis(1),
+                Duration::from_secs(1),
+                Duration::from_secs(60),
+            ] {
+                let time_nanos = answered_nanos + elapsed.as_nanos() as u64;
+                let fresh_ceb =
+                    ceb::ceb_nanos_at(ref_time_nanos, base_ceb_nanos, growth_ppb, time_nanos)
+                        .unwrap();
+                let fresh = ceb::bound_at(fresh_ceb, time_nanos);
+                let bound = cached.bound_at(sent + elapsed);
+                assert!(
+                    bound.earliest <= fresh.earliest && bound.latest >= fresh.latest,
+                    "{} ppb after {:?}: cached [{}, {}] is tighter than [{}, {}]",
+                    growth_ppb,
+                    elapsed,
+                    bound.earliest,
+                    bound.latest,
+                    fresh.earliest,
+                    fresh.latest
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn bound_at_unknown_calculation_time() {
+        let sent = Instant::now();
+        let cached = Cached {
+            response_version: 1,
+            unsynchronized_flag: false,
+            earliest: 1_000_000,
+            latest: 1_100_000,
+            sent,
+            received: sent + Duration::from_micros(10),
+        };
+
+        // When the response is received, the latest bound has moved by the time the request was
+        // in flight and both have widened over it
+        let bound = cached.bound_at(sent + Duration::from_micros(10));
+        let growth = ceb::growth_nanos(10_000, CACHED_GROWTH_PPB);
+        assert!(bound.earliest <= 1_000_000 - growth);
+        assert!(bound.latest >= 1_110_000 + growth);
+
+        // A second later they have moved forward by a second and widened by at least the
+        // conservative growth rate on each side
+        let bound = cached.bound_at(sent + Duration::from_secs(1) + Duration::from_micros(10));
+        let growth = ceb::growth_nanos(1_000_000_000, CACHED_GROWTH_PPB);
+        assert!(bound.earliest <= 1_000_000 + 1_000_000_000 - growth);
+        assert!(bound.latest >= 1_100_000 + 1_000_010_000 + growth);
+    }
+}
@@ -0,0 +1,236 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+//! Evaluation of the Clock Error Bound model, for the readers that compute the bounds locally
+//! rather than sending a request to ClockBoundD.
+//!
+//! The model is held in integer nanoseconds and parts per billion, and evaluated with saturating
+//! integer arithmetic, the same way ClockBoundD evaluates it.
+use crate::Bound;
+
+/// The number of nanoseconds in a second.
+const NANOS_PER_SEC: u64 = 1_000_000_000;
+
+/// The largest rate the Clock Error Bound is modelled to grow at, in parts per billion.
+const MAX_GROWTH_PPB: u64 = NANOS_PER_SEC;
+
+/// Round a f64 number of seconds to the nearest nanosecond. Negative values and NaN are 0, and
+/// values too large for a u64 saturate.
+///
+/// # Arguments
+///
+/// * `value` - A f64 value in seconds to round to the nearest nanosecond.
+pub fn round_f64_nanos(value: f64) -> u64 {
+    // Casting a float to an integer saturates, and maps NaN to 0
+    (value * NANOS_PER_SEC as f64).round() as u64
+}
+
+/// Convert a rate in parts per million to parts per billion, rounded up so that the bound is never
+/// modelled to grow slower than the rate. Negative rates and NaN are 0.
+///
+/// # Arguments
+///
+/// * `ppm` - The rate in parts per million.
+pub fn ppm_to_ppb(ppm: f64) -> u64 {
+    ((ppm * 1000.0).ceil() as u64).min(MAX_GROWTH_PPB)
+}
+
+/// Convert a growth rate in nanoseconds per second, as sent by ClockBoundD in an update, to parts
+/// per billion.
+///
+/// # Arguments
+///
+/// * `growth_rate` - The growth rate in nanoseconds per second.
+pub fn growth_rate_to_ppb(growth_rate: f64) -> u64 {
+    (growth_rate.ceil() as u64).min(MAX_GROWTH_PPB)
+}
+
+/// Get the Clock Error Bound in nanoseconds: |System time offset| + Root dispersion +
+/// (Root delay / 2). Half the root delay is rounded up, and the sum saturates rather than wraps.
+///
+/// # Arguments
+///
+/// * `system_time_offset_nanos` - The absolute offset of the system clock in nanoseconds.
+/// * `root_dispersion_nanos` - The root dispersion in nanoseconds.
+/// * `root_delay_nanos` - The root delay in nanoseconds.
+pub fn clock_error_bound(
+    system_time_offset_nanos: u64,
+    root_dispersion_nanos: u64,
+    root_delay_nanos: u64,
+) -> u64 {
+    system_time_offset_nanos
+        .saturating_add(root_dispersion_nanos)
+        .saturating_add(root_delay_nanos / 2 + root_delay_nanos % 2)
+}
+
+/// Evaluate the Clock Error Bound in nanoseconds at a point in time:
+///
+/// CEB(t) = CEB at reference time + (t - reference time) * Growth rate
+///
+/// The growth is rounded up to the next nanosecond. Returns None if the time is before the
+/// reference time, since the bound can not be extrapolated backwards. ClockBoundD answers an Error
+/// response in that case.
+///
+/// # Arguments
+///
+/// * `ref_time_nanos` - The time of Chrony's last update in nanoseconds since the Unix epoch.
+/// * `base_ceb_nanos` - The Clock Error Bound at the reference time in nanoseconds.
+/// * `growth_ppb` - The rate the Clock Error Bound grows at in parts per billion.
+/// * `time_nanos` - The time in nanoseconds since the Unix epoch.
+pub fn ceb_nanos_at(
+    ref_time_nanos: u64,
+    base_ceb_nanos: u64,
+    growth_ppb: u64,
+    time_nanos: u64,
+) -> Option<u64> {
+    let elapsed_nanos = time_nanos.checked_sub(ref_time_nanos)?;
+    Some(base_ceb_nanos.saturating_add(growth_nanos(elapsed_nanos, growth_ppb)))
+}
+
+/// Get the growth of the Clock Error Bound over a duration in nanoseconds, rounded up to the next
+/// nanosecond.
+///
+/// # Arguments
+///
+/// * `elapsed_nanos` - The duration in nanoseconds.
+/// * `growth_ppb` - The rate the Clock Error Bound grows at in parts per billion.
+pub fn growth_nanos(elapsed_nanos: u64, growth_ppb: u64) -> u64 {
+    let growth_ppb = growth_ppb.min(MAX_GROWTH_PPB);
+    // Split into whole seconds so that the product stays within 64 bits
+    let secs = elapsed_nanos / NANOS_PER_SEC;
+    let remaining = elapsed_nanos % NANOS_PER_SEC;
+    secs.saturating_mul(growth_ppb)
+        .saturating_add((remaining * growth_ppb + NANOS_PER_SEC - 1) / NANOS_PER_SEC)
+}
+
+/// Get the bounds [time - CEB, time + CEB], saturating rather than wrapping.
+///
+/// # Arguments
+///
+/// * `ceb_nanos` - The Clock Error Bound in nanoseconds.
+/// * `time_nanos` - The time in nanoseconds since the Unix epoch.
+pub fn bound_at(ceb_nanos: u64, time_nanos: u64) -> Bound {
+    Bound {
+        earliest: time_nanos.saturating_sub(ceb_nanos),
+        latest: time_nanos.saturating_add(ceb_nanos),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::ceb::{
+        bound_at, ceb_nanos_at, clock_error_bound, growth_nanos, growth_rate_to_ppb, ppm_to_ppb,
+        round_f64_nanos, MAX_GROWTH_PPB, NANOS_PER_SEC,
+    };
+
+    #[test]
+    fn round_f64_nanos_successful() {
+        let value = round_f64_nanos(0.0000000055_f64);
+        assert_eq!(value, 6);
+
+        // The value never goes negative or wraps
+        assert_eq!(round_f64_nanos(-0.5), 0);
+        assert_eq!(round_f64_nanos(f64::NAN), 0);
+        assert_eq!(round_f64_nanos(1e30), u64::MAX);
+    }
+
+    #[test]
+    fn ppm_to_ppb_successful() {
+        assert_eq!(ppm_to_ppb(1.0), 1000);
+        // Rounded up to the next part per billion
+        assert_eq!(ppm_to_ppb(0.0121), 13);
+        assert_eq!(ppm_to_ppb(-3.0), 0);
+        assert_eq!(ppm_to_ppb(f64::NAN), 0);
+        assert_eq!(ppm_to_ppb(1e12), MAX_GROWTH_PPB);
+    }
+
+    #[test]
+    fn growth_rate_to_ppb_successful() {
+        assert_eq!(growth_rate_to_ppb(1000.0), 1000);
+        assert_eq!(growth_rate_to_ppb(12.1), 13);
+        assert_eq!(growth_rate_to_ppb(-3.0), 0);
+        assert_eq!(growth_rate_to_ppb(1e12), MAX_GROWTH_PPB);
+    }
+
+    #[test]
+    fn growth_nanos_successful() {
+        assert_eq!(growth_nanos(5 * NANOS_PER_SEC, 1000), 5000);
+        // A partial nanosecond of growth is rounded up
+        assert_eq!(growth_nanos(1, 1000), 1);
+        assert_eq!(growth_nanos(1_500_000_000, 1001), 1502);
+        assert_eq!(growth_nanos(0, 1000), 0);
+        // The growth does not wrap, and the rate is clamped
+        assert_eq!(growth_nanos(u64::MAX, MAX_GROWTH_PPB), u64::MAX);
+        assert_eq!(growth_nanos(NANOS_PER_SEC, u64::MAX), MAX_GROWTH_PPB);
+    }
+
+    #[test]
+    fn ceb_nanos_at_successful() {
+        let ref_time_nanos = 1_000_000_000_000_000_000;
+        let base_ceb_nanos = 50_000;
+
+        // At the reference time the bound is the Clock Error Bound of the tracking data
+        assert_eq!(
+            ceb_nanos_at(ref_time_nanos, base_ceb_nanos, 1000, ref_time_nanos),
+            Some(base_ceb_nanos)
+        );
+
+        // Validate the bound has grown by the error rate for a 5 second duration
+        assert_eq!(
+            ceb_nanos_at(
+                ref_time_nanos,
+                base_ceb_nanos,
+                1000,
+                ref_time_nanos + 5 * NANOS_PER_SEC
+            ),
+            Some(base_ceb_nanos + 5000)
+        );
+
+        // A partial nanosecond of growth is rounded up
+        assert_eq!(
+            ceb_nanos_at(
+                ref_time_nanos,
+                base_ceb_nanos,
+                1001,
+                ref_time_nanos + 1_500_000_000
+            ),
+            Some(base_ceb_nanos + 1502)
+        );
+
+        // The bound can not be evaluated before the reference time, as in ClockBoundD
+        assert_eq!(
+            ceb_nanos_at(ref_time_nanos, base_ceb_nanos, 1000, ref_time_nanos - 1),
+            None
+        );
+
+        // The bound saturates rather than wraps long after the reference time, and the rate is
+        // clamped
+        assert_eq!(
+            ceb_nanos_at(0, u64::MAX - 10, MAX_GROWTH_PPB, u64::MAX),
+            Some(u64::MAX)
+        );
+        assert_eq!(
+            ceb_nanos_at(0, 0, u64::MAX, NANOS_PER_SEC),
+            Some(MAX_GROWTH_PPB)
+        );
+    }
+
+    #[test]
+    fn clock_error_bound_successful() {
+        let ceb = clock_error_bound(200_000, 100_000, 400_000);
+        assert_eq!(ceb, 500_000);
+
+        // Half the root delay is rounded up
+        assert_eq!(clock_error_bound(1, 2, 5), 6);
+        assert_eq!(clock_error_bound(u64::MAX, 1, 1), u64::MAX);
+    }
+
+    #[test]
+    fn bound_at_successful() {
+        let bound = bound_at(10, 100);
+        assert_eq!((90, 110), (bound.earliest, bound.latest));
+
+        // The bounds saturate rather than wrap
+        let bound = bound_at(u64::MAX, 100);
+        assert_eq!((0, u64::MAX), (bound.earliest, bound.latest));
+    }
+}
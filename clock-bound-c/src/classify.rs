@@ -0,0 +1,545 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+//! Classify many timestamps against one Bound locally, without a request per timestamp.
+//!
+//! A timestamp is definitely before the bound if it is before its earliest time, definitely
+//! after the bound if it is after its latest time, and uncertain otherwise, the same tests as
+//! ClockBoundClient::before and ClockBoundClient::after. The results are packed into bitmaps:
+//! bit i % 64 of word i / 64 is set for the ith timestamp, as in the response to a batch request.
+//!
+//! On x86_64 CPUs with AVX2 four timestamps are compared per instruction. Elsewhere a branchless
+//! loop is used, which the compiler vectorizes where the target allows it.
+//!
+//! ```
+//! use clock_bound_c::Bound;
+//! use clock_bound_c::classify::classify;
+//! let bound = Bound {
+//!     earliest: 1_000,
+//!     latest: 2_000,
+//! };
+//! let classification = classify(&bound, &[500, 1_500, 2_500]);
+//! assert!(classification.is_before(0));
+//! assert!(classification.is_uncertain(1));
+//! assert!(classification.is_after(2));
+//! ```
+use crate::error::ClockBoundCError;
+use crate::Bound;
+
+/// The number of timestamps whose results are held in one word of a bitmap.
+const WORD_BITS: usize = 64;
+
+/// The classification of timestamps against a Bound.
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct Classification {
+    before: Vec<u64>,
+    after: Vec<u64>,
+    len: usize,
+}
+
+impl Classification {
+    /// Create an empty classification, that can be reused to classify timestamps without
+    /// allocating once its bitmaps are large enough.
+    pub fn new() -> Classification {
+        Classification::default()
+    }
+
+    /// Classify timestamps against a bound, replacing the previous results.
+    ///
+    /// # Arguments
+    ///
+    /// * `bound` - The bound to classify the timestamps against.
+    /// * `epochs` - The timestamps, represented as nanoseconds since the Unix Epoch.
+    pub fn classify(&mut self, bound: &Bound, epochs: &[u64]) {
+        self.resize(epochs.len());
+        classify_words(bound, epochs, None, &mut self.before, &mut self.after);
+    }
+
+    /// Classify timestamps that each have an error margin of their own against a bound, replacing
+    /// the previous results.
+    ///
+    /// A timestamp is definitely before the bound if it plus its margin is before the earliest
+    /// time, and definitely after the bound if it minus its margin is after the latest time.
+    ///
+    /// # Arguments
+    ///
+    /// * `bound` - The bound to classify the timestamps against.
+    /// * `epochs` - The timestamps, represented as nanoseconds since the Unix Epoch.
+    /// * `margins` - The error margin of each timestamp in nanoseconds. Must be as many as the
+    /// timestamps.
+    pub fn classify_with_margin(
+        &mut self,
+        bound: &Bound,
+        epochs: &[u64],
+        margins: &[u64],
+    ) -> Result<(), ClockBoundCError> {
+        if margins.len() != epochs.len() {
+            return Err(ClockBoundCError::InvalidMarginCount(
+                margins.len(),
+                epochs.len(),
+            ));
+        }
+        self.resize(epochs.len());
+        classify_words(
+            bound,
+            epochs,
+            Some(margins),
+            &mut self.before,
+            &mut self.after,
+        );
+        Ok(())
+    }
+
+    fn resize(&mut self, len: usize) {
+        let words = (len + WORD_BITS - 1) / WORD_BITS;
+        self.before.resize(words, 0);
+        self.after.resize(words, 0);
+        self.len = len;
+    }
+
+    /// The number of timestamps classified.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Returns true if no timestamps were classified.
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// The bitmap of the timestamps that are definitely before the bound.
+    pub fn before(&self) -> &[u64] {
+        &self.before
+    }
+
+    /// The bitmap of the timestamps that are definitely after the bound.
+    pub fn after(&self) -> &[u64] {
+        &self.after
+    }
+
+    /// Returns true if the ith timestamp is definitely before the bound.
+    ///
+    /// # Arguments
+    ///
+    /// * `i` - The index of the timestamp. Panics if it is not below len().
+    pub fn is_before(&self, i: usize) -> bool {
+        assert!(i < self.len, "index {} out of range for {}", i, self.len);
+        self.before[i / WORD_BITS] & (1 << (i % WORD_BITS)) != 0
+    }
+
+    /// Returns true if the ith timestamp is definitely after the bound.
+    ///
+    /// # Arguments
+    ///
+    /// * `i` - The index of the timestamp. Panics if it is not below len().
+    pub fn is_after(&self, i: usize) -> bool {
+        assert!(i < self.len, "index {} out of range for {}", i, self.len);
+        self.after[i / WORD_BITS] & (1 << (i % WORD_BITS)) != 0
+    }
+
+    /// Returns true if the ith timestamp is within the bound, so it is neither definitely before
+    /// nor definitely after it.
+    ///
+    /// # Arguments
+    ///
+    /// * `i` - The index of the timestamp. Panics if it is not below len().
+    pub fn is_uncertain(&self, i: usize) -> bool {
+        !self.is_before(i) && !self.is_after(i)
+    }
+
+    /// The number of timestamps that are definitely before the bound.
+    pub fn count_before(&self) -> usize {
+        self.before.iter().map(|w| w.count_ones() as usize).sum()
+    }
+
+    /// The number of timestamps that are definitely after the bound.
+    pub fn count_after(&self) -> usize {
+        self.after.iter().map(|w| w.count_ones() as usize).sum()
+    }
+
+    /// The number of timestamps that are within the bound.
+    pub fn count_uncertain(&self) -> usize {
+        self.len - self.count_before() - self.count_after()
+    }
+}
+
+/// Classify timestamps against a bound.
+///
+/// # Arguments
+///
+/// * `bound` - The bound to classify the timestamps against.
+/// * `epochs` - The timestamps, represented as nanoseconds since the Unix Epoch.
+pub fn classify(bound: &Bound, epochs: &[u64]) -> Classification {
+    let mut classification = Classification::new();
+    classification.classify(bound, epochs);
+    classification
+}
+
+/// Classify timestamps that each have an error margin of their own against a bound. See
+/// Classification::classify_with_margin.
+///
+/// # Arguments
+///
+/// * `bound` - The bound to classify the timestamps against.
+/// * `epochs` - The timestamps, represented as nanoseconds since the Unix Epoch.
+/// * `margins` - The error margin of each timestamp in nanoseconds. Must be as many as the
+/// timestamps.
+///
+/// # Examples
+///
+/// ```
+/// use clock_bound_c::Bound;
+/// use clock_bound_c::classify::classify_with_margin;
+/// let bound = Bound {
+///     earliest: 1_000,
+///     latest: 2_000,
+/// };
+/// let classification = match classify_with_margin(&bound, &[500, 500], &[100, 600]) {
+///     Ok(classification) => classification,
+///     Err(e) => {
+///         println!("Couldn't classify timestamps: {}", e);
+///         return
+///     }
+/// };
+/// assert!(classification.is_before(0));
+/// assert!(classification.is_uncertain(1));
+/// ```
+pub fn classify_with_margin(
+    bound: &Bound,
+    epochs: &[u64],
+    margins: &[u64],
+) -> Result<Classification, ClockBoundCError> {
+    let mut classification = Classification::new();
+    classification.classify_with_margin(bound, epochs, margins)?;
+    Ok(classification)
+}
+
+/// Fill the bitmaps with the classification of the timestamps, using AVX2 if the CPU has it.
+pub(crate) fn classify_words(
+    bound: &Bound,
+    epochs: &[u64],
+    margins: Option<&[u64]>,
+    before: &mut [u64],
+    after: &mut [u64],
+) {
+    let mut done = 0;
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            // The AVX2 kernels handle whole words, the rest is left to the portable loop
+            done = epochs.len() / WORD_BITS * WORD_BITS;
+            let words = done / WORD_BITS;
+            unsafe {
+                match margins {
+                    None => avx2::classify(
+                        bound.earliest,
+                        bound.latest,
+                        &epochs[..done],
+                        &mut before[..words],
+                        &mut after[..words],
+                    ),
+                    Some(margins) => avx2::classify_with_margin(
+                        bound.earliest,
+                        bound.latest,
+                        &epochs[..done],
+                        &margins[..done],
+                        &mut before[..words],
+                        &mut after[..words],
+                    ),
+                }
+            }
+        }
+    }
+
+    let words = done / WORD_BITS;
+    match margins {
+        None => classify_portable(
+            bound.earliest,
+            bound.latest,
+            &epochs[done..],
+            &mut before[words..],
+            &mut after[words..],
+        ),
+        Some(margins) => classify_with_margin_portable(
+            bound.earliest,
+            bound.latest,
+            &epochs[done..],
+            &margins[done..],
+            &mut before[words..],
+            &mut after[words..],
+        ),
+    }
+}
+
+/// Classify timestamps with a branchless loop.
+fn classify_portable(
+    earliest: u64,
+    latest: u64,
+    epochs: &[u64],
+    before: &mut [u64],
+    after: &mut [u64],
+) {
+    for (w, chunk) in epochs.chunks(WORD_BITS).enumerate() {
+        let mut before_word = 0;
+        let mut after_word = 0;
+        for (i, &epoch) in chunk.iter().enumerate() {
+            before_word |= u64::from(epoch < earliest) << i;
+            after_word |= u64::from(epoch > latest) << i;
+        }
+        before[w] = before_word;
+        after[w] = after_word;
+    }
+}
+
+/// Classify timestamps with their margins with a branchless loop.
+fn classify_with_margin_portable(
+    earliest: u64,
+    latest: u64,
+    epochs: &[u64],
+    margins: &[u64],
+    before: &mut [u64],
+    after: &mut [u64],
+) {
+    for (w, (chunk, chunk_margins)) in epochs
+        .chunks(WORD_BITS)
+        .zip(margins.chunks(WORD_BITS))
+        .enumerate()
+    {
+        let mut before_word = 0;
+        let mut after_word = 0;
+        for (i, (&epoch, &margin)) in chunk.iter().zip(chunk_margins).enumerate() {
+            before_word |= u64::from(epoch.saturating_add(margin) < earliest) << i;
+            after_word |= u64::from(epoch.saturating_sub(margin) > latest) << i;
+        }
+        before[w] = before_word;
+        after[w] = after_word;
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+mod avx2 {
+    use super::WORD_BITS;
+    use std::arch::x86_64::*;
+
+    /// The number of timestamps compared per instruction.
+    const LANES: usize = 4;
+
+    /// Flip the sign bit of each lane, so that a signed comparison of the results is an unsigned
+    /// comparison of the inputs. AVX2 only has a signed 64 bit comparison.
+    #[inline(always)]
+    unsafe fn unsigned(v: __m256i) -> __m256i {
+        _mm256_xor_si256(v, _mm256_set1_epi64x(i64::MIN))
+    }
+
+    /// One bit per lane set in a comparison result.
+    #[inline(always)]
+    unsafe fn mask(v: __m256i) -> u64 {
+        _mm256_movemask_pd(_mm256_castsi256_pd(v)) as u64
+    }
+
+    /// Classify whole words of timestamps.
+    ///
+    /// # Safety
+    ///
+    /// The CPU must have AVX2, and epochs must hold WORD_BITS timestamps per word of the bitmaps.
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn classify(
+        earliest: u64,
+        latest: u64,
+        epochs: &[u64],
+        before: &mut [u64],
+        after: &mut [u64],
+    ) {
+        let earliest = unsigned(_mm256_set1_epi64x(earliest as i64));
+        let latest = unsigned(_mm256_set1_epi64x(latest as i64));
+        for (w, chunk) in epochs.chunks_exact(WORD_BITS).enumerate() {
+            let mut before_word = 0;
+            let mut after_word = 0;
+            for i in 0..WORD_BITS / LANES {
+                let epoch = _mm256_loadu_si256(chunk.as_ptr().add(i * LANES) as *const __m256i);
+                let epoch = unsigned(epoch);
+                before_word |= mask(_mm256_cmpgt_epi64(earliest, epoch)) << (i * LANES);
+                after_word |= mask(_mm256_cmpgt_epi64(epoch, latest)) << (i * LANES);
+            }
+            before[w] = before_word;
+            after[w] = after_word;
+        }
+    }
+
+    /// Classify whole words of timestamps with their margins.
+    ///
+    /// # Safety
+    ///
+    /// The CPU must have AVX2, and epochs and margins must hold WORD_BITS timestamps per word of
+    /// the bitmaps.
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn classify_with_margin(
+        earliest: u64,
+        latest: u64,
+        epochs: &[u64],
+        margins: &[u64],
+        before: &mut [u64],
+        after: &mut [u64],
+    ) {
+        let earliest = unsigned(_mm256_set1_epi64x(earliest as i64));
+        let latest = unsigned(_mm256_set1_epi64x(latest as i64));
+        for (w, (chunk, chunk_margins)) in epochs
+            .chunks_exact(WORD_BITS)
+            .zip(margins.chunks_exact(WORD_BITS))
+            .enumerate()
+        {
+            let mut before_word = 0;
+            let mut after_word = 0;
+            for i in 0..WORD_BITS / LANES {
+                let epoch = _mm256_loadu_si256(chunk.as_ptr().add(i * LANES) as *const __m256i);
+                let margin =
+                    _mm256_loadu_si256(chunk_margins.as_ptr().add(i * LANES) as *const __m256i);
+
+                // epoch + margin, saturating: the sum wrapped if it is below the epoch
+                let sum = _mm256_add_epi64(epoch, margin);
+                let wrapped = _mm256_cmpgt_epi64(unsigned(epoch), unsigned(sum));
+                let latest_epoch = unsigned(_mm256_or_si256(sum, wrapped));
+                // epoch - margin, saturating: the difference wrapped if the margin is larger
+                let difference = _mm256_sub_epi64(epoch, margin);
+                let wrapped = _mm256_cmpgt_epi64(unsigned(margin), unsigned(epoch));
+                let earliest_epoch = unsigned(_mm256_andnot_si256(wrapped, difference));
+
+                before_word |= mask(_mm256_cmpgt_epi64(earliest, latest_epoch)) << (i * LANES);
+                after_word |= mask(_mm256_cmpgt_epi64(earliest_epoch, latest)) << (i * LANES);
+            }
+            before[w] = before_word;
+            after[w] = after_word;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::classify::{classify_portable, classify_with_margin_portable, classify_words};
+    use crate::Bound;
+
+    /// The edges of the u64 timestamps, margins and bounds.
+    const VALUES: [u64; 4] = [0, 1, u64::MAX - 1, u64::MAX];
+    const BOUNDS: [u64; 2] = [0, u64::MAX];
+    const LENGTHS: [usize; 7] = [0, 1, 3, 63, 64, 65, 130];
+
+    /// Timestamps and margins cycling through the edge values, so that every pair of them is
+    /// classified once there are at least 16 timestamps.
+    fn inputs(len: usize) -> (Vec<u64>, Vec<u64>) {
+        let epochs = (0..len).map(|i| VALUES[i % 4]).collect();
+        let margins = (0..len).map(|i| VALUES[i / 4 % 4]).collect();
+        (epochs, margins)
+    }
+
+    /// Classify one timestamp at a time with the tests of ClockBoundClient::before and
+    /// ClockBoundClient::after.
+    fn expected(bound: &Bound, epochs: &[u64], margins: Option<&[u64]>) -> (Vec<u64>, Vec<u64>) {
+        let words = (epochs.len() + 63) / 64;
+        let mut before = vec![0; words];
+        let mut after = vec![0; words];
+        for (i, &epoch) in epochs.iter().enumerate() {
+            let margin = margins.map_or(0, |margins| margins[i]);
+            if epoch.saturating_add(margin) < bound.earliest {
+                before[i / 64] |= 1 << (i % 64);
+            }
+            if epoch.saturating_sub(margin) > bound.latest {
+                after[i / 64] |= 1 << (i % 64);
+            }
+        }
+        (before, after)
+    }
+
+    /// Run a classification over every edge bound and length, checking it against expected.
+    fn check(
+        name: &str,
+        classify: impl Fn(&Bound, &[u64], Option<&[u64]>, &mut [u64], &mut [u64]),
+    ) {
+        for &earliest in BOUNDS.iter() {
+            for &latest in BOUNDS.iter().filter(|&&latest| latest >= earliest) {
+                let bound = Bound { earliest, latest };
+                for len in LENGTHS {
+                    let (epochs, margins) = inputs(len);
+                    for margins in [None, Some(&margins[..])] {
+                        let words = (len + 63) / 64;
+                        let mut before = vec![u64::MAX; words];
+                        let mut after = vec![u64::MAX; words];
+                        classify(&bound, &epochs, margins, &mut before, &mut after);
+                        assert_eq!(
+                            expected(&bound, &epochs, margins),
+                            (before, after),
+                            "{} bound [{}, {}] len {} margins {}",
+                            name,
+                            earliest,
+                            latest,
+                            len,
+                            margins.is_some()
+                        );
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn classify_words_edges() {
+        check("dispatch", |bound, epochs, margins, before, after| {
+            classify_words(bound, epochs, margins, before, after)
+        });
+    }
+
+    #[test]
+    fn classify_portable_edges() {
+        check(
+            "portable",
+            |bound, epochs, margins, before, after| match margins {
+                None => classify_portable(bound.earliest, bound.latest, epochs, before, after),
+                Some(margins) => classify_with_margin_portable(
+                    bound.earliest,
+                    bound.latest,
+                    epochs,
+                    margins,
+                    before,
+                    after,
+                ),
+            },
+        );
+    }
+
+    #[cfg(target_arch = "x86_64")]
+    #[test]
+    fn classify_avx2_edges() {
+        use crate::classify::avx2;
+
+        if !is_x86_feature_detected!("avx2") {
+            println!("Skipping, the CPU does not have AVX2");
+            return;
+        }
+        // The AVX2 kernels only handle whole words, so check the whole words of each length and
+        // leave the rest of the bitmaps to the expected classification
+        check("avx2", |bound, epochs, margins, before, after| {
+            let done = epochs.len() / 64 * 64;
+            let (tail_before, tail_after) =
+                expected(bound, &epochs[done..], margins.map(|m| &m[done..]));
+            unsafe {
+                match margins {
+                    None => avx2::classify(
+                        bound.earliest,
+                        bound.latest,
+                        &epochs[..done],
+                        &mut before[..done / 64],
+                        &mut after[..done / 64],
+                    ),
+                    Some(margins) => avx2::classify_with_margin(
+                        bound.earliest,
+                        bound.latest,
+                        &epochs[..done],
+                        &margins[..done],
+                        &mut before[..done / 64],
+                        &mut after[..done / 64],
+                    ),
+                }
+            }
+            before[done / 64..].copy_from_slice(&tail_before);
+            after[done / 64..].copy_from_slice(&tail_after);
+        });
+    }
+}
@@ -23,4 +23,35 @@ pub enum ClockBoundCError {
     /// Represents an error when trying to write a request.
     #[error("Could not write a request. {0}")]
     WriteRequestError(#[source] std::io::Error),
+    /// Represents a batch request with no timestamps or more timestamps than fit in one request.
+    #[error("A batch request must have between 1 and 64 timestamps. Received: {0}")]
+    InvalidTimestampCount(usize),
+    /// Represents timestamps classified with a different number of error margins.
+    #[error("Every timestamp must have an error margin. Received {0} margins for {1} timestamps.")]
+    InvalidMarginCount(usize, usize),
+    /// Represents a subscribe request that ClockBoundD did not respond to with an update, or
+    /// responded to with a lease of 0.
+    #[error("ClockBoundD did not accept the subscription.")]
+    SubscriptionRefused,
+    /// Represents a subscription that has not received an update from ClockBoundD within its lease.
+    #[error("No update was received from ClockBoundD within the lease of the subscription.")]
+    SubscriptionExpired,
+    /// Represents an error when trying to open ClockBoundD's shared memory segment.
+    #[error("Could not open ClockBoundD's shared memory segment. {0}")]
+    ShmOpenError(#[source] std::io::Error),
+    /// Represents an error when trying to map ClockBoundD's shared memory segment.
+    #[error("Could not map ClockBoundD's shared memory segment. {0}")]
+    ShmMapError(#[source] std::io::Error),
+    /// Represents a shared memory segment with an unexpected size, magic number or version.
+    #[error("ClockBoundD's shared memory segment is invalid or has an unsupported version.")]
+    ShmInvalidSegment,
+    /// Represents a shared memory segment that stayed locked by an update for too long.
+    #[error("ClockBoundD's shared memory segment is being updated. Try again.")]
+    ShmBusy,
+    /// Represents a Clock Error Bound evaluated locally at a time before ClockBoundD's last
+    /// update, which ClockBoundD would have answered with an Error response.
+    #[error(
+        "The Clock Error Bound could not be evaluated. ClockBoundD's last update is in the future."
+    )]
+    BoundUnavailable,
 }
@@ -0,0 +1,831 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+//! The C ABI of the client, declared in include/clockbound.h.
+//!
+//! Every function returns a status: CLOCKBOUND_OK (0) on success, or one of the negative
+//! CLOCKBOUND_ERR_* values, with errno set to the error from the operating system if there was
+//! one. Results are written to structs owned by the caller, so no call allocates except creating a
+//! client or starting a timer. A panic never unwinds into the caller: it is returned as
+//! CLOCKBOUND_ERR_OTHER.
+use crate::classify;
+use crate::error::ClockBoundCError;
+use crate::{Bound, ClockBoundClient, ResponseHeader, TimingGuard};
+use std::ffi::CStr;
+use std::os::raw::{c_char, c_int};
+use std::panic::{self, AssertUnwindSafe};
+use std::path::PathBuf;
+use std::time::UNIX_EPOCH;
+
+/// The call succeeded.
+pub const CLOCKBOUND_OK: c_int = 0;
+/// A pointer argument was null, or a path was not valid UTF-8.
+pub const CLOCKBOUND_ERR_INVALID_ARGUMENT: c_int = -1;
+/// See ClockBoundCError::ConnectError.
+pub const CLOCKBOUND_ERR_CONNECT: c_int = -2;
+/// See ClockBoundCError::BindError.
+pub const CLOCKBOUND_ERR_BIND: c_int = -3;
+/// See ClockBoundCError::SetPermissionsError.
+pub const CLOCKBOUND_ERR_SET_PERMISSIONS: c_int = -4;
+/// See ClockBoundCError::SendMessageError.
+pub const CLOCKBOUND_ERR_SEND: c_int = -5;
+/// See ClockBoundCError::ReceiveMessageError.
+pub const CLOCKBOUND_ERR_RECEIVE: c_int = -6;
+/// See ClockBoundCError::WriteRequestError.
+pub const CLOCKBOUND_ERR_WRITE_REQUEST: c_int = -7;
+/// See ClockBoundCError::InvalidTimestampCount.
+pub const CLOCKBOUND_ERR_INVALID_TIMESTAMP_COUNT: c_int = -8;
+/// See ClockBoundCError::ShmOpenError. Only returned by the inline reader of clockbound.h.
+pub const CLOCKBOUND_ERR_SHM_OPEN: c_int = -9;
+/// See ClockBoundCError::ShmMapError. Only returned by the inline reader of clockbound.h.
+pub const CLOCKBOUND_ERR_SHM_MAP: c_int = -10;
+/// See ClockBoundCError::ShmInvalidSegment. Only returned by the inline reader of clockbound.h.
+pub const CLOCKBOUND_ERR_SHM_INVALID: c_int = -11;
+/// See ClockBoundCError::ShmBusy. Only returned by the inline reader of clockbound.h.
+pub const CLOCKBOUND_ERR_SHM_BUSY: c_int = -12;
+/// Any other error of the client, or a panic.
+pub const CLOCKBOUND_ERR_OTHER: c_int = -13;
+/// See ClockBoundCError::BoundUnavailable. Only returned by the inline reader of clockbound.h.
+pub const CLOCKBOUND_ERR_BOUND_UNAVAILABLE: c_int = -14;
+
+/// struct clockbound_header: the header of a response.
+#[repr(C)]
+pub struct Header {
+    pub response_version: u8,
+    pub response_type: u8,
+    pub unsynchronized: u8,
+}
+
+/// struct clockbound_now_result: the result of clockbound_now.
+#[repr(C)]
+pub struct NowResult {
+    pub header: Header,
+    pub bound: Bound,
+    pub timestamp: u64,
+}
+
+/// struct clockbound_before_result: the result of clockbound_before.
+#[repr(C)]
+pub struct BeforeResult {
+    pub header: Header,
+    pub before: u8,
+}
+
+/// struct clockbound_after_result: the result of clockbound_after.
+#[repr(C)]
+pub struct AfterResult {
+    pub header: Header,
+    pub after: u8,
+}
+
+/// struct clockbound_compare_result: the result of clockbound_compare.
+#[repr(C)]
+pub struct CompareResult {
+    pub header: Header,
+    pub bound: Bound,
+    pub before: u8,
+    pub after: u8,
+}
+
+/// struct clockbound_many_result: the result of clockbound_before_many and
+/// clockbound_after_many.
+#[repr(C)]
+pub struct ManyResult {
+    pub header: Header,
+    pub bound: Bound,
+    pub bits: u64,
+}
+
+/// struct clockbound_timing_result: the result of clockbound_timing_finish, in nanoseconds.
+#[repr(C)]
+pub struct TimingResultNanos {
+    pub earliest_start: u64,
+    pub latest_finish: u64,
+    pub min_execution_time: u64,
+    pub max_execution_time: u64,
+}
+
+impl From<ResponseHeader> for Header {
+    fn from(header: ResponseHeader) -> Header {
+        Header {
+            response_version: header.response_version,
+            response_type: header.response_type,
+            unsynchronized: u8::from(header.unsynchronized_flag),
+        }
+    }
+}
+
+/// Map an error to its status, setting errno to the error from the operating system if there was
+/// one.
+///
+/// # Arguments
+///
+/// * `error` - The error returned by the client.
+fn status(error: ClockBoundCError) -> c_int {
+    let (status, source) = match error {
+        ClockBoundCError::ConnectError(e) => (CLOCKBOUND_ERR_CONNECT, Some(e)),
+        ClockBoundCError::BindError(e) => (CLOCKBOUND_ERR_BIND, Some(e)),
+        ClockBoundCError::SetPermissionsError(e) => (CLOCKBOUND_ERR_SET_PERMISSIONS, Some(e)),
+        ClockBoundCError::SendMessageError(e) => (CLOCKBOUND_ERR_SEND, Some(e)),
+        ClockBoundCError::ReceiveMessageError(e) => (CLOCKBOUND_ERR_RECEIVE, Some(e)),
+        ClockBoundCError::WriteRequestError(e) => (CLOCKBOUND_ERR_WRITE_REQUEST, Some(e)),
+        ClockBoundCError::InvalidTimestampCount(_) => {
+            (CLOCKBOUND_ERR_INVALID_TIMESTAMP_COUNT, None)
+        }
+        ClockBoundCError::ShmOpenError(e) => (CLOCKBOUND_ERR_SHM_OPEN, Some(e)),
+        ClockBoundCError::ShmMapError(e) => (CLOCKBOUND_ERR_SHM_MAP, Some(e)),
+        ClockBoundCError::ShmInvalidSegment => (CLOCKBOUND_ERR_SHM_INVALID, None),
+        ClockBoundCError::ShmBusy => (CLOCKBOUND_ERR_SHM_BUSY, None),
+        ClockBoundCError::BoundUnavailable => (CLOCKBOUND_ERR_BOUND_UNAVAILABLE, None),
+        _ => (CLOCKBOUND_ERR_OTHER, None),
+    };
+    if let Some(code) = source.and_then(|e| e.raw_os_error()) {
+        unsafe { *libc::__errno_location() = code };
+    }
+    status
+}
+
+/// Run the body of a function of the C ABI, returning CLOCKBOUND_ERR_OTHER if it panics rather
+/// than unwinding into the caller.
+///
+/// # Arguments
+///
+/// * `f` - The body of the function.
+fn catch_panic<F: FnOnce() -> c_int>(f: F) -> c_int {
+    panic::catch_unwind(AssertUnwindSafe(f)).unwrap_or(CLOCKBOUND_ERR_OTHER)
+}
+
+/// Write the result of a call to the caller's struct, returning its status.
+///
+/// # Arguments
+///
+/// * `result` - The result of the call.
+/// * `out` - The struct owned by the caller the result is written to.
+fn write_result<T>(result: Result<T, ClockBoundCError>, out: *mut T) -> c_int {
+    match result {
+        Ok(value) => {
+            unsafe { out.write(value) };
+            CLOCKBOUND_OK
+        }
+        Err(e) => status(e),
+    }
+}
+
+/// Returns a static description of a status.
+#[no_mangle]
+pub extern "C" fn clockbound_strerror(status: c_int) -> *const c_char {
+    let description = |status| -> &'static [u8] {
+        match status {
+            CLOCKBOUND_OK => b"Success\0",
+            CLOCKBOUND_ERR_INVALID_ARGUMENT => b"Invalid argument\0",
+            CLOCKBOUND_ERR_CONNECT => b"Could not connect to ClockBoundD's socket\0",
+            CLOCKBOUND_ERR_BIND => b"Could not bind to socket\0",
+            CLOCKBOUND_ERR_SET_PERMISSIONS => b"Could not set permissions on socket\0",
+            CLOCKBOUND_ERR_SEND => b"Could not send message to ClockBoundD\0",
+            CLOCKBOUND_ERR_RECEIVE => b"Could not receive message from ClockBoundD\0",
+            CLOCKBOUND_ERR_WRITE_REQUEST => b"Could not write a request\0",
+            CLOCKBOUND_ERR_INVALID_TIMESTAMP_COUNT => {
+                b"A batch request must have between 1 and 64 timestamps\0"
+            }
+            CLOCKBOUND_ERR_SHM_OPEN => b"Could not open ClockBoundD's shared memory segment\0",
+            CLOCKBOUND_ERR_SHM_MAP => b"Could not map ClockBoundD's shared memory segment\0",
+            CLOCKBOUND_ERR_SHM_INVALID => {
+                b"ClockBoundD's shared memory segment is invalid or has an unsupported version\0"
+            }
+            CLOCKBOUND_ERR_SHM_BUSY => b"ClockBoundD's shared memory segment is being updated\0",
+            CLOCKBOUND_ERR_BOUND_UNAVAILABLE => {
+                b"The Clock Error Bound could not be evaluated, ClockBoundD's last update is in the future\0"
+            }
+            _ => b"Unknown error\0",
+        }
+    };
+    panic::catch_unwind(|| description(status))
+        .unwrap_or(b"Unknown error\0")
+        .as_ptr() as *const c_char
+}
+
+/// Create a client connected to the default clockboundd.sock path.
+///
+/// # Safety
+///
+/// `client` must be a valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_client_new(client: *mut *mut ClockBoundClient) -> c_int {
+    catch_panic(|| {
+        if client.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let new = ClockBoundClient::new().map(|new| Box::into_raw(Box::new(new)));
+        write_result(new, client)
+    })
+}
+
+/// Create a client connected to a ClockBoundD socket path.
+///
+/// # Safety
+///
+/// `path` must be a null-terminated string, and `client` a valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_client_new_with_path(
+    path: *const c_char,
+    client: *mut *mut ClockBoundClient,
+) -> c_int {
+    catch_panic(|| {
+        if path.is_null() || client.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let path = match CStr::from_ptr(path).to_str() {
+            Ok(path) => PathBuf::from(path),
+            Err(_) => return CLOCKBOUND_ERR_INVALID_ARGUMENT,
+        };
+        let new = ClockBoundClient::new_with_path(path).map(|new| Box::into_raw(Box::new(new)));
+        write_result(new, client)
+    })
+}
+
+/// Close a client. A null client is ignored.
+///
+/// # Safety
+///
+/// `client` must have been created by clockbound_client_new or clockbound_client_new_with_path,
+/// and not be used again.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_client_free(client: *mut ClockBoundClient) {
+    let _ = panic::catch_unwind(AssertUnwindSafe(|| {
+        if !client.is_null() {
+            drop(Box::from_raw(client));
+        }
+    }));
+}
+
+/// See ClockBoundClient::now.
+///
+/// # Safety
+///
+/// `client` must be a client that is not used by another thread at the same time, and `result` a
+/// valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_now(
+    client: *const ClockBoundClient,
+    result: *mut NowResult,
+) -> c_int {
+    catch_panic(|| {
+        if client.is_null() || result.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let response = (*client).now().map(|response| NowResult {
+            header: response.header.into(),
+            bound: response.bound,
+            timestamp: response.timestamp,
+        });
+        write_result(response, result)
+    })
+}
+
+/// See ClockBoundClient::before.
+///
+/// # Safety
+///
+/// `client` must be a client that is not used by another thread at the same time, and `result` a
+/// valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_before(
+    client: *const ClockBoundClient,
+    before_time: u64,
+    result: *mut BeforeResult,
+) -> c_int {
+    catch_panic(|| {
+        if client.is_null() || result.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let response = (*client).before(before_time).map(|response| BeforeResult {
+            header: response.header.into(),
+            before: u8::from(response.before),
+        });
+        write_result(response, result)
+    })
+}
+
+/// See ClockBoundClient::after.
+///
+/// # Safety
+///
+/// `client` must be a client that is not used by another thread at the same time, and `result` a
+/// valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_after(
+    client: *const ClockBoundClient,
+    after_time: u64,
+    result: *mut AfterResult,
+) -> c_int {
+    catch_panic(|| {
+        if client.is_null() || result.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let response = (*client).after(after_time).map(|response| AfterResult {
+            header: response.header.into(),
+            after: u8::from(response.after),
+        });
+        write_result(response, result)
+    })
+}
+
+/// See ClockBoundClient::compare.
+///
+/// # Safety
+///
+/// `client` must be a client that is not used by another thread at the same time, and `result` a
+/// valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_compare(
+    client: *const ClockBoundClient,
+    time: u64,
+    result: *mut CompareResult,
+) -> c_int {
+    catch_panic(|| {
+        if client.is_null() || result.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let response = (*client).compare(time).map(|response| CompareResult {
+            header: response.header.into(),
+            bound: response.bound,
+            before: u8::from(response.before),
+            after: u8::from(response.after),
+        });
+        write_result(response, result)
+    })
+}
+
+/// See ClockBoundClient::before_many.
+///
+/// # Safety
+///
+/// `client` must be a client that is not used by another thread at the same time, `times` must
+/// point to `count` timestamps, and `result` must be a valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_before_many(
+    client: *const ClockBoundClient,
+    times: *const u64,
+    count: usize,
+    result: *mut ManyResult,
+) -> c_int {
+    catch_panic(|| {
+        if client.is_null() || times.is_null() || result.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let times = std::slice::from_raw_parts(times, count);
+        let response = (*client).before_many(times).map(|response| ManyResult {
+            header: response.header.into(),
+            bound: response.bound,
+            bits: response.before,
+        });
+        write_result(response, result)
+    })
+}
+
+/// See ClockBoundClient::after_many.
+///
+/// # Safety
+///
+/// `client` must be a client that is not used by another thread at the same time, `times` must
+/// point to `count` timestamps, and `result` must be a valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_after_many(
+    client: *const ClockBoundClient,
+    times: *const u64,
+    count: usize,
+    result: *mut ManyResult,
+) -> c_int {
+    catch_panic(|| {
+        if client.is_null() || times.is_null() || result.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let times = std::slice::from_raw_parts(times, count);
+        let response = (*client).after_many(times).map(|response| ManyResult {
+            header: response.header.into(),
+            bound: response.bound,
+            bits: response.after,
+        });
+        write_result(response, result)
+    })
+}
+
+/// Start a timer from the bounds of the current time. See ClockBoundClient::start_timing.
+///
+/// # Safety
+///
+/// `client` must be a client that is not used by another thread at the same time, and `timer` a
+/// valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_timing_start(
+    client: *const ClockBoundClient,
+    timer: *mut *mut TimingGuard,
+) -> c_int {
+    catch_panic(|| {
+        if client.is_null() || timer.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let guard = (*client)
+            .start_timing()
+            .map(|guard| Box::into_raw(Box::new(guard)));
+        write_result(guard, timer)
+    })
+}
+
+/// Stop a timer and free it. See TimingGuard::finish.
+///
+/// # Safety
+///
+/// `timer` must have been started by clockbound_timing_start, and not be used again. `result`
+/// must be a valid pointer.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_timing_finish(
+    timer: *mut TimingGuard,
+    result: *mut TimingResultNanos,
+) -> c_int {
+    catch_panic(|| {
+        if timer.is_null() || result.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let timing = Box::from_raw(timer).finish();
+        let nanos = |time: std::time::SystemTime| match time.duration_since(UNIX_EPOCH) {
+            Ok(d) => d.as_nanos() as u64,
+            Err(_) => 0,
+        };
+        result.write(TimingResultNanos {
+            earliest_start: nanos(timing.earliest_start),
+            latest_finish: nanos(timing.latest_finish),
+            min_execution_time: timing.min_execution_time.as_nanos() as u64,
+            max_execution_time: timing.max_execution_time.as_nanos() as u64,
+        });
+        CLOCKBOUND_OK
+    })
+}
+
+/// Classify timestamps against a bound locally, without a request to ClockBoundD. See the
+/// classify module. The bitmaps must each have room for (count + 63) / 64 words.
+///
+/// # Safety
+///
+/// `bound` must be a valid pointer, `times` must point to `count` timestamps, `margins` must be
+/// null or point to `count` margins, and `before` and `after` must each point to
+/// (count + 63) / 64 words.
+#[no_mangle]
+pub unsafe extern "C" fn clockbound_classify(
+    bound: *const Bound,
+    times: *const u64,
+    margins: *const u64,
+    count: usize,
+    before: *mut u64,
+    after: *mut u64,
+) -> c_int {
+    catch_panic(|| {
+        if count == 0 {
+            return CLOCKBOUND_OK;
+        }
+        if bound.is_null() || times.is_null() || before.is_null() || after.is_null() {
+            return CLOCKBOUND_ERR_INVALID_ARGUMENT;
+        }
+        let words = (count + 63) / 64;
+        let margins = if margins.is_null() {
+            None
+        } else {
+            Some(std::slice::from_raw_parts(margins, count))
+        };
+        classify::classify_words(
+            &*bound,
+            std::slice::from_raw_parts(times, count),
+            margins,
+            std::slice::from_raw_parts_mut(before, words),
+            std::slice::from_raw_parts_mut(after, words),
+        );
+        CLOCKBOUND_OK
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::error::ClockBoundCError;
+    use crate::ffi::*;
+    use crate::mock::MockClockBoundD;
+    use crate::shm::{ClockBoundShmReader, SHM_MAGIC, SHM_VERSION};
+    use crate::Bound;
+    use std::ffi::CString;
+    use std::io;
+    use std::path::{Path, PathBuf};
+    use std::process::Command;
+    use std::ptr;
+    use std::time::{SystemTime, UNIX_EPOCH};
+
+    fn errno() -> c_int {
+        unsafe { *libc::__errno_location() }
+    }
+
+    fn set_errno(code: c_int) {
+        unsafe { *libc::__errno_location() = code };
+    }
+
+    #[test]
+    fn test_null_arguments() {
+        // Never dereferenced, since each call checks its arguments first
+        let client =
+            ptr::NonNull::<ClockBoundClient>::dangling().as_ptr() as *const ClockBoundClient;
+        let times = [0u64];
+        unsafe {
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_client_new(ptr::null_mut())
+            );
+            let path = CString::new("/nonexistent").unwrap();
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_client_new_with_path(ptr::null(), &mut ptr::null_mut())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_client_new_with_path(path.as_ptr(), ptr::null_mut())
+            );
+            clockbound_client_free(ptr::null_mut());
+
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_now(ptr::null(), &mut std::mem::zeroed())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_now(client, ptr::null_mut())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_before(client, 0, ptr::null_mut())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_after(client, 0, ptr::null_mut())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_compare(client, 0, ptr::null_mut())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_before_many(client, ptr::null(), 1, &mut std::mem::zeroed())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_after_many(client, times.as_ptr(), 1, ptr::null_mut())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_timing_start(client, ptr::null_mut())
+            );
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_timing_finish(ptr::null_mut(), &mut std::mem::zeroed())
+            );
+
+            let bound = Bound {
+                earliest: 0,
+                latest: 0,
+            };
+            let mut bits = [0u64];
+            assert_eq!(
+                CLOCKBOUND_ERR_INVALID_ARGUMENT,
+                clockbound_classify(
+                    &bound,
+                    times.as_ptr(),
+                    ptr::null(),
+                    1,
+                    ptr::null_mut(),
+                    bits.as_mut_ptr()
+                )
+            );
+            // No timestamps to classify, so nothing is read or written
+            assert_eq!(
+                CLOCKBOUND_OK,
+                clockbound_classify(
+                    ptr::null(),
+                    ptr::null(),
+                    ptr::null(),
+                    0,
+                    ptr::null_mut(),
+                    ptr::null_mut()
+                )
+            );
+        }
+    }
+
+    #[test]
+    fn test_invalid_timestamp_count() {
+        let mock = MockClockBoundD::new();
+        let path = CString::new(mock.path.to_str().unwrap()).unwrap();
+        let times = [0u64; 65];
+        unsafe {
+            let mut client = ptr::null_mut();
+            assert_eq!(
+                CLOCKBOUND_OK,
+                clockbound_client_new_with_path(path.as_ptr(), &mut client)
+            );
+            for count in [0, 65] {
+                let mut result = std::mem::zeroed();
+                assert_eq!(
+                    CLOCKBOUND_ERR_INVALID_TIMESTAMP_COUNT,
+                    clockbound_before_many(client, times.as_ptr(), count, &mut result)
+                );
+                assert_eq!(
+                    CLOCKBOUND_ERR_INVALID_TIMESTAMP_COUNT,
+                    clockbound_after_many(client, times.as_ptr(), count, &mut result)
+                );
+            }
+            clockbound_client_free(client);
+        }
+        // No request was sent
+        mock.socket.set_nonblocking(true).unwrap();
+        assert!(mock.socket.recv(&mut [0; 1]).is_err());
+    }
+
+    #[test]
+    fn test_status_errno() {
+        set_errno(0);
+        assert_eq!(
+            CLOCKBOUND_ERR_RECEIVE,
+            status(ClockBoundCError::ReceiveMessageError(
+                io::Error::from_raw_os_error(libc::EAGAIN)
+            ))
+        );
+        assert_eq!(libc::EAGAIN, errno());
+
+        assert_eq!(
+            CLOCKBOUND_ERR_CONNECT,
+            status(ClockBoundCError::ConnectError(
+                io::Error::from_raw_os_error(libc::ENOENT)
+            ))
+        );
+        assert_eq!(libc::ENOENT, errno());
+
+        // Errors without one from the operating system leave errno as it was
+        set_errno(0);
+        assert_eq!(
+            CLOCKBOUND_ERR_SEND,
+            status(ClockBoundCError::SendMessageError(io::Error::new(
+                io::ErrorKind::Other,
+                "not from the operating system"
+            )))
+        );
+        assert_eq!(CLOCKBOUND_ERR_SHM_BUSY, status(ClockBoundCError::ShmBusy));
+        assert_eq!(
+            CLOCKBOUND_ERR_INVALID_TIMESTAMP_COUNT,
+            status(ClockBoundCError::InvalidTimestampCount(65))
+        );
+        assert_eq!(
+            CLOCKBOUND_ERR_BOUND_UNAVAILABLE,
+            status(ClockBoundCError::BoundUnavailable)
+        );
+        assert_eq!(
+            CLOCKBOUND_ERR_OTHER,
+            status(ClockBoundCError::SubscriptionRefused)
+        );
+        assert_eq!(0, errno());
+    }
+
+    #[test]
+    fn test_catch_panic() {
+        assert_eq!(CLOCKBOUND_OK, catch_panic(|| CLOCKBOUND_OK));
+        assert_eq!(
+            CLOCKBOUND_ERR_OTHER,
+            catch_panic(|| panic!("in the client"))
+        );
+    }
+
+    /// A C program reading a segment with the inline reader of clockbound.h, printing the status,
+    /// and the response version, response type, unsynchronized flag and Clock Error Bound if
+    /// successful.
+    const SHM_PROGRAM: &str = r#"
+#include <stdio.h>
+#include "clockbound.h"
+
+int main(int argc, char **argv)
+{
+    struct clockbound_shm shm;
+    struct clockbound_now_result now;
+    int status = argc == 2 ? clockbound_shm_open(&shm, argv[1]) : CLOCKBOUND_ERR_INVALID_ARGUMENT;
+
+    if (status == CLOCKBOUND_OK) {
+        status = clockbound_shm_now(&shm, &now);
+        clockbound_shm_close(&shm);
+    }
+    if (status != CLOCKBOUND_OK) {
+        printf("%d\n", status);
+        return 0;
+    }
+    printf("%d %u %u %u %llu\n", status, now.header.response_version, now.header.response_type,
+           now.header.unsynchronized,
+           (unsigned long long)((now.bound.latest - now.bound.earliest) / 2));
+    return 0;
+}
+"#;
+
+    /// The Clock Error Bound of the segments written by write_segment: a correction of 1ms, a
+    /// root dispersion of 0.5ms and half a root delay of 3us, with no growth.
+    const SEGMENT_CEB: u64 = 1_501_500;
+
+    /// Write a segment the way ClockBoundD lays it out, with no error rate so that its Clock
+    /// Error Bound does not depend on when it is read.
+    fn write_segment(path: &Path, magic: u32, ref_time: u64, leap_status: u32, error_flag: u32) {
+        let mut segment = Vec::new();
+        segment.extend_from_slice(&magic.to_ne_bytes());
+        segment.extend_from_slice(&SHM_VERSION.to_ne_bytes());
+        segment.extend_from_slice(&2u64.to_ne_bytes());
+        segment.extend_from_slice(&ref_time.to_ne_bytes());
+        for field in [0.0005f64, -0.001, 0.000003, 0.0, 0.0, 0.0] {
+            segment.extend_from_slice(&field.to_bits().to_ne_bytes());
+        }
+        segment.extend_from_slice(&leap_status.to_ne_bytes());
+        segment.extend_from_slice(&error_flag.to_ne_bytes());
+        std::fs::write(path, segment).unwrap();
+    }
+
+    #[test]
+    fn test_header_shm_reader() {
+        let dir = std::env::temp_dir().join(format!("clockbound-h-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let source = dir.join("shm.c");
+        let program = dir.join("shm");
+        std::fs::write(&source, SHM_PROGRAM).unwrap();
+        let include = PathBuf::from(env!("CARGO_MANIFEST_DIR")).join("include");
+        let compiled = Command::new("cc")
+            .args(["-std=gnu99", "-Wall", "-Wextra", "-Werror", "-I"])
+            .arg(&include)
+            .arg(&source)
+            .arg("-o")
+            .arg(&program)
+            .arg("-lm")
+            .status();
+        match compiled {
+            Ok(compiled) => assert!(compiled.success(), "clockbound.h failed to compile"),
+            Err(e) => {
+                eprintln!(
+                    "Skipping the check of clockbound.h, cc is not available: {}",
+                    e
+                );
+                let _ = std::fs::remove_dir_all(&dir);
+                return;
+            }
+        }
+
+        let segment = dir.join("segment.shm");
+        let read = |segment: &Path| {
+            let output = Command::new(&program).arg(segment).output().unwrap();
+            assert!(output.status.success());
+            String::from_utf8(output.stdout).unwrap().trim().to_string()
+        };
+        let now = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .unwrap()
+            .as_nanos() as u64;
+
+        write_segment(&segment, SHM_MAGIC, now - 10_000_000_000, 0, 0);
+        assert_eq!(
+            format!(
+                "{} {} {} 0 {}",
+                CLOCKBOUND_OK,
+                crate::protocol::REQUEST_VERSION,
+                crate::protocol::REQUEST_TYPE_NOW,
+                SEGMENT_CEB
+            ),
+            read(&segment)
+        );
+        // The same bound as read by the Rust reader
+        let response = ClockBoundShmReader::new_with_path(segment.clone())
+            .unwrap()
+            .now()
+            .unwrap();
+        assert_eq!(
+            crate::protocol::REQUEST_VERSION,
+            response.header.response_version
+        );
+        assert_eq!(
+            SEGMENT_CEB,
+            (response.bound.latest - response.bound.earliest) / 2
+        );
+
+        // Unsynchronized, and ClockBoundD's last poll to Chrony failed
+        write_segment(&segment, SHM_MAGIC, now - 10_000_000_000, 3, 1);
+        assert_eq!(
+            format!("{} 1 0 1 {}", CLOCKBOUND_OK, SEGMENT_CEB),
+            read(&segment)
+        );
+
+        write_segment(&segment, SHM_MAGIC, now + 60_000_000_000, 0, 0);
+        assert_eq!(CLOCKBOUND_ERR_BOUND_UNAVAILABLE.to_string(), read(&segment));
+
+        write_segment(&segment, 0, now - 10_000_000_000, 0, 0);
+        assert_eq!(CLOCKBOUND_ERR_SHM_INVALID.to_string(), read(&segment));
+
+        assert_eq!(
+            CLOCKBOUND_ERR_SHM_OPEN.to_string(),
+            read(&dir.join("missing.shm"))
+        );
+
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+}
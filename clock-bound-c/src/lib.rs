@@ -24,6 +24,124 @@
 //! cargo run --example before /run/clockboundd/clockboundd.sock
 //! cargo run --example after /run/clockboundd/clockboundd.sock
 //! cargo run --example timing /run/clockboundd/clockboundd.sock
+//! cargo run --example stats /run/clockboundd/clockboundd.sock
+//! ```
+//!
+//! The shm_now example reads the bounds from ClockBoundD's shared memory segment instead of its
+//! socket. "/run/clockboundd/clockboundd.shm" is the expected default clockboundd.shm location:
+//!
+//! ```text
+//! cargo run --example shm_now /run/clockboundd/clockboundd.shm
+//! ```
+//!
+//! The load example drives a mix of Now, Before and After requests from many threads, either
+//! closed loop or paced to a target rate, and reports the achieved rate, error responses and
+//! latency percentiles of each request type. It can spread its threads across the shard sockets of
+//! a ClockBoundD running with several workers:
+//!
+//! ```text
+//! cargo run --release --example load /run/clockboundd/clockboundd.sock --threads 8 --rate 100000 --duration 10 --mix 8:1:1 --shards 4
+//! ```
+//!
+//! ## Timing with the monotonic clock
+//!
+//! timing() sends a now request before and after the callback. timing_monotonic() and
+//! start_timing() send a single now request, or read the shared memory segment, at the start and
+//! measure the execution time with the monotonic clock. start_timing() returns a TimingGuard that
+//! is finished whenever the work is done, so the work does not have to be a single closure.
+//!
+//! ## Commit wait
+//!
+//! wait_until_before(t) blocks until `t` is before the earliest error bound, that is until `t` has
+//! definitely passed. This is the commit wait of TrueTime, where TT.after(t) corresponds to
+//! before(t). The wait is calculated from one set of bounds and slept with an absolute deadline on
+//! the system clock, so a commit wait usually takes two requests to ClockBoundD rather than a loop
+//! of before requests.
+//!
+//! ## Sharing a client across threads
+//!
+//! A ClockBoundClient expects one request at a time. ClockBoundSharedClient is `Sync` and can be
+//! shared by many threads behind an `Arc`: it tags every request with a request id and routes each
+//! response back to the thread that sent the request.
+//!
+//! ## Avoiding socket setup
+//!
+//! By default a client binds a socket file in the system's temp directory, which ClockBoundD
+//! sends its responses to, and removes it when dropped. A client created with
+//! `ClientAddress::Autobind` is bound to an address in the Linux abstract namespace picked by the
+//! kernel instead: no file is created or removed, and a crashed process leaves nothing behind.
+//! ClockBoundD must be running in the same network namespace.
+//!
+//! The pool module keeps one such client per thread, created on the thread's first request, so
+//! `clock_bound_c::pool::now()` only pays for setting up a socket once per thread.
+//!
+//! ## Caching bounds locally
+//!
+//! ClockBoundCachingClient answers now, before and after from the last bounds received from
+//! ClockBoundD, moved forward with the monotonic clock and widened by CACHED_GROWTH_PPB, for
+//! ClockBoundD's own bound growing, and FREQUENCY_ERROR over the time elapsed. It only sends a new
+//! request once the extrapolated Clock Error Bound passes a maximum error or the cached bounds pass
+//! a maximum age, so tight loops make few requests. The bounds returned are never tighter than
+//! ClockBoundD's.
+//!
+//! ## Subscribing to updates
+//!
+//! ClockBoundSubscriber subscribes to the Clock Error Bound model, which ClockBoundD pushes whenever
+//! it changes, and calculates the bounds locally from the current system time. Like
+//! ClockBoundShmReader no request is sent per call, but it only needs access to the socket:
+//!
+//! ```text
+//! cargo run --example subscribe /run/clockboundd/clockboundd.sock
+//! ```
+//!
+//! ## Classifying timestamps
+//!
+//! The classify module tests many timestamps, such as the timestamps of log records, against one
+//! Bound without a request per timestamp. Each timestamp is classified as definitely before,
+//! definitely after or within the bound, optionally widened by an error margin of its own, and the
+//! results are packed into bitmaps. On x86_64 CPUs with AVX2 four timestamps are compared per
+//! instruction.
+//!
+//! ## Async client
+//!
+//! With the `async` feature enabled, ClockBoundAsyncClient offers the same requests as async
+//! functions on a Tokio `UnixDatagram`. Many requests can be in flight on its socket at once; a
+//! task spawned with the client routes each response back to its request by request id.
+//!
+//! ```text
+//! [dependencies]
+//! clock-bound-c = { version = "0.1.0", features = ["async"] }
+//! ```
+//!
+//! ```text
+//! cargo run --features async --example async_now /run/clockboundd/clockboundd.sock
+//! ```
+//!
+//! ## C and C++
+//!
+//! The cdylib (libclock_bound_c.so) and staticlib (libclock_bound_c.a) built by Cargo export a C ABI
+//! declared in include/clockbound.h: clockbound_now, clockbound_before, clockbound_after,
+//! clockbound_compare, clockbound_before_many, clockbound_after_many, clockbound_timing_start and
+//! clockbound_timing_finish on a clockbound_client, and clockbound_classify. Each returns a status
+//! and writes its result to a struct owned by the caller.
+//!
+//! The header also defines an inline reader of the shared memory segment, clockbound_shm_open and
+//! clockbound_shm_now, clockbound_shm_before, clockbound_shm_after and clockbound_shm_compare. It
+//! calculates the bounds in the calling function with the same arithmetic as ClockBoundShmReader, so
+//! a C or C++ hot path gets the bounds without a call into the library or a system call, and without
+//! linking clock-bound-c.
+//!
+//! ```text
+//! cargo build --release
+//! cc -O2 -I include app.c -L target/release -lclock_bound_c -lm
+//! ```
+//!
+//! # Benchmarks
+//!
+//! Benchmarks of the client's requests run against a responder thread answering like ClockBoundD,
+//! so they do not require ClockBoundD or chronyd:
+//! ```text
+//! cargo bench
 //! ```
 //!
 //! # Updating README
@@ -32,19 +150,38 @@
 //! ```text
 //! cargo readme > README.md
 //! ```
+#[cfg(feature = "async")]
+mod async_client;
+mod caching;
+mod ceb;
+pub mod classify;
 mod error;
+mod ffi;
+#[cfg(test)]
+mod mock;
+pub mod pool;
+mod protocol;
+mod shared;
+mod shm;
+mod subscriber;
 
 use crate::error::ClockBoundCError;
-use byteorder::{ByteOrder, NetworkEndian};
 use rand::distributions::Alphanumeric;
 use rand::{thread_rng, Rng};
 use std::fs;
+use std::io;
 use std::os::unix::fs::PermissionsExt;
+use std::os::unix::io::FromRawFd;
 use std::os::unix::net::UnixDatagram;
 use std::path::PathBuf;
-use std::time::{Duration, SystemTime, UNIX_EPOCH};
-
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 
+#[cfg(feature = "async")]
+pub use crate::async_client::ClockBoundAsyncClient;
+pub use crate::caching::{ClockBoundCachingClient, CACHED_GROWTH_PPB};
+pub use crate::shared::ClockBoundSharedClient;
+pub use crate::shm::{ClockBoundShmReader, CLOCKBOUNDD_SHM_PATH};
+pub use crate::subscriber::ClockBoundSubscriber;
 
 /// The default Unix Datagram Socket file that is generated by ClockBoundD.
 pub const CLOCKBOUNDD_SOCKET_ADDRESS_PATH: &str = "/run/clockboundd/clockboundd.sock";
@@ -55,8 +192,27 @@ pub const CLOCKBOUNDC_SOCKET_NAME_PREFIX: &str = "clockboundc";
 /// Setting clock frequency to 1ppm to match chrony
 pub const FREQUENCY_ERROR: u64 = 1; //1ppm
 
+/// The longest the shared, async and pooled clients wait for the response to a request before
+/// failing it with ReceiveMessageError, so that a lost datagram or a stopped ClockBoundD does not
+/// block a caller forever.
+pub const RECEIVE_TIMEOUT: Duration = Duration::from_secs(1);
+
+/// The address a client socket is bound to, that ClockBoundD sends its responses to.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum ClientAddress {
+    /// A uniquely named socket file in the system's temp directory, made writable by ClockBoundD
+    /// and removed when the client is dropped. A client that crashes leaves the file behind.
+    File,
+    /// A unique address in the Linux abstract namespace, picked by the kernel when the socket is
+    /// bound. No file is created, made writable or removed, and nothing is left behind by a client
+    /// that crashes. ClockBoundD must be running in the same network namespace as the client.
+    Autobind,
+}
+
 /// A structure for containing the error bounds returned from ClockBoundD. The values represent
-/// the time since the Unix Epoch in nanoseconds.
+/// the time since the Unix Epoch in nanoseconds. Laid out as struct clockbound_bound of
+/// include/clockbound.h.
+#[repr(C)]
 pub struct Bound {
     /// System time minus the error calculated from chrony in nanoseconds since the Unix Epoch
     pub earliest: u64,
@@ -96,6 +252,70 @@ pub struct ResponseAfter {
     pub after: bool,
 }
 
+/// A structure for holding the response of a compare request.
+pub struct ResponseCompare {
+    pub header: ResponseHeader,
+    /// The bounds the timestamp was tested against.
+    pub bound: Bound,
+    /// A boolean indicating if the requested time is before the earliest error bound or not.
+    pub before: bool,
+    /// A boolean indicating if the requested time is after the latest error bound or not.
+    pub after: bool,
+}
+
+/// A structure for holding the response of a before request testing many timestamps.
+pub struct ResponseBeforeMany {
+    pub header: ResponseHeader,
+    /// The bounds every timestamp was tested against.
+    pub bound: Bound,
+    /// A bitset of the timestamps that are before the current error bounds. The nth least
+    /// significant bit is set if the nth requested timestamp is before the bounds.
+    pub before: u64,
+}
+
+/// A structure for holding the response of an after request testing many timestamps.
+pub struct ResponseAfterMany {
+    pub header: ResponseHeader,
+    /// The bounds every timestamp was tested against.
+    pub bound: Bound,
+    /// A bitset of the timestamps that are after the current error bounds. The nth least
+    /// significant bit is set if the nth requested timestamp is after the bounds.
+    pub after: u64,
+}
+
+/// The percentiles of a latency measured by ClockBoundD, in nanoseconds.
+pub struct LatencyStats {
+    pub p50: u64,
+    pub p99: u64,
+    pub p999: u64,
+    pub max: u64,
+}
+
+/// A structure for holding the response of a stats request. All counts are since ClockBoundD
+/// started, summed across its worker threads.
+pub struct ResponseStats {
+    pub header: ResponseHeader,
+    /// The time since ClockBoundD started.
+    pub uptime: Duration,
+    /// The responses sent by request type: invalid (0), now (1), before (2), after (3), batch (4),
+    /// subscribe (5), stats (7) and compare (8). Index 6 is always 0.
+    pub requests: [u64; 9],
+    /// The error responses sent to valid requests because the last poll of chronyd failed.
+    pub error_flag_responses: u64,
+    /// The responses that ClockBoundD could not send.
+    pub send_failures: u64,
+    /// The polls of chronyd, or of the tracking source ClockBoundD was started with.
+    pub polls: u64,
+    /// The polls that failed.
+    pub poll_failures: u64,
+    /// The time from ClockBoundD receiving a request to sending its response.
+    pub service_time: LatencyStats,
+    /// The time since chronyd last updated the clock when a request was served.
+    pub snapshot_age: LatencyStats,
+    /// The time a poll of chronyd took.
+    pub poll_latency: LatencyStats,
+}
+
 /// A structure for holding the response of a timing request.
 #[derive(Debug)]
 pub struct TimingResult {
@@ -111,6 +331,66 @@ pub struct TimingResult {
     pub max_execution_time : Duration
 }
 
+/// A timer started from a single set of bounds, that times work with the monotonic clock.
+///
+/// Unlike timing(), finishing the timer does not send a request to ClockBoundD: the execution time
+/// is measured with the monotonic clock, allowing for FREQUENCY_ERROR, and the finish bound is
+/// derived from the start bounds. A TimingGuard does not need to be finished in the scope it was
+/// started in, so it can time async work or work spanning several stack frames.
+#[derive(Debug)]
+pub struct TimingGuard {
+    /// The earliest bound of the start bounds in nanoseconds since the Unix Epoch.
+    earliest_start: u64,
+    /// The latest bound of the start bounds in nanoseconds since the Unix Epoch.
+    latest_start: u64,
+    /// The monotonic time at which the start bounds were requested. They were calculated no
+    /// earlier than this.
+    requested: Instant,
+    /// The monotonic time at which the timer was started, once the start bounds were received.
+    started: Instant,
+}
+
+impl TimingGuard {
+    /// Start a timer from the bounds of the current time.
+    ///
+    /// # Arguments
+    ///
+    /// * `bound` - The bounds of the current time.
+    /// * `requested` - The monotonic time at which the bounds were requested.
+    fn new(bound: Bound, requested: Instant) -> TimingGuard {
+        TimingGuard {
+            earliest_start: bound.earliest,
+            latest_start: bound.latest,
+            requested,
+            started: Instant::now(),
+        }
+    }
+
+    /// Stop the timer and return bounds on the time elapsed since it was started.
+    pub fn finish(self) -> TimingResult {
+        let finished = Instant::now();
+        let execution_time = finished.saturating_duration_since(self.started).as_nanos() as u64;
+        let error_rate = frequency_error_nanos(execution_time);
+
+        // The start bounds were calculated somewhere between requesting and receiving them, so
+        // the latest finish is measured from when they were requested
+        let since_requested = finished
+            .saturating_duration_since(self.requested)
+            .as_nanos() as u64;
+        let latest_finish = self
+            .latest_start
+            .saturating_add(since_requested)
+            .saturating_add(frequency_error_nanos(since_requested));
+
+        TimingResult {
+            earliest_start: UNIX_EPOCH + Duration::from_nanos(self.earliest_start),
+            latest_finish: UNIX_EPOCH + Duration::from_nanos(latest_finish),
+            min_execution_time: Duration::from_nanos(execution_time.saturating_sub(error_rate)),
+            max_execution_time: Duration::from_nanos(execution_time + error_rate),
+        }
+    }
+}
+
 /// A structure for holding a client to communicate with ClockBoundD.
 pub struct ClockBoundClient {
     /// A ClockBoundClient must have a socket to communicate with ClockBoundD.
@@ -161,28 +441,104 @@ impl ClockBoundClient {
     pub fn new_with_path(
         clock_bound_d_socket: PathBuf,
     ) -> Result<ClockBoundClient, ClockBoundCError> {
-        let client_path = get_socket_path();
+        ClockBoundClient::new_with_address(clock_bound_d_socket, ClientAddress::File)
+    }
 
-        // Binding will fail if the socket file already exists. However, since the socket file is
-        // uniquely created based on the current time this should not fail.
-        let sock = match UnixDatagram::bind(client_path.as_path()) {
-            Ok(sock) => sock,
-            Err(e) => return Err(ClockBoundCError::BindError(e)),
-        };
+    /// Create a new ClockBoundClient using a defined clockboundd.sock path, with its socket bound
+    /// to a chosen kind of address.
+    ///
+    /// An Autobind address makes creating and dropping a client a pair of system calls, with no
+    /// file system access, which suits short lived processes and clients.
+    ///
+    /// # Arguments
+    ///
+    /// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+    /// * `address` - The kind of address the client socket is bound to.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::{ClientAddress, ClockBoundClient};
+    /// let client = match ClockBoundClient::new_with_address(std::path::PathBuf::from("/run/clockboundd/clockboundd.sock"), ClientAddress::Autobind){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new_with_address(
+        clock_bound_d_socket: PathBuf,
+        address: ClientAddress,
+    ) -> Result<ClockBoundClient, ClockBoundCError> {
+        Ok(ClockBoundClient {
+            socket: connect_socket(clock_bound_d_socket, address)?,
+        })
+    }
 
-        let mode = 0o666;
-        let permissions = fs::Permissions::from_mode(mode);
-        match fs::set_permissions(client_path, permissions) {
-            Err(e) => return Err(ClockBoundCError::SetPermissionsError(e)),
-            _ => {}
-        }
+    /// Create a new ClockBoundClient connected to one of the shard sockets of a ClockBoundD
+    /// running with multiple workers, using the default clockboundd.sock path at
+    /// "/run/clockboundd/clockboundd.sock".
+    ///
+    /// The shard is picked from the CPU the calling thread is running on, so that clients created
+    /// on different CPUs spread their requests across the ClockBoundD workers.
+    ///
+    /// # Arguments
+    ///
+    /// * `shards` - The number of workers ClockBoundD is running with.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new_sharded(4){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new_sharded(shards: usize) -> Result<ClockBoundClient, ClockBoundCError> {
+        ClockBoundClient::new_sharded_with_path(
+            std::path::PathBuf::from(CLOCKBOUNDD_SOCKET_ADDRESS_PATH),
+            shards,
+        )
+    }
 
-        match sock.connect(clock_bound_d_socket.as_path()) {
-            Err(e) => return Err(ClockBoundCError::ConnectError(e)),
-            _ => {}
-        }
+    /// Create a new ClockBoundClient connected to one of the shard sockets of a ClockBoundD
+    /// running with multiple workers, using a defined clockboundd.sock path.
+    ///
+    /// Shard 0 is the clockboundd.sock socket itself. Shard n is the clockboundd-<n>.sock socket
+    /// in the same directory.
+    ///
+    /// # Arguments
+    ///
+    /// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+    /// * `shards` - The number of workers ClockBoundD is running with.
+    pub fn new_sharded_with_path(
+        clock_bound_d_socket: PathBuf,
+        shards: usize,
+    ) -> Result<ClockBoundClient, ClockBoundCError> {
+        let shard = match unsafe { libc::sched_getcpu() } {
+            cpu if cpu >= 0 => cpu as usize % shards.max(1),
+            _ => 0,
+        };
+        ClockBoundClient::new_with_path(get_shard_socket_path(clock_bound_d_socket, shard))
+    }
 
-        Ok(ClockBoundClient { socket: sock })
+    /// Set how long a request waits for its response before failing with ReceiveMessageError.
+    /// None, the default, waits forever.
+    ///
+    /// Since responses to version 1 requests carry no request id, a response that arrives after
+    /// its request timed out is received by the next request. A client whose request timed out
+    /// should be dropped and a new one created.
+    ///
+    /// # Arguments
+    ///
+    /// * `timeout` - The longest a request waits for its response, or None to wait forever.
+    pub fn set_receive_timeout(&self, timeout: Option<Duration>) -> io::Result<()> {
+        self.socket.set_read_timeout(timeout)
     }
 
     /// Returns the bounds of the current system time +/- the error calculated from chrony.
@@ -207,39 +563,87 @@ impl ClockBoundClient {
     /// };
     /// ```
     pub fn now(&self) -> Result<ResponseNow, ClockBoundCError> {
-        // Header
-        // 1st - Version
-        // 2nd - Command Type
-        // 3rd, 4th - Reserved
-        let mut request: [u8; 4] = [1, 1, 0, 0];
+        let request = protocol::now_request();
 
-        match self.socket.send(&mut request) {
+        match self.socket.send(&request) {
             Err(e) => return Err(ClockBoundCError::SendMessageError(e)),
             _ => {}
         }
-        let mut response: [u8; 20] = [0; 20];
+        let mut response: [u8; protocol::NOW_RESPONSE_SIZE] = [0; protocol::NOW_RESPONSE_SIZE];
         match self.socket.recv(&mut response) {
             Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
             _ => {}
         }
-        let response_version = response[0];
-        let response_type = response[1];
-        let unsynchronized_flag = response[2] != 0;
-        let earliest = NetworkEndian::read_u64(&response[4..12]);
-        let latest = NetworkEndian::read_u64(&response[12..20]);
+        let bound = protocol::decode_bound(&response[protocol::HEADER_SIZE..]);
+        // Since the bounds are the system time +/- the Clock Error Bound, the system time
+        // timestamp can be calculated with the below formula.
+        let timestamp = bound.latest - ((bound.latest - bound.earliest) / 2);
         Ok(ResponseNow {
-            header: ResponseHeader {
-                response_version,
-                response_type,
-                unsynchronized_flag,
-            },
-            bound: Bound { earliest, latest },
-            // Since the bounds are the system time +/- the Clock Error Bound, the system time
-            // timestamp can be calculated with the below formula.
-            timestamp: (latest - ((latest - earliest) / 2)),
+            header: protocol::decode_header(&response),
+            bound,
+            timestamp,
         })
     }
 
+    /// Returns the bounds of the current system time +/- the error calculated from chrony, and the
+    /// time the request was queued on ClockBoundD's socket before it was handled.
+    ///
+    /// The bounds are as of when ClockBoundD handled the request, so a large queue delay means
+    /// they were taken well after the request was sent, and a caller can discard them. The delay
+    /// is None if ClockBoundD does not report it.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let (response, queue_delay) = match client.now_with_queue_delay(){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete now request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn now_with_queue_delay(
+        &self,
+    ) -> Result<(ResponseNow, Option<Duration>), ClockBoundCError> {
+        let request = protocol::now_queue_delay_request();
+
+        match self.socket.send(&request) {
+            Err(e) => return Err(ClockBoundCError::SendMessageError(e)),
+            _ => {}
+        }
+        let mut response: [u8; protocol::NOW_QUEUE_DELAY_RESPONSE_SIZE] =
+            [0; protocol::NOW_QUEUE_DELAY_RESPONSE_SIZE];
+        let size = match self.socket.recv(&mut response) {
+            Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
+            Ok(size) => size,
+        };
+        let bound = protocol::decode_bound(&response[protocol::HEADER_SIZE..]);
+        let timestamp = bound.latest - ((bound.latest - bound.earliest) / 2);
+        let queue_delay = match size {
+            protocol::NOW_QUEUE_DELAY_RESPONSE_SIZE => Some(Duration::from_nanos(
+                protocol::decode_queue_delay(&response[protocol::NOW_RESPONSE_SIZE..]),
+            )),
+            _ => None,
+        };
+        Ok((
+            ResponseNow {
+                header: protocol::decode_header(&response),
+                bound,
+                timestamp,
+            },
+            queue_delay,
+        ))
+    }
+
     /// Returns true if the provided timestamp is before the earliest error bound.
     /// Otherwise, returns false.
     ///
@@ -269,35 +673,21 @@ impl ClockBoundClient {
     /// };
     /// ```
     pub fn before(&self, before_time: u64) -> Result<ResponseBefore, ClockBoundCError> {
-        // Header
-        // 1st - Version
-        // 2nd - Command Type
-        // 3rd, 4th - Reserved
-        let mut request: [u8; 12] = [1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0];
-
-        // Body
-        NetworkEndian::write_u64(&mut request[4..12], before_time);
+        let request = protocol::before_after_request(protocol::REQUEST_TYPE_BEFORE, before_time);
 
-        match self.socket.send(&mut request) {
+        match self.socket.send(&request) {
             Err(e) => return Err(ClockBoundCError::SendMessageError(e)),
             _ => {}
         }
-        let mut response: [u8; 5] = [0; 5];
+        let mut response: [u8; protocol::BEFORE_AFTER_RESPONSE_SIZE] =
+            [0; protocol::BEFORE_AFTER_RESPONSE_SIZE];
         match self.socket.recv(&mut response) {
             Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
             _ => {}
         }
-        let response_version = response[0];
-        let response_type = response[1];
-        let unsynchronized_flag = response[2] != 0;
-        let before = response[4] != 0;
         Ok(ResponseBefore {
-            header: ResponseHeader {
-                response_version,
-                response_type,
-                unsynchronized_flag,
-            },
-            before,
+            header: protocol::decode_header(&response),
+            before: protocol::decode_flag(&response[protocol::HEADER_SIZE..]),
         })
     }
 
@@ -330,105 +720,481 @@ impl ClockBoundClient {
     /// };
     /// ```
     pub fn after(&self, after_time: u64) -> Result<ResponseAfter, ClockBoundCError> {
-        // Header
-        // 1st - Version
-        // 2nd - Command Type
-        // 3rd, 4th - Reserved
-        let mut request: [u8; 12] = [1, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0];
-
-        // Body
-        NetworkEndian::write_u64(&mut request[4..12], after_time);
+        let request = protocol::before_after_request(protocol::REQUEST_TYPE_AFTER, after_time);
 
-        match self.socket.send(&mut request) {
+        match self.socket.send(&request) {
             Err(e) => return Err(ClockBoundCError::SendMessageError(e)),
             _ => {}
         }
-        let mut response: [u8; 5] = [0; 5];
+        let mut response: [u8; protocol::BEFORE_AFTER_RESPONSE_SIZE] =
+            [0; protocol::BEFORE_AFTER_RESPONSE_SIZE];
         match self.socket.recv(&mut response) {
             Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
             _ => {}
         }
-        let response_version = response[0];
-        let response_type = response[1];
-        let unsynchronized_flag = response[2] != 0;
-        let after = response[4] != 0;
         Ok(ResponseAfter {
-            header: ResponseHeader {
-                response_version,
-                response_type,
-                unsynchronized_flag,
-            },
+            header: protocol::decode_header(&response),
+            after: protocol::decode_flag(&response[protocol::HEADER_SIZE..]),
+        })
+    }
+
+    /// Tests the provided timestamp against both error bounds, and returns the bounds it was
+    /// tested against. The bounds and both results come from a single read of the clock by
+    /// ClockBoundD, so unlike a before request followed by an after request they can not
+    /// disagree. A timestamp that is neither before nor after the bounds is within them.
+    ///
+    /// A ClockBoundD that does not support compare requests responds with an Error (0) response
+    /// type, 0 bounds and both results false.
+    ///
+    /// # Arguments
+    ///
+    /// * `time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is tested
+    /// against the error bounds.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// // Using 0 which equates to the Unix Epoch
+    /// let response = match client.compare(0){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete compare request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn compare(&self, time: u64) -> Result<ResponseCompare, ClockBoundCError> {
+        let request = protocol::before_after_request(protocol::REQUEST_TYPE_COMPARE, time);
+
+        match self.socket.send(&request) {
+            Err(e) => return Err(ClockBoundCError::SendMessageError(e)),
+            _ => {}
+        }
+        let mut response: [u8; protocol::COMPARE_RESPONSE_SIZE] =
+            [0; protocol::COMPARE_RESPONSE_SIZE];
+        match self.socket.recv(&mut response) {
+            Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
+            _ => {}
+        }
+        let (bound, before, after) = protocol::decode_compare(&response[protocol::HEADER_SIZE..]);
+        Ok(ResponseCompare {
+            header: protocol::decode_header(&response),
+            bound,
+            before,
             after,
         })
     }
 
+    /// Tests each of the provided timestamps against the earliest error bound. All timestamps are
+    /// tested against the same bounds with a single request to ClockBoundD.
+    ///
+    /// Returns a bitset where the nth least significant bit is set if the nth timestamp is before
+    /// the earliest error bound.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_times` - Between 1 and 64 timestamps, represented as nanoseconds since the Unix
+    /// Epoch, that are tested against the earliest error bound.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// // Using 0 which equates to the Unix Epoch
+    /// let response = match client.before_many(&[0, 1, 2]){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete before request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn before_many(
+        &self,
+        before_times: &[u64],
+    ) -> Result<ResponseBeforeMany, ClockBoundCError> {
+        let (header, bound, before, _) = self.batch(before_times)?;
+        Ok(ResponseBeforeMany {
+            header,
+            bound,
+            before,
+        })
+    }
+
+    /// Tests each of the provided timestamps against the latest error bound. All timestamps are
+    /// tested against the same bounds with a single request to ClockBoundD.
+    ///
+    /// Returns a bitset where the nth least significant bit is set if the nth timestamp is after
+    /// the latest error bound.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_times` - Between 1 and 64 timestamps, represented as nanoseconds since the Unix
+    /// Epoch, that are tested against the latest error bound.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// // Using 0 which equates to the Unix Epoch
+    /// let response = match client.after_many(&[0, 1, 2]){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete after request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn after_many(&self, after_times: &[u64]) -> Result<ResponseAfterMany, ClockBoundCError> {
+        let (header, bound, _, after) = self.batch(after_times)?;
+        Ok(ResponseAfterMany {
+            header,
+            bound,
+            after,
+        })
+    }
+
+    /// Returns the metrics ClockBoundD has recorded since it started: the responses sent by request
+    /// type, failures, and percentiles of its service time, of the age of the tracking data it
+    /// serves from, and of its polls of chronyd.
+    ///
+    /// A ClockBoundD that does not support stats requests responds with an Error (0) response
+    /// type, and every metric is 0.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let response = match client.stats(){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete stats request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn stats(&self) -> Result<ResponseStats, ClockBoundCError> {
+        let request = protocol::stats_request();
+
+        match self.socket.send(&request) {
+            Err(e) => return Err(ClockBoundCError::SendMessageError(e)),
+            _ => {}
+        }
+        let mut response: [u8; protocol::STATS_RESPONSE_SIZE] = [0; protocol::STATS_RESPONSE_SIZE];
+        match self.socket.recv(&mut response) {
+            Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
+            _ => {}
+        }
+        let values = protocol::decode_stats(&response[protocol::HEADER_SIZE..]);
+        let latency = |i: usize| LatencyStats {
+            p50: values[i],
+            p99: values[i + 1],
+            p999: values[i + 2],
+            max: values[i + 3],
+        };
+        Ok(ResponseStats {
+            header: protocol::decode_header(&response),
+            uptime: Duration::from_nanos(values[0]),
+            requests: [
+                values[1], values[2], values[3], values[4], values[5], values[6], 0, values[7],
+                values[24],
+            ],
+            error_flag_responses: values[8],
+            send_failures: values[9],
+            polls: values[10],
+            poll_failures: values[11],
+            service_time: latency(12),
+            snapshot_age: latency(16),
+            poll_latency: latency(20),
+        })
+    }
+
+    /// Send a batch request and return the header, bounds, and before and after bitsets of the
+    /// response.
+    fn batch(&self, times: &[u64]) -> Result<(ResponseHeader, Bound, u64, u64), ClockBoundCError> {
+        if times.is_empty() || times.len() > protocol::MAX_BATCH_TIMESTAMPS {
+            return Err(ClockBoundCError::InvalidTimestampCount(times.len()));
+        }
+
+        let mut request: [u8; protocol::BATCH_REQUEST_BUFFER_SIZE] =
+            [0; protocol::BATCH_REQUEST_BUFFER_SIZE];
+        let request_size = protocol::batch_request(times, &mut request);
+
+        match self.socket.send(&request[..request_size]) {
+            Err(e) => return Err(ClockBoundCError::SendMessageError(e)),
+            _ => {}
+        }
+        let mut response: [u8; protocol::BATCH_RESPONSE_SIZE] = [0; protocol::BATCH_RESPONSE_SIZE];
+        match self.socket.recv(&mut response) {
+            Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
+            _ => {}
+        }
+        let (bound, before, after) = protocol::decode_batch(&response[protocol::HEADER_SIZE..]);
+        Ok((protocol::decode_header(&response), bound, before, after))
+    }
+
     ///Execute `f` and return bounds on execution time
     pub fn timing<A, F>(&self, f: F) -> Result<(TimingResult, A), (ClockBoundCError, Result<A,F>)>
         where F: FnOnce() -> A {
 
         // Get the first timestamps
 
-        // Header
-        // 1st - Version
-        // 2nd - Command Type
-        // 3rd, 4th - Reserved
-        let mut request: [u8; 4] = [1, 1, 0, 0];
+        let request = protocol::now_request();
 
-        match self.socket.send(&mut request) {
+        match self.socket.send(&request) {
             Err(e) => return Err((ClockBoundCError::SendMessageError(e), Err(f))),
             _ => {}
         }
-        let mut response: [u8; 20] = [0; 20];
+        let mut response: [u8; protocol::NOW_RESPONSE_SIZE] = [0; protocol::NOW_RESPONSE_SIZE];
         match self.socket.recv(&mut response) {
             Err(e) => return Err((ClockBoundCError::ReceiveMessageError(e), Err(f))),
             _ => {}
         }
-        let earliest_start = NetworkEndian::read_u64(&response[4..12]);
-        let latest_start = NetworkEndian::read_u64(&response[12..20]);
+        let Bound {
+            earliest: earliest_start,
+            latest: latest_start,
+        } = protocol::decode_bound(&response[protocol::HEADER_SIZE..]);
 
         // Execute the provided function, f
         let callback = f();
 
         // Get the second timestamps
-        let mut request: [u8; 4] = [1, 1, 0, 0];
-        match self.socket.send(&mut request) {
+        match self.socket.send(&request) {
             Err(e) => return Err((ClockBoundCError::SendMessageError(e), Ok(callback))),
             _ => {}
         }
-        let mut response: [u8; 20] = [0; 20];
         match self.socket.recv(&mut response) {
             Err(e) => return Err((ClockBoundCError::ReceiveMessageError(e), Ok(callback))),
             _ => {}
         }
-        let earliest_finish = NetworkEndian::read_u64(&response[4..12]);
-        let latest_finish = NetworkEndian::read_u64(&response[12..20]);
-
-        // Calculate midpoints of start and finish
-        let start_midpoint = (earliest_start + latest_start)/2;
-        let end_midpoint = (earliest_finish + latest_finish)/2;
-
-        // Convert to SystemTime
-        let earliest_start = UNIX_EPOCH + Duration::from_nanos(earliest_start);
-        let latest_finish = UNIX_EPOCH + Duration::from_nanos(latest_finish);
-
-        // Calculates duration between the two midpoints
-        let execution_time = end_midpoint - start_midpoint;
-        let error_rate = (execution_time * FREQUENCY_ERROR) / 1_000_000 +
-            //Ugly way of saying .div_ceil() until it stabilizes
-            if (execution_time * FREQUENCY_ERROR) % 1_000_000 == 0 { 0 } else { 1 };
-
-        let min_execution_time = Duration::from_nanos(execution_time - error_rate);
-        let max_execution_time = Duration::from_nanos(execution_time + error_rate);
-
-        Ok((TimingResult{
-            earliest_start,
-            latest_finish,
-            min_execution_time,
-            max_execution_time
-        }, callback))
+        let Bound {
+            earliest: earliest_finish,
+            latest: latest_finish,
+        } = protocol::decode_bound(&response[protocol::HEADER_SIZE..]);
+
+        Ok((
+            timing_result(earliest_start, latest_start, earliest_finish, latest_finish),
+            callback,
+        ))
+    }
+
+    /// Start a timer from the bounds of the current time, with a single now request to
+    /// ClockBoundD. See TimingGuard.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let timer = match client.start_timing(){
+    ///     Ok(timer) => timer,
+    ///     Err(e) => {
+    ///         println!("Couldn't start timer: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let result = timer.finish();
+    /// ```
+    pub fn start_timing(&self) -> Result<TimingGuard, ClockBoundCError> {
+        let requested = Instant::now();
+        let response = self.now()?;
+        Ok(TimingGuard::new(response.bound, requested))
+    }
+
+    /// Block until the provided timestamp is before the earliest error bound, that is until it has
+    /// definitely passed, and return the bounds that confirmed it.
+    ///
+    /// This is the commit wait of TrueTime, where TT.after(t) corresponds to before(t) here.
+    /// Rather than sending before requests in a loop, the remaining wait is calculated from the
+    /// bounds of one now request and slept with an absolute deadline on the system clock. A
+    /// second now request usually confirms that the wait is over.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, to wait
+    /// for the earliest error bound to pass.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundClient;
+    /// let client = match ClockBoundClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// // Using 0 which equates to the Unix Epoch, which has already passed
+    /// let response = match client.wait_until_before(0){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete commit wait: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn wait_until_before(&self, before_time: u64) -> Result<ResponseNow, ClockBoundCError> {
+        wait_until_before(before_time, || self.now())
+    }
+
+    /// Execute `f` and return bounds on execution time, with a single now request to ClockBoundD
+    /// before `f` is executed. The execution time is measured with the monotonic clock. See
+    /// TimingGuard.
+    pub fn timing_monotonic<A, F>(
+        &self,
+        f: F,
+    ) -> Result<(TimingResult, A), (ClockBoundCError, Result<A, F>)>
+    where
+        F: FnOnce() -> A,
+    {
+        let timer = match self.start_timing() {
+            Ok(timer) => timer,
+            Err(e) => return Err((e, Err(f))),
+        };
+        let callback = f();
+        Ok((timer.finish(), callback))
     }
 }
 
+/// Calculate the bounds on the execution time of a callback from the bounds taken before and
+/// after it was executed.
+fn timing_result(
+    earliest_start: u64,
+    latest_start: u64,
+    earliest_finish: u64,
+    latest_finish: u64,
+) -> TimingResult {
+    // Calculate midpoints of start and finish
+    let start_midpoint = (earliest_start + latest_start) / 2;
+    let end_midpoint = (earliest_finish + latest_finish) / 2;
+
+    // Convert to SystemTime
+    let earliest_start = UNIX_EPOCH + Duration::from_nanos(earliest_start);
+    let latest_finish = UNIX_EPOCH + Duration::from_nanos(latest_finish);
+
+    // Calculates duration between the two midpoints
+    let execution_time = end_midpoint - start_midpoint;
+    let error_rate = frequency_error_nanos(execution_time);
+
+    let min_execution_time = Duration::from_nanos(execution_time - error_rate);
+    let max_execution_time = Duration::from_nanos(execution_time + error_rate);
+
+    TimingResult {
+        earliest_start,
+        latest_finish,
+        min_execution_time,
+        max_execution_time,
+    }
+}
+
+/// Block until a timestamp is before the earliest error bound, sleeping until the system time at
+/// which the earliest bound is expected to pass it between getting bounds.
+///
+/// # Arguments
+///
+/// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, to wait for
+/// the earliest error bound to pass.
+/// * `now` - Get the bounds of the current system time.
+fn wait_until_before<N>(before_time: u64, now: N) -> Result<ResponseNow, ClockBoundCError>
+where
+    N: Fn() -> Result<ResponseNow, ClockBoundCError>,
+{
+    loop {
+        let response = now()?;
+        if before_time < response.bound.earliest {
+            return Ok(response);
+        }
+
+        // The earliest bound is the system time minus the Clock Error Bound, so it passes the
+        // timestamp once the system time passes the timestamp plus the Clock Error Bound. The
+        // Clock Error Bound keeps growing while sleeping, so allow for FREQUENCY_ERROR over the
+        // wait to avoid waking up just short of the deadline.
+        let ceb = response.timestamp - response.bound.earliest;
+        let wait = (before_time - response.bound.earliest).saturating_add(1);
+        let deadline = response
+            .timestamp
+            .saturating_add(wait)
+            .saturating_add(frequency_error_nanos(wait.saturating_add(ceb)));
+        sleep_until_system_time(deadline);
+    }
+}
+
+/// Sleep until the system time reaches a deadline. Sleeping against the system clock rather than
+/// for a duration keeps the deadline correct if the system clock is slewed or stepped meanwhile.
+///
+/// # Arguments
+///
+/// * `deadline_nanos` - The deadline in nanoseconds since the Unix Epoch.
+fn sleep_until_system_time(deadline_nanos: u64) {
+    let deadline = libc::timespec {
+        tv_sec: (deadline_nanos / 1_000_000_000) as libc::time_t,
+        tv_nsec: (deadline_nanos % 1_000_000_000) as libc::c_long,
+    };
+    loop {
+        let result = unsafe {
+            libc::clock_nanosleep(
+                libc::CLOCK_REALTIME,
+                libc::TIMER_ABSTIME,
+                &deadline,
+                std::ptr::null_mut(),
+            )
+        };
+        // Only retry if the sleep was interrupted by a signal
+        if result != libc::EINTR {
+            return;
+        }
+    }
+}
+
+/// Calculate the most a clock can drift from true time over an elapsed time at FREQUENCY_ERROR,
+/// rounded up to the next nanosecond.
+///
+/// # Arguments
+///
+/// * `elapsed_nanos` - The elapsed time in nanoseconds.
+fn frequency_error_nanos(elapsed_nanos: u64) -> u64 {
+    let drift = elapsed_nanos.saturating_mul(FREQUENCY_ERROR);
+    drift / 1_000_000 +
+        //Ugly way of saying .div_ceil() until it stabilizes
+        if drift % 1_000_000 == 0 { 0 } else { 1 }
+}
+
 impl Drop for ClockBoundClient {
     /// Remove the client socket file when a ClockBoundClient is dropped.
     fn drop(&mut self) {
@@ -441,6 +1207,109 @@ impl Drop for ClockBoundClient {
     }
 }
 
+/// Create a client socket with a unique address and connect it to a ClockBoundD socket.
+///
+/// # Arguments
+///
+/// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+/// * `address` - The kind of address the client socket is bound to.
+fn connect_socket(
+    clock_bound_d_socket: PathBuf,
+    address: ClientAddress,
+) -> Result<UnixDatagram, ClockBoundCError> {
+    let sock = match address {
+        ClientAddress::File => bind_socket_file()?,
+        ClientAddress::Autobind => match bind_autobind_socket() {
+            Ok(sock) => sock,
+            Err(e) => return Err(ClockBoundCError::BindError(e)),
+        },
+    };
+
+    match sock.connect(clock_bound_d_socket.as_path()) {
+        Err(e) => {
+            // Do not leave the socket file of a client that was never returned behind
+            if let Some(path) = sock
+                .local_addr()
+                .ok()
+                .as_ref()
+                .and_then(|a| a.as_pathname())
+            {
+                let _ = fs::remove_file(path);
+            }
+            return Err(ClockBoundCError::ConnectError(e));
+        }
+        _ => {}
+    }
+
+    Ok(sock)
+}
+
+/// Create a client socket bound to a unique socket file that ClockBoundD can write to.
+fn bind_socket_file() -> Result<UnixDatagram, ClockBoundCError> {
+    let client_path = get_socket_path();
+
+    // Binding will fail if the socket file already exists. However, since the socket file is
+    // uniquely created based on the current time this should not fail.
+    let sock = match UnixDatagram::bind(client_path.as_path()) {
+        Ok(sock) => sock,
+        Err(e) => return Err(ClockBoundCError::BindError(e)),
+    };
+
+    let mode = 0o666;
+    let permissions = fs::Permissions::from_mode(mode);
+    match fs::set_permissions(&client_path, permissions) {
+        Err(e) => {
+            let _ = fs::remove_file(&client_path);
+            return Err(ClockBoundCError::SetPermissionsError(e));
+        }
+        _ => {}
+    }
+    Ok(sock)
+}
+
+/// Create a client socket bound to a unique address in the abstract namespace, picked by the
+/// kernel.
+fn bind_autobind_socket() -> Result<UnixDatagram, io::Error> {
+    let fd = unsafe { libc::socket(libc::AF_UNIX, libc::SOCK_DGRAM | libc::SOCK_CLOEXEC, 0) };
+    if fd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    // The socket is closed when dropped, if binding fails
+    let sock = unsafe { UnixDatagram::from_raw_fd(fd) };
+
+    // Binding to an address of only the address family makes the kernel pick a unique abstract
+    // name for the socket
+    let mut addr: libc::sockaddr_un = unsafe { std::mem::zeroed() };
+    addr.sun_family = libc::AF_UNIX as libc::sa_family_t;
+    let result = unsafe {
+        libc::bind(
+            fd,
+            &addr as *const libc::sockaddr_un as *const libc::sockaddr,
+            std::mem::size_of::<libc::sa_family_t>() as libc::socklen_t,
+        )
+    };
+    if result < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(sock)
+}
+
+/// Get the path of a ClockBoundD shard socket.
+///
+/// Shard 0 is the clockboundd.sock socket itself, every other shard n is the clockboundd-<n>.sock
+/// socket next to it.
+/// Ex: /run/clockboundd/clockboundd-3.sock
+fn get_shard_socket_path(clock_bound_d_socket: PathBuf, shard: usize) -> PathBuf {
+    if shard == 0 {
+        return clock_bound_d_socket;
+    }
+    let stem = match clock_bound_d_socket.file_stem() {
+        Some(stem) => stem.to_string_lossy().into_owned(),
+        None => return clock_bound_d_socket,
+    };
+    clock_bound_d_socket.with_file_name(format!("{}-{}.sock", stem, shard))
+}
+
 /// Create a unique client socket file in the system's temp directory
 ///
 /// The socket name will have clockboundc as a prefix, followed by a random string of 20
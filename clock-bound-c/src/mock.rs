@@ -0,0 +1,114 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+//! A mock ClockBoundD socket that the tests of the clients send their requests to, and answer
+//! from by hand.
+use crate::protocol;
+use byteorder::{ByteOrder, NetworkEndian};
+use std::os::unix::net::{SocketAddr, UnixDatagram};
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+/// Distinguishes the sockets of the tests running in the same process.
+static NEXT_MOCK: AtomicUsize = AtomicUsize::new(0);
+
+/// A socket bound in the temp directory in place of ClockBoundD's, removed when dropped.
+pub struct MockClockBoundD {
+    pub socket: UnixDatagram,
+    pub path: PathBuf,
+}
+
+impl MockClockBoundD {
+    pub fn new() -> MockClockBoundD {
+        let path = std::env::temp_dir().join(format!(
+            "clockboundd-mock-{}-{}.sock",
+            std::process::id(),
+            NEXT_MOCK.fetch_add(1, Ordering::Relaxed)
+        ));
+        let _ = std::fs::remove_file(&path);
+        MockClockBoundD::at(path)
+    }
+
+    /// Bind the mock at a path, such as the one of a mock that was dropped.
+    pub fn at(path: PathBuf) -> MockClockBoundD {
+        let socket = UnixDatagram::bind(&path).unwrap();
+        // A test waiting on a request that never comes fails rather than hangs
+        socket
+            .set_read_timeout(Some(Duration::from_secs(10)))
+            .unwrap();
+        MockClockBoundD { socket, path }
+    }
+
+    /// Receive a request, and the address of the client to respond to.
+    pub fn recv(&self) -> (Vec<u8>, SocketAddr) {
+        let mut request = [0; 1024];
+        let (size, addr) = self.socket.recv_from(&mut request).unwrap();
+        (request[..size].to_vec(), addr)
+    }
+
+    /// Send a response to a client, bound to a socket file or an Autobind address.
+    pub fn send(&self, response: &[u8], addr: &SocketAddr) {
+        self.socket.send_to_addr(response, addr).unwrap();
+    }
+}
+
+impl Drop for MockClockBoundD {
+    fn drop(&mut self) {
+        let _ = std::fs::remove_file(&self.path);
+    }
+}
+
+/// Build the response ClockBoundD would send to a version 2 compare request: the header echoing
+/// the request id, then bounds of [time, time] so that a test can tell which request a response
+/// answers, and neither flag set.
+///
+/// # Arguments
+///
+/// * `request` - The compare request.
+pub fn compare_response(request: &[u8]) -> Vec<u8> {
+    let time = NetworkEndian::read_u64(&request[protocol::HEADER_SIZE_V2..]);
+    let mut response = vec![0; protocol::HEADER_SIZE_V2 + protocol::COMPARE_BODY_SIZE];
+    response[0] = protocol::REQUEST_VERSION_2;
+    response[1] = protocol::REQUEST_TYPE_COMPARE;
+    response[4..8].copy_from_slice(&request[4..8]);
+    NetworkEndian::write_u64(&mut response[8..16], time);
+    NetworkEndian::write_u64(&mut response[16..24], time);
+    response
+}
+
+/// Build the response ClockBoundD would send to a version 1 subscribe request: a model with a
+/// Clock Error Bound of 1us and no growth, updated a second ago.
+///
+/// # Arguments
+///
+/// * `lease_secs` - The lease of the subscription.
+pub fn update_response(lease_secs: u32) -> Vec<u8> {
+    let ref_time = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .unwrap()
+        .as_nanos() as u64
+        - 1_000_000_000;
+    let mut response = vec![0; protocol::UPDATE_RESPONSE_SIZE];
+    response[0] = protocol::REQUEST_VERSION;
+    response[1] = protocol::REQUEST_TYPE_SUBSCRIBE;
+    NetworkEndian::write_u64(&mut response[4..12], ref_time);
+    NetworkEndian::write_u64(&mut response[12..20], 1_000);
+    NetworkEndian::write_u32(&mut response[28..32], lease_secs);
+    response
+}
+
+/// Build the response ClockBoundD would send to a version 1 compare request, with bounds of
+/// [time, time] and neither flag set.
+///
+/// # Arguments
+///
+/// * `request` - The compare request.
+pub fn compare_response_v1(request: &[u8]) -> Vec<u8> {
+    let time = NetworkEndian::read_u64(&request[protocol::HEADER_SIZE..]);
+    let mut response = vec![0; protocol::COMPARE_RESPONSE_SIZE];
+    response[0] = protocol::REQUEST_VERSION;
+    response[1] = protocol::REQUEST_TYPE_COMPARE;
+    NetworkEndian::write_u64(&mut response[4..12], time);
+    NetworkEndian::write_u64(&mut response[12..20], time);
+    response
+}
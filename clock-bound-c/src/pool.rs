@@ -0,0 +1,215 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+//! A lazily created ClockBoundClient per thread, so that getting the bounds never pays for setting
+//! up a socket after the first request of a thread.
+//!
+//! Each thread's client is bound to an Autobind address, so no socket file is created, and is
+//! created on the first request the thread makes. A request that is not answered within
+//! RECEIVE_TIMEOUT fails with ReceiveMessageError. A client whose request fails to be sent or
+//! received is dropped, and the thread's next request creates a new one, for example after
+//! ClockBoundD was restarted, so that a late response is never taken for the next request.
+//!
+//! ```
+//! let response = match clock_bound_c::pool::now() {
+//!     Ok(response) => response,
+//!     Err(e) => {
+//!         println!("Couldn't complete now request: {}", e);
+//!         return
+//!     }
+//! };
+//! ```
+use crate::error::ClockBoundCError;
+use crate::{
+    ClientAddress, ClockBoundClient, ResponseAfter, ResponseBefore, ResponseCompare, ResponseNow,
+    CLOCKBOUNDD_SOCKET_ADDRESS_PATH, RECEIVE_TIMEOUT,
+};
+use std::cell::RefCell;
+use std::path::{Path, PathBuf};
+
+thread_local! {
+    /// The client of the thread, and the path of the ClockBoundD socket it is connected to.
+    static CLIENT: RefCell<Option<(PathBuf, ClockBoundClient)>> = RefCell::new(None);
+}
+
+/// Run a function with the calling thread's client, connected to the default clockboundd.sock
+/// path at "/run/clockboundd/clockboundd.sock".
+///
+/// # Arguments
+///
+/// * `f` - The function, sending requests with the client.
+pub fn with_client<A, F>(f: F) -> Result<A, ClockBoundCError>
+where
+    F: FnOnce(&ClockBoundClient) -> Result<A, ClockBoundCError>,
+{
+    with_client_at(Path::new(CLOCKBOUNDD_SOCKET_ADDRESS_PATH), f)
+}
+
+/// Run a function with the calling thread's client, connected to a defined clockboundd.sock
+/// path.
+///
+/// The thread keeps one client. It is replaced if a different path is given than the one it is
+/// connected to.
+///
+/// # Arguments
+///
+/// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+/// * `f` - The function, sending requests with the client.
+pub fn with_client_at<A, F>(clock_bound_d_socket: &Path, f: F) -> Result<A, ClockBoundCError>
+where
+    F: FnOnce(&ClockBoundClient) -> Result<A, ClockBoundCError>,
+{
+    // The client is taken out of the thread local while it is in use, so that a function calling
+    // back into the pool gets a client of its own rather than a borrow error
+    let cached = CLIENT.with(|client| client.borrow_mut().take());
+    let (path, client) = match cached {
+        Some((path, client)) if path == clock_bound_d_socket => (path, client),
+        _ => {
+            let path = clock_bound_d_socket.to_path_buf();
+            let client = ClockBoundClient::new_with_address(path.clone(), ClientAddress::Autobind)?;
+            // A thread must not block forever on a ClockBoundD that never answers
+            if let Err(e) = client.set_receive_timeout(Some(RECEIVE_TIMEOUT)) {
+                return Err(ClockBoundCError::ConnectError(e));
+            }
+            (path, client)
+        }
+    };
+
+    let result = f(&client);
+    match result {
+        // A client that failed to send or receive may be connected to a ClockBoundD that is gone
+        Err(ClockBoundCError::SendMessageError(_))
+        | Err(ClockBoundCError::ReceiveMessageError(_)) => {}
+        _ => CLIENT.with(|cached| *cached.borrow_mut() = Some((path, client))),
+    }
+    result
+}
+
+/// Returns the bounds of the current system time +/- the error calculated from chrony, using the
+/// calling thread's client. See ClockBoundClient::now.
+pub fn now() -> Result<ResponseNow, ClockBoundCError> {
+    with_client(|client| client.now())
+}
+
+/// Returns true if the provided timestamp is before the earliest error bound, using the calling
+/// thread's client. See ClockBoundClient::before.
+///
+/// # Arguments
+///
+/// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+/// tested against the earliest error bound.
+pub fn before(before_time: u64) -> Result<ResponseBefore, ClockBoundCError> {
+    with_client(|client| client.before(before_time))
+}
+
+/// Returns true if the provided timestamp is after the latest error bound, using the calling
+/// thread's client. See ClockBoundClient::after.
+///
+/// # Arguments
+///
+/// * `after_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is tested
+/// against the latest error bound.
+pub fn after(after_time: u64) -> Result<ResponseAfter, ClockBoundCError> {
+    with_client(|client| client.after(after_time))
+}
+
+/// Tests the provided timestamp against both error bounds, using the calling thread's client. See
+/// ClockBoundClient::compare.
+///
+/// # Arguments
+///
+/// * `time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is tested
+/// against the error bounds.
+pub fn compare(time: u64) -> Result<ResponseCompare, ClockBoundCError> {
+    with_client(|client| client.compare(time))
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::error::ClockBoundCError;
+    use crate::mock::{compare_response_v1, MockClockBoundD};
+    use crate::pool::with_client_at;
+    use crate::RECEIVE_TIMEOUT;
+    use std::os::linux::net::SocketAddrExt;
+    use std::os::unix::net::SocketAddr;
+    use std::path::Path;
+    use std::time::Instant;
+
+    /// Send a compare request with the calling thread's client, answering it from the mock unless
+    /// `answer` is false, and return the result and the address the request came from.
+    fn compare(
+        mock: &MockClockBoundD,
+        path: &Path,
+        time: u64,
+        answer: bool,
+    ) -> (Result<u64, ClockBoundCError>, Vec<u8>) {
+        std::thread::scope(|s| {
+            let responder = s.spawn(|| {
+                let (request, addr) = mock.recv();
+                if answer {
+                    mock.send(&compare_response_v1(&request), &addr);
+                }
+                abstract_name(&addr)
+            });
+            let result = with_client_at(path, |client| client.compare(time));
+            (
+                result.map(|response| response.bound.earliest),
+                responder.join().unwrap(),
+            )
+        })
+    }
+
+    fn abstract_name(addr: &SocketAddr) -> Vec<u8> {
+        addr.as_abstract_name().unwrap().to_vec()
+    }
+
+    #[test]
+    fn test_reuses_client() {
+        let mock = MockClockBoundD::new();
+        let (first, first_addr) = compare(&mock, &mock.path, 1, true);
+        let (second, second_addr) = compare(&mock, &mock.path, 2, true);
+        assert_eq!(1, first.unwrap());
+        assert_eq!(2, second.unwrap());
+        assert_eq!(first_addr, second_addr);
+    }
+
+    #[test]
+    fn test_recreates_client_after_receive_error() {
+        let mock = MockClockBoundD::new();
+        let (_, first_addr) = compare(&mock, &mock.path, 1, true);
+
+        let start = Instant::now();
+        let (timed_out, timed_out_addr) = compare(&mock, &mock.path, 2, false);
+        match timed_out {
+            Err(ClockBoundCError::ReceiveMessageError(_)) => {}
+            result => panic!("Unexpected result: {:?}", result.map_err(|e| e.to_string())),
+        }
+        assert!(start.elapsed() >= RECEIVE_TIMEOUT);
+        assert_eq!(first_addr, timed_out_addr);
+
+        let (third, third_addr) = compare(&mock, &mock.path, 3, true);
+        assert_eq!(3, third.unwrap());
+        assert_ne!(timed_out_addr, third_addr);
+    }
+
+    #[test]
+    fn test_recreates_client_after_send_error() {
+        let mock = MockClockBoundD::new();
+        let path = mock.path.clone();
+        let (_, first_addr) = compare(&mock, &path, 1, true);
+
+        // ClockBoundD goes away, then comes back at the same path
+        drop(mock);
+        match with_client_at(&path, |client| client.compare(2)) {
+            Err(ClockBoundCError::SendMessageError(_)) => {}
+            result => panic!(
+                "Unexpected result: {:?}",
+                result.map(|_| ()).map_err(|e| e.to_string())
+            ),
+        }
+        let mock = MockClockBoundD::at(path);
+
+        let (third, third_addr) = compare(&mock, &mock.path, 3, true);
+        assert_eq!(3, third.unwrap());
+        assert_ne!(first_addr, third_addr);
+    }
+}
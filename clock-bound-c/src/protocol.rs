@@ -0,0 +1,376 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+//! Encoding of requests to, and decoding of responses from, ClockBoundD. See PROTOCOL.md for a
+//! description of the wire format.
+//!
+//! Requests and responses are encoded into and decoded from fixed-size arrays on the stack, so
+//! that no allocation is needed per request.
+use crate::{Bound, ResponseHeader};
+use byteorder::{ByteOrder, NetworkEndian};
+
+/// The protocol version of requests sent to ClockBoundD.
+pub const REQUEST_VERSION: u8 = 1;
+
+/// The protocol version of requests carrying a request id.
+pub const REQUEST_VERSION_2: u8 = 2;
+
+/// The request type of a now request.
+pub const REQUEST_TYPE_NOW: u8 = 1;
+
+/// The request type of a before request.
+pub const REQUEST_TYPE_BEFORE: u8 = 2;
+
+/// The request type of an after request.
+pub const REQUEST_TYPE_AFTER: u8 = 3;
+
+/// The request type of a batch request.
+pub const REQUEST_TYPE_BATCH: u8 = 4;
+
+/// The request type of a subscribe request.
+pub const REQUEST_TYPE_SUBSCRIBE: u8 = 5;
+
+/// The response type of an update pushed to a subscriber.
+pub const RESPONSE_TYPE_UPDATE: u8 = 6;
+
+/// The request type of a stats request.
+pub const REQUEST_TYPE_STATS: u8 = 7;
+
+/// The request type of a compare request.
+pub const REQUEST_TYPE_COMPARE: u8 = 8;
+
+/// A flag of a now request, asking ClockBoundD to append the time the request was queued on its
+/// socket to the response.
+pub const REQUEST_FLAG_QUEUE_DELAY: u8 = 1;
+
+/// The maximum number of timestamps a batch request can carry.
+pub const MAX_BATCH_TIMESTAMPS: usize = 64;
+
+/// The size of the header of a version 1 request or response.
+pub const HEADER_SIZE: usize = 4;
+
+/// The size of the header of a version 2 request or response, which ends with the request id.
+pub const HEADER_SIZE_V2: usize = 8;
+
+/// The size of the body of a batch request before its timestamps: the count and 2 reserved bytes.
+const BATCH_COUNT_SIZE: usize = 4;
+
+/// The size of the body of a batch request carrying the maximum number of timestamps.
+pub const BATCH_BODY_SIZE: usize = BATCH_COUNT_SIZE + 8 * MAX_BATCH_TIMESTAMPS;
+
+/// The size of the buffer a batch request is encoded into.
+pub const BATCH_REQUEST_BUFFER_SIZE: usize = HEADER_SIZE + BATCH_BODY_SIZE;
+
+/// The size of the body of a response to a now request.
+pub const NOW_BODY_SIZE: usize = 16;
+
+/// The size of the body of a response to a before or after request.
+pub const BEFORE_AFTER_BODY_SIZE: usize = 1;
+
+/// The size of the body of a response to a batch request.
+pub const BATCH_BODY_RESPONSE_SIZE: usize = 36;
+
+/// The size of the body of a response to a subscribe request, or of an update.
+pub const UPDATE_BODY_SIZE: usize = 28;
+
+/// The size of the body of a response to a stats request: 25 values of 8 bytes.
+pub const STATS_BODY_SIZE: usize = 200;
+
+/// The size of the body of a response to a compare request: the bounds, then the before and
+/// after flags.
+pub const COMPARE_BODY_SIZE: usize = 18;
+
+/// The size of a response to a now request.
+pub const NOW_RESPONSE_SIZE: usize = HEADER_SIZE + NOW_BODY_SIZE;
+
+/// The size of a response to a now request asking for the queue delay.
+pub const NOW_QUEUE_DELAY_RESPONSE_SIZE: usize = NOW_RESPONSE_SIZE + 8;
+
+/// The size of a response to a before or after request.
+pub const BEFORE_AFTER_RESPONSE_SIZE: usize = HEADER_SIZE + BEFORE_AFTER_BODY_SIZE;
+
+/// The size of a response to a batch request.
+pub const BATCH_RESPONSE_SIZE: usize = HEADER_SIZE + BATCH_BODY_RESPONSE_SIZE;
+
+/// The size of a response to a subscribe request, or of an update.
+pub const UPDATE_RESPONSE_SIZE: usize = HEADER_SIZE + UPDATE_BODY_SIZE;
+
+/// The size of a response to a stats request.
+pub const STATS_RESPONSE_SIZE: usize = HEADER_SIZE + STATS_BODY_SIZE;
+
+/// The size of a response to a compare request.
+pub const COMPARE_RESPONSE_SIZE: usize = HEADER_SIZE + COMPARE_BODY_SIZE;
+
+/// The size of the largest version 2 request, a batch request.
+pub const REQUEST_BUFFER_SIZE_V2: usize = HEADER_SIZE_V2 + BATCH_BODY_SIZE;
+
+/// The size of the largest version 2 response, a batch response.
+pub const RESPONSE_BUFFER_SIZE_V2: usize = HEADER_SIZE_V2 + BATCH_BODY_RESPONSE_SIZE;
+
+/// A version 2 response received from ClockBoundD.
+#[derive(Clone, Copy)]
+pub struct ResponseV2 {
+    pub buffer: [u8; RESPONSE_BUFFER_SIZE_V2],
+}
+
+impl ResponseV2 {
+    /// Decode the header of the response.
+    pub fn header(&self) -> ResponseHeader {
+        decode_header(&self.buffer)
+    }
+
+    /// The body of the response, following its header.
+    pub fn body(&self) -> &[u8] {
+        &self.buffer[HEADER_SIZE_V2..]
+    }
+
+    /// Decode the request id of the response, if a whole version 2 header was received.
+    ///
+    /// # Arguments
+    ///
+    /// * `size` - The amount of bytes received.
+    pub fn request_id(&self, size: usize) -> Option<u32> {
+        if size >= HEADER_SIZE_V2 && self.buffer[0] == REQUEST_VERSION_2 {
+            Some(decode_request_id(&self.buffer))
+        } else {
+            None
+        }
+    }
+}
+
+/// Encode a now request.
+pub fn now_request() -> [u8; 4] {
+    // Header
+    // 1st - Version
+    // 2nd - Command Type
+    // 3rd, 4th - Reserved
+    [REQUEST_VERSION, REQUEST_TYPE_NOW, 0, 0]
+}
+
+/// Encode a now request asking for the time the request was queued on ClockBoundD's socket.
+pub fn now_queue_delay_request() -> [u8; 4] {
+    [
+        REQUEST_VERSION,
+        REQUEST_TYPE_NOW,
+        REQUEST_FLAG_QUEUE_DELAY,
+        0,
+    ]
+}
+
+/// Encode a subscribe request.
+pub fn subscribe_request() -> [u8; 4] {
+    [REQUEST_VERSION, REQUEST_TYPE_SUBSCRIBE, 0, 0]
+}
+
+/// Encode a stats request.
+pub fn stats_request() -> [u8; 4] {
+    [REQUEST_VERSION, REQUEST_TYPE_STATS, 0, 0]
+}
+
+/// Encode a before, after or compare request.
+///
+/// # Arguments
+///
+/// * `request_type` - The request type: Before (2), After (3) or Compare (8).
+/// * `time` - A timestamp, represented as nanoseconds since the Unix Epoch, to be tested against
+/// the error bounds.
+pub fn before_after_request(request_type: u8, time: u64) -> [u8; 12] {
+    let mut request: [u8; 12] = [0; 12];
+    // Header
+    request[0] = REQUEST_VERSION;
+    request[1] = request_type;
+    // Body
+    encode_before_after_body(time, &mut request[HEADER_SIZE..]);
+    request
+}
+
+/// Encode a batch request into a buffer. Returns the size of the request in bytes.
+///
+/// # Arguments
+///
+/// * `times` - The timestamps, represented as nanoseconds since the Unix Epoch, to be tested
+/// against the error bounds. Must hold between 1 and MAX_BATCH_TIMESTAMPS timestamps.
+/// * `request` - The buffer the request is encoded into.
+pub fn batch_request(times: &[u64], request: &mut [u8; BATCH_REQUEST_BUFFER_SIZE]) -> usize {
+    // Header
+    request[0] = REQUEST_VERSION;
+    request[1] = REQUEST_TYPE_BATCH;
+    request[2] = 0;
+    request[3] = 0;
+    // Body
+    HEADER_SIZE + encode_batch_body(times, &mut request[HEADER_SIZE..])
+}
+
+/// Encode a version 2 request header. Returns the size of the header in bytes.
+///
+/// # Arguments
+///
+/// * `request_type` - The request type: Now (1), Before (2), After (3), Batch (4) or Compare
+/// (8).
+/// * `request_id` - The request id that ClockBoundD echoes back in its response.
+/// * `request` - The buffer the header is encoded into.
+pub fn encode_header_v2(request_type: u8, request_id: u32, request: &mut [u8]) -> usize {
+    request[0] = REQUEST_VERSION_2;
+    request[1] = request_type;
+    request[2] = 0;
+    request[3] = 0;
+    NetworkEndian::write_u32(&mut request[4..8], request_id);
+    HEADER_SIZE_V2
+}
+
+/// Encode a version 2 request. Returns the size of the request in bytes.
+///
+/// # Arguments
+///
+/// * `request_type` - The request type: Now (1), Before (2), After (3), Batch (4) or Compare
+/// (8).
+/// * `request_id` - The request id that ClockBoundD echoes back in its response.
+/// * `body` - The encoded body of the request.
+/// * `request` - The buffer the request is encoded into.
+pub fn encode_request_v2(
+    request_type: u8,
+    request_id: u32,
+    body: &[u8],
+    request: &mut [u8; REQUEST_BUFFER_SIZE_V2],
+) -> usize {
+    let header_size = encode_header_v2(request_type, request_id, request);
+    request[header_size..header_size + body.len()].copy_from_slice(body);
+    header_size + body.len()
+}
+
+/// Encode the body of a before or after request. Returns the size of the body in bytes.
+///
+/// # Arguments
+///
+/// * `time` - A timestamp, represented as nanoseconds since the Unix Epoch, to be tested against
+/// the error bounds.
+/// * `body` - The buffer the body is encoded into.
+pub fn encode_before_after_body(time: u64, body: &mut [u8]) -> usize {
+    NetworkEndian::write_u64(&mut body[0..8], time);
+    8
+}
+
+/// Encode the body of a batch request. Returns the size of the body in bytes.
+///
+/// # Arguments
+///
+/// * `times` - The timestamps, represented as nanoseconds since the Unix Epoch, to be tested
+/// against the error bounds. Must hold between 1 and MAX_BATCH_TIMESTAMPS timestamps.
+/// * `body` - The buffer the body is encoded into.
+pub fn encode_batch_body(times: &[u64], body: &mut [u8]) -> usize {
+    // Count, followed by 2 reserved bytes
+    NetworkEndian::write_u16(&mut body[0..2], times.len() as u16);
+    body[2] = 0;
+    body[3] = 0;
+    for (i, time) in times.iter().enumerate() {
+        let offset = BATCH_COUNT_SIZE + 8 * i;
+        NetworkEndian::write_u64(&mut body[offset..offset + 8], *time);
+    }
+    BATCH_COUNT_SIZE + 8 * times.len()
+}
+
+/// Decode the header of a response.
+///
+/// # Arguments
+///
+/// * `response` - The response received from ClockBoundD. Must be at least 4 bytes long.
+pub fn decode_header(response: &[u8]) -> ResponseHeader {
+    ResponseHeader {
+        response_version: response[0],
+        response_type: response[1],
+        unsynchronized_flag: response[2] != 0,
+    }
+}
+
+/// Decode the request id of a version 2 response.
+///
+/// # Arguments
+///
+/// * `response` - The response received from ClockBoundD. Must be at least 8 bytes long.
+pub fn decode_request_id(response: &[u8]) -> u32 {
+    NetworkEndian::read_u32(&response[4..8])
+}
+
+/// Decode the bounds of the body of a response to a now request.
+///
+/// # Arguments
+///
+/// * `body` - The body of the response received from ClockBoundD, following its header.
+pub fn decode_bound(body: &[u8]) -> Bound {
+    Bound {
+        earliest: NetworkEndian::read_u64(&body[0..8]),
+        latest: NetworkEndian::read_u64(&body[8..16]),
+    }
+}
+
+/// Decode the queue delay in nanoseconds following the bounds of a response to a now request.
+///
+/// # Arguments
+///
+/// * `field` - The 8 bytes of the response following its bounds.
+pub fn decode_queue_delay(field: &[u8]) -> u64 {
+    NetworkEndian::read_u64(&field[0..8])
+}
+
+/// Decode the metrics of the body of a response to a stats request.
+///
+/// # Arguments
+///
+/// * `body` - The body of the response received from ClockBoundD, following its header. Must be
+/// STATS_BODY_SIZE bytes long.
+pub fn decode_stats(body: &[u8]) -> [u64; STATS_BODY_SIZE / 8] {
+    let mut values = [0; STATS_BODY_SIZE / 8];
+    for (value, field) in values.iter_mut().zip(body.chunks_exact(8)) {
+        *value = NetworkEndian::read_u64(field);
+    }
+    values
+}
+
+/// Decode the flag of the body of a response to a before or after request.
+///
+/// # Arguments
+///
+/// * `body` - The body of the response received from ClockBoundD, following its header.
+pub fn decode_flag(body: &[u8]) -> bool {
+    body[0] != 0
+}
+
+/// Decode the bounds and the before and after flags of the body of a response to a compare
+/// request.
+///
+/// # Arguments
+///
+/// * `body` - The body of the response received from ClockBoundD, following its header.
+pub fn decode_compare(body: &[u8]) -> (Bound, bool, bool) {
+    (decode_bound(body), body[16] != 0, body[17] != 0)
+}
+
+/// Decode the bounds and the before and after bitmaps of the body of a response to a batch
+/// request.
+///
+/// # Arguments
+///
+/// * `body` - The body of the response received from ClockBoundD, following its header.
+pub fn decode_batch(body: &[u8]) -> (Bound, u64, u64) {
+    (
+        decode_bound(body),
+        NetworkEndian::read_u64(&body[20..28]),
+        NetworkEndian::read_u64(&body[28..36]),
+    )
+}
+
+/// Decode the body of a response to a subscribe request, or of an update. Returns the reference
+/// time in nanoseconds since the Unix epoch, the Clock Error Bound at the reference time in
+/// nanoseconds, its growth rate in nanoseconds per second and the lease of the subscription in
+/// seconds.
+///
+/// # Arguments
+///
+/// * `body` - The body of the response received from ClockBoundD, following its header.
+pub fn decode_update(body: &[u8]) -> (u64, u64, f64, u32) {
+    (
+        NetworkEndian::read_u64(&body[0..8]),
+        NetworkEndian::read_u64(&body[8..16]),
+        f64::from_bits(NetworkEndian::read_u64(&body[16..24])),
+        NetworkEndian::read_u32(&body[24..28]),
+    )
+}
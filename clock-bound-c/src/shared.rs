@@ -0,0 +1,410 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use crate::error::ClockBoundCError;
+use crate::protocol::{self, ResponseV2};
+use crate::{
+    ClockBoundClient, ResponseAfter, ResponseAfterMany, ResponseBefore, ResponseBeforeMany,
+    ResponseCompare, ResponseNow, CLOCKBOUNDD_SOCKET_ADDRESS_PATH, RECEIVE_TIMEOUT,
+};
+use std::collections::HashMap;
+use std::io;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::{Condvar, Mutex, MutexGuard, PoisonError};
+use std::time::Instant;
+
+/// The requests waiting on a response.
+struct Pending {
+    /// Set while one of the callers is blocked receiving from the socket.
+    receiving: bool,
+    /// The response to each request id in flight, once it has been received.
+    responses: HashMap<u32, Option<ResponseV2>>,
+}
+
+/// A client to communicate with ClockBoundD that can be shared across threads.
+///
+/// Requests are sent with version 2 of the protocol, which carries a request id that ClockBoundD
+/// echoes back. Concurrent callers share a single socket: whichever caller is waiting takes a turn
+/// receiving from the socket and hands each response to the caller with the matching request id.
+///
+/// A request fails with ReceiveMessageError if its response is not received within
+/// RECEIVE_TIMEOUT, or if the caller receiving gets a response without a request id, such as the
+/// version 1 error response of a ClockBoundD that does not support version 2. Since such a
+/// response can not be matched to a request, it fails the request of the caller that received it.
+pub struct ClockBoundSharedClient {
+    client: ClockBoundClient,
+    next_request_id: AtomicU32,
+    pending: Mutex<Pending>,
+    response_received: Condvar,
+}
+
+impl ClockBoundSharedClient {
+    /// Create a new ClockBoundSharedClient using the default clockboundd.sock path at
+    /// "/run/clockboundd/clockboundd.sock".
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundSharedClient;
+    /// let client = match ClockBoundSharedClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new() -> Result<ClockBoundSharedClient, ClockBoundCError> {
+        ClockBoundSharedClient::new_with_path(PathBuf::from(CLOCKBOUNDD_SOCKET_ADDRESS_PATH))
+    }
+
+    /// Create a new ClockBoundSharedClient using a defined clockboundd.sock path.
+    ///
+    /// # Arguments
+    ///
+    /// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundSharedClient;
+    /// let client = match ClockBoundSharedClient::new_with_path(std::path::PathBuf::from("/run/clockboundd/clockboundd.sock")){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new_with_path(
+        clock_bound_d_socket: PathBuf,
+    ) -> Result<ClockBoundSharedClient, ClockBoundCError> {
+        let client = ClockBoundClient::new_with_path(clock_bound_d_socket)?;
+        // Bounds how long a caller taking its turn receiving can block on the socket
+        if let Err(e) = client.socket.set_read_timeout(Some(RECEIVE_TIMEOUT)) {
+            return Err(ClockBoundCError::ConnectError(e));
+        }
+        Ok(ClockBoundSharedClient {
+            client,
+            next_request_id: AtomicU32::new(0),
+            pending: Mutex::new(Pending {
+                receiving: false,
+                responses: HashMap::new(),
+            }),
+            response_received: Condvar::new(),
+        })
+    }
+
+    /// Returns the bounds of the current system time +/- the error calculated from chrony.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundSharedClient;
+    /// let client = match ClockBoundSharedClient::new(){
+    ///     Ok(client) => client,
+    ///     Err(e) => {
+    ///         println!("Couldn't create client: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let response = match client.now(){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete now request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn now(&self) -> Result<ResponseNow, ClockBoundCError> {
+        let response = self.request(protocol::REQUEST_TYPE_NOW, &[])?;
+        let bound = protocol::decode_bound(response.body());
+        // Since the bounds are the system time +/- the Clock Error Bound, the system time
+        // timestamp can be calculated with the below formula.
+        let timestamp = bound.latest - ((bound.latest - bound.earliest) / 2);
+        Ok(ResponseNow {
+            header: response.header(),
+            bound,
+            timestamp,
+        })
+    }
+
+    /// Returns true if the provided timestamp is before the earliest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the earliest error bound.
+    pub fn before(&self, before_time: u64) -> Result<ResponseBefore, ClockBoundCError> {
+        let mut body: [u8; 8] = [0; 8];
+        protocol::encode_before_after_body(before_time, &mut body);
+        let response = self.request(protocol::REQUEST_TYPE_BEFORE, &body)?;
+        Ok(ResponseBefore {
+            header: response.header(),
+            before: protocol::decode_flag(response.body()),
+        })
+    }
+
+    /// Returns true if the provided timestamp is after the latest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the latest error bound.
+    pub fn after(&self, after_time: u64) -> Result<ResponseAfter, ClockBoundCError> {
+        let mut body: [u8; 8] = [0; 8];
+        protocol::encode_before_after_body(after_time, &mut body);
+        let response = self.request(protocol::REQUEST_TYPE_AFTER, &body)?;
+        Ok(ResponseAfter {
+            header: response.header(),
+            after: protocol::decode_flag(response.body()),
+        })
+    }
+
+    /// Tests the provided timestamp against both error bounds. See ClockBoundClient::compare.
+    ///
+    /// # Arguments
+    ///
+    /// * `time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is tested
+    /// against the error bounds.
+    pub fn compare(&self, time: u64) -> Result<ResponseCompare, ClockBoundCError> {
+        let mut body: [u8; 8] = [0; 8];
+        protocol::encode_before_after_body(time, &mut body);
+        let response = self.request(protocol::REQUEST_TYPE_COMPARE, &body)?;
+        let (bound, before, after) = protocol::decode_compare(response.body());
+        Ok(ResponseCompare {
+            header: response.header(),
+            bound,
+            before,
+            after,
+        })
+    }
+
+    /// Tests each of the provided timestamps against the earliest error bound. See
+    /// ClockBoundClient::before_many.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_times` - Between 1 and 64 timestamps, represented as nanoseconds since the Unix
+    /// Epoch, that are tested against the earliest error bound.
+    pub fn before_many(
+        &self,
+        before_times: &[u64],
+    ) -> Result<ResponseBeforeMany, ClockBoundCError> {
+        let response = self.batch(before_times)?;
+        let (bound, before, _) = protocol::decode_batch(response.body());
+        Ok(ResponseBeforeMany {
+            header: response.header(),
+            bound,
+            before,
+        })
+    }
+
+    /// Tests each of the provided timestamps against the latest error bound. See
+    /// ClockBoundClient::after_many.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_times` - Between 1 and 64 timestamps, represented as nanoseconds since the Unix
+    /// Epoch, that are tested against the latest error bound.
+    pub fn after_many(&self, after_times: &[u64]) -> Result<ResponseAfterMany, ClockBoundCError> {
+        let response = self.batch(after_times)?;
+        let (bound, _, after) = protocol::decode_batch(response.body());
+        Ok(ResponseAfterMany {
+            header: response.header(),
+            bound,
+            after,
+        })
+    }
+
+    /// Send a batch request and wait for its response.
+    fn batch(&self, times: &[u64]) -> Result<ResponseV2, ClockBoundCError> {
+        if times.is_empty() || times.len() > protocol::MAX_BATCH_TIMESTAMPS {
+            return Err(ClockBoundCError::InvalidTimestampCount(times.len()));
+        }
+        let mut body: [u8; protocol::BATCH_BODY_SIZE] = [0; protocol::BATCH_BODY_SIZE];
+        let body_size = protocol::encode_batch_body(times, &mut body);
+        self.request(protocol::REQUEST_TYPE_BATCH, &body[..body_size])
+    }
+
+    /// Send a request with a new request id and wait for the response with the same id.
+    ///
+    /// # Arguments
+    ///
+    /// * `request_type` - The request type: Now (1), Before (2), After (3), Batch (4) or
+    /// Compare (8).
+    /// * `body` - The encoded body of the request.
+    fn request(&self, request_type: u8, body: &[u8]) -> Result<ResponseV2, ClockBoundCError> {
+        let request_id = self.next_request_id.fetch_add(1, Ordering::Relaxed);
+        let mut request: [u8; protocol::REQUEST_BUFFER_SIZE_V2] =
+            [0; protocol::REQUEST_BUFFER_SIZE_V2];
+        let request_size =
+            protocol::encode_request_v2(request_type, request_id, body, &mut request);
+
+        // Register the request before sending it, so that whoever receives the response knows it
+        // is still wanted
+        self.lock().responses.insert(request_id, None);
+        if let Err(e) = self.client.socket.send(&request[..request_size]) {
+            self.lock().responses.remove(&request_id);
+            return Err(ClockBoundCError::SendMessageError(e));
+        }
+
+        let deadline = Instant::now() + RECEIVE_TIMEOUT;
+        let mut pending = self.lock();
+        loop {
+            if let Some(Some(response)) = pending.responses.get(&request_id) {
+                let response = *response;
+                pending.responses.remove(&request_id);
+                return Ok(response);
+            }
+
+            let now = Instant::now();
+            if now >= deadline {
+                pending.responses.remove(&request_id);
+                return Err(ClockBoundCError::ReceiveMessageError(io::Error::new(
+                    io::ErrorKind::TimedOut,
+                    "No response was received from ClockBoundD",
+                )));
+            }
+
+            if pending.receiving {
+                // Another caller is receiving. Wait for it to hand over a response.
+                pending = match self.response_received.wait_timeout(pending, deadline - now) {
+                    Ok((pending, _)) => pending,
+                    Err(e) => e.into_inner().0,
+                };
+                continue;
+            }
+
+            // Take a turn receiving from the socket
+            pending.receiving = true;
+            drop(pending);
+            let mut response = ResponseV2 {
+                buffer: [0; protocol::RESPONSE_BUFFER_SIZE_V2],
+            };
+            let result = self.client.socket.recv(&mut response.buffer);
+            pending = self.lock();
+            pending.receiving = false;
+            self.response_received.notify_all();
+
+            match result {
+                Ok(size) => match response.request_id(size) {
+                    Some(id) => {
+                        // Responses to requests that are no longer waiting are dropped
+                        if let Some(slot) = pending.responses.get_mut(&id) {
+                            *slot = Some(response);
+                        }
+                    }
+                    None => {
+                        pending.responses.remove(&request_id);
+                        return Err(ClockBoundCError::ReceiveMessageError(io::Error::new(
+                            io::ErrorKind::InvalidData,
+                            "Received a response without a request id from ClockBoundD",
+                        )));
+                    }
+                },
+                Err(e) => {
+                    pending.responses.remove(&request_id);
+                    return Err(ClockBoundCError::ReceiveMessageError(e));
+                }
+            }
+        }
+    }
+
+    fn lock(&self) -> MutexGuard<'_, Pending> {
+        self.pending.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::error::ClockBoundCError;
+    use crate::mock::{compare_response, MockClockBoundD};
+    use crate::{ClockBoundSharedClient, RECEIVE_TIMEOUT};
+    use std::sync::Arc;
+    use std::time::Instant;
+
+    #[test]
+    fn test_routes_by_request_id() {
+        let mock = MockClockBoundD::new();
+        let client = Arc::new(ClockBoundSharedClient::new_with_path(mock.path.clone()).unwrap());
+
+        let callers: Vec<_> = (1..=2)
+            .map(|time| {
+                let client = client.clone();
+                std::thread::spawn(move || (time, client.compare(time)))
+            })
+            .collect();
+
+        // Answer both requests in the reverse order they were received in
+        let first = mock.recv();
+        let second = mock.recv();
+        mock.send(&compare_response(&second.0), &second.1);
+        mock.send(&compare_response(&first.0), &first.1);
+
+        for caller in callers {
+            let (time, response) = caller.join().unwrap();
+            let response = response.unwrap();
+            assert_eq!(time, response.bound.earliest);
+            assert_eq!(time, response.bound.latest);
+        }
+    }
+
+    #[test]
+    fn test_response_without_request_id() {
+        let mock = MockClockBoundD::new();
+        let client = ClockBoundSharedClient::new_with_path(mock.path.clone()).unwrap();
+
+        // A version 1 error response, as sent by a ClockBoundD without version 2, and a response
+        // shorter than a version 2 header
+        for response in [&[1, 0, 0, 0][..], &[2, 1, 0, 0, 0][..]] {
+            let start = Instant::now();
+            std::thread::scope(|s| {
+                let caller = s.spawn(|| client.now());
+                let (_, addr) = mock.recv();
+                mock.send(response, &addr);
+                match caller.join().unwrap() {
+                    Err(ClockBoundCError::ReceiveMessageError(_)) => {}
+                    Err(e) => panic!("Unexpected error: {}", e),
+                    Ok(_) => panic!("A response without a request id was accepted"),
+                }
+            });
+            assert!(start.elapsed() < RECEIVE_TIMEOUT);
+        }
+
+        // A later request is still answered
+        std::thread::scope(|s| {
+            let caller = s.spawn(|| client.compare(3));
+            let (request, addr) = mock.recv();
+            mock.send(&compare_response(&request), &addr);
+            assert_eq!(3, caller.join().unwrap().unwrap().bound.earliest);
+        });
+    }
+
+    #[test]
+    fn test_receive_timeout() {
+        let mock = MockClockBoundD::new();
+        let client = Arc::new(ClockBoundSharedClient::new_with_path(mock.path.clone()).unwrap());
+
+        // Neither the caller receiving nor the one waiting on it is answered
+        let start = Instant::now();
+        let callers: Vec<_> = (0..2)
+            .map(|_| {
+                let client = client.clone();
+                std::thread::spawn(move || client.now())
+            })
+            .collect();
+        for caller in callers {
+            match caller.join().unwrap() {
+                Err(ClockBoundCError::ReceiveMessageError(_)) => {}
+                Err(e) => panic!("Unexpected error: {}", e),
+                Ok(_) => panic!("A request was answered"),
+            }
+        }
+        assert!(start.elapsed() >= RECEIVE_TIMEOUT);
+        assert!(start.elapsed() < RECEIVE_TIMEOUT * 3);
+        assert!(client.lock().responses.is_empty());
+    }
+}
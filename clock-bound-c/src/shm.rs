@@ -0,0 +1,321 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use crate::ceb;
+use crate::error::ClockBoundCError;
+use crate::protocol::REQUEST_VERSION;
+use crate::{Bound, ResponseAfter, ResponseBefore, ResponseHeader, ResponseNow, TimingGuard};
+use std::fs::File;
+use std::os::unix::io::AsRawFd;
+use std::path::PathBuf;
+use std::sync::atomic::{fence, AtomicU32, AtomicU64, Ordering};
+use std::time::{Instant, SystemTime, UNIX_EPOCH};
+
+/// The default shared memory segment file that is generated by ClockBoundD.
+pub const CLOCKBOUNDD_SHM_PATH: &str = "/run/clockboundd/clockboundd.shm";
+
+/// Magic number at the start of the shared memory segment ("CLKB").
+pub const SHM_MAGIC: u32 = 0x434c_4b42;
+
+/// The layout version of the shared memory segment supported by this reader.
+pub const SHM_VERSION: u32 = 1;
+
+/// The number of times a read is retried while ClockBoundD is updating the segment before giving
+/// up. An update only takes a few stores, so this is only reached if ClockBoundD stopped part way
+/// through one.
+const SHM_READ_RETRIES: u32 = 1_000_000;
+
+/// The layout of the shared memory segment. Must match the layout documented in PROTOCOL.md.
+#[repr(C)]
+struct ShmSegment {
+    magic: AtomicU32,
+    version: AtomicU32,
+    seq: AtomicU64,
+    ref_time: AtomicU64,
+    root_dispersion: AtomicU64,
+    current_correction: AtomicU64,
+    root_delay: AtomicU64,
+    skew_ppm: AtomicU64,
+    resid_freq_ppm: AtomicU64,
+    max_clock_error: AtomicU64,
+    leap_status: AtomicU32,
+    error_flag: AtomicU32,
+}
+
+/// A consistent copy of the tracking data published by ClockBoundD.
+#[derive(Clone, Copy, Debug)]
+struct ShmTracking {
+    ref_time: u64,
+    root_dispersion: f64,
+    current_correction: f64,
+    root_delay: f64,
+    skew_ppm: f64,
+    resid_freq_ppm: f64,
+    max_clock_error: f64,
+    leap_status: u32,
+    error_flag: bool,
+}
+
+/// A leap status value of 3 means unsynchronized.
+const LEAP_STATUS_UNSYNCHRONIZED: u32 = 3;
+
+/// A structure for reading the error bounds directly from the shared memory segment published by
+/// ClockBoundD. Unlike ClockBoundClient no request is sent to ClockBoundD; the bounds are
+/// calculated locally from the current system time and the latest tracking data from Chrony.
+pub struct ClockBoundShmReader {
+    segment: *const ShmSegment,
+}
+
+// The segment is only ever accessed through atomics.
+unsafe impl Send for ClockBoundShmReader {}
+unsafe impl Sync for ClockBoundShmReader {}
+
+impl ClockBoundShmReader {
+    /// Create a new ClockBoundShmReader using the default shared memory segment path at
+    /// "/run/clockboundd/clockboundd.shm".
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundShmReader;
+    /// let reader = match ClockBoundShmReader::new(){
+    ///     Ok(reader) => reader,
+    ///     Err(e) => {
+    ///         println!("Couldn't create reader: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new() -> Result<ClockBoundShmReader, ClockBoundCError> {
+        ClockBoundShmReader::new_with_path(PathBuf::from(CLOCKBOUNDD_SHM_PATH))
+    }
+
+    /// Create a new ClockBoundShmReader using a defined shared memory segment path.
+    ///
+    /// # Arguments
+    ///
+    /// * `clock_bound_d_shm` - The path at which the clockboundd.shm lives.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundShmReader;
+    /// let reader = match ClockBoundShmReader::new_with_path(std::path::PathBuf::from("/run/clockboundd/clockboundd.shm")){
+    ///     Ok(reader) => reader,
+    ///     Err(e) => {
+    ///         println!("Couldn't create reader: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new_with_path(
+        clock_bound_d_shm: PathBuf,
+    ) -> Result<ClockBoundShmReader, ClockBoundCError> {
+        let file = match File::open(clock_bound_d_shm.as_path()) {
+            Ok(file) => file,
+            Err(e) => return Err(ClockBoundCError::ShmOpenError(e)),
+        };
+
+        let size = std::mem::size_of::<ShmSegment>();
+        match file.metadata() {
+            Ok(metadata) if metadata.len() >= size as u64 => {}
+            Ok(_) => return Err(ClockBoundCError::ShmInvalidSegment),
+            Err(e) => return Err(ClockBoundCError::ShmOpenError(e)),
+        }
+
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                size,
+                libc::PROT_READ,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(ClockBoundCError::ShmMapError(
+                std::io::Error::last_os_error(),
+            ));
+        }
+
+        let reader = ClockBoundShmReader {
+            segment: ptr as *const ShmSegment,
+        };
+        let segment = reader.segment();
+        if segment.magic.load(Ordering::Acquire) != SHM_MAGIC
+            || segment.version.load(Ordering::Relaxed) != SHM_VERSION
+        {
+            return Err(ClockBoundCError::ShmInvalidSegment);
+        }
+
+        Ok(reader)
+    }
+
+    fn segment(&self) -> &ShmSegment {
+        unsafe { &*self.segment }
+    }
+
+    /// Take a consistent copy of the tracking data using the segment's seqlock.
+    fn read(&self) -> Result<ShmTracking, ClockBoundCError> {
+        let segment = self.segment();
+        for _ in 0..SHM_READ_RETRIES {
+            let seq = segment.seq.load(Ordering::Acquire);
+            if seq & 1 == 0 {
+                let tracking = ShmTracking {
+                    ref_time: segment.ref_time.load(Ordering::Relaxed),
+                    root_dispersion: load_f64(&segment.root_dispersion),
+                    current_correction: load_f64(&segment.current_correction),
+                    root_delay: load_f64(&segment.root_delay),
+                    skew_ppm: load_f64(&segment.skew_ppm),
+                    resid_freq_ppm: load_f64(&segment.resid_freq_ppm),
+                    max_clock_error: load_f64(&segment.max_clock_error),
+                    leap_status: segment.leap_status.load(Ordering::Relaxed),
+                    error_flag: segment.error_flag.load(Ordering::Relaxed) != 0,
+                };
+                fence(Ordering::Acquire);
+                if segment.seq.load(Ordering::Relaxed) == seq {
+                    return Ok(tracking);
+                }
+            }
+            std::hint::spin_loop();
+        }
+        Err(ClockBoundCError::ShmBusy)
+    }
+
+    /// Read the tracking data and the current system time, returning the header and bounds.
+    fn bound(&self) -> Result<(ResponseHeader, Bound), ClockBoundCError> {
+        let tracking = self.read()?;
+        let time_nanos = match SystemTime::now().duration_since(UNIX_EPOCH) {
+            Ok(d) => d.as_nanos() as u64,
+            Err(_) => 0,
+        };
+
+        // Mirror the response header ClockBoundD would have sent. An error (0) response type
+        // indicates that ClockBoundD could not get tracking data on its last poll to Chrony, in
+        // which case the bounds keep growing from the last tracking data received.
+        let header = ResponseHeader {
+            response_version: REQUEST_VERSION,
+            response_type: if tracking.error_flag { 0 } else { 1 },
+            unsynchronized_flag: tracking.leap_status == LEAP_STATUS_UNSYNCHRONIZED,
+        };
+
+        // Clock Error Bound = |System time offset| + Root dispersion + (Root delay / 2), at the
+        // time of Chrony's last update
+        let base_ceb_nanos = ceb::clock_error_bound(
+            ceb::round_f64_nanos(tracking.current_correction.abs()),
+            ceb::round_f64_nanos(tracking.root_dispersion),
+            ceb::round_f64_nanos(tracking.root_delay),
+        );
+        // The root dispersion grows at the error rate per second since Chrony's last update.
+        let growth_ppb =
+            ceb::ppm_to_ppb(tracking.max_clock_error + tracking.skew_ppm + tracking.resid_freq_ppm);
+        let ceb_nanos =
+            ceb::ceb_nanos_at(tracking.ref_time, base_ceb_nanos, growth_ppb, time_nanos)
+                .ok_or(ClockBoundCError::BoundUnavailable)?;
+
+        Ok((header, ceb::bound_at(ceb_nanos, time_nanos)))
+    }
+
+    /// Returns the bounds of the current system time +/- the error calculated from chrony.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundShmReader;
+    /// let reader = match ClockBoundShmReader::new(){
+    ///     Ok(reader) => reader,
+    ///     Err(e) => {
+    ///         println!("Couldn't create reader: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let response = match reader.now(){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete now request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn now(&self) -> Result<ResponseNow, ClockBoundCError> {
+        let (header, bound) = self.bound()?;
+        let timestamp = bound.latest - ((bound.latest - bound.earliest) / 2);
+        Ok(ResponseNow {
+            header,
+            bound,
+            timestamp,
+        })
+    }
+
+    /// Returns true if the provided timestamp is before the earliest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the earliest error bound.
+    pub fn before(&self, before_time: u64) -> Result<ResponseBefore, ClockBoundCError> {
+        let (mut header, bound) = self.bound()?;
+        if header.response_type != 0 {
+            header.response_type = 2;
+        }
+        Ok(ResponseBefore {
+            header,
+            before: before_time < bound.earliest,
+        })
+    }
+
+    /// Returns true if the provided timestamp is after the latest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the latest error bound.
+    pub fn after(&self, after_time: u64) -> Result<ResponseAfter, ClockBoundCError> {
+        let (mut header, bound) = self.bound()?;
+        if header.response_type != 0 {
+            header.response_type = 3;
+        }
+        Ok(ResponseAfter {
+            header,
+            after: after_time > bound.latest,
+        })
+    }
+
+    /// Block until the provided timestamp is before the earliest error bound, that is until it has
+    /// definitely passed. See ClockBoundClient::wait_until_before.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, to wait
+    /// for the earliest error bound to pass.
+    pub fn wait_until_before(&self, before_time: u64) -> Result<ResponseNow, ClockBoundCError> {
+        crate::wait_until_before(before_time, || self.now())
+    }
+
+    /// Start a timer from the bounds of the current time, calculated from the shared memory
+    /// segment. See TimingGuard.
+    pub fn start_timing(&self) -> Result<TimingGuard, ClockBoundCError> {
+        let requested = Instant::now();
+        let (_, bound) = self.bound()?;
+        Ok(TimingGuard::new(bound, requested))
+    }
+}
+
+impl Drop for ClockBoundShmReader {
+    /// Unmap the shared memory segment when a ClockBoundShmReader is dropped.
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(
+                self.segment as *mut libc::c_void,
+                std::mem::size_of::<ShmSegment>(),
+            );
+        }
+    }
+}
+
+/// Load a f64 from an AtomicU64 holding its IEEE 754 bit representation.
+fn load_f64(field: &AtomicU64) -> f64 {
+    f64::from_bits(field.load(Ordering::Relaxed))
+}
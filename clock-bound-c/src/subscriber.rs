@@ -0,0 +1,409 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+use crate::ceb;
+use crate::error::ClockBoundCError;
+use crate::protocol;
+use crate::{
+    Bound, ClockBoundClient, ResponseAfter, ResponseBefore, ResponseHeader, ResponseNow,
+    CLOCKBOUNDD_SOCKET_ADDRESS_PATH, RECEIVE_TIMEOUT,
+};
+use std::io::ErrorKind;
+use std::net::Shutdown;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard, PoisonError};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// The latest Clock Error Bound model received from ClockBoundD.
+#[derive(Clone, Copy, Debug)]
+struct Update {
+    /// The protocol version of the update.
+    response_version: u8,
+    /// Set if ClockBoundD could not get tracking data on its last poll to Chrony.
+    error_flag: bool,
+    /// Set if Chrony is not synchronized to a source.
+    unsynchronized_flag: bool,
+    /// The time of Chrony's last update in nanoseconds since the Unix epoch.
+    ref_time_nanos: u64,
+    /// The Clock Error Bound at the time of Chrony's last update in nanoseconds.
+    base_ceb_nanos: u64,
+    /// The rate at which the Clock Error Bound grows, in parts per billion.
+    growth_ppb: u64,
+    /// How long the subscription lasts without being renewed.
+    lease: Duration,
+    /// The time the update was received.
+    received: Instant,
+}
+
+impl Update {
+    /// Decode an update received from ClockBoundD. Fails with SubscriptionRefused if the response
+    /// is not an update, or has a lease of 0 because ClockBoundD did not subscribe the client.
+    ///
+    /// # Arguments
+    ///
+    /// * `response` - The response received from ClockBoundD.
+    fn decode(response: &[u8]) -> Result<Update, ClockBoundCError> {
+        if response.len() != protocol::UPDATE_RESPONSE_SIZE {
+            return Err(ClockBoundCError::SubscriptionRefused);
+        }
+        let header = protocol::decode_header(response);
+        // An error (0) response still carries the last valid model
+        match header.response_type {
+            0 | protocol::REQUEST_TYPE_SUBSCRIBE | protocol::RESPONSE_TYPE_UPDATE => {}
+            _ => return Err(ClockBoundCError::SubscriptionRefused),
+        }
+        let (ref_time_nanos, base_ceb_nanos, growth_rate, lease_secs) =
+            protocol::decode_update(&response[protocol::HEADER_SIZE..]);
+        if lease_secs == 0 {
+            return Err(ClockBoundCError::SubscriptionRefused);
+        }
+        Ok(Update {
+            response_version: header.response_version,
+            error_flag: header.response_type == 0,
+            unsynchronized_flag: header.unsynchronized_flag,
+            ref_time_nanos,
+            base_ceb_nanos,
+            growth_ppb: ceb::growth_rate_to_ppb(growth_rate),
+            lease: Duration::from_secs(lease_secs.into()),
+            received: Instant::now(),
+        })
+    }
+}
+
+/// State shared with the thread receiving updates.
+struct Inner {
+    client: ClockBoundClient,
+    /// The path of the ClockBoundD socket the client is connected to.
+    clock_bound_d_socket: PathBuf,
+    update: Mutex<Update>,
+    stopped: AtomicBool,
+}
+
+/// A client that subscribes to updates of the Clock Error Bound model from ClockBoundD.
+///
+/// ClockBoundD pushes the model to the subscriber whenever it changes, and the bounds are
+/// calculated locally from the model and the current system time. No request is sent to
+/// ClockBoundD per call. A thread started with the subscriber receives the updates and renews the
+/// subscription before its lease runs out.
+pub struct ClockBoundSubscriber {
+    inner: Arc<Inner>,
+    receiver: Option<JoinHandle<()>>,
+}
+
+impl ClockBoundSubscriber {
+    /// Create a new ClockBoundSubscriber using the default clockboundd.sock path at
+    /// "/run/clockboundd/clockboundd.sock".
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundSubscriber;
+    /// let subscriber = match ClockBoundSubscriber::new(){
+    ///     Ok(subscriber) => subscriber,
+    ///     Err(e) => {
+    ///         println!("Couldn't create subscriber: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn new() -> Result<ClockBoundSubscriber, ClockBoundCError> {
+        ClockBoundSubscriber::new_with_path(PathBuf::from(CLOCKBOUNDD_SOCKET_ADDRESS_PATH))
+    }
+
+    /// Create a new ClockBoundSubscriber using a defined clockboundd.sock path.
+    ///
+    /// Blocks until ClockBoundD responds to the subscribe request with the current model, or fails
+    /// with ReceiveMessageError if there is no response within RECEIVE_TIMEOUT.
+    ///
+    /// # Arguments
+    ///
+    /// * `clock_bound_d_socket` - The path at which the clockboundd.sock lives.
+    pub fn new_with_path(
+        clock_bound_d_socket: PathBuf,
+    ) -> Result<ClockBoundSubscriber, ClockBoundCError> {
+        let client = ClockBoundClient::new_with_path(clock_bound_d_socket.clone())?;
+        if let Err(e) = client.socket.set_read_timeout(Some(RECEIVE_TIMEOUT)) {
+            return Err(ClockBoundCError::ConnectError(e));
+        }
+
+        if let Err(e) = client.socket.send(&protocol::subscribe_request()) {
+            return Err(ClockBoundCError::SendMessageError(e));
+        }
+        let mut response: [u8; protocol::UPDATE_RESPONSE_SIZE] =
+            [0; protocol::UPDATE_RESPONSE_SIZE];
+        let update = match client.socket.recv(&mut response) {
+            Ok(size) => Update::decode(&response[..size])?,
+            Err(e) => return Err(ClockBoundCError::ReceiveMessageError(e)),
+        };
+
+        let inner = Arc::new(Inner {
+            client,
+            clock_bound_d_socket,
+            update: Mutex::new(update),
+            stopped: AtomicBool::new(false),
+        });
+        let receiver = {
+            let inner = inner.clone();
+            std::thread::Builder::new()
+                .name(String::from("clockboundc-subscriber"))
+                .spawn(move || receive_updates(&inner))
+                .map_err(ClockBoundCError::ConnectError)?
+        };
+
+        Ok(ClockBoundSubscriber {
+            inner,
+            receiver: Some(receiver),
+        })
+    }
+
+    /// Calculate the bounds of the current system time from the latest model received.
+    fn bound(&self) -> Result<(Update, Bound), ClockBoundCError> {
+        let update = *lock(&self.inner.update);
+        if update.received.elapsed() > update.lease {
+            return Err(ClockBoundCError::SubscriptionExpired);
+        }
+
+        let time_nanos = match SystemTime::now().duration_since(UNIX_EPOCH) {
+            Ok(d) => d.as_nanos() as u64,
+            Err(_) => 0,
+        };
+
+        let ceb_nanos = ceb::ceb_nanos_at(
+            update.ref_time_nanos,
+            update.base_ceb_nanos,
+            update.growth_ppb,
+            time_nanos,
+        )
+        .ok_or(ClockBoundCError::BoundUnavailable)?;
+        Ok((update, ceb::bound_at(ceb_nanos, time_nanos)))
+    }
+
+    /// Returns the bounds of the current system time +/- the error calculated from chrony.
+    ///
+    /// # Examples
+    ///
+    /// ```
+    /// use clock_bound_c::ClockBoundSubscriber;
+    /// let subscriber = match ClockBoundSubscriber::new(){
+    ///     Ok(subscriber) => subscriber,
+    ///     Err(e) => {
+    ///         println!("Couldn't create subscriber: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// let response = match subscriber.now(){
+    ///     Ok(response) => response,
+    ///     Err(e) => {
+    ///         println!("Couldn't complete now request: {}", e);
+    ///         return
+    ///     }
+    /// };
+    /// ```
+    pub fn now(&self) -> Result<ResponseNow, ClockBoundCError> {
+        let (update, bound) = self.bound()?;
+        let timestamp = bound.latest - ((bound.latest - bound.earliest) / 2);
+        Ok(ResponseNow {
+            header: response_header(&update, protocol::REQUEST_TYPE_NOW),
+            bound,
+            timestamp,
+        })
+    }
+
+    /// Returns true if the provided timestamp is before the earliest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `before_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the earliest error bound.
+    pub fn before(&self, before_time: u64) -> Result<ResponseBefore, ClockBoundCError> {
+        let (update, bound) = self.bound()?;
+        Ok(ResponseBefore {
+            header: response_header(&update, protocol::REQUEST_TYPE_BEFORE),
+            before: before_time < bound.earliest,
+        })
+    }
+
+    /// Returns true if the provided timestamp is after the latest error bound.
+    /// Otherwise, returns false.
+    ///
+    /// # Arguments
+    ///
+    /// * `after_time` - A timestamp, represented as nanoseconds since the Unix Epoch, that is
+    /// tested against the latest error bound.
+    pub fn after(&self, after_time: u64) -> Result<ResponseAfter, ClockBoundCError> {
+        let (update, bound) = self.bound()?;
+        Ok(ResponseAfter {
+            header: response_header(&update, protocol::REQUEST_TYPE_AFTER),
+            after: after_time > bound.latest,
+        })
+    }
+}
+
+impl Drop for ClockBoundSubscriber {
+    /// Stop the thread receiving updates when a ClockBoundSubscriber is dropped. The client socket
+    /// file is removed once the thread has stopped.
+    fn drop(&mut self) {
+        self.inner.stopped.store(true, Ordering::Relaxed);
+        // Wake the thread up if it is blocked receiving
+        let _ = self.inner.client.socket.shutdown(Shutdown::Read);
+        if let Some(receiver) = self.receiver.take() {
+            let _ = receiver.join();
+        }
+    }
+}
+
+/// Mirror the response header ClockBoundD would have sent to a request. An error (0) response
+/// type indicates that ClockBoundD could not get tracking data on its last poll to Chrony, in
+/// which case the bounds keep growing from the last model received.
+///
+/// # Arguments
+///
+/// * `update` - The latest update.
+/// * `request_type` - The request type: Now (1), Before (2) or After (3).
+fn response_header(update: &Update, request_type: u8) -> ResponseHeader {
+    ResponseHeader {
+        response_version: update.response_version,
+        response_type: if update.error_flag { 0 } else { request_type },
+        unsynchronized_flag: update.unsynchronized_flag,
+    }
+}
+
+/// Receive updates from ClockBoundD until the subscriber is dropped, renewing the subscription
+/// halfway through each lease.
+///
+/// # Arguments
+///
+/// * `inner` - The state shared with the subscriber.
+fn receive_updates(inner: &Inner) {
+    let socket = &inner.client.socket;
+    let mut renewed = Instant::now();
+    let mut response: [u8; protocol::UPDATE_RESPONSE_SIZE] = [0; protocol::UPDATE_RESPONSE_SIZE];
+
+    while !inner.stopped.load(Ordering::Relaxed) {
+        let renew_after = lock(&inner.update).lease / 2;
+        if renewed.elapsed() >= renew_after {
+            // A socket connected to a ClockBoundD that restarted can not reach the new one, so it
+            // is connected again. If ClockBoundD is not running the subscription runs out, and a
+            // later renewal subscribes again once ClockBoundD is back.
+            if socket.send(&protocol::subscribe_request()).is_err()
+                && socket.connect(&inner.clock_bound_d_socket).is_ok()
+            {
+                let _ = socket.send(&protocol::subscribe_request());
+            }
+            renewed = Instant::now();
+        }
+
+        // Wake up in time for the next renewal
+        let timeout = renew_after
+            .saturating_sub(renewed.elapsed())
+            .max(Duration::from_millis(1));
+        if socket.set_read_timeout(Some(timeout)).is_err() {
+            std::thread::sleep(timeout);
+            continue;
+        }
+        match socket.recv(&mut response) {
+            // A refused renewal leaves the subscription to run out
+            Ok(size) => {
+                if let Ok(update) = Update::decode(&response[..size]) {
+                    *lock(&inner.update) = update;
+                }
+            }
+            Err(e) => {
+                // Timed out waiting for an update. Any other error is retried after the next
+                // renewal.
+                if e.kind() != ErrorKind::WouldBlock && e.kind() != ErrorKind::TimedOut {
+                    std::thread::sleep(timeout);
+                }
+            }
+        }
+    }
+}
+
+fn lock(update: &Mutex<Update>) -> MutexGuard<'_, Update> {
+    update.lock().unwrap_or_else(PoisonError::into_inner)
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::error::ClockBoundCError;
+    use crate::mock::{update_response, MockClockBoundD};
+    use crate::protocol;
+    use crate::{ClockBoundSubscriber, RECEIVE_TIMEOUT};
+    use std::path::PathBuf;
+    use std::time::{Duration, Instant};
+
+    /// Subscribe at a path, answering the subscribe request from the mock.
+    fn subscribe(mock: &MockClockBoundD, path: PathBuf) -> ClockBoundSubscriber {
+        std::thread::scope(|s| {
+            let subscriber = s.spawn(|| ClockBoundSubscriber::new_with_path(path));
+            let (request, addr) = mock.recv();
+            assert_eq!(protocol::subscribe_request(), request[..]);
+            mock.send(&update_response(1), &addr);
+            subscriber.join().unwrap().unwrap()
+        })
+    }
+
+    #[test]
+    fn test_subscribe_refused() {
+        let mock = MockClockBoundD::new();
+        let path = mock.path.clone();
+        std::thread::scope(|s| {
+            let subscriber = s.spawn(|| ClockBoundSubscriber::new_with_path(path));
+            let (_, addr) = mock.recv();
+            mock.send(&update_response(0), &addr);
+            match subscriber.join().unwrap() {
+                Err(ClockBoundCError::SubscriptionRefused) => {}
+                Err(e) => panic!("Unexpected error: {}", e),
+                Ok(_) => panic!("A lease of 0 was accepted"),
+            }
+        });
+    }
+
+    #[test]
+    fn test_subscribe_timeout() {
+        let mock = MockClockBoundD::new();
+        let start = Instant::now();
+        match ClockBoundSubscriber::new_with_path(mock.path.clone()) {
+            Err(ClockBoundCError::ReceiveMessageError(_)) => {}
+            Err(e) => panic!("Unexpected error: {}", e),
+            Ok(_) => panic!("The subscribe request was answered"),
+        }
+        assert!(start.elapsed() >= RECEIVE_TIMEOUT);
+        assert_eq!(protocol::subscribe_request(), mock.recv().0[..]);
+    }
+
+    #[test]
+    fn test_resubscribes_after_restart() {
+        let mock = MockClockBoundD::new();
+        let path = mock.path.clone();
+        let subscriber = subscribe(&mock, path.clone());
+        assert!(subscriber.now().is_ok());
+
+        // ClockBoundD goes away until the lease runs out, then comes back at the same path
+        drop(mock);
+        std::thread::sleep(Duration::from_millis(1500));
+        match subscriber.now() {
+            Err(ClockBoundCError::SubscriptionExpired) => {}
+            result => panic!(
+                "Unexpected result: {:?}",
+                result.map(|_| ()).map_err(|e| e.to_string())
+            ),
+        }
+        let mock = MockClockBoundD::at(path);
+
+        // The next renewal reaches the new ClockBoundD
+        let (request, addr) = mock.recv();
+        assert_eq!(protocol::subscribe_request(), request[..]);
+        mock.send(&update_response(1), &addr);
+        let deadline = Instant::now() + Duration::from_secs(10);
+        while subscriber.now().is_err() {
+            assert!(
+                Instant::now() < deadline,
+                "The subscription was not renewed"
+            );
+            std::thread::sleep(Duration::from_millis(10));
+        }
+    }
+}
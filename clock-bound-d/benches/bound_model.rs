@@ -0,0 +1,48 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+mod common;
+
+use chrony_candm::common::ChronyFloat;
+use chrony_candm::reply::Tracking;
+use clock_bound_d::ceb::BoundModel;
+use common::{epoch_nanos, tracking};
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use std::time::SystemTime;
+
+/// The per request work done before the bound model was precomputed: a copy of the tracking data,
+/// two reads of the system time, the root dispersion update and the Clock Error Bound formula in
+/// floating point.
+fn ceb_nanos_from_tracking(tracking: Tracking, max_clock_error: f64) -> u64 {
+    let mut tracking = tracking.clone();
+    assert!(tracking.ref_time <= SystemTime::now());
+    let dur = SystemTime::now().duration_since(tracking.ref_time).unwrap();
+    let error_rate =
+        (max_clock_error + f64::from(tracking.skew_ppm) + f64::from(tracking.resid_freq_ppm))
+            * 1e-6;
+    tracking.root_dispersion =
+        ChronyFloat::from(f64::from(tracking.root_dispersion) + dur.as_secs() as f64 * error_rate);
+    let ceb = f64::from(tracking.current_correction).abs()
+        + f64::from(tracking.root_dispersion)
+        + f64::from(tracking.root_delay) / 2.0;
+    (ceb * 1_000_000_000.0).round() as u64
+}
+
+fn bench_clock_error_bound(c: &mut Criterion) {
+    let tracking = tracking();
+    let model = BoundModel::new(tracking, 1.0);
+
+    let mut group = c.benchmark_group("clock_error_bound");
+    group.bench_function("from_tracking_per_request", |b| {
+        b.iter(|| ceb_nanos_from_tracking(black_box(tracking), black_box(1.0)))
+    });
+    group.bench_function("precomputed_model", |b| {
+        b.iter(|| black_box(&model).ceb_nanos_at(epoch_nanos()))
+    });
+    group.bench_function("model_update", |b| {
+        b.iter(|| BoundModel::new(black_box(tracking), black_box(1.0)))
+    });
+    group.finish();
+}
+
+criterion_group!(benches, bench_clock_error_bound);
+criterion_main!(benches);
@@ -0,0 +1,58 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+//! Helpers shared by the benchmarks.
+#![allow(dead_code)]
+use chrony_candm::common::{ChronyAddr, ChronyFloat};
+use chrony_candm::reply::Tracking;
+use std::net::IpAddr;
+use std::time::{Duration, SystemTime};
+
+/// Tracking data as reported by a synchronized chronyd, updated a second ago.
+pub fn tracking() -> Tracking {
+    Tracking {
+        ip_addr: ChronyAddr::from(IpAddr::from([169, 254, 169, 123])),
+        current_correction: ChronyFloat::from(0.000_012_f64),
+        freq_ppm: ChronyFloat::from(-3.2_f64),
+        last_offset: ChronyFloat::from(0.000_001_f64),
+        last_update_interval: ChronyFloat::from(16.0_f64),
+        leap_status: 0,
+        ref_time: SystemTime::now() - Duration::from_secs(1),
+        ref_id: 0,
+        resid_freq_ppm: ChronyFloat::from(0.001_f64),
+        rms_offset: ChronyFloat::from(0.000_002_f64),
+        root_delay: ChronyFloat::from(0.000_350_f64),
+        root_dispersion: ChronyFloat::from(0.000_120_f64),
+        skew_ppm: ChronyFloat::from(0.03_f64),
+        stratum: 4,
+    }
+}
+
+/// The current system time in nanoseconds since the Unix epoch.
+pub fn epoch_nanos() -> u64 {
+    SystemTime::now()
+        .duration_since(SystemTime::UNIX_EPOCH)
+        .unwrap()
+        .as_nanos() as u64
+}
+
+/// Encode a request as a client would send it.
+///
+/// # Arguments
+///
+/// * `version` - The protocol version of the request. Version 2 requests carry a request id.
+/// * `request_type` - The request type.
+/// * `epochs` - The timestamps the request carries. A Batch (4) request is prefixed with their count.
+pub fn request(version: u8, request_type: u8, epochs: &[u64]) -> Vec<u8> {
+    let mut request = vec![version, request_type, 0, 0];
+    if version == 2 {
+        request.extend_from_slice(&42_u32.to_be_bytes());
+    }
+    if request_type == 4 {
+        request.extend_from_slice(&(epochs.len() as u16).to_be_bytes());
+        request.extend_from_slice(&[0, 0]);
+    }
+    for epoch in epochs {
+        request.extend_from_slice(&epoch.to_be_bytes());
+    }
+    request
+}
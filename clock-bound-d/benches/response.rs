@@ -0,0 +1,67 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+mod common;
+
+use clock_bound_d::ceb::BoundModel;
+use clock_bound_d::response::{
+    build_response, build_update, REQUEST_BUFFER_SIZE, RESPONSE_BUFFER_SIZE,
+};
+use common::{epoch_nanos, request, tracking};
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion};
+
+/// Copy a request into a buffer the size of the one requests are received into.
+fn request_buffer(request: &[u8]) -> ([u8; REQUEST_BUFFER_SIZE], usize) {
+    let mut buffer = [0; REQUEST_BUFFER_SIZE];
+    buffer[..request.len()].copy_from_slice(request);
+    (buffer, request.len())
+}
+
+/// The work done per request after it is received: reading the system time, validating and
+/// decoding the request, evaluating the bound model and encoding the response.
+fn bench_build_response(c: &mut Criterion) {
+    let model = BoundModel::new(tracking(), 1.0);
+    let now = epoch_nanos();
+    let batch: Vec<u64> = (0..64).map(|i| now - 32 + i).collect();
+    let requests = [
+        ("now", request(1, 1, &[])),
+        ("before", request(1, 2, &[now])),
+        ("after", request(1, 3, &[now])),
+        ("batch_64", request(1, 4, &batch)),
+        ("subscribe", request(1, 5, &[])),
+        ("now_v2", request(2, 1, &[])),
+        ("batch_64_v2", request(2, 4, &batch)),
+        ("invalid", request(1, 9, &[])),
+    ];
+
+    let mut group = c.benchmark_group("build_response");
+    for (name, request) in requests.iter() {
+        let (request, request_size) = request_buffer(request);
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        group.bench_with_input(BenchmarkId::from_parameter(name), &request, |b, request| {
+            b.iter(|| {
+                build_response(
+                    black_box(request),
+                    black_box(request_size),
+                    black_box(&model),
+                    false,
+                    epoch_nanos(),
+                    epoch_nanos(),
+                    &mut response,
+                )
+            })
+        });
+    }
+    group.finish();
+}
+
+/// The work done per subscriber when an update of the bound model is pushed.
+fn bench_build_update(c: &mut Criterion) {
+    let model = BoundModel::new(tracking(), 1.0);
+    let mut response = [0; RESPONSE_BUFFER_SIZE];
+    c.bench_function("build_update", |b| {
+        b.iter(|| build_update(black_box(&model), false, 2, 42, &mut response))
+    });
+}
+
+criterion_group!(benches, bench_build_response, bench_build_update);
+criterion_main!(benches);
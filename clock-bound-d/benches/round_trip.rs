@@ -0,0 +1,142 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+mod common;
+
+use clock_bound_d::ceb::BoundModel;
+use clock_bound_d::metrics::Metrics;
+use clock_bound_d::server::{ClockBoundServer, Engine};
+use clock_bound_d::snapshot::SharedSnapshot;
+use common::{request, tracking};
+use criterion::{criterion_group, criterion_main, Criterion};
+use std::os::unix::net::UnixDatagram;
+use std::path::PathBuf;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+/// The number of round trips the latency percentiles are computed from.
+const SAMPLES: usize = 100_000;
+
+fn socket_path(name: &str) -> PathBuf {
+    let path = std::env::temp_dir().join(format!(
+        "clockboundd-bench-{}-{}.sock",
+        std::process::id(),
+        name
+    ));
+    let _ = std::fs::remove_file(&path);
+    path
+}
+
+/// A client socket connected to a ClockBoundD server. The socket files of both are removed when
+/// it is dropped, so that no benchmark run leaves them in the temporary directory.
+struct Connection {
+    client: UnixDatagram,
+    paths: [PathBuf; 2],
+}
+
+impl Drop for Connection {
+    fn drop(&mut self) {
+        for path in &self.paths {
+            let _ = std::fs::remove_file(path);
+        }
+    }
+}
+
+/// Start a ClockBoundD server on its own thread, serving a fixed bound model, and connect a
+/// client socket to it. Returns None if the engine can not be set up.
+fn connect(name: &str, batch_size: usize, engine: Engine) -> Option<Connection> {
+    let server_path = socket_path(&format!("server-{}", name));
+    let client_path = socket_path(&format!("client-{}", name));
+    let snapshot = Arc::new(SharedSnapshot::new(BoundModel::new(tracking(), 1.0), false));
+    let metrics = Arc::new(Metrics::new(1));
+    let mut server = ClockBoundServer::new(&server_path, snapshot, batch_size, metrics, 0);
+    if let Engine::IoUring { sqpoll } = engine {
+        if let Err(e) = server.enable_uring(sqpoll) {
+            println!("Skipping {}, io_uring is not available: {:?}", name, e);
+            let _ = std::fs::remove_file(&server_path);
+            return None;
+        }
+    }
+    std::thread::spawn(move || loop {
+        let _ = match (engine, batch_size) {
+            (Engine::IoUring { .. }, _) => server.handle_clients_uring(),
+            (_, 1) => server.handle_client(),
+            _ => server.handle_clients_batched(),
+        };
+    });
+
+    let connection = Connection {
+        client: UnixDatagram::bind(&client_path).unwrap(),
+        paths: [server_path, client_path],
+    };
+    connection.client.connect(&connection.paths[0]).unwrap();
+    Some(connection)
+}
+
+/// Send a request and wait for its response.
+fn round_trip(client: &UnixDatagram, request: &[u8], response: &mut [u8]) {
+    client.send(request).unwrap();
+    client.recv(response).unwrap();
+}
+
+/// Print the percentiles of the latency of a round trip.
+fn print_percentiles(name: &str, client: &UnixDatagram, request: &[u8]) {
+    let mut response = [0; 64];
+    let mut samples: Vec<Duration> = (0..SAMPLES)
+        .map(|_| {
+            let start = Instant::now();
+            round_trip(client, request, &mut response);
+            start.elapsed()
+        })
+        .collect();
+    samples.sort_unstable();
+    let percentile = |p: f64| samples[((samples.len() - 1) as f64 * p) as usize];
+    println!(
+        "{}: p50 {:?} p99 {:?} p999 {:?} max {:?} ({} samples)",
+        name,
+        percentile(0.5),
+        percentile(0.99),
+        percentile(0.999),
+        samples[samples.len() - 1],
+        samples.len()
+    );
+}
+
+/// The latency of a request over a real Unix socket, from the client sending it to the client
+/// receiving the response, including the server's receive and send system calls.
+fn bench_round_trip(c: &mut Criterion) {
+    let requests = [("now", request(1, 1, &[])), ("now_v2", request(2, 1, &[]))];
+
+    let engines = [
+        ("batch_size_1", 1, Engine::Blocking),
+        ("batch_size_16", 16, Engine::Blocking),
+        ("io_uring", 1, Engine::IoUring { sqpoll: false }),
+        ("io_uring_sqpoll", 1, Engine::IoUring { sqpoll: true }),
+    ];
+
+    for (engine_name, batch_size, engine) in engines {
+        let connection = match connect(engine_name, batch_size, engine) {
+            Some(connection) => connection,
+            None => continue,
+        };
+        let client = &connection.client;
+        let mut group = c.benchmark_group(format!("round_trip_{}", engine_name));
+        for (name, request) in requests.iter() {
+            let mut response = [0; 64];
+            group.bench_function(*name, |b| {
+                b.iter(|| round_trip(client, request, &mut response))
+            });
+        }
+        group.finish();
+
+        for (name, request) in requests.iter() {
+            print_percentiles(
+                &format!("round_trip_{}/{}", engine_name, name),
+                client,
+                request,
+            );
+        }
+    }
+}
+
+criterion_group!(benches, bench_round_trip);
+criterion_main!(benches);
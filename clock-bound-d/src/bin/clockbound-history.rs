@@ -0,0 +1,107 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use clap::{value_t, App, Arg};
+use clock_bound_d::history::{HistoryReader, HistoryRecord};
+use std::io::Write;
+use std::path::Path;
+use std::time::Duration;
+
+/// The default path of the history file of ClockBoundD.
+const DEFAULT_HISTORY_PATH: &str = "/run/clockboundd/clockboundd.history";
+
+/// How often the history file is checked for new records when following it.
+const FOLLOW_INTERVAL: Duration = Duration::from_millis(100);
+
+/// The header of the CSV the records are exported as.
+const CSV_HEADER: &str = "time_ns,ref_time_ns,ceb_ns,current_correction,root_delay,\
+root_dispersion,skew_ppm,resid_freq_ppm,poll_latency_ns,leap_status,error_flag,poll_failed";
+
+// Export the history file of ClockBoundD as CSV, without signalling ClockBoundD.
+fn main() {
+    let matches = App::new("clockbound-history")
+        .version(env!("CARGO_PKG_VERSION"))
+        .about("Export the history of the polls of ClockBoundD to chronyd as CSV.")
+        .arg(Arg::with_name("path")
+            .index(1)
+            .help("The path of the history file. Default value is /run/clockboundd/clockboundd.history."))
+        .arg(Arg::with_name("last")
+            .short("n")
+            .long("last")
+            .takes_value(true)
+            .help("Export only the last records. By default every record in the history file is exported."))
+        .arg(Arg::with_name("follow")
+            .short("f")
+            .long("follow")
+            .help("Keep exporting records as ClockBoundD appends them."))
+        .get_matches();
+
+    let path = matches.value_of("path").unwrap_or(DEFAULT_HISTORY_PATH);
+    let reader = match HistoryReader::open(Path::new(path)) {
+        Ok(reader) => reader,
+        Err(e) => {
+            eprintln!("Failed to open history file {}. Error: {}", path, e);
+            std::process::exit(1);
+        }
+    };
+
+    let head = reader.head();
+    let mut last = head.min(reader.capacity());
+    if matches.is_present("last") {
+        last = last.min(value_t!(matches.value_of("last"), u64).unwrap_or_else(|e| e.exit()));
+    }
+
+    let stdout = std::io::stdout();
+    let mut out = stdout.lock();
+    // Stop quietly once the output is closed, for example when piped into head
+    if writeln!(out, "{}", CSV_HEADER).is_err() {
+        return;
+    }
+    let mut next = head - last;
+    loop {
+        let head = reader.head();
+        // Records the reader fell a whole ring behind on were overwritten
+        if head.saturating_sub(next) > reader.capacity() {
+            let skipped = head - reader.capacity() - next;
+            eprintln!(
+                "Skipped {} records overwritten before they were read",
+                skipped
+            );
+            next += skipped;
+        }
+        while next < head {
+            match reader.read(next) {
+                Some(record) => {
+                    if write_record(&mut out, &record).is_err() {
+                        return;
+                    }
+                }
+                None => eprintln!("Skipped record {} overwritten while it was read", next),
+            }
+            next += 1;
+        }
+        if !matches.is_present("follow") || out.flush().is_err() {
+            return;
+        }
+        std::thread::sleep(FOLLOW_INTERVAL);
+    }
+}
+
+// Write a record as a CSV line.
+fn write_record(out: &mut impl Write, record: &HistoryRecord) -> std::io::Result<()> {
+    writeln!(
+        out,
+        "{},{},{},{},{},{},{},{},{},{},{},{}",
+        record.time_nanos,
+        record.ref_time_nanos,
+        record.ceb_nanos,
+        record.current_correction,
+        record.root_delay,
+        record.root_dispersion,
+        record.skew_ppm,
+        record.resid_freq_ppm,
+        record.poll_latency_nanos,
+        record.leap_status,
+        u8::from(record.error_flag()),
+        u8::from(record.poll_failed())
+    )
+}
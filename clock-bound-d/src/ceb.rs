@@ -1,6 +1,17 @@
 // Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
 // SPDX-License-Identifier: GPL-2.0-only
+use crate::chrony_poller::LEAP_STATUS_UNSYNCHRONIZED;
+use crate::tracking::error_rate_ppb;
 use chrony_candm::reply::Tracking;
+use std::time::SystemTime;
+
+/// The number of nanoseconds in a second.
+pub const NANOS_PER_SEC: u64 = 1_000_000_000;
+
+/// The largest rate the Clock Error Bound is modelled to grow at, in parts per billion. A clock
+/// error of a second per second is far beyond any real error rate, and keeps the growth within
+/// 64 bits.
+pub const MAX_GROWTH_PPB: u64 = NANOS_PER_SEC;
 
 /// A struct containing the Clock Error Bound. The Clock Error Bound is the bound of error that is
 /// accumulated for a NTP packet.
@@ -19,66 +30,248 @@ use chrony_candm::reply::Tracking;
 /// Root delay - Sum of network latency accumulated across each strata.
 #[derive(Clone, Debug)]
 pub struct ClockErrorBound {
-    pub ceb: f64,
+    /// The Clock Error Bound in nanoseconds.
+    pub ceb_nanos: u64,
 }
 
 impl ClockErrorBound {
     /// Calculate the Clock Error Bound using the Tracking information from Chrony.
     pub fn from(packet: Tracking) -> ClockErrorBound {
         ClockErrorBound {
-            ceb: get_clock_error_bound(
-                f64::from(packet.current_correction),
-                f64::from(packet.root_dispersion),
-                f64::from(packet.root_delay),
+            ceb_nanos: get_clock_error_bound(
+                round_f64_nanos(f64::from(packet.current_correction).abs()),
+                round_f64_nanos(f64::from(packet.root_dispersion)),
+                round_f64_nanos(f64::from(packet.root_delay)),
             ),
         }
     }
 }
 
-/// Get the Clock Error Bound.
+/// The model of the Clock Error Bound derived from one set of tracking data from Chrony.
+///
+/// The Clock Error Bound is lowest at the time of Chrony's last update and grows linearly with the
+/// time elapsed since then. The model is computed once when new tracking data is received, so a
+/// request only needs to evaluate it at the current time:
+///
+/// CEB(t) = CEB at reference time + (t - reference time) * Growth rate
+///
+/// The model is held in integer nanoseconds and parts per billion, so that evaluating it is
+/// saturating integer arithmetic only.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct BoundModel {
+    /// The time of Chrony's last update in nanoseconds since the Unix epoch.
+    pub ref_time_nanos: u64,
+    /// The Clock Error Bound at the time of Chrony's last update in nanoseconds.
+    pub base_ceb_nanos: u64,
+    /// The rate at which the Clock Error Bound grows in parts per billion, or nanoseconds per
+    /// second. At most MAX_GROWTH_PPB.
+    pub growth_ppb: u64,
+    /// The leap status reported by Chrony.
+    pub leap_status: u16,
+}
+
+impl BoundModel {
+    /// Compute the Clock Error Bound model from the Tracking information from Chrony.
+    ///
+    /// # Arguments
+    ///
+    /// * `tracking` - The tracking information received from Chrony.
+    /// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
+    pub fn new(tracking: Tracking, max_clock_error: f64) -> BoundModel {
+        let ref_time_nanos = match tracking.ref_time.duration_since(SystemTime::UNIX_EPOCH) {
+            Ok(d) => d.as_nanos() as u64,
+            Err(_) => 0,
+        };
+        BoundModel {
+            ref_time_nanos,
+            base_ceb_nanos: ClockErrorBound::from(tracking).ceb_nanos,
+            growth_ppb: error_rate_ppb(&tracking, max_clock_error),
+            leap_status: tracking.leap_status,
+        }
+    }
+
+    /// The model served before chronyd first reports being synchronized. The Clock Error Bound
+    /// is unbounded, so the bounds span every representable time.
+    pub fn unsynchronized() -> BoundModel {
+        BoundModel {
+            ref_time_nanos: 0,
+            base_ceb_nanos: u64::MAX,
+            growth_ppb: 0,
+            leap_status: LEAP_STATUS_UNSYNCHRONIZED,
+        }
+    }
+
+    /// Evaluate the Clock Error Bound in nanoseconds at a point in time.
+    ///
+    /// Returns None if the time is before Chrony's last update, since the bound can not be
+    /// extrapolated backwards.
+    ///
+    /// # Arguments
+    ///
+    /// * `time_nanos` - The time in nanoseconds since the Unix epoch.
+    pub fn ceb_nanos_at(&self, time_nanos: u64) -> Option<u64> {
+        let elapsed_nanos = time_nanos.checked_sub(self.ref_time_nanos)?;
+        Some(
+            self.base_ceb_nanos
+                .saturating_add(growth_nanos(elapsed_nanos, self.growth_ppb)),
+        )
+    }
+}
+
+/// Get the growth of the Clock Error Bound over a duration in nanoseconds, rounded up to the next
+/// nanosecond.
+///
+/// The duration is split into whole seconds and the nanoseconds remaining, so that the product
+/// stays within 64 bits and the division is by a constant.
+///
+/// # Arguments
+/// * `elapsed_nanos` - The duration in nanoseconds.
+/// * `growth_ppb` - The rate the Clock Error Bound grows at in parts per billion, at most
+/// MAX_GROWTH_PPB.
+pub fn growth_nanos(elapsed_nanos: u64, growth_ppb: u64) -> u64 {
+    let growth_ppb = growth_ppb.min(MAX_GROWTH_PPB);
+    let secs = elapsed_nanos / NANOS_PER_SEC;
+    let remaining = elapsed_nanos % NANOS_PER_SEC;
+    // remaining * growth_ppb is below NANOS_PER_SEC * MAX_GROWTH_PPB, 10^18
+    let growth_remaining = (remaining * growth_ppb + NANOS_PER_SEC - 1) / NANOS_PER_SEC;
+    secs.saturating_mul(growth_ppb)
+        .saturating_add(growth_remaining)
+}
+
+/// Get the Clock Error Bound in nanoseconds.
 ///
 /// Clock Error Bound is calculated with the formula:
 /// |System time offset| + Root dispersion + (Root delay / 2)
 ///
+/// Half the root delay is rounded up, and the sum saturates rather than wraps.
+///
 /// # Arguments
-/// * `system_time_offset` - Difference between chrony's estimate of the "true time" from it's root
-/// reference and the system's clock.
-/// * `root_dispersion` - Sum of dispersion across each strata.
-/// * `root_delay` - Sum of network latency accumulated across each strata.
+/// * `system_time_offset_nanos` - The absolute difference between chrony's estimate of the "true
+/// time" from it's root reference and the system's clock, in nanoseconds.
+/// * `root_dispersion_nanos` - Sum of dispersion across each strata, in nanoseconds.
+/// * `root_delay_nanos` - Sum of network latency accumulated across each strata, in nanoseconds.
 pub fn get_clock_error_bound(
-    system_time_offset: f64,
-    root_dispersion: f64,
-    root_delay: f64,
-) -> f64 {
-    round_f64_nanos(system_time_offset.abs() + root_dispersion + (root_delay / 2_f64))
+    system_time_offset_nanos: u64,
+    root_dispersion_nanos: u64,
+    root_delay_nanos: u64,
+) -> u64 {
+    system_time_offset_nanos
+        .saturating_add(root_dispersion_nanos)
+        .saturating_add(root_delay_nanos / 2 + root_delay_nanos % 2)
 }
 
-/// Round a f64 to nanosecond precision.
+/// Round a f64 number of seconds to the nearest nanosecond.
 ///
 /// A ChronyFloat as defined by Chrony can introduce some loss when converting from a f64.
 /// However, the loss is in a value of precision that is not needed by ClockBound. Since ClockBound
 /// provides bounds in the nanosecond accuracy this extra loss in precision can be ignored by
-/// rounding to the nearest nanosecond.
+/// rounding to the nearest nanosecond. Negative values and NaN are 0, and values too large for a
+/// u64 saturate.
 ///
 /// # Arguments
-/// * `value` - A f64 value to round to the nearest nanosecond.
-pub fn round_f64_nanos(value: f64) -> f64 {
-    (value * 1000000000.0).round() / 1000000000.0
+/// * `value` - A f64 value in seconds to round to the nearest nanosecond.
+pub fn round_f64_nanos(value: f64) -> u64 {
+    // Casting a float to an integer saturates, and maps NaN to 0
+    (value * NANOS_PER_SEC as f64).round() as u64
+}
+
+/// Convert a rate in parts per million to parts per billion, rounded up so that the bound is never
+/// modelled to grow slower than the rate. Negative rates and NaN are 0, and the rate is at most
+/// MAX_GROWTH_PPB.
+///
+/// # Arguments
+/// * `ppm` - The rate in parts per million.
+pub fn ppm_to_ppb(ppm: f64) -> u64 {
+    ((ppm * 1000.0).ceil() as u64).min(MAX_GROWTH_PPB)
 }
 
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::tracking::mock_tracking;
 
     #[test]
     fn round_f64_nanos_successful() {
         let value = round_f64_nanos(0.0000000055_f64);
-        assert_eq!(value, 0.000000006);
+        assert_eq!(value, 6);
+
+        // The value never goes negative or wraps
+        assert_eq!(round_f64_nanos(-0.5), 0);
+        assert_eq!(round_f64_nanos(f64::NAN), 0);
+        assert_eq!(round_f64_nanos(1e30), u64::MAX);
+    }
+
+    #[test]
+    fn unsynchronized_successful() {
+        let model = BoundModel::unsynchronized();
+        assert_eq!(LEAP_STATUS_UNSYNCHRONIZED, model.leap_status);
+        // The bound is unbounded at any time
+        assert_eq!(Some(u64::MAX), model.ceb_nanos_at(0));
+        assert_eq!(Some(u64::MAX), model.ceb_nanos_at(u64::MAX));
+    }
+
+    #[test]
+    fn ppm_to_ppb_successful() {
+        assert_eq!(ppm_to_ppb(1.0), 1000);
+        // Rounded up to the next part per billion
+        assert_eq!(ppm_to_ppb(0.0121), 13);
+        assert_eq!(ppm_to_ppb(-3.0), 0);
+        assert_eq!(ppm_to_ppb(f64::NAN), 0);
+        assert_eq!(ppm_to_ppb(1e12), MAX_GROWTH_PPB);
+    }
+
+    #[test]
+    fn growth_nanos_successful() {
+        assert_eq!(growth_nanos(5 * NANOS_PER_SEC, 1000), 5000);
+        // A partial nanosecond of growth is rounded up
+        assert_eq!(growth_nanos(1, 1000), 1);
+        assert_eq!(growth_nanos(1_500_000_000, 1001), 1502);
+        assert_eq!(growth_nanos(0, 1000), 0);
+        // The growth does not wrap, and the rate is clamped
+        assert_eq!(growth_nanos(u64::MAX, MAX_GROWTH_PPB), u64::MAX);
+        assert_eq!(growth_nanos(NANOS_PER_SEC, u64::MAX), MAX_GROWTH_PPB);
+    }
+
+    #[test]
+    fn bound_model_successful() {
+        let tracking = mock_tracking();
+        let max_clock_error: f64 = 1.0;
+        let model = BoundModel::new(tracking, max_clock_error);
+
+        // At the reference time the bound is the Clock Error Bound of the tracking data
+        let ceb_nanos = ClockErrorBound::from(tracking).ceb_nanos;
+        assert_eq!(model.base_ceb_nanos, ceb_nanos);
+        assert_eq!(
+            model.ceb_nanos_at(model.ref_time_nanos),
+            Some(model.base_ceb_nanos)
+        );
+
+        // Validate the bound has grown by the error rate for a 5 second duration
+        let dur_secs: u64 = 5;
+        let expected_growth = dur_secs * error_rate_ppb(&tracking, max_clock_error);
+        assert_eq!(
+            model.ceb_nanos_at(model.ref_time_nanos + dur_secs * 1_000_000_000),
+            Some(model.base_ceb_nanos + expected_growth)
+        );
+
+        // The bound can not be evaluated before the reference time
+        assert_eq!(model.ceb_nanos_at(model.ref_time_nanos - 1), None);
+
+        // The bound saturates rather than wraps long after the reference time
+        let model = BoundModel {
+            base_ceb_nanos: u64::MAX - 10,
+            ..model
+        };
+        assert_eq!(model.ceb_nanos_at(u64::MAX), Some(u64::MAX));
     }
 
     #[test]
     fn get_clock_error_bound_successful() {
-        let ceb = get_clock_error_bound(0.0002_f64, 0.0001_f64, 0.0004_f64);
-        assert_eq!(ceb, 0.0005_f64);
+        let ceb = get_clock_error_bound(200_000, 100_000, 400_000);
+        assert_eq!(ceb, 500_000);
+
+        // Half the root delay is rounded up
+        assert_eq!(get_clock_error_bound(1, 2, 5), 6);
+        assert_eq!(get_clock_error_bound(u64::MAX, 1, 1), u64::MAX);
     }
 }
@@ -1,67 +1,302 @@
 // Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
 // SPDX-License-Identifier: GPL-2.0-only
-use chrony_candm::blocking_query;
-use chrony_candm::reply::{ReplyBody, Tracking};
-use chrony_candm::request::RequestBody;
-use chrony_candm::ClientOptions;
-use log::{error, warn};
-use std::net::{Ipv6Addr, SocketAddr, SocketAddrV6};
+use crate::ceb::BoundModel;
+use crate::cmdmon;
+use crate::history::{HistoryRecord, HistoryWriter, HISTORY_FLAG_ERROR, HISTORY_FLAG_POLL_FAILED};
+use crate::metrics::Metrics;
+use crate::realtime::ThreadPolicy;
+use crate::schedule::{PollIntervals, PollSchedule};
+use crate::shm::ShmWriter;
+use crate::snapshot::SharedSnapshot;
+use crate::source::TrackingSource;
+use crate::subscribers::Subscribers;
+use chrony_candm::reply::Tracking;
+use log::{error, info, warn};
+use std::cell::{Cell, RefCell};
+use std::fs;
+use std::io;
+use std::net::{Ipv4Addr, Ipv6Addr, SocketAddr, SocketAddrV6, UdpSocket};
+use std::os::unix::fs::PermissionsExt;
+use std::os::unix::net::UnixDatagram;
+use std::path::PathBuf;
 use std::str::FromStr;
-use std::time::SystemTime;
-use tokio::sync::watch::Sender;
-
-/// The interval in seconds that we attempt to get an initial poll from chrony.
-pub const CHRONY_TRACKING_INITIALIZE_INTERVAL: u64 = 10;
-
-/// The interval in seconds that the chrony poller thread runs
-pub const CHRONY_POLL_INTERVAL: u64 = 1;
+use std::sync::Arc;
+use std::time::{Duration, Instant, SystemTime};
 
 /// A leap status value of 3 means unsynchronized.
 pub const LEAP_STATUS_UNSYNCHRONIZED: u16 = 3;
 
-/// Poll chronyd for tracking information.
-pub fn poll() -> Option<Tracking> {
-    let request_body = RequestBody::Tracking;
+/// The interval an initial poll to chronyd is first retried at. The interval doubles on every
+/// retry, up to the initialize interval.
+pub const INITIALIZE_MIN_INTERVAL: Duration = Duration::from_millis(1);
 
-    // Chrony by default can be communicated with via localhost on port 323
-    let server_addr = SocketAddr::V6(SocketAddrV6::new(
-        Ipv6Addr::from_str("::1").unwrap(),
-        323,
-        0,
-        0,
-    ));
-    let result = blocking_query(request_body, ClientOptions::default(), &server_addr);
+/// The shortest time between two logs of a failed initial poll.
+pub const INITIALIZE_LOG_INTERVAL: Duration = Duration::from_secs(10);
+
+/// The number of times a request to chronyd is sent before a poll fails.
+pub const CHRONY_REQUEST_TRIES: usize = 3;
+
+/// The path of chronyd's Unix command socket.
+pub const CHRONYD_SOCKET_PATH: &str = "/var/run/chrony/chronyd.sock";
+
+/// Where chronyd's commands are sent to.
+#[derive(Clone, Debug)]
+pub enum ChronyServer {
+    /// chronyd's command port.
+    Udp(SocketAddr),
+    /// chronyd's Unix command socket.
+    Unix(PathBuf),
+}
+
+/// The socket a ChronyClient sends its requests on, kept open from one poll to the next.
+enum CmdmonSocket {
+    Udp(UdpSocket),
+    /// A socket bound to a file next to chronyd's Unix command socket, which chronyd replies to.
+    /// The file is removed when the socket is dropped.
+    Unix(UnixDatagram, PathBuf),
+}
+
+impl CmdmonSocket {
+    /// Create a socket connected to chronyd, that waits up to `timeout` for a reply.
+    fn connect(server: &ChronyServer, timeout: Duration) -> Result<CmdmonSocket, io::Error> {
+        let socket = match server {
+            ChronyServer::Udp(addr) => {
+                let local: SocketAddr = match addr {
+                    SocketAddr::V4(_) => (Ipv4Addr::UNSPECIFIED, 0).into(),
+                    SocketAddr::V6(_) => (Ipv6Addr::UNSPECIFIED, 0).into(),
+                };
+                let socket = UdpSocket::bind(local)?;
+                socket.connect(addr)?;
+                CmdmonSocket::Udp(socket)
+            }
+            ChronyServer::Unix(path) => {
+                let client_path =
+                    path.with_file_name(format!("clockboundd.{}.sock", std::process::id()));
+                let _ = fs::remove_file(&client_path);
+                let socket = UnixDatagram::bind(&client_path)?;
+                // chronyd runs as its own user, and must be able to write its replies
+                let connected =
+                    fs::set_permissions(&client_path, fs::Permissions::from_mode(0o666))
+                        .and_then(|_| socket.connect(path));
+                if let Err(e) = connected {
+                    let _ = fs::remove_file(&client_path);
+                    return Err(e);
+                }
+                CmdmonSocket::Unix(socket, client_path)
+            }
+        };
+        socket.set_read_timeout(timeout)?;
+        Ok(socket)
+    }
+
+    fn send(&self, buf: &[u8]) -> Result<usize, io::Error> {
+        match self {
+            CmdmonSocket::Udp(socket) => socket.send(buf),
+            CmdmonSocket::Unix(socket, _) => socket.send(buf),
+        }
+    }
 
-    match result {
-        Err(e) => {
-            error!("No reply from chronyd. Is it running? Error: {:?}", e);
-            None
+    fn recv(&self, buf: &mut [u8]) -> Result<usize, io::Error> {
+        match self {
+            CmdmonSocket::Udp(socket) => socket.recv(buf),
+            CmdmonSocket::Unix(socket, _) => socket.recv(buf),
         }
-        Ok(reply) => {
-            if let ReplyBody::Tracking(body) = reply.body {
-                Some(body)
-            } else {
+    }
+
+    fn set_read_timeout(&self, timeout: Duration) -> Result<(), io::Error> {
+        match self {
+            CmdmonSocket::Udp(socket) => socket.set_read_timeout(Some(timeout)),
+            CmdmonSocket::Unix(socket, _) => socket.set_read_timeout(Some(timeout)),
+        }
+    }
+}
+
+impl Drop for CmdmonSocket {
+    fn drop(&mut self) {
+        if let CmdmonSocket::Unix(_, path) = self {
+            let _ = fs::remove_file(path);
+        }
+    }
+}
+
+/// A client polling chronyd for tracking information.
+///
+/// The client keeps one socket open, so that a poll costs a single send and receive unless chronyd
+/// does not reply in time. A socket that fails, rather than times out, is set up again on the next
+/// poll, for example to reach a restarted chronyd on its Unix command socket.
+pub struct ChronyClient {
+    /// Where chronyd's commands are sent to.
+    server: ChronyServer,
+    /// How long to wait for chronyd to reply before sending the request again.
+    timeout: Duration,
+    /// The socket the requests are sent on, or None until the next poll sets it up.
+    socket: RefCell<Option<CmdmonSocket>>,
+    /// The sequence number of the last request, that chronyd echoes in its reply.
+    sequence: Cell<u32>,
+}
+
+impl ChronyClient {
+    /// Create a client polling chronyd.
+    ///
+    /// # Arguments
+    ///
+    /// * `unix_socket` - Whether to send requests to chronyd's Unix command socket rather than to
+    /// its command port on localhost. The Unix command socket is only accessible to root and the
+    /// chrony user.
+    /// * `timeout` - How long to wait for chronyd to reply before sending the request again. A poll
+    /// fails after CHRONY_REQUEST_TRIES requests without a reply.
+    pub fn new(unix_socket: bool, timeout: Duration) -> ChronyClient {
+        // Chrony by default can be communicated with via localhost on port 323
+        let server = match unix_socket {
+            true => ChronyServer::Unix(PathBuf::from(CHRONYD_SOCKET_PATH)),
+            false => ChronyServer::Udp(SocketAddr::V6(SocketAddrV6::new(
+                Ipv6Addr::from_str("::1").unwrap(),
+                323,
+                0,
+                0,
+            ))),
+        };
+        ChronyClient::with_server(server, timeout)
+    }
+
+    /// Create a client polling chronyd at a defined address.
+    ///
+    /// # Arguments
+    ///
+    /// * `server` - Where chronyd's commands are sent to.
+    /// * `timeout` - How long to wait for chronyd to reply before sending the request again.
+    pub fn with_server(server: ChronyServer, timeout: Duration) -> ChronyClient {
+        // Replies to the requests of an earlier run of ClockBoundD are unlikely to match
+        let sequence = SystemTime::now()
+            .duration_since(SystemTime::UNIX_EPOCH)
+            .map_or(0, |d| d.subsec_nanos());
+        ChronyClient {
+            server,
+            timeout,
+            socket: RefCell::new(None),
+            sequence: Cell::new(sequence),
+        }
+    }
+
+    /// Send a tracking request to chronyd, setting up the socket first if needed.
+    fn query(&self) -> Result<Tracking, io::Error> {
+        let socket = match self.socket.take() {
+            Some(socket) => socket,
+            None => CmdmonSocket::connect(&self.server, self.timeout)?,
+        };
+        let result = self.query_on(&socket);
+        // A socket that failed is dropped. Timing out or an invalid reply says nothing about it.
+        match &result {
+            Err(e) if !is_timeout(e) && e.kind() != io::ErrorKind::InvalidData => {}
+            _ => *self.socket.borrow_mut() = Some(socket),
+        }
+        result
+    }
+
+    /// Send a tracking request on a socket, up to CHRONY_REQUEST_TRIES times, and decode its
+    /// reply.
+    fn query_on(&self, socket: &CmdmonSocket) -> Result<Tracking, io::Error> {
+        let sequence = self.sequence.get().wrapping_add(1);
+        self.sequence.set(sequence);
+        let mut request = [0; cmdmon::TRACKING_REPLY_SIZE];
+        let mut reply = [0; 2 * cmdmon::TRACKING_REPLY_SIZE];
+        // Set if the read timeout was shortened to wait out the rest of an attempt
+        let mut shortened = false;
+
+        for attempt in 0..CHRONY_REQUEST_TRIES {
+            if shortened {
+                socket.set_read_timeout(self.timeout)?;
+                shortened = false;
+            }
+            cmdmon::tracking_request(sequence, attempt as u16, &mut request);
+            socket.send(&request)?;
+            let deadline = Instant::now() + self.timeout;
+            loop {
+                let size = match socket.recv(&mut reply) {
+                    Ok(size) => size,
+                    Err(e) if is_timeout(&e) => break,
+                    Err(e) => return Err(e),
+                };
+                if cmdmon::reply_sequence(&reply[..size]) == Some(sequence) {
+                    return cmdmon::decode_tracking(&reply[..size]);
+                }
+                // A late reply to an earlier request. Wait out the rest of this attempt.
+                let remaining = deadline.saturating_duration_since(Instant::now());
+                if remaining.is_zero() {
+                    break;
+                }
+                socket.set_read_timeout(remaining)?;
+                shortened = true;
+            }
+        }
+        if shortened {
+            socket.set_read_timeout(self.timeout)?;
+        }
+        Err(io::Error::new(
+            io::ErrorKind::TimedOut,
+            format!("No reply after {} requests", CHRONY_REQUEST_TRIES),
+        ))
+    }
+}
+
+/// Whether an error is a receive timing out.
+fn is_timeout(e: &io::Error) -> bool {
+    e.kind() == io::ErrorKind::WouldBlock || e.kind() == io::ErrorKind::TimedOut
+}
+
+impl TrackingSource for ChronyClient {
+    /// Poll chronyd for tracking information.
+    fn poll(&self) -> Option<Tracking> {
+        match self.query() {
+            Ok(tracking) => Some(tracking),
+            Err(e) if e.kind() == io::ErrorKind::InvalidData => {
                 error!(
-                    "Reply from chronyd was invalid. Expected tracking data. Reply: {:?}",
-                    reply
+                    "Reply from chronyd was invalid. Expected tracking data. Error: {}",
+                    e
                 );
                 None
             }
+            Err(e) => {
+                error!("No reply from chronyd. Is it running? Error: {:?}", e);
+                None
+            }
         }
     }
 }
 
-/// Initialize tracking information from a poll to Chrony.
+/// Initialize tracking information from a poll to the tracking source, chronyd by default.
+///
+/// ClockBoundD serves unsynchronized responses until chronyd first reports being synchronized,
+/// since until then there is no tracking information to work with. The source is polled again
+/// with an exponential backoff, starting from INITIALIZE_MIN_INTERVAL, so that ClockBoundD is
+/// ready shortly after chronyd synchronizes however long chronyd took to start.
+///
+/// # Arguments
+///
+/// * `source` - The source polled for tracking information.
+/// * `metrics` - The metrics that every poll of the source is recorded into.
+/// * `initialize_interval` - The longest interval that an initial poll is retried at.
 ///
-/// We need to initialize tracking information from a poll to chrony at least once before we can
-/// start sending responses to clients. This ensures that chrony is running at startup and that
-/// we can get initial tracking information to work with.
-pub fn initialize_tracking() -> Tracking {
+/// Returns the tracking information, and how long the poll that received it took.
+pub fn initialize_tracking(
+    source: &dyn TrackingSource,
+    metrics: &Metrics,
+    initialize_interval: Duration,
+) -> (Tracking, Duration) {
+    let mut delay = INITIALIZE_MIN_INTERVAL.min(initialize_interval);
+    // The retries are logged at most once per INITIALIZE_LOG_INTERVAL, so that polling often does
+    // not spam the logs while we wait for Chrony to startup
+    let mut last_logged: Option<Instant> = None;
     loop {
-        // Do an initial poll to initialize the tracking data before starting the Chrony poller
-        // thread
-        let result = poll();
+        let polled = Instant::now();
+        let result = source.poll();
+        let latency = polled.elapsed();
+        metrics.poller().count_poll(latency, result.is_none());
 
+        let log = match last_logged {
+            Some(logged) => logged.elapsed() >= INITIALIZE_LOG_INTERVAL,
+            None => true,
+        };
         match result {
             Some(tracking) => {
                 // When chronyd starts it takes a few seconds to initially synchronize. This check
@@ -69,72 +304,423 @@ pub fn initialize_tracking() -> Tracking {
                 // considered initialized. Otherwise there is a brief period when chronyd starts
                 // that all tracking information will be default values.
                 if tracking.leap_status != LEAP_STATUS_UNSYNCHRONIZED {
-                    return tracking;
+                    return (tracking, latency);
+                }
+                if log {
+                    warn!(
+                        "chronyd is reporting as unsynchronized. Serving unsynchronized responses \
+                     until chronyd is synchronized. Retrying..."
+                    );
+                    last_logged = Some(polled);
+                }
+            }
+            None => {
+                if log {
+                    error!("Unable to initialize tracking information from Chrony.");
+                    last_logged = Some(polled);
                 }
-                warn!(
-                    "chronyd is reporting as unsynchronized. Starting clockboundd requires chronyd \
-                 to be synchronized. Retrying..."
-                );
             }
-            None => error!("Unable to initialize tracking information from Chrony."),
         };
 
-        // Sleep and retry. We don't want to constantly spam the logs with errors while we wait for
-        // Chrony to startup.
-        std::thread::sleep(std::time::Duration::from_secs(
-            CHRONY_TRACKING_INITIALIZE_INTERVAL,
-        ));
+        std::thread::sleep(delay);
+        delay = delay.saturating_mul(2).min(initialize_interval);
     }
 }
 
 /// Start the Chrony poller thread.
-/// This thread obtains the tracking information from Chrony every second by default.
+/// This thread first initializes the tracking information, then obtains it from Chrony shortly
+/// after each update chronyd is expected to apply, as scheduled by PollSchedule.
 ///
 /// # Arguments
 ///
-/// * `tx_tracking` - A tokio::sync::watch::channel sender handle that is used for sending Chrony
-/// tracking information to the main thread.
-/// * `tx_error_flag` - A tokio::sync::watch::channel sender handle that is used for sending an
-/// error flag, indicating that the last Chrony poll failed, to the main thread.
-pub fn start_chrony_poller(tx_tracking: Sender<Tracking>, tx_error_flag: Sender<bool>) {
-    std::thread::spawn(move || loop {
-        let result = poll();
-
-        // If an error happens when polling Chrony, or attempting to send the tracking data to the
-        // main thread, update the error_flag to true.
-        let error_flag = match result {
-            Some(tracking) => {
-                // If chronyd is restarted it will report default values until it first syncs to a
-                // source. If chronyd is reporting ref time as the Unix Epoch, then do not send
-                // tracking information to clockboundd's main thread. This lets clockboundd continue
-                // to use the last set of valid tracking data from chronyd instead of having the
-                // clock error bound jump up until chronyd syncs to a source.
-                if tracking.ref_time != SystemTime::UNIX_EPOCH {
-                    // Send tracking data to the main thread
-                    match tx_tracking.send(tracking.clone()) {
-                        Ok(..) => false,
-                        Err(e) => {
-                            error!("Unable to send tracking data to main thread: {:?}", e);
-                            true
-                        }
+/// * `source` - The source polled for tracking information, chronyd by default.
+/// * `snapshot` - The snapshot that the Clock Error Bound model computed from Chrony tracking
+/// information, and an error flag indicating that the last Chrony poll failed, are published to
+/// for the threads handling client requests. The Chrony poller thread must be its only writer.
+/// * `shm` - The shared memory segment that the tracking information and error flag are also
+/// published to, if it could be created.
+/// * `history` - The history file that a record of every poll is appended to, if it is enabled
+/// and could be created.
+/// * `subscribers` - The subscribers of each ClockBoundD socket, that the model and error flag are
+/// pushed to whenever either changes.
+/// * `metrics` - The metrics that every poll of the source is recorded into.
+/// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
+/// * `intervals` - The intervals that Chrony is polled at.
+/// * `initialize_interval` - The longest interval that an initial poll is retried at.
+/// * `policy` - How the Chrony poller thread is scheduled.
+pub fn start_chrony_poller(
+    source: Box<dyn TrackingSource + Send>,
+    snapshot: Arc<SharedSnapshot>,
+    shm: Option<ShmWriter>,
+    history: Option<HistoryWriter>,
+    subscribers: Vec<Arc<Subscribers>>,
+    metrics: Arc<Metrics>,
+    max_clock_error: f64,
+    intervals: PollIntervals,
+    initialize_interval: Duration,
+    policy: ThreadPolicy,
+) {
+    std::thread::spawn(move || {
+        policy.apply("Chrony poller thread");
+
+        // The model and error flag last pushed to subscribers. Subscribers evaluate the bounds
+        // locally from the model, so an update is only pushed when one of them changes.
+        let initial = snapshot.load();
+        let mut last_pushed = (initial.model, initial.error_flag);
+
+        let (tracking, latency) =
+            initialize_tracking(source.as_ref(), &metrics, initialize_interval);
+        info!("Initialized tracking information from Chrony");
+        snapshot.publish(BoundModel::new(tracking, max_clock_error), false);
+        if let Some(shm) = &shm {
+            shm.publish(&tracking, false, max_clock_error);
+        }
+        if let Some(history) = &history {
+            append_history(history, &snapshot, &tracking, latency, 0);
+        }
+        push_to_subscribers(&snapshot, &subscribers, &mut last_pushed);
+
+        // The last valid tracking data. Published to the shared memory segment alongside the
+        // error flag when a poll fails, mirroring what the requests are answered from in that
+        // case.
+        let mut last_tracking = tracking;
+        let mut schedule = PollSchedule::new(intervals);
+        // Tracking was initialized with a poll, so wait for chronyd's next update
+        let mut delay = schedule.next_poll(Some(&tracking), SystemTime::now());
+
+        loop {
+            std::thread::sleep(delay);
+            let polled = Instant::now();
+            let result = source.poll();
+            let latency = polled.elapsed();
+            metrics.poller().count_poll(latency, result.is_none());
+            delay = schedule.next_poll(result.as_ref(), SystemTime::now());
+            let poll_failed = result.is_none();
+
+            // If an error happens when polling Chrony, publish the error flag as true. The
+            // threads handling requests keep using the last valid model in that case.
+            let error_flag = match result {
+                Some(tracking) => {
+                    // If chronyd is restarted it will report default values until it first syncs
+                    // to a source. If chronyd is reporting ref time as the Unix Epoch, then do not
+                    // send tracking information to clockboundd's main thread. This lets
+                    // clockboundd continue to use the last set of valid tracking data from
+                    // chronyd instead of having the clock error bound jump up until chronyd syncs
+                    // to a source.
+                    if tracking.ref_time != SystemTime::UNIX_EPOCH {
+                        last_tracking = tracking;
+                        // Compute the Clock Error Bound model once per poll and publish it
+                        // together with the error flag, so that a request never sees one without
+                        // the other
+                        snapshot.publish(BoundModel::new(tracking, max_clock_error), false);
+                        false
+                    } else {
+                        warn!(
+                            "chronyd has not synced to a source since starting. Calculating error \
+                        locally until chronyd synchronizes."
+                        );
+                        snapshot.publish_error_flag(true);
+                        true
                     }
-                } else {
-                    warn!(
-                        "chronyd has not synced to a source since starting. Calculating error \
-                    locally until chronyd synchronizes."
-                    );
+                }
+                None => {
+                    snapshot.publish_error_flag(true);
                     true
                 }
+            };
+
+            // Publish to clients reading the shared memory segment directly
+            if let Some(shm) = &shm {
+                shm.publish(&last_tracking, error_flag, max_clock_error);
             }
-            None => true,
-        };
 
-        // Send error flag to the main thread
-        match tx_error_flag.send(error_flag.clone()) {
-            Ok(..) => (),
-            Err(e) => error!("Unable to send Chrony error flag to main thread: {:?}", e),
-        }
+            // Record the poll, so that a change of the bounds can be explained afterwards
+            if let Some(history) = &history {
+                let mut flags = 0;
+                if error_flag {
+                    flags |= HISTORY_FLAG_ERROR;
+                }
+                if poll_failed {
+                    flags |= HISTORY_FLAG_POLL_FAILED;
+                }
+                append_history(history, &snapshot, &last_tracking, latency, flags);
+            }
 
-        std::thread::sleep(std::time::Duration::from_secs(CHRONY_POLL_INTERVAL));
+            push_to_subscribers(&snapshot, &subscribers, &mut last_pushed);
+        }
     });
 }
+
+/// Append the record of a poll to the history file, with the Clock Error Bound of the published
+/// model at the current time.
+///
+/// # Arguments
+///
+/// * `history` - The history file.
+/// * `snapshot` - The snapshot the model was published to.
+/// * `tracking` - The tracking information received from Chrony, or the last received if the
+/// poll failed.
+/// * `latency` - How long the poll took.
+/// * `flags` - HISTORY_FLAG_ERROR and HISTORY_FLAG_POLL_FAILED.
+fn append_history(
+    history: &HistoryWriter,
+    snapshot: &SharedSnapshot,
+    tracking: &Tracking,
+    latency: Duration,
+    flags: u32,
+) {
+    let now = SystemTime::now();
+    let model = snapshot.load().model;
+    let now_nanos = match now.duration_since(SystemTime::UNIX_EPOCH) {
+        Ok(d) => d.as_nanos() as u64,
+        Err(_) => 0,
+    };
+    let ceb_nanos = model
+        .ceb_nanos_at(now_nanos)
+        .unwrap_or(model.base_ceb_nanos);
+    history.append(&HistoryRecord::new(
+        now, tracking, ceb_nanos, latency, flags,
+    ));
+}
+
+/// Push the model and error flag of the snapshot to subscribed clients, if either changed since
+/// they were last pushed.
+///
+/// # Arguments
+///
+/// * `snapshot` - The snapshot of the model and error flag.
+/// * `subscribers` - The subscribers of each ClockBoundD socket.
+/// * `last_pushed` - The model and error flag last pushed, updated if they are pushed.
+fn push_to_subscribers(
+    snapshot: &SharedSnapshot,
+    subscribers: &[Arc<Subscribers>],
+    last_pushed: &mut (BoundModel, bool),
+) {
+    let current = snapshot.load();
+    if (current.model, current.error_flag) != *last_pushed {
+        *last_pushed = (current.model, current.error_flag);
+        let now = Instant::now();
+        for socket_subscribers in subscribers {
+            socket_subscribers.publish(&current.model, current.error_flag, now);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::chrony_poller::{
+        initialize_tracking, ChronyClient, ChronyServer, CHRONY_REQUEST_TRIES,
+        LEAP_STATUS_UNSYNCHRONIZED,
+    };
+    use crate::cmdmon;
+    use crate::metrics::Metrics;
+    use crate::source::TrackingSource;
+    use crate::tracking::mock_tracking;
+    use byteorder::{ByteOrder, NetworkEndian};
+    use chrony_candm::reply::Tracking;
+    use std::cell::Cell;
+    use std::net::UdpSocket;
+    use std::os::unix::net::UnixDatagram;
+    use std::sync::atomic::Ordering;
+    use std::time::{Duration, Instant, SystemTime};
+
+    /// The reference time of the replies of the fake chronyd.
+    const REF_SECS: u64 = 1_700_000_000;
+
+    /// How long the clients of the tests wait for a reply.
+    const TIMEOUT: Duration = Duration::from_millis(50);
+
+    /// Read the attempt and sequence number of a tracking request.
+    fn decode_request(request: &[u8]) -> (u16, u32) {
+        assert_eq!(cmdmon::TRACKING_REPLY_SIZE, request.len());
+        assert_eq!(
+            cmdmon::REQ_TRACKING,
+            NetworkEndian::read_u16(&request[4..6])
+        );
+        (
+            NetworkEndian::read_u16(&request[6..8]),
+            NetworkEndian::read_u32(&request[8..12]),
+        )
+    }
+
+    fn udp_chronyd() -> UdpSocket {
+        let server = UdpSocket::bind("127.0.0.1:0").unwrap();
+        server
+            .set_read_timeout(Some(Duration::from_secs(10)))
+            .unwrap();
+        server
+    }
+
+    fn ref_time() -> SystemTime {
+        SystemTime::UNIX_EPOCH + Duration::new(REF_SECS, 500_000_000)
+    }
+
+    /// A source that fails its first polls, then reports being unsynchronized, then synchronized.
+    struct StartingSource {
+        polls: Cell<usize>,
+        failures: usize,
+        unsynchronized: usize,
+    }
+
+    impl TrackingSource for StartingSource {
+        fn poll(&self) -> Option<Tracking> {
+            let poll = self.polls.get();
+            self.polls.set(poll + 1);
+            if poll < self.failures {
+                return None;
+            }
+            let mut tracking = mock_tracking();
+            if poll < self.failures + self.unsynchronized {
+                tracking.leap_status = LEAP_STATUS_UNSYNCHRONIZED;
+            }
+            Some(tracking)
+        }
+    }
+
+    #[test]
+    fn test_chrony_client_keeps_socket() {
+        let server = udp_chronyd();
+        let client =
+            ChronyClient::with_server(ChronyServer::Udp(server.local_addr().unwrap()), TIMEOUT);
+
+        std::thread::scope(|s| {
+            let chronyd = s.spawn(|| {
+                let mut peers = Vec::new();
+                let mut request = [0; 256];
+                for _ in 0..2 {
+                    let (size, peer) = server.recv_from(&mut request).unwrap();
+                    let (_, sequence) = decode_request(&request[..size]);
+                    // A late reply to an earlier request is skipped by the client
+                    let stale = cmdmon::tracking_reply(sequence.wrapping_sub(1), 3, 0);
+                    server.send_to(&stale, peer).unwrap();
+                    let reply = cmdmon::tracking_reply(sequence, 0, REF_SECS);
+                    server.send_to(&reply, peer).unwrap();
+                    peers.push(peer);
+                }
+                peers
+            });
+            for _ in 0..2 {
+                let tracking = client.poll().unwrap();
+                assert_eq!(ref_time(), tracking.ref_time);
+                assert_eq!(0, tracking.leap_status);
+            }
+            // Both polls were sent from the same socket
+            let peers = chronyd.join().unwrap();
+            assert_eq!(peers[0], peers[1]);
+        });
+    }
+
+    #[test]
+    fn test_chrony_client_retries() {
+        let server = udp_chronyd();
+        let client =
+            ChronyClient::with_server(ChronyServer::Udp(server.local_addr().unwrap()), TIMEOUT);
+
+        // The first request is lost, the second is answered
+        std::thread::scope(|s| {
+            let chronyd = s.spawn(|| {
+                let mut request = [0; 256];
+                let (size, _) = server.recv_from(&mut request).unwrap();
+                let first = decode_request(&request[..size]);
+                let (size, peer) = server.recv_from(&mut request).unwrap();
+                let second = decode_request(&request[..size]);
+                server
+                    .send_to(&cmdmon::tracking_reply(second.1, 0, REF_SECS), peer)
+                    .unwrap();
+                (first, second)
+            });
+            assert_eq!(ref_time(), client.poll().unwrap().ref_time);
+            let (first, second) = chronyd.join().unwrap();
+            assert_eq!(0, first.0);
+            assert_eq!((1, first.1), second);
+        });
+
+        // chronyd does not reply at all
+        let started = Instant::now();
+        assert!(client.poll().is_none());
+        assert!(started.elapsed() >= TIMEOUT * CHRONY_REQUEST_TRIES as u32);
+    }
+
+    #[test]
+    fn test_chrony_client_unix_restart() {
+        let dir = std::env::temp_dir().join(format!("clockboundd-chrony-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("chronyd.sock");
+        let client_path = dir.join(format!("clockboundd.{}.sock", std::process::id()));
+        let client = ChronyClient::with_server(ChronyServer::Unix(path.clone()), TIMEOUT);
+
+        let answer = |server: &UnixDatagram| {
+            let mut request = [0; 256];
+            let (size, peer) = server.recv_from(&mut request).unwrap();
+            let (_, sequence) = decode_request(&request[..size]);
+            let reply = cmdmon::tracking_reply(sequence, 0, REF_SECS);
+            server.send_to(&reply, peer.as_pathname().unwrap()).unwrap();
+        };
+        let chronyd = || {
+            let server = UnixDatagram::bind(&path).unwrap();
+            server
+                .set_read_timeout(Some(Duration::from_secs(10)))
+                .unwrap();
+            server
+        };
+
+        let server = chronyd();
+        std::thread::scope(|s| {
+            s.spawn(|| answer(&server));
+            assert_eq!(ref_time(), client.poll().unwrap().ref_time);
+        });
+        assert!(client_path.exists());
+
+        // chronyd restarts. The poll while it is gone fails, and the next one reaches the new
+        // chronyd.
+        drop(server);
+        std::fs::remove_file(&path).unwrap();
+        assert!(client.poll().is_none());
+        let server = chronyd();
+        std::thread::scope(|s| {
+            s.spawn(|| answer(&server));
+            assert_eq!(ref_time(), client.poll().unwrap().ref_time);
+        });
+
+        drop(client);
+        assert!(!client_path.exists());
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+
+    #[test]
+    fn test_initialize_tracking_successful() {
+        let source = StartingSource {
+            polls: Cell::new(0),
+            failures: 3,
+            unsynchronized: 3,
+        };
+        let metrics = Metrics::new(1);
+
+        let started = Instant::now();
+        let (tracking, _) = initialize_tracking(&source, &metrics, Duration::from_secs(10));
+
+        assert_ne!(LEAP_STATUS_UNSYNCHRONIZED, tracking.leap_status);
+        assert_eq!(7, source.polls.get());
+        assert_eq!(7, metrics.poller().polls.load(Ordering::Relaxed));
+        assert_eq!(3, metrics.poller().poll_failures.load(Ordering::Relaxed));
+        // The retries back off from a millisecond: 1 + 2 + 4 + 8 + 16 + 32 ms
+        assert!(started.elapsed() < Duration::from_secs(1));
+    }
+
+    #[test]
+    fn test_initialize_tracking_capped_backoff() {
+        let source = StartingSource {
+            polls: Cell::new(0),
+            failures: 0,
+            unsynchronized: 10,
+        };
+        let metrics = Metrics::new(1);
+
+        // The retries back off to the initialize interval at most, 19 ms in total rather than the
+        // 1023 ms of an uncapped backoff
+        let started = Instant::now();
+        initialize_tracking(&source, &metrics, Duration::from_millis(2));
+        assert_eq!(11, source.polls.get());
+        assert!(started.elapsed() < Duration::from_millis(500));
+    }
+}
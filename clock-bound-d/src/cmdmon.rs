@@ -0,0 +1,303 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+//! The tracking request and reply of chronyd's command and monitoring protocol, cmdmon, as laid
+//! out in chrony's candm.h.
+//!
+//! Only the tracking request is supported, so polling chronyd costs a single send and receive
+//! on a socket that stays open, rather than setting up a new session for every poll.
+use byteorder::{ByteOrder, NetworkEndian};
+use chrony_candm::common::{ChronyAddr, ChronyFloat};
+use chrony_candm::reply::Tracking;
+use std::io;
+use std::net::{IpAddr, Ipv4Addr, Ipv6Addr};
+use std::time::{Duration, SystemTime};
+
+/// The version of the cmdmon protocol.
+pub const PROTOCOL_VERSION: u8 = 6;
+
+/// The packet type of a request.
+const PKT_TYPE_CMD_REQUEST: u8 = 1;
+
+/// The packet type of a reply.
+const PKT_TYPE_CMD_REPLY: u8 = 2;
+
+/// The command of a tracking request.
+pub const REQ_TRACKING: u16 = 33;
+
+/// The reply to a tracking request.
+pub const RPY_TRACKING: u16 = 5;
+
+/// The status of a successful reply.
+const STT_SUCCESS: u16 = 0;
+
+/// The size of the header of a reply.
+const REPLY_HEADER_SIZE: usize = 28;
+
+/// The size of the body of a tracking reply.
+const TRACKING_BODY_SIZE: usize = 76;
+
+/// The size of a tracking reply. chronyd ignores requests shorter than their reply, so that it
+/// can not be used to amplify traffic, and the tracking request is padded to this size.
+pub const TRACKING_REPLY_SIZE: usize = REPLY_HEADER_SIZE + TRACKING_BODY_SIZE;
+
+/// The high 32 bits of the seconds of a timestamp sent by a chronyd without 64 bit time.
+const TV_NOHIGHSEC: u32 = 0x7fff_ffff;
+
+/// The address families of an IPAddr.
+const IPADDR_INET4: u16 = 1;
+const IPADDR_INET6: u16 = 2;
+
+/// The bits of the exponent and of the coefficient of a cmdmon float.
+const FLOAT_EXP_BITS: u32 = 7;
+const FLOAT_COEF_BITS: u32 = 32 - FLOAT_EXP_BITS;
+
+/// Write a tracking request into a buffer.
+///
+/// # Arguments
+///
+/// * `sequence` - The sequence number the reply echoes.
+/// * `attempt` - The number of times the request was sent before.
+/// * `request` - The buffer the request is written into.
+pub fn tracking_request(sequence: u32, attempt: u16, request: &mut [u8; TRACKING_REPLY_SIZE]) {
+    request.fill(0);
+    request[0] = PROTOCOL_VERSION;
+    request[1] = PKT_TYPE_CMD_REQUEST;
+    NetworkEndian::write_u16(&mut request[4..6], REQ_TRACKING);
+    NetworkEndian::write_u16(&mut request[6..8], attempt);
+    NetworkEndian::write_u32(&mut request[8..12], sequence);
+}
+
+/// Get the sequence number of a reply, or None if it is not a reply to a tracking request.
+///
+/// # Arguments
+///
+/// * `reply` - The reply received from chronyd.
+pub fn reply_sequence(reply: &[u8]) -> Option<u32> {
+    if reply.len() < REPLY_HEADER_SIZE
+        || reply[1] != PKT_TYPE_CMD_REPLY
+        || NetworkEndian::read_u16(&reply[4..6]) != REQ_TRACKING
+    {
+        return None;
+    }
+    Some(NetworkEndian::read_u32(&reply[16..20]))
+}
+
+/// Decode the reply to a tracking request.
+///
+/// # Arguments
+///
+/// * `reply` - The reply received from chronyd.
+pub fn decode_tracking(reply: &[u8]) -> Result<Tracking, io::Error> {
+    let invalid = |message: String| io::Error::new(io::ErrorKind::InvalidData, message);
+    if reply.len() < REPLY_HEADER_SIZE || reply[1] != PKT_TYPE_CMD_REPLY {
+        return Err(invalid(format!("Not a reply: {:?}", reply)));
+    }
+    if reply[0] != PROTOCOL_VERSION {
+        return Err(invalid(format!(
+            "Unsupported protocol version {}",
+            reply[0]
+        )));
+    }
+    let status = NetworkEndian::read_u16(&reply[8..10]);
+    if status != STT_SUCCESS {
+        return Err(invalid(format!("Request failed with status {}", status)));
+    }
+    let reply_type = NetworkEndian::read_u16(&reply[6..8]);
+    if reply_type != RPY_TRACKING || reply.len() < TRACKING_REPLY_SIZE {
+        return Err(invalid(format!(
+            "Expected tracking data. Reply type {}, {} bytes",
+            reply_type,
+            reply.len()
+        )));
+    }
+
+    let body = &reply[REPLY_HEADER_SIZE..TRACKING_REPLY_SIZE];
+    let float =
+        |offset: usize| ChronyFloat::from(decode_float(NetworkEndian::read_u32(&body[offset..])));
+    Ok(Tracking {
+        ref_id: NetworkEndian::read_u32(&body[0..4]),
+        ip_addr: decode_addr(&body[4..24]),
+        stratum: NetworkEndian::read_u16(&body[24..26]),
+        leap_status: NetworkEndian::read_u16(&body[26..28]),
+        ref_time: decode_timespec(&body[28..40]),
+        current_correction: float(40),
+        last_offset: float(44),
+        rms_offset: float(48),
+        freq_ppm: float(52),
+        resid_freq_ppm: float(56),
+        skew_ppm: float(60),
+        root_delay: float(64),
+        root_dispersion: float(68),
+        last_update_interval: float(72),
+    })
+}
+
+/// Decode an IPAddr: 16 bytes of address, then its family. Addresses of other families, such as
+/// the reference id of a refclock, are decoded as 0.0.0.0.
+fn decode_addr(addr: &[u8]) -> ChronyAddr {
+    let ip = match NetworkEndian::read_u16(&addr[16..18]) {
+        IPADDR_INET4 => IpAddr::from(Ipv4Addr::from(NetworkEndian::read_u32(&addr[0..4]))),
+        IPADDR_INET6 => {
+            let mut octets = [0; 16];
+            octets.copy_from_slice(&addr[0..16]);
+            IpAddr::from(Ipv6Addr::from(octets))
+        }
+        _ => IpAddr::from([0; 4]),
+    };
+    ChronyAddr::from(ip)
+}
+
+/// Decode a Timespec: the high and low 32 bits of the seconds since the Unix epoch, then the
+/// nanoseconds.
+fn decode_timespec(timespec: &[u8]) -> SystemTime {
+    let high = match NetworkEndian::read_u32(&timespec[0..4]) {
+        TV_NOHIGHSEC => 0,
+        high => high,
+    };
+    let secs = (u64::from(high) << 32) | u64::from(NetworkEndian::read_u32(&timespec[4..8]));
+    let nanos = NetworkEndian::read_u32(&timespec[8..12]) % 1_000_000_000;
+    SystemTime::UNIX_EPOCH + Duration::new(secs, nanos)
+}
+
+/// Decode a cmdmon float: a signed 7 bit exponent above a signed 25 bit coefficient.
+fn decode_float(bits: u32) -> f64 {
+    let mut exp = (bits >> FLOAT_COEF_BITS) as i32;
+    if exp >= 1 << (FLOAT_EXP_BITS - 1) {
+        exp -= 1 << FLOAT_EXP_BITS;
+    }
+    let mut coef = (bits % (1 << FLOAT_COEF_BITS)) as i32;
+    if coef >= 1 << (FLOAT_COEF_BITS - 1) {
+        coef -= 1 << FLOAT_COEF_BITS;
+    }
+    f64::from(coef) * 2f64.powi(exp - FLOAT_COEF_BITS as i32)
+}
+
+/// Encode a cmdmon float the way chronyd does, for values in the range of a tracking reply.
+#[cfg(test)]
+fn encode_float(x: f64) -> u32 {
+    let coef_max = (1i64 << (FLOAT_COEF_BITS - 1)) - 1;
+    let neg = i64::from(x < 0.0);
+    let x = x.abs();
+    if x < 1.0e-100 {
+        return 0;
+    }
+    let mut exp = (x.log2() + 1.0) as i32;
+    let mut coef = (x * 2f64.powi(FLOAT_COEF_BITS as i32 - exp) + 0.5) as i64;
+    while coef > coef_max + neg {
+        coef >>= 1;
+        exp += 1;
+    }
+    if neg == 1 {
+        coef = -coef;
+    }
+    ((exp as u32) << FLOAT_COEF_BITS) | (coef as u32 & ((1 << FLOAT_COEF_BITS) - 1))
+}
+
+/// Create the reply chronyd sends to a tracking request for testing, with the leap status and
+/// reference time given and typical values for the rest.
+#[cfg(test)]
+pub fn tracking_reply(sequence: u32, leap_status: u16, ref_secs: u64) -> Vec<u8> {
+    let mut reply = vec![0; TRACKING_REPLY_SIZE];
+    reply[0] = PROTOCOL_VERSION;
+    reply[1] = PKT_TYPE_CMD_REPLY;
+    NetworkEndian::write_u16(&mut reply[4..6], REQ_TRACKING);
+    NetworkEndian::write_u16(&mut reply[6..8], RPY_TRACKING);
+    NetworkEndian::write_u32(&mut reply[16..20], sequence);
+    let body = &mut reply[28..];
+    NetworkEndian::write_u32(&mut body[0..4], 0xa9fe_a97b);
+    NetworkEndian::write_u32(&mut body[4..8], 0xa9fe_a97b);
+    NetworkEndian::write_u16(&mut body[20..22], 1);
+    NetworkEndian::write_u16(&mut body[24..26], 4);
+    NetworkEndian::write_u16(&mut body[26..28], leap_status);
+    NetworkEndian::write_u32(&mut body[28..32], (ref_secs >> 32) as u32);
+    NetworkEndian::write_u32(&mut body[32..36], ref_secs as u32);
+    NetworkEndian::write_u32(&mut body[36..40], 500_000_000);
+    for (i, value) in [
+        -0.000_012, 0.000_003, 0.000_02, -7.5, 0.001, 0.05, 0.000_4, 0.000_2, 16.0,
+    ]
+    .iter()
+    .enumerate()
+    {
+        NetworkEndian::write_u32(&mut body[40 + 4 * i..], encode_float(*value));
+    }
+    reply
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::cmdmon::*;
+
+    #[test]
+    fn test_tracking_request() {
+        let mut request = [0xff; TRACKING_REPLY_SIZE];
+        tracking_request(0x0102_0304, 2, &mut request);
+        assert_eq!(
+            [6, 1, 0, 0, 0, 33, 0, 2, 1, 2, 3, 4, 0, 0, 0, 0, 0, 0, 0, 0],
+            request[..20]
+        );
+        // The padding up to the size of the reply is zeroed
+        assert!(request[20..].iter().all(|byte| *byte == 0));
+    }
+
+    #[test]
+    fn test_decode_float() {
+        for value in [0.0, 1.0, -1.0, 0.000_012, -7.5, 16.0, 123_456.789] {
+            let decoded = decode_float(encode_float(value));
+            assert!((decoded - value).abs() <= value.abs() / (1 << 23) as f64);
+        }
+        // The most negative coefficient and exponent, and the largest positive ones
+        assert_eq!(-(2f64.powi(24 - 64 - 25)), decode_float(0x8100_0000));
+        assert_eq!(16_777_215.0 * 2f64.powi(63 - 25), decode_float(0x7eff_ffff));
+    }
+
+    #[test]
+    fn test_decode_tracking() {
+        let reply = tracking_reply(7, 0, 1_700_000_000);
+        assert_eq!(Some(7), reply_sequence(&reply));
+        let tracking = decode_tracking(&reply).unwrap();
+        assert_eq!(0xa9fe_a97b, tracking.ref_id);
+        assert_eq!(
+            ChronyAddr::from(IpAddr::from([169, 254, 169, 123])),
+            tracking.ip_addr
+        );
+        assert_eq!(4, tracking.stratum);
+        assert_eq!(0, tracking.leap_status);
+        assert_eq!(
+            SystemTime::UNIX_EPOCH + Duration::new(1_700_000_000, 500_000_000),
+            tracking.ref_time
+        );
+        let close = |expected: f64, value: ChronyFloat| {
+            assert!((f64::from(value) - expected).abs() <= expected.abs() / (1 << 23) as f64);
+        };
+        close(-0.000_012, tracking.current_correction);
+        close(0.000_02, tracking.rms_offset);
+        close(-7.5, tracking.freq_ppm);
+        close(0.05, tracking.skew_ppm);
+        close(0.000_4, tracking.root_delay);
+        close(0.000_2, tracking.root_dispersion);
+        close(16.0, tracking.last_update_interval);
+
+        // Seconds past 2106 are sent in the high 32 bits
+        let reply = tracking_reply(7, 0, 1 << 32);
+        assert_eq!(
+            SystemTime::UNIX_EPOCH + Duration::new(1 << 32, 500_000_000),
+            decode_tracking(&reply).unwrap().ref_time
+        );
+    }
+
+    #[test]
+    fn test_decode_tracking_invalid() {
+        let reply = tracking_reply(7, 0, 1_700_000_000);
+        assert!(decode_tracking(&reply[..TRACKING_REPLY_SIZE - 1]).is_err());
+        let mut failed = reply.clone();
+        NetworkEndian::write_u16(&mut failed[8..10], 2);
+        assert!(decode_tracking(&failed).is_err());
+        let mut version = reply.clone();
+        version[0] = 5;
+        assert!(decode_tracking(&version).is_err());
+        let mut request = reply;
+        request[1] = 1;
+        assert_eq!(None, reply_sequence(&request));
+        assert!(decode_tracking(&request).is_err());
+    }
+}
@@ -0,0 +1,542 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+//! A history of the polls of the tracking source, kept in a memory mapped ring file.
+//!
+//! The Chrony poller thread appends a fixed size record to the ring after every poll, with the
+//! tracking data, the Clock Error Bound computed from it, the error flag and how long the poll
+//! took. Once the ring is full the oldest records are overwritten. Appending a record is a few
+//! atomic stores into the mapping: it takes no lock and allocates nothing.
+//!
+//! Readers map the file read-only and tail it without signalling ClockBoundD. Every record is
+//! guarded by its own sequence number, so that a reader detects a record that was overwritten
+//! while it was read. See PROTOCOL.md for a description of the layout.
+use chrony_candm::reply::Tracking;
+use log::{error, info};
+use std::fs::OpenOptions;
+use std::io;
+use std::os::unix::fs::{OpenOptionsExt, PermissionsExt};
+use std::os::unix::io::AsRawFd;
+use std::sync::atomic::{fence, AtomicU32, AtomicU64, Ordering};
+use std::time::{Duration, SystemTime};
+
+/// The history file for ClockBoundD
+pub const CLOCKBOUND_HISTORY_FILE: &str = "clockboundd.history";
+
+/// Magic number at the start of the history file ("CLKH").
+pub const HISTORY_MAGIC: u32 = 0x434c_4b48;
+
+/// The current layout version of the history file.
+pub const HISTORY_VERSION: u32 = 1;
+
+/// The number of records kept by default. 4 MiB of records, which is 12 days of history when
+/// chronyd updates every 16 seconds.
+pub const DEFAULT_HISTORY_RECORDS: u64 = 65536;
+
+/// Set in the flags of a record if the error flag was published after the poll.
+pub const HISTORY_FLAG_ERROR: u32 = 1 << 0;
+
+/// Set in the flags of a record if the poll failed. The tracking data of the record is then the
+/// last tracking data received.
+pub const HISTORY_FLAG_POLL_FAILED: u32 = 1 << 1;
+
+/// The header at the start of the history file.
+#[repr(C)]
+struct HistoryHeader {
+    magic: AtomicU32,
+    version: AtomicU32,
+    /// The number of records in the ring.
+    capacity: AtomicU64,
+    /// The number of records ever appended. The next record is appended at this index, modulo
+    /// the capacity.
+    head: AtomicU64,
+    reserved: [AtomicU64; 5],
+}
+
+/// The layout of a record in the history file.
+///
+/// Every field is an atomic so that readers in other processes never observe a torn value. The
+/// fields are protected as a whole by `seq`: it is 0 while the record is written, and the index
+/// of the record plus one once it is complete.
+#[repr(C)]
+struct HistorySlot {
+    seq: AtomicU64,
+    time: AtomicU64,
+    ref_time: AtomicU64,
+    ceb: AtomicU64,
+    current_correction: AtomicU32,
+    root_delay: AtomicU32,
+    root_dispersion: AtomicU32,
+    skew_ppm: AtomicU32,
+    resid_freq_ppm: AtomicU32,
+    poll_latency: AtomicU32,
+    leap_status: AtomicU32,
+    flags: AtomicU32,
+}
+
+/// A record of a poll of the tracking source.
+///
+/// The tracking data is stored in single precision, which is about the precision chronyd sends it
+/// in.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct HistoryRecord {
+    /// The time of the poll in nanoseconds since the Unix epoch.
+    pub time_nanos: u64,
+    /// The time of Chrony's last update in nanoseconds since the Unix epoch.
+    pub ref_time_nanos: u64,
+    /// The Clock Error Bound at the time of the poll in nanoseconds.
+    pub ceb_nanos: u64,
+    /// The system time offset in seconds.
+    pub current_correction: f32,
+    /// The root delay in seconds.
+    pub root_delay: f32,
+    /// The root dispersion at the time of Chrony's last update in seconds.
+    pub root_dispersion: f32,
+    /// The estimated error bound on the frequency in ppm.
+    pub skew_ppm: f32,
+    /// The residual frequency in ppm.
+    pub resid_freq_ppm: f32,
+    /// How long the poll took in nanoseconds, saturating at u32::MAX.
+    pub poll_latency_nanos: u32,
+    /// Chrony's leap status.
+    pub leap_status: u16,
+    /// HISTORY_FLAG_ERROR and HISTORY_FLAG_POLL_FAILED.
+    pub flags: u32,
+}
+
+impl HistoryRecord {
+    /// Create the record of a poll.
+    ///
+    /// # Arguments
+    ///
+    /// * `time` - The time of the poll.
+    /// * `tracking` - The tracking information received from Chrony, or the last received if
+    /// the poll failed.
+    /// * `ceb_nanos` - The Clock Error Bound at the time of the poll in nanoseconds.
+    /// * `poll_latency` - How long the poll took.
+    /// * `flags` - HISTORY_FLAG_ERROR and HISTORY_FLAG_POLL_FAILED.
+    pub fn new(
+        time: SystemTime,
+        tracking: &Tracking,
+        ceb_nanos: u64,
+        poll_latency: Duration,
+        flags: u32,
+    ) -> HistoryRecord {
+        HistoryRecord {
+            time_nanos: nanos_since_epoch(time),
+            ref_time_nanos: nanos_since_epoch(tracking.ref_time),
+            ceb_nanos,
+            current_correction: f64::from(tracking.current_correction) as f32,
+            root_delay: f64::from(tracking.root_delay) as f32,
+            root_dispersion: f64::from(tracking.root_dispersion) as f32,
+            skew_ppm: f64::from(tracking.skew_ppm) as f32,
+            resid_freq_ppm: f64::from(tracking.resid_freq_ppm) as f32,
+            poll_latency_nanos: poll_latency.as_nanos().min(u32::MAX as u128) as u32,
+            leap_status: tracking.leap_status,
+            flags,
+        }
+    }
+
+    /// Whether the error flag was published after the poll.
+    pub fn error_flag(&self) -> bool {
+        self.flags & HISTORY_FLAG_ERROR != 0
+    }
+
+    /// Whether the poll failed.
+    pub fn poll_failed(&self) -> bool {
+        self.flags & HISTORY_FLAG_POLL_FAILED != 0
+    }
+}
+
+/// A memory mapping of the history file.
+struct HistoryMap {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl HistoryMap {
+    fn map(file: &std::fs::File, len: usize, prot: libc::c_int) -> Result<HistoryMap, io::Error> {
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                prot,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(HistoryMap { ptr, len })
+    }
+
+    fn header(&self) -> &HistoryHeader {
+        unsafe { &*(self.ptr as *const HistoryHeader) }
+    }
+
+    /// The slot of a record. The index must be below the capacity of the ring.
+    fn slot(&self, index: u64) -> &HistorySlot {
+        unsafe {
+            let slots = (self.ptr as *const u8).add(std::mem::size_of::<HistoryHeader>());
+            &*(slots as *const HistorySlot).add(index as usize)
+        }
+    }
+}
+
+impl Drop for HistoryMap {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr, self.len);
+        }
+    }
+}
+
+/// The size of a history file holding a number of records.
+fn file_size(capacity: u64) -> u64 {
+    std::mem::size_of::<HistoryHeader>() as u64
+        + capacity.saturating_mul(std::mem::size_of::<HistorySlot>() as u64)
+}
+
+/// HistoryWriter owns the memory mapping of the history file and appends records to it. The
+/// Chrony poller thread must be its only writer.
+pub struct HistoryWriter {
+    map: HistoryMap,
+    capacity: u64,
+}
+
+// The mapping is only ever accessed through atomics, so the writer can be handed to the Chrony
+// poller thread.
+unsafe impl Send for HistoryWriter {}
+
+impl HistoryWriter {
+    /// Create the history file at the specified path and map it into memory.
+    ///
+    /// An existing history file of the same capacity is appended to, so that the history is kept
+    /// across restarts of ClockBoundD. Otherwise the file is cleared.
+    ///
+    /// # Arguments
+    ///
+    /// * `path` - The path of the history file.
+    /// * `capacity` - The number of records kept in the ring. Must be positive.
+    pub fn create(path: &std::path::Path, capacity: u64) -> Result<HistoryWriter, io::Error> {
+        if capacity == 0 {
+            return Err(io::Error::from_raw_os_error(libc::EINVAL));
+        }
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .mode(0o644)
+            .open(path)?;
+        let size = file_size(capacity);
+        let reuse = file.metadata()?.len() == size && {
+            let map = HistoryMap::map(&file, size as usize, libc::PROT_READ)?;
+            let header = map.header();
+            header.magic.load(Ordering::Acquire) == HISTORY_MAGIC
+                && header.version.load(Ordering::Relaxed) == HISTORY_VERSION
+                && header.capacity.load(Ordering::Relaxed) == capacity
+        };
+        if !reuse {
+            // Truncating first zeroes every record, so that no record of an older layout is read
+            file.set_len(0)?;
+            file.set_len(size)?;
+        }
+
+        // Set permissions to rw r r so that an unprivileged process can map the file for
+        // reading, regardless of the umask.
+        if let Err(e) = file.set_permissions(std::fs::Permissions::from_mode(0o644)) {
+            error!("Failed to set permissions: {}", e);
+        }
+
+        let map = HistoryMap::map(&file, size as usize, libc::PROT_READ | libc::PROT_WRITE)?;
+        let header = map.header();
+        if reuse {
+            info!(
+                "Appending to history file at path {} after {} records",
+                path.display(),
+                header.head.load(Ordering::Relaxed)
+            );
+        } else {
+            header.version.store(HISTORY_VERSION, Ordering::Relaxed);
+            header.capacity.store(capacity, Ordering::Relaxed);
+            header.head.store(0, Ordering::Relaxed);
+            // Publish the magic last, so that a reader never sees a valid magic with a stale
+            // header
+            header.magic.store(HISTORY_MAGIC, Ordering::Release);
+            info!("Created history file at path {}", path.display());
+        }
+
+        Ok(HistoryWriter { map, capacity })
+    }
+
+    /// Append a record to the ring, overwriting the oldest record once the ring is full.
+    ///
+    /// # Arguments
+    ///
+    /// * `record` - The record of a poll.
+    pub fn append(&self, record: &HistoryRecord) {
+        let header = self.map.header();
+        let index = header.head.load(Ordering::Relaxed);
+        let slot = self.map.slot(index % self.capacity);
+
+        slot.seq.store(0, Ordering::Relaxed);
+        fence(Ordering::Release);
+
+        slot.time.store(record.time_nanos, Ordering::Relaxed);
+        slot.ref_time
+            .store(record.ref_time_nanos, Ordering::Relaxed);
+        slot.ceb.store(record.ceb_nanos, Ordering::Relaxed);
+        store_f32(&slot.current_correction, record.current_correction);
+        store_f32(&slot.root_delay, record.root_delay);
+        store_f32(&slot.root_dispersion, record.root_dispersion);
+        store_f32(&slot.skew_ppm, record.skew_ppm);
+        store_f32(&slot.resid_freq_ppm, record.resid_freq_ppm);
+        slot.poll_latency
+            .store(record.poll_latency_nanos, Ordering::Relaxed);
+        slot.leap_status
+            .store(u32::from(record.leap_status), Ordering::Relaxed);
+        slot.flags.store(record.flags, Ordering::Relaxed);
+
+        slot.seq.store(index.wrapping_add(1), Ordering::Release);
+        header.head.store(index.wrapping_add(1), Ordering::Release);
+    }
+}
+
+/// HistoryReader owns a read-only memory mapping of the history file, and reads the records
+/// ClockBoundD appends to it.
+pub struct HistoryReader {
+    map: HistoryMap,
+    capacity: u64,
+}
+
+impl HistoryReader {
+    /// Map the history file at the specified path.
+    ///
+    /// # Arguments
+    ///
+    /// * `path` - The path of the history file.
+    pub fn open(path: &std::path::Path) -> Result<HistoryReader, io::Error> {
+        let file = OpenOptions::new().read(true).open(path)?;
+        let len = file.metadata()?.len();
+        if len < std::mem::size_of::<HistoryHeader>() as u64 {
+            return Err(invalid_file());
+        }
+
+        let header_map =
+            HistoryMap::map(&file, std::mem::size_of::<HistoryHeader>(), libc::PROT_READ)?;
+        let header = header_map.header();
+        let capacity = header.capacity.load(Ordering::Relaxed);
+        if header.magic.load(Ordering::Acquire) != HISTORY_MAGIC
+            || header.version.load(Ordering::Relaxed) != HISTORY_VERSION
+            || capacity == 0
+            || file_size(capacity) != len
+        {
+            return Err(invalid_file());
+        }
+
+        let map = HistoryMap::map(&file, len as usize, libc::PROT_READ)?;
+        Ok(HistoryReader { map, capacity })
+    }
+
+    /// The number of records in the ring.
+    pub fn capacity(&self) -> u64 {
+        self.capacity
+    }
+
+    /// The number of records ever appended. The records from `head() - capacity()` to `head()`
+    /// are in the ring.
+    pub fn head(&self) -> u64 {
+        self.map.header().head.load(Ordering::Acquire)
+    }
+
+    /// Read a record.
+    ///
+    /// Returns None if the record was not appended yet, was overwritten, or is being overwritten.
+    ///
+    /// # Arguments
+    ///
+    /// * `index` - The index of the record, counting every record ever appended.
+    pub fn read(&self, index: u64) -> Option<HistoryRecord> {
+        let slot = self.map.slot(index % self.capacity);
+        let seq = slot.seq.load(Ordering::Acquire);
+        if seq != index.wrapping_add(1) {
+            return None;
+        }
+
+        let record = HistoryRecord {
+            time_nanos: slot.time.load(Ordering::Relaxed),
+            ref_time_nanos: slot.ref_time.load(Ordering::Relaxed),
+            ceb_nanos: slot.ceb.load(Ordering::Relaxed),
+            current_correction: load_f32(&slot.current_correction),
+            root_delay: load_f32(&slot.root_delay),
+            root_dispersion: load_f32(&slot.root_dispersion),
+            skew_ppm: load_f32(&slot.skew_ppm),
+            resid_freq_ppm: load_f32(&slot.resid_freq_ppm),
+            poll_latency_nanos: slot.poll_latency.load(Ordering::Relaxed),
+            leap_status: slot.leap_status.load(Ordering::Relaxed) as u16,
+            flags: slot.flags.load(Ordering::Relaxed),
+        };
+        fence(Ordering::Acquire);
+        if slot.seq.load(Ordering::Relaxed) != seq {
+            return None;
+        }
+        Some(record)
+    }
+}
+
+fn invalid_file() -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, "not a ClockBoundD history file")
+}
+
+fn nanos_since_epoch(time: SystemTime) -> u64 {
+    match time.duration_since(SystemTime::UNIX_EPOCH) {
+        Ok(d) => d.as_nanos() as u64,
+        Err(_) => 0,
+    }
+}
+
+/// Store a f32 into an AtomicU32 using its IEEE 754 bit representation.
+fn store_f32(field: &AtomicU32, value: f32) {
+    field.store(value.to_bits(), Ordering::Relaxed);
+}
+
+/// Load a f32 from an AtomicU32 holding its IEEE 754 bit representation.
+fn load_f32(field: &AtomicU32) -> f32 {
+    f32::from_bits(field.load(Ordering::Relaxed))
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::history::{
+        HistoryHeader, HistoryReader, HistoryRecord, HistorySlot, HistoryWriter,
+        HISTORY_FLAG_ERROR, HISTORY_FLAG_POLL_FAILED,
+    };
+    use crate::tracking::mock_tracking;
+    use std::path::PathBuf;
+    use std::time::{Duration, SystemTime};
+
+    fn history_path(name: &str) -> PathBuf {
+        std::env::temp_dir().join(format!(
+            "clockboundd-{}-{}.history",
+            name,
+            std::process::id()
+        ))
+    }
+
+    fn record(time_nanos: u64) -> HistoryRecord {
+        let mut record = HistoryRecord::new(
+            SystemTime::UNIX_EPOCH + Duration::from_nanos(time_nanos),
+            &mock_tracking(),
+            1000,
+            Duration::from_micros(50),
+            HISTORY_FLAG_ERROR,
+        );
+        record.root_dispersion = 0.25;
+        record
+    }
+
+    #[test]
+    fn test_layout() {
+        assert_eq!(64, std::mem::size_of::<HistoryHeader>());
+        assert_eq!(64, std::mem::size_of::<HistorySlot>());
+    }
+
+    #[test]
+    fn test_record_new() {
+        let record = record(5);
+        assert_eq!(5, record.time_nanos);
+        assert_eq!(1_000_000_000_000_000_000, record.ref_time_nanos);
+        assert_eq!(1000, record.ceb_nanos);
+        assert_eq!(50_000, record.poll_latency_nanos);
+        assert!(record.error_flag());
+        assert!(!record.poll_failed());
+
+        // The poll latency saturates
+        let slow = HistoryRecord::new(
+            SystemTime::UNIX_EPOCH,
+            &mock_tracking(),
+            0,
+            Duration::from_secs(10),
+            HISTORY_FLAG_POLL_FAILED,
+        );
+        assert_eq!(u32::MAX, slow.poll_latency_nanos);
+        assert!(slow.poll_failed());
+    }
+
+    #[test]
+    fn test_append_read_successful() {
+        let path = history_path("append");
+        let writer = HistoryWriter::create(&path, 4).unwrap();
+        let reader = HistoryReader::open(&path).unwrap();
+        assert_eq!(4, reader.capacity());
+        assert_eq!(0, reader.head());
+        assert_eq!(None, reader.read(0));
+
+        writer.append(&record(1));
+        writer.append(&record(2));
+        assert_eq!(2, reader.head());
+        assert_eq!(Some(record(1)), reader.read(0));
+        assert_eq!(Some(record(2)), reader.read(1));
+        assert_eq!(None, reader.read(2));
+
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn test_append_overwrites_oldest() {
+        let path = history_path("overwrite");
+        let writer = HistoryWriter::create(&path, 4).unwrap();
+        let reader = HistoryReader::open(&path).unwrap();
+        for time in 0..6 {
+            writer.append(&record(time));
+        }
+
+        assert_eq!(6, reader.head());
+        // The first two records were overwritten by the last two
+        assert_eq!(None, reader.read(0));
+        assert_eq!(None, reader.read(1));
+        for index in 2..6 {
+            assert_eq!(Some(record(index)), reader.read(index));
+        }
+
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn test_create_keeps_history() {
+        let path = history_path("reopen");
+        let writer = HistoryWriter::create(&path, 4).unwrap();
+        writer.append(&record(1));
+        drop(writer);
+
+        // Restarting with the same capacity appends to the history
+        let writer = HistoryWriter::create(&path, 4).unwrap();
+        writer.append(&record(2));
+        let reader = HistoryReader::open(&path).unwrap();
+        assert_eq!(2, reader.head());
+        assert_eq!(Some(record(1)), reader.read(0));
+        drop(reader);
+        drop(writer);
+
+        // Restarting with another capacity clears it
+        let writer = HistoryWriter::create(&path, 8).unwrap();
+        let reader = HistoryReader::open(&path).unwrap();
+        assert_eq!(8, reader.capacity());
+        assert_eq!(0, reader.head());
+        assert_eq!(None, reader.read(0));
+        drop(writer);
+
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn test_open_invalid() {
+        let path = history_path("invalid");
+        std::fs::write(&path, [0u8; 128]).unwrap();
+        assert!(HistoryReader::open(&path).is_err());
+        std::fs::remove_file(&path).unwrap();
+
+        assert!(HistoryWriter::create(&path, 0).is_err());
+    }
+}
@@ -84,6 +84,71 @@
 //! systemctl status clockboundd
 //! ```
 //!
+//! ## Socket activation
+//!
+//! ClockBoundD binds its sockets as soon as it starts, and answers requests with unsynchronized
+//! responses, with the error response type, until chronyd first reports being synchronized. chronyd
+//! is polled with an exponential backoff from 1 ms up to the initialize interval of 100 ms in the
+//! meantime, so that ClockBoundD is ready shortly after chronyd synchronizes.
+//!
+//! ClockBoundD can also be started by systemd socket activation, so that clients can send requests
+//! before it is started. ClockBoundD serves every socket passed by systemd that is bound to the path
+//! of one of its sockets, and binds the other sockets itself.
+//!
+//! * Create unit file /usr/lib/systemd/system/clockboundd.socket with the following contents. With
+//! more than one worker, add a ListenDatagram line for every shard socket, clockboundd-<n>.sock.
+//! ```text
+//! [Unit]
+//! Description=ClockBoundD socket
+//!
+//! [Socket]
+//! ListenDatagram=/run/clockboundd/clockboundd.sock
+//! SocketMode=0777
+//! SocketUser=clockbound
+//!
+//! [Install]
+//! WantedBy=sockets.target
+//! ```
+//!
+//! * Add `Requires=clockboundd.socket` to the `[Unit]` section of clockboundd.service, and
+//! `RuntimeDirectoryPreserve=yes` to its `[Service]` section, so that the socket is not removed when
+//! ClockBoundD is restarted.
+//!
+//! * Enable the socket
+//! ```text
+//! sudo systemctl daemon-reload
+//! sudo systemctl enable --now clockboundd.socket
+//! ```
+//!
+//! ## Real-time scheduling
+//!
+//! The worker threads answering requests can be pinned to CPUs with `--cpus`, and the Chrony poller
+//! thread with `--poller_cpu`. The worker threads can run under the SCHED_FIFO real-time policy
+//! with `--fifo_priority`, and all the memory of ClockBoundD can be locked with `--mlockall`, so that
+//! a request is not delayed by the thread answering it being descheduled or page faulting.
+//! ClockBoundD keeps running without them if they can not be applied, which is logged.
+//!
+//! Running as the clockbound user, the unit file needs the following in its `[Service]` section.
+//! ```text
+//! LimitRTPRIO=99
+//! LimitMEMLOCK=infinity
+//! ```
+//!
+//! ## History
+//!
+//! ClockBoundD appends a 64 byte record of every poll to chronyd to the history file
+//! clockboundd.history in its working directory: the tracking data, the Clock Error Bound, the
+//! error flag and how long the poll took. Once the file holds `--history_records` records, 65536 or
+//! 4 MiB by default, the oldest record is overwritten. The history is kept across restarts.
+//!
+//! The history can be exported as CSV without signalling ClockBoundD, and followed as records are
+//! appended:
+//! ```text
+//! clockbound-history /run/clockboundd/clockboundd.history --last 100 --follow
+//! ```
+//!
+//! See [PROTOCOL.md](../PROTOCOL.md#clockboundd-history-file-version-1) for the layout of the file.
+//!
 //! # Usage
 //!
 //! To communicate with ClockBoundD a client is required. A rust client library exists at [ClockBoundC](../clock-bound-c/README.md)
@@ -101,75 +166,288 @@
 //! ```text
 //! journalctl -u clockboundd
 //! ```
+//! # Benchmarks
+//!
+//! Benchmarks of the request handling hot path can be run with Cargo and do not require chronyd:
+//! ```text
+//! cargo bench
+//! ```
+//!
+//! The `round_trip` benchmark serves requests from a ClockBoundD server on a Unix socket in the
+//! same process, and also prints the p50, p99 and p999 latencies of a round trip:
+//! ```text
+//! cargo bench --bench round_trip
+//! ```
+//!
 //! # Updating README
 //!
 //! This README is generated via [cargo-readme](https://crates.io/crates/cargo-readme). Updating can be done by running:
 //! ```text
 //! cargo readme > README.md
 //! ```
-mod ceb;
+pub mod ceb;
 mod chrony_poller;
-mod response;
-mod server;
+mod cmdmon;
+pub mod history;
+mod log_summary;
+pub mod metrics;
+mod realtime;
+pub mod response;
+mod schedule;
+pub mod server;
+mod shm;
+pub mod snapshot;
 mod socket;
+mod source;
+mod subscribers;
 mod tracking;
+mod uring;
 
-use crate::chrony_poller::start_chrony_poller;
-use crate::server::ClockBoundServer;
-use chrony_candm::reply::Tracking;
+use crate::ceb::BoundModel;
+use crate::chrony_poller::{start_chrony_poller, ChronyClient};
+use crate::history::{HistoryWriter, CLOCKBOUND_HISTORY_FILE};
+use crate::log_summary::{start_log_summary, LOG_SUMMARY_INTERVAL};
+use crate::metrics::Metrics;
+use crate::realtime::ThreadPolicy;
+use crate::server::{worker_socket_path, ClockBoundServer, Engine};
+use crate::shm::{ShmWriter, CLOCKBOUND_SHM_FILE};
+use crate::snapshot::SharedSnapshot;
+use crate::source::{AdjtimexSource, TrackingSource};
+use crate::subscribers::Subscribers;
 use log::{error, info};
-use tokio::sync::watch;
-use tokio::sync::watch::Receiver;
+use std::sync::Arc;
+use std::time::Duration;
+
+pub use crate::schedule::PollIntervals;
+pub use crate::source::TrackingSourceKind;
+
+/// The options ClockBoundD is started with.
+pub struct ClockBoundDOptions {
+    /// The assumed maximum frequency error that a system clock can gain between updates in ppm.
+    pub max_clock_error: f64,
+    /// The maximum number of requests received and responded to in one batch. A batch size of 1
+    /// handles requests one at a time.
+    pub batch_size: usize,
+    /// The number of worker threads handling requests. Worker 0 serves clockboundd.sock and every
+    /// other worker n serves its own shard socket, clockboundd-<n>.sock.
+    pub workers: usize,
+    /// The intervals that the Chrony poller thread polls chronyd at.
+    pub poll_intervals: PollIntervals,
+    /// The longest interval that an initial poll to chronyd is retried at until chronyd is
+    /// synchronized. The retries back off exponentially up to it.
+    pub initialize_interval: Duration,
+    /// Whether chronyd is polled through its Unix command socket rather than its command port on
+    /// localhost.
+    pub chrony_unix_socket: bool,
+    /// How long to wait for chronyd to reply to a request before sending it again.
+    pub chrony_timeout: Duration,
+    /// The source the tracking information is polled from.
+    pub source: TrackingSourceKind,
+    /// How the servers receive requests and send responses.
+    pub engine: Engine,
+    /// The CPUs the worker threads are pinned to. Worker n is pinned to the n-th CPU, wrapping
+    /// around if there are fewer CPUs than workers. Empty to let the workers run on any CPU.
+    pub cpus: Vec<usize>,
+    /// The CPU the Chrony poller thread is pinned to, or None to let it run on any CPU.
+    pub poller_cpu: Option<usize>,
+    /// The SCHED_FIFO priority the worker threads run at, or None to keep the default policy.
+    pub fifo_priority: Option<i32>,
+    /// Whether all the memory of ClockBoundD is locked with mlockall on startup.
+    pub lock_memory: bool,
+    /// The number of records kept in the history file of polls, or 0 to keep no history.
+    pub history_records: u64,
+}
 
 /// Start ClockBoundD.
 ///
 /// # Arguments
 ///
-/// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
-pub fn run(max_clock_error: f64) {
+/// * `options` - The options ClockBoundD is started with.
+pub fn run(options: ClockBoundDOptions) {
     info!("Initialized ClockBoundD");
+    let max_clock_error = options.max_clock_error;
 
-    // Do an initial poll to initialize the tracking data before starting the Chrony poller
-    // thread
-    let tracking = chrony_poller::initialize_tracking();
-    // Set up a channel for sending tracking data between threads
-    let (tx_tracking, rx_tracking) = watch::channel(tracking);
+    // Lock the memory before the worker threads and their stacks are created, so that their stacks
+    // are locked and prefaulted as they are mapped
+    if options.lock_memory {
+        match realtime::lock_memory() {
+            Ok(()) => info!("Locked the memory of ClockBoundD"),
+            Err(e) => error!("Failed to lock the memory of ClockBoundD. Error: {:?}", e),
+        }
+    }
+
+    let source: Box<dyn TrackingSource + Send> = match options.source {
+        TrackingSourceKind::Chrony => Box::new(ChronyClient::new(
+            options.chrony_unix_socket,
+            options.chrony_timeout,
+        )),
+        TrackingSourceKind::Adjtimex => Box::new(AdjtimexSource),
+    };
+    // The Clock Error Bound model is computed once per tracking update, rather than on every
+    // request. Until the Chrony poller thread initializes the tracking data, requests are
+    // answered without waiting with unsynchronized responses.
+    let model = BoundModel::unsynchronized();
     // An error flag used to inform the main thread if there was an error with the most recent
-    // poll to Chrony. This flag will make it's way to clients via the response header.
-    let error_flag = false;
-    // Set up a channel for sending error flag data between threads
-    let (tx_error_flag, rx_error_flag) = watch::channel(error_flag);
-    // Initialize the server with initial tracking data
-    let server = ClockBoundServer::new(tracking);
+    // poll to Chrony. This flag will make it's way to clients via the response header. It is set
+    // until the tracking data is initialized.
+    let error_flag = true;
+    // The model and error flag are published together by the Chrony poller thread, and read
+    // without taking a lock by every thread handling requests.
+    let snapshot = Arc::new(SharedSnapshot::new(model, error_flag));
+    // The metrics every thread records into, which are sent to clients in response to a stats
+    // request
+    let metrics = Arc::new(Metrics::new(options.workers.max(1)));
+    // Initialize a server for each worker, serving the socket passed by systemd socket
+    // activation at the worker's socket path if there is one, and binding it otherwise
+    let mut listen_fds = socket::listen_fds();
+    let mut servers: Vec<ClockBoundServer> = (0..options.workers.max(1))
+        .map(|worker| {
+            let path = worker_socket_path(worker);
+            match socket::take_listen_fd(&mut listen_fds, path.as_path()) {
+                Some(socket) => ClockBoundServer::with_socket(
+                    socket,
+                    snapshot.clone(),
+                    options.batch_size,
+                    metrics.clone(),
+                    worker,
+                ),
+                None => ClockBoundServer::new(
+                    path.as_path(),
+                    snapshot.clone(),
+                    options.batch_size,
+                    metrics.clone(),
+                    worker,
+                ),
+            }
+        })
+        .collect();
+    socket::warn_unused_listen_fds(listen_fds);
+
+    // Set up the shared memory segment that clients can read the tracking data from without
+    // sending a request. ClockBoundD keeps serving requests over the socket if this fails.
+    let shm = match ShmWriter::create(std::path::Path::new(CLOCKBOUND_SHM_FILE)) {
+        Ok(shm) => {
+            shm.publish_unsynchronized(max_clock_error);
+            Some(shm)
+        }
+        Err(e) => {
+            error!("Failed to create shared memory segment. Error: {:?}", e);
+            None
+        }
+    };
 
-    // Chrony poller thread
-    start_chrony_poller(tx_tracking, tx_error_flag);
+    // Set up the history file that a record of every poll is appended to. ClockBoundD keeps
+    // running without history if this fails.
+    let history = match options.history_records {
+        0 => None,
+        records => {
+            match HistoryWriter::create(std::path::Path::new(CLOCKBOUND_HISTORY_FILE), records) {
+                Ok(history) => Some(history),
+                Err(e) => {
+                    error!("Failed to create history file. Error: {:?}", e);
+                    None
+                }
+            }
+        }
+    };
+
+    // The subscribers of every worker's socket, that updates of the model are pushed to
+    let subscribers: Vec<Arc<Subscribers>> =
+        servers.iter().map(|server| server.subscribers()).collect();
+
+    // Chrony poller thread, which initializes the tracking data
+    start_chrony_poller(
+        source,
+        snapshot,
+        shm,
+        history,
+        subscribers,
+        metrics.clone(),
+        max_clock_error,
+        options.poll_intervals,
+        options.initialize_interval,
+        ThreadPolicy {
+            cpu: options.poller_cpu,
+            fifo_priority: None,
+        },
+    );
     info!("Initialized Chrony Poller thread");
 
+    // Log summary thread, logging the errors the threads handling requests count rather than log
+    start_log_summary(metrics, LOG_SUMMARY_INTERVAL);
+
+    // Start the worker threads serving the shard sockets. The first server is run on the main
+    // thread.
+    let server = servers.remove(0);
+    let worker_policy = |worker: usize| ThreadPolicy {
+        cpu: match options.cpus.len() {
+            0 => None,
+            len => Some(options.cpus[worker % len]),
+        },
+        fifo_priority: options.fifo_priority,
+    };
+    for (worker, shard) in servers.into_iter().enumerate() {
+        let batch_size = options.batch_size;
+        let engine = options.engine;
+        let policy = worker_policy(worker + 1);
+        let name = format!("clockboundd-worker-{}", worker + 1);
+        let spawned = std::thread::Builder::new()
+            .name(name.clone())
+            .spawn(move || {
+                policy.apply(&name);
+                start_main_thread(shard, batch_size, engine)
+            });
+        if let Err(e) = spawned {
+            panic!(
+                "Failed to start worker thread {}. Error: {:?}",
+                worker + 1,
+                e
+            );
+        }
+    }
+    if options.workers > 1 {
+        info!("Initialized {} worker threads", options.workers);
+    }
+
     // Start main thread
-    start_main_thread(server, rx_tracking, rx_error_flag, max_clock_error);
+    worker_policy(0).apply("main thread");
+    start_main_thread(server, options.batch_size, options.engine);
 }
 
 /// Start the main thread of ClockBoundD.
-/// This thread processes any client requests that are received.
+/// This thread processes any client requests that are received. Each worker thread runs the same
+/// loop against its own server.
 ///
 /// # Arguments
 ///
-/// * `server` - A ClockBoundServer bound to our ClockBoundD Unix Socket.
-/// * `rx_tracking` - A tokio::sync::watch::channel receiver handle that is used for receiving Chrony
-/// tracking information from the Chrony Poller thread.
-/// * `rx_error_flag` - A tokio::sync::watch::channel receiver handle that is used for receiving an
-/// error flag, indicating that the last Chrony poll failed, from the Chrony Poller thread.
-/// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
-pub fn start_main_thread(
-    mut server: ClockBoundServer,
-    rx_tracking: Receiver<Tracking>,
-    rx_error_flag: Receiver<bool>,
-    max_clock_error: f64,
-) {
+/// * `server` - A ClockBoundServer bound to one of our ClockBoundD Unix Sockets.
+/// * `batch_size` - The maximum number of requests received and responded to in one batch.
+/// * `engine` - How the server receives requests and sends responses. If the io_uring engine can
+/// not be set up, for example on a kernel without io_uring, the blocking engine is used.
+pub fn start_main_thread(mut server: ClockBoundServer, batch_size: usize, engine: Engine) {
+    if let Engine::IoUring { sqpoll } = engine {
+        match server.enable_uring(sqpoll) {
+            Ok(()) => loop {
+                match server.handle_clients_uring() {
+                    Err(e) => error!("Failed to communicate with client. Error: {:?}", e),
+                    _ => {}
+                };
+            },
+            Err(e) => error!(
+                "Failed to set up io_uring, falling back to blocking system calls. Error: {:?}",
+                e
+            ),
+        }
+    }
+
     // Main thread
     loop {
-        match server.handle_client(rx_tracking.clone(), rx_error_flag.clone(), max_clock_error) {
+        let result = if batch_size > 1 {
+            server.handle_clients_batched()
+        } else {
+            server.handle_client()
+        };
+        match result {
             Err(e) => error!("Failed to communicate with client. Error: {:?}", e),
             _ => {}
         };
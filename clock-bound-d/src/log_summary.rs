@@ -0,0 +1,152 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use crate::metrics::{ErrorCounts, Metrics};
+use crate::response::REQUEST_ERRORS;
+use log::warn;
+use std::io;
+use std::sync::Arc;
+use std::time::Duration;
+
+/// How often the errors counted on the request path are logged, at most.
+pub const LOG_SUMMARY_INTERVAL: Duration = Duration::from_secs(10);
+
+/// The kinds of request errors, indexed by RequestError::index.
+const REQUEST_ERROR_NAMES: [&str; REQUEST_ERRORS] = [
+    "unsupported version",
+    "invalid type",
+    "invalid size",
+    "batch count mismatch",
+    "bound unavailable",
+];
+
+/// Summarize the errors counted since the previous summary. Returns one message per kind of
+/// error that was counted, or nothing if there were none.
+///
+/// # Arguments
+///
+/// * `previous` - The errors counted at the previous summary.
+/// * `current` - The errors counted now.
+/// * `interval` - The time since the previous summary.
+fn summarize(previous: &ErrorCounts, current: &ErrorCounts, interval: Duration) -> Vec<String> {
+    let mut messages = Vec::new();
+
+    let counts: Vec<(usize, u64)> = (0..REQUEST_ERRORS)
+        .map(|i| {
+            (
+                i,
+                current.request_errors[i].wrapping_sub(previous.request_errors[i]),
+            )
+        })
+        .filter(|(_, count)| *count > 0)
+        .collect();
+    if !counts.is_empty() {
+        let total: u64 = counts.iter().map(|(_, count)| count).sum();
+        let kinds: Vec<String> = counts
+            .iter()
+            .map(|(i, count)| format!("{} {}", count, REQUEST_ERROR_NAMES[*i]))
+            .collect();
+        // The last error of the most frequent kind stands for the rest
+        let (most, _) = counts.iter().max_by_key(|(_, count)| *count).unwrap();
+        let last = current.last_request_errors[*most]
+            .map(|e| e.to_string())
+            .unwrap_or_default();
+        messages.push(format!(
+            "Sent error responses to {} invalid requests in the last {:?} ({}). Last: {}",
+            total,
+            interval,
+            kinds.join(", "),
+            last
+        ));
+    }
+
+    let send_failures = current.send_failures.wrapping_sub(previous.send_failures);
+    if send_failures > 0 {
+        let last = match current.last_send_error {
+            Some(code) => format!("{:?}", io::Error::from_raw_os_error(code)),
+            None => String::new(),
+        };
+        messages.push(format!(
+            "Failed to send {} responses to clients in the last {:?}. Last error: {}",
+            send_failures, interval, last
+        ));
+    }
+    messages
+}
+
+/// Start the log summary thread.
+///
+/// The threads serving requests never log per request; they count invalid requests and failed
+/// sends instead. This thread logs the errors counted since its last summary, at most once per
+/// interval, so that syslog is written to off the request path and at a bounded rate however many
+/// errors occur.
+///
+/// # Arguments
+///
+/// * `metrics` - The metrics the threads serving requests count errors into.
+/// * `interval` - How often the errors are summarized.
+pub fn start_log_summary(metrics: Arc<Metrics>, interval: Duration) {
+    std::thread::spawn(move || {
+        let mut previous = metrics.errors();
+        loop {
+            std::thread::sleep(interval);
+            let current = metrics.errors();
+            for message in summarize(&previous, &current, interval) {
+                warn!("{}", message);
+            }
+            previous = current;
+        }
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::log_summary::summarize;
+    use crate::metrics::ErrorCounts;
+    use crate::response::RequestError;
+    use std::time::Duration;
+
+    #[test]
+    fn test_summarize_nothing_counted() {
+        let counts = ErrorCounts {
+            request_errors: [5, 0, 0, 0, 0],
+            last_request_errors: [
+                Some(RequestError::UnsupportedVersion(3)),
+                None,
+                None,
+                None,
+                None,
+            ],
+            send_failures: 2,
+            last_send_error: Some(libc::ENOBUFS),
+        };
+        // Errors counted before the previous summary are not logged again
+        assert!(summarize(&counts, &counts, Duration::from_secs(10)).is_empty());
+    }
+
+    #[test]
+    fn test_summarize_errors() {
+        let previous = ErrorCounts::default();
+        let current = ErrorCounts {
+            request_errors: [1000, 0, 2, 0, 0],
+            last_request_errors: [
+                Some(RequestError::UnsupportedVersion(3)),
+                None,
+                Some(RequestError::InvalidSize {
+                    request_type: 1,
+                    size: 12,
+                }),
+                None,
+                None,
+            ],
+            send_failures: 7,
+            last_send_error: Some(libc::ECONNREFUSED),
+        };
+
+        let messages = summarize(&previous, &current, Duration::from_secs(10));
+        assert_eq!(2, messages.len());
+        assert!(messages[0].starts_with("Sent error responses to 1002 invalid requests"));
+        assert!(messages[0].contains("1000 unsupported version, 2 invalid size"));
+        assert!(messages[0].contains("The request version 3 is not supported"));
+        assert!(messages[1].starts_with("Failed to send 7 responses to clients"));
+    }
+}
@@ -1,7 +1,10 @@
 // Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
 // SPDX-License-Identifier: GPL-2.0-only
 use clap::{value_t, App, Arg};
-use clock_bound_d::run;
+use clock_bound_d::history::DEFAULT_HISTORY_RECORDS;
+use clock_bound_d::server::Engine;
+use clock_bound_d::{run, ClockBoundDOptions, PollIntervals, TrackingSourceKind};
+use std::time::Duration;
 use syslog::Error;
 
 // Constants that reference package information from Cargo.toml
@@ -11,6 +14,12 @@ const AUTHORS: &'static str = env!("CARGO_PKG_AUTHORS");
 const DESCRIPTION: &'static str = env!("CARGO_PKG_DESCRIPTION");
 
 pub const DEFAULT_MAX_CLOCK_ERROR: f64 = 1.0; // 1ppm, same value as what chronyd is hard-coded to
+pub const DEFAULT_BATCH_SIZE: usize = 1; // Handle requests one at a time
+pub const DEFAULT_WORKERS: usize = 1; // Serve clockboundd.sock only
+pub const DEFAULT_POLL_INTERVAL: u64 = 1000; // 1 second, in milliseconds
+pub const DEFAULT_MAX_POLL_INTERVAL: u64 = 16000; // 16 seconds, chronyd's poll interval with the Amazon Time Sync Service
+pub const DEFAULT_INITIALIZE_INTERVAL: u64 = 100; // 100 milliseconds
+pub const DEFAULT_CHRONY_TIMEOUT: u64 = 100; // 100 milliseconds, chronyd replies from memory
 
 // ClockBoundD application entry point.
 fn main() -> Result<(), Error> {
@@ -30,6 +39,89 @@ fn main() -> Result<(), Error> {
             .long("max_clock_error")
             .takes_value(true)
             .help("Set the max clock error in ppm. This is the assumed maximum frequency error that a system clock can gain between updates. This should be set to the same value as maxclockerror in chrony's configuration. Default value is 1 ppm."))
+        .arg(Arg::with_name("batch_size")
+            .short("b")
+            .long("batch_size")
+            .takes_value(true)
+            .validator(validate_positive)
+            .help("Set the maximum number of requests received and responded to in one batch. Batches are received with recvmmsg and responded to with sendmmsg, and share a single read of the tracking data and system time. Default value is 1, which handles requests one at a time."))
+        .arg(Arg::with_name("workers")
+            .short("w")
+            .long("workers")
+            .takes_value(true)
+            .validator(validate_positive)
+            .help("Set the number of worker threads handling requests. Worker 0 serves clockboundd.sock and every other worker n serves its own shard socket clockboundd-<n>.sock. Clients can spread their requests across the shard sockets. Default value is 1."))
+        .arg(Arg::with_name("poll_interval")
+            .short("p")
+            .long("poll_interval")
+            .takes_value(true)
+            .validator(validate_positive)
+            .help("Set the interval in milliseconds that chronyd is polled at while an update it is expected to apply is overdue, or while it is not synchronized to a source. Otherwise chronyd is polled shortly after its next update is expected. Failed polls are retried with an exponential backoff starting from this interval. Default value is 1000 ms."))
+        .arg(Arg::with_name("max_poll_interval")
+            .short("m")
+            .long("max_poll_interval")
+            .takes_value(true)
+            .validator(validate_positive)
+            .help("Set the maximum interval in milliseconds between two polls to chronyd. This bounds how long ClockBoundD takes to report that chronyd is unreachable. Default value is 16000 ms."))
+        .arg(Arg::with_name("initialize_interval")
+            .short("i")
+            .long("initialize_interval")
+            .takes_value(true)
+            .validator(validate_positive)
+            .help("Set the maximum interval in milliseconds that an initial poll to chronyd is retried at on startup, until chronyd is running and synchronized. The retries back off exponentially from 1 ms. Unsynchronized responses are served in the meantime. Default value is 100 ms."))
+        .arg(Arg::with_name("chrony_timeout")
+            .short("t")
+            .long("chrony_timeout")
+            .takes_value(true)
+            .validator(validate_positive)
+            .help("Set the time in milliseconds to wait for chronyd to reply to a request before sending it again. A poll fails after 3 requests without a reply. Default value is 100 ms."))
+        .arg(Arg::with_name("chrony_unix_socket")
+            .short("u")
+            .long("chrony_unix_socket")
+            .help("Poll chronyd through its Unix command socket instead of its command port on localhost. The Unix command socket is only accessible to root and the chrony user."))
+        .arg(Arg::with_name("source")
+            .short("s")
+            .long("source")
+            .takes_value(true)
+            .possible_values(&["chrony", "adjtimex"])
+            .help("Set the source of the tracking information the Clock Error Bound is computed from. The available sources are: chrony, which polls chronyd, and adjtimex, which reads the maximum error the NTP daemon set in the kernel with ntp_adjtime. adjtimex needs no communication with the NTP daemon, but the kernel grows the maximum error by 500 ppm between the daemon's updates. The default value is chrony."))
+        .arg(Arg::with_name("io_uring")
+            .short("r")
+            .long("io_uring")
+            .help("Receive requests and send responses through an io_uring instead of blocking system calls. A receive is kept posted for every request of the batch, of at least 64 requests, and receives and sends are submitted without a system call per request. Falls back to blocking system calls if io_uring is not available."))
+        .arg(Arg::with_name("sqpoll")
+            .short("q")
+            .long("sqpoll")
+            .requires("io_uring")
+            .help("With --io_uring, have a kernel thread poll the submission queue of each worker's io_uring, so that responses are sent without a system call. The kernel thread uses a CPU while requests are received, and sleeps after 1 second without requests. Kernels older than 5.11 only allow root to use it."))
+        .arg(Arg::with_name("cpus")
+            .short("c")
+            .long("cpus")
+            .takes_value(true)
+            .validator(validate_cpu_list)
+            .help("Pin the worker threads to a comma separated list of CPUs, for example 2,3. Worker n is pinned to the n-th CPU listed, wrapping around if fewer CPUs than workers are listed. By default the workers run on any CPU."))
+        .arg(Arg::with_name("poller_cpu")
+            .short("P")
+            .long("poller_cpu")
+            .takes_value(true)
+            .validator(validate_cpu)
+            .help("Pin the Chrony poller thread to a CPU. By default it runs on any CPU."))
+        .arg(Arg::with_name("fifo_priority")
+            .short("f")
+            .long("fifo_priority")
+            .takes_value(true)
+            .validator(validate_fifo_priority)
+            .help("Run the worker threads under the SCHED_FIFO real-time policy at a priority from 1 to 99, so that they are not descheduled by other threads while answering a request. Requires CAP_SYS_NICE or an RLIMIT_RTPRIO of at least the priority. By default the worker threads keep the default policy."))
+        .arg(Arg::with_name("mlockall")
+            .short("l")
+            .long("mlockall")
+            .help("Lock all the memory of ClockBoundD with mlockall on startup, so that answering a request never page faults. Requires CAP_IPC_LOCK or a sufficient RLIMIT_MEMLOCK."))
+        .arg(Arg::with_name("history_records")
+            .short("H")
+            .long("history_records")
+            .takes_value(true)
+            .validator(validate_non_negative)
+            .help("Set the number of records kept in the history file clockboundd.history. A 64 byte record of the tracking data, Clock Error Bound, error flag and latency of every poll to chronyd is appended to it, overwriting the oldest record once it is full. It can be exported with clockbound-history. 0 keeps no history. Default value is 65536, 4 MiB."))
         .get_matches();
 
     // Validate max_clock_error is a float. Otherwise, use the default value.
@@ -40,6 +132,77 @@ fn main() -> Result<(), Error> {
         DEFAULT_MAX_CLOCK_ERROR
     };
 
+    let batch_size = if matches.is_present("batch_size") {
+        value_t!(matches.value_of("batch_size"), usize).unwrap_or_else(|e| e.exit())
+    } else {
+        DEFAULT_BATCH_SIZE
+    };
+
+    let workers = if matches.is_present("workers") {
+        value_t!(matches.value_of("workers"), usize).unwrap_or_else(|e| e.exit())
+    } else {
+        DEFAULT_WORKERS
+    };
+
+    let poll_interval = if matches.is_present("poll_interval") {
+        value_t!(matches.value_of("poll_interval"), u64).unwrap_or_else(|e| e.exit())
+    } else {
+        DEFAULT_POLL_INTERVAL
+    };
+
+    let max_poll_interval = if matches.is_present("max_poll_interval") {
+        value_t!(matches.value_of("max_poll_interval"), u64).unwrap_or_else(|e| e.exit())
+    } else {
+        DEFAULT_MAX_POLL_INTERVAL
+    };
+
+    let initialize_interval = if matches.is_present("initialize_interval") {
+        value_t!(matches.value_of("initialize_interval"), u64).unwrap_or_else(|e| e.exit())
+    } else {
+        DEFAULT_INITIALIZE_INTERVAL
+    };
+
+    let chrony_timeout = if matches.is_present("chrony_timeout") {
+        value_t!(matches.value_of("chrony_timeout"), u64).unwrap_or_else(|e| e.exit())
+    } else {
+        DEFAULT_CHRONY_TIMEOUT
+    };
+
+    let source = match matches.value_of("source") {
+        Some("adjtimex") => TrackingSourceKind::Adjtimex,
+        _ => TrackingSourceKind::Chrony,
+    };
+
+    let engine = match matches.is_present("io_uring") {
+        true => Engine::IoUring {
+            sqpoll: matches.is_present("sqpoll"),
+        },
+        false => Engine::Blocking,
+    };
+
+    let history_records = if matches.is_present("history_records") {
+        value_t!(matches.value_of("history_records"), u64).unwrap_or_else(|e| e.exit())
+    } else {
+        DEFAULT_HISTORY_RECORDS
+    };
+
+    let cpus = match matches.value_of("cpus") {
+        Some(cpus) => parse_cpu_list(cpus).unwrap_or_default(),
+        None => Vec::new(),
+    };
+
+    let poller_cpu = if matches.is_present("poller_cpu") {
+        Some(value_t!(matches.value_of("poller_cpu"), usize).unwrap_or_else(|e| e.exit()))
+    } else {
+        None
+    };
+
+    let fifo_priority = if matches.is_present("fifo_priority") {
+        Some(value_t!(matches.value_of("fifo_priority"), i32).unwrap_or_else(|e| e.exit()))
+    } else {
+        None
+    };
+
     // Default minimum log level is Info
     let mut log_level = log::LevelFilter::Info;
     if matches.is_present("level") {
@@ -67,6 +230,75 @@ fn main() -> Result<(), Error> {
         .map(|()| log::set_max_level(log_level))
         .unwrap();
 
-    run(max_clock_error);
+    run(ClockBoundDOptions {
+        max_clock_error,
+        batch_size,
+        workers,
+        poll_intervals: PollIntervals {
+            poll_interval: Duration::from_millis(poll_interval),
+            // The maximum interval can not be shorter than the poll interval
+            max_poll_interval: Duration::from_millis(max_poll_interval.max(poll_interval)),
+        },
+        initialize_interval: Duration::from_millis(initialize_interval),
+        chrony_unix_socket: matches.is_present("chrony_unix_socket"),
+        chrony_timeout: Duration::from_millis(chrony_timeout),
+        source,
+        engine,
+        cpus,
+        poller_cpu,
+        fifo_priority,
+        lock_memory: matches.is_present("mlockall"),
+        history_records,
+    });
     Ok(())
 }
+
+// Validate that an argument is a positive integer.
+fn validate_positive(value: String) -> Result<(), String> {
+    match value.parse::<usize>() {
+        Ok(v) if v > 0 => Ok(()),
+        _ => Err(String::from("the value must be a positive integer")),
+    }
+}
+
+// Validate that an argument is a non-negative integer.
+fn validate_non_negative(value: String) -> Result<(), String> {
+    match value.parse::<u64>() {
+        Ok(_) => Ok(()),
+        _ => Err(String::from("the value must be a non-negative integer")),
+    }
+}
+
+// Validate that an argument is a CPU index.
+fn validate_cpu(value: String) -> Result<(), String> {
+    match value.parse::<usize>() {
+        Ok(_) => Ok(()),
+        _ => Err(String::from("the value must be a CPU index")),
+    }
+}
+
+// Validate that an argument is a comma separated list of CPUs.
+fn validate_cpu_list(value: String) -> Result<(), String> {
+    match parse_cpu_list(&value) {
+        Some(_) => Ok(()),
+        None => Err(String::from(
+            "the value must be a comma separated list of CPU indexes",
+        )),
+    }
+}
+
+// Parse a comma separated list of CPUs.
+fn parse_cpu_list(value: &str) -> Option<Vec<usize>> {
+    value
+        .split(',')
+        .map(|cpu| cpu.trim().parse::<usize>().ok())
+        .collect()
+}
+
+// Validate that an argument is a SCHED_FIFO priority.
+fn validate_fifo_priority(value: String) -> Result<(), String> {
+    match value.parse::<i32>() {
+        Ok(v) if (1..=99).contains(&v) => Ok(()),
+        _ => Err(String::from("the value must be an integer from 1 to 99")),
+    }
+}
@@ -0,0 +1,521 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use crate::response::{RequestError, REQUEST_ERRORS};
+use std::io;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+
+/// The number of request types counted, indexed by request type. Index 0 counts invalid requests.
+pub const REQUEST_TYPES: usize = 9;
+
+/// Values below this are recorded in a bucket of their own. Above it every power of two is split
+/// into SUB_BUCKETS / 2 linear buckets, so that a value is recorded within 1/16 of its bucket.
+const SUB_BUCKETS: u64 = 32;
+
+/// The number of buckets needed to record any u64 value.
+const BUCKETS: usize = bucket_index(u64::MAX) + 1;
+
+/// Add to a counter that only one thread writes to.
+///
+/// Every counter has a single writer, so it is updated with a plain load and store rather than a
+/// read-modify-write. Readers on other threads see every update eventually, never a torn value.
+fn add(counter: &AtomicU64, value: u64) {
+    counter.store(
+        counter.load(Ordering::Relaxed).wrapping_add(value),
+        Ordering::Relaxed,
+    );
+}
+
+const fn bucket_index(value: u64) -> usize {
+    if value < SUB_BUCKETS {
+        return value as usize;
+    }
+    let shift = 63 - value.leading_zeros() as u64 - 4;
+    let sub = (value >> shift) - SUB_BUCKETS / 2;
+    (SUB_BUCKETS + (shift - 1) * SUB_BUCKETS / 2 + sub) as usize
+}
+
+/// The highest value recorded in a bucket.
+fn bucket_value(index: usize) -> u64 {
+    let index = index as u64;
+    if index < SUB_BUCKETS {
+        return index;
+    }
+    let shift = (index - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+    let sub = (index - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+    ((sub + 1) << shift).wrapping_sub(1)
+}
+
+/// A histogram of durations in nanoseconds with a single writer.
+pub struct Histogram {
+    counts: Vec<AtomicU64>,
+    max: AtomicU64,
+}
+
+impl Histogram {
+    pub fn new() -> Histogram {
+        Histogram {
+            counts: (0..BUCKETS).map(|_| AtomicU64::new(0)).collect(),
+            max: AtomicU64::new(0),
+        }
+    }
+
+    /// Record a value a number of times.
+    ///
+    /// # Arguments
+    ///
+    /// * `value` - The value in nanoseconds.
+    /// * `count` - The number of times the value is recorded.
+    pub fn record(&self, value: u64, count: u64) {
+        add(&self.counts[bucket_index(value)], count);
+        if value > self.max.load(Ordering::Relaxed) {
+            self.max.store(value, Ordering::Relaxed);
+        }
+    }
+
+    /// Record a duration once.
+    pub fn record_duration(&self, duration: Duration) {
+        self.record(duration.as_nanos().min(u64::MAX as u128) as u64, 1);
+    }
+}
+
+/// A copy of one or more histograms, summed, that percentiles are read from.
+pub struct HistogramSummary {
+    counts: Vec<u64>,
+    total: u64,
+    max: u64,
+}
+
+impl HistogramSummary {
+    pub fn new() -> HistogramSummary {
+        HistogramSummary {
+            counts: vec![0; BUCKETS],
+            total: 0,
+            max: 0,
+        }
+    }
+
+    /// Forget the values added, keeping the buckets allocated.
+    pub fn clear(&mut self) {
+        self.counts.iter_mut().for_each(|count| *count = 0);
+        self.total = 0;
+        self.max = 0;
+    }
+
+    /// Add the values recorded in a histogram.
+    pub fn add(&mut self, histogram: &Histogram) {
+        for (count, recorded) in self.counts.iter_mut().zip(&histogram.counts) {
+            let recorded = recorded.load(Ordering::Relaxed);
+            *count += recorded;
+            self.total += recorded;
+        }
+        self.max = self.max.max(histogram.max.load(Ordering::Relaxed));
+    }
+
+    /// The value in nanoseconds at a percentile, or 0 if nothing was recorded.
+    ///
+    /// # Arguments
+    ///
+    /// * `percentile` - The percentile, between 0 and 100.
+    pub fn percentile(&self, percentile: f64) -> u64 {
+        if self.total == 0 {
+            return 0;
+        }
+        let rank = ((self.total as f64 * percentile / 100.0).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (index, count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return bucket_value(index).min(self.max);
+            }
+        }
+        self.max
+    }
+
+    pub fn max(&self) -> u64 {
+        self.max
+    }
+}
+
+/// The metrics of one thread serving a ClockBoundD socket. Only that thread writes to them.
+pub struct WorkerMetrics {
+    /// The responses sent by request type. Index 0 counts error responses to invalid requests.
+    pub requests: [AtomicU64; REQUEST_TYPES],
+    /// The error responses sent to valid requests because the last poll of the tracking source
+    /// failed.
+    pub error_flag_responses: AtomicU64,
+    /// The error responses sent to invalid requests, by kind of request error.
+    pub request_errors: [AtomicU64; REQUEST_ERRORS],
+    /// The details of the last request error of each kind, packed by RequestError::pack.
+    last_request_errors: [AtomicU64; REQUEST_ERRORS],
+    /// The responses that could not be sent.
+    pub send_failures: AtomicU64,
+    /// The OS error code of the last response that could not be sent.
+    last_send_error: AtomicU64,
+    /// The time from receiving a request to sending its response.
+    pub service_time: Histogram,
+    /// The time since the tracking source's last update, when a request is served from a
+    /// synchronized model.
+    pub snapshot_age: Histogram,
+}
+
+impl WorkerMetrics {
+    fn new() -> WorkerMetrics {
+        WorkerMetrics {
+            requests: Default::default(),
+            error_flag_responses: AtomicU64::new(0),
+            request_errors: Default::default(),
+            last_request_errors: Default::default(),
+            send_failures: AtomicU64::new(0),
+            last_send_error: AtomicU64::new(0),
+            service_time: Histogram::new(),
+            snapshot_age: Histogram::new(),
+        }
+    }
+
+    /// Count a response sent.
+    ///
+    /// # Arguments
+    ///
+    /// * `response_type` - The response type of the response.
+    /// * `error_flag` - Whether an error response was sent to a valid request because the error
+    /// flag was set. Error responses to invalid requests are counted as invalid either way.
+    pub fn count_response(&self, response_type: u8, error_flag: bool) {
+        match response_type as usize {
+            0 if error_flag => add(&self.error_flag_responses, 1),
+            t if t < REQUEST_TYPES => add(&self.requests[t], 1),
+            _ => add(&self.requests[0], 1),
+        }
+    }
+
+    /// Count an invalid request, in place of logging it.
+    ///
+    /// # Arguments
+    ///
+    /// * `error` - Why the request is invalid.
+    pub fn count_request_error(&self, error: RequestError) {
+        add(&self.request_errors[error.index()], 1);
+        self.last_request_errors[error.index()].store(error.pack(), Ordering::Relaxed);
+    }
+
+    /// Count a response that could not be sent, in place of logging it.
+    ///
+    /// # Arguments
+    ///
+    /// * `error` - The error sending the response failed with.
+    pub fn count_send_failure(&self, error: &io::Error) {
+        add(&self.send_failures, 1);
+        let code = error.raw_os_error().unwrap_or(0);
+        self.last_send_error
+            .store(code as u32 as u64, Ordering::Relaxed);
+    }
+}
+
+/// The metrics of the Chrony poller thread. Only that thread writes to them.
+pub struct PollerMetrics {
+    /// The polls of the tracking source.
+    pub polls: AtomicU64,
+    /// The polls of the tracking source that failed.
+    pub poll_failures: AtomicU64,
+    /// The time a poll of the tracking source took.
+    pub poll_latency: Histogram,
+}
+
+impl PollerMetrics {
+    fn new() -> PollerMetrics {
+        PollerMetrics {
+            polls: AtomicU64::new(0),
+            poll_failures: AtomicU64::new(0),
+            poll_latency: Histogram::new(),
+        }
+    }
+
+    /// Count a poll of the tracking source.
+    ///
+    /// # Arguments
+    ///
+    /// * `latency` - The time the poll took.
+    /// * `failed` - Whether the poll failed.
+    pub fn count_poll(&self, latency: Duration, failed: bool) {
+        add(&self.polls, 1);
+        if failed {
+            add(&self.poll_failures, 1);
+        }
+        self.poll_latency.record_duration(latency);
+    }
+}
+
+/// The metrics of ClockBoundD.
+///
+/// Every thread records into metrics of its own without locks or read-modify-write instructions,
+/// so recording is cheap enough to leave on for every request. Nothing is logged per request.
+/// A Stats request sums the metrics of every thread.
+pub struct Metrics {
+    started: Instant,
+    workers: Vec<WorkerMetrics>,
+    poller: PollerMetrics,
+}
+
+/// The errors counted on the request path in place of logging them, summed across threads.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct ErrorCounts {
+    pub request_errors: [u64; REQUEST_ERRORS],
+    /// The last request error of each kind counted, from any thread.
+    pub last_request_errors: [Option<RequestError>; REQUEST_ERRORS],
+    pub send_failures: u64,
+    /// The OS error code of the last response that could not be sent, from any thread.
+    pub last_send_error: Option<i32>,
+}
+
+/// The metrics of ClockBoundD summed across threads, as sent in response to a Stats request.
+///
+/// A summary can be refilled with Metrics::summary_into, so that serving a Stats request does
+/// not allocate.
+pub struct MetricsSummary {
+    pub uptime: Duration,
+    pub requests: [u64; REQUEST_TYPES],
+    pub error_flag_responses: u64,
+    pub errors: ErrorCounts,
+    pub polls: u64,
+    pub poll_failures: u64,
+    pub service_time: HistogramSummary,
+    pub snapshot_age: HistogramSummary,
+    pub poll_latency: HistogramSummary,
+}
+
+impl MetricsSummary {
+    pub fn new() -> MetricsSummary {
+        MetricsSummary {
+            uptime: Duration::ZERO,
+            requests: [0; REQUEST_TYPES],
+            error_flag_responses: 0,
+            errors: ErrorCounts::default(),
+            polls: 0,
+            poll_failures: 0,
+            service_time: HistogramSummary::new(),
+            snapshot_age: HistogramSummary::new(),
+            poll_latency: HistogramSummary::new(),
+        }
+    }
+}
+
+impl Metrics {
+    /// Create the metrics of ClockBoundD.
+    ///
+    /// # Arguments
+    ///
+    /// * `workers` - The number of threads serving ClockBoundD sockets.
+    pub fn new(workers: usize) -> Metrics {
+        Metrics {
+            started: Instant::now(),
+            workers: (0..workers.max(1)).map(|_| WorkerMetrics::new()).collect(),
+            poller: PollerMetrics::new(),
+        }
+    }
+
+    /// The metrics of a thread serving a ClockBoundD socket.
+    ///
+    /// # Arguments
+    ///
+    /// * `worker` - The index of the worker.
+    pub fn worker(&self, worker: usize) -> &WorkerMetrics {
+        &self.workers[worker % self.workers.len()]
+    }
+
+    /// The metrics of the Chrony poller thread.
+    pub fn poller(&self) -> &PollerMetrics {
+        &self.poller
+    }
+
+    /// Sum the errors counted by every thread.
+    pub fn errors(&self) -> ErrorCounts {
+        let mut errors = ErrorCounts::default();
+        for worker in &self.workers {
+            for index in 0..REQUEST_ERRORS {
+                let count = worker.request_errors[index].load(Ordering::Relaxed);
+                if count > 0 {
+                    errors.request_errors[index] += count;
+                    let packed = worker.last_request_errors[index].load(Ordering::Relaxed);
+                    errors.last_request_errors[index] = Some(RequestError::unpack(index, packed));
+                }
+            }
+            let send_failures = worker.send_failures.load(Ordering::Relaxed);
+            if send_failures > 0 {
+                errors.send_failures += send_failures;
+                errors.last_send_error =
+                    Some(worker.last_send_error.load(Ordering::Relaxed) as i32);
+            }
+        }
+        errors
+    }
+
+    /// Sum the metrics of every thread.
+    pub fn summary(&self) -> MetricsSummary {
+        let mut summary = MetricsSummary::new();
+        self.summary_into(&mut summary);
+        summary
+    }
+
+    /// Sum the metrics of every thread into a summary, replacing its contents without allocating.
+    ///
+    /// # Arguments
+    ///
+    /// * `summary` - The summary to refill.
+    pub fn summary_into(&self, summary: &mut MetricsSummary) {
+        summary.uptime = self.started.elapsed();
+        summary.requests = [0; REQUEST_TYPES];
+        summary.error_flag_responses = 0;
+        summary.errors = self.errors();
+        summary.polls = self.poller.polls.load(Ordering::Relaxed);
+        summary.poll_failures = self.poller.poll_failures.load(Ordering::Relaxed);
+        summary.service_time.clear();
+        summary.snapshot_age.clear();
+        summary.poll_latency.clear();
+        summary.poll_latency.add(&self.poller.poll_latency);
+        for worker in &self.workers {
+            for (sum, count) in summary.requests.iter_mut().zip(&worker.requests) {
+                *sum += count.load(Ordering::Relaxed);
+            }
+            summary.error_flag_responses += worker.error_flag_responses.load(Ordering::Relaxed);
+            summary.service_time.add(&worker.service_time);
+            summary.snapshot_age.add(&worker.snapshot_age);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::metrics::{
+        bucket_index, bucket_value, Histogram, HistogramSummary, Metrics, MetricsSummary,
+    };
+    use crate::response::RequestError;
+    use std::io;
+    use std::time::Duration;
+
+    #[test]
+    fn test_bucket_precision() {
+        for value in [
+            0,
+            1,
+            31,
+            32,
+            33,
+            100,
+            1_000,
+            123_456,
+            10_000_000_000,
+            u64::MAX,
+        ] {
+            let upper = bucket_value(bucket_index(value));
+            assert!(upper >= value, "{} > {}", value, upper);
+            assert!(
+                upper - value <= value / 16,
+                "{} is too far from {}",
+                upper,
+                value
+            );
+        }
+    }
+
+    #[test]
+    fn test_histogram_percentiles() {
+        let histogram = Histogram::new();
+        for value in 1..=1000 {
+            histogram.record(value * 1000, 1);
+        }
+        let mut summary = HistogramSummary::new();
+        summary.add(&histogram);
+
+        let p50 = summary.percentile(50.0);
+        assert!((500_000..=500_000 + 500_000 / 16).contains(&p50), "{}", p50);
+        let p99 = summary.percentile(99.0);
+        assert!((990_000..=990_000 + 990_000 / 16).contains(&p99), "{}", p99);
+        assert_eq!(1_000_000, summary.percentile(100.0));
+        assert_eq!(1_000_000, summary.max());
+
+        // Nothing recorded
+        assert_eq!(0, HistogramSummary::new().percentile(99.0));
+    }
+
+    #[test]
+    fn test_metrics_summary() {
+        let metrics = Metrics::new(2);
+        metrics.worker(0).count_response(1, false);
+        metrics.worker(1).count_response(1, false);
+        metrics.worker(1).count_response(2, false);
+        metrics.worker(1).count_response(0, true);
+        metrics.worker(0).count_response(0, false);
+        metrics
+            .worker(0)
+            .count_send_failure(&io::Error::from_raw_os_error(libc::ENOBUFS));
+        metrics
+            .worker(1)
+            .count_request_error(RequestError::InvalidSize {
+                request_type: 2,
+                size: 4,
+            });
+        metrics
+            .worker(0)
+            .count_request_error(RequestError::UnsupportedVersion(3));
+        metrics
+            .worker(1)
+            .count_request_error(RequestError::UnsupportedVersion(9));
+        metrics.worker(0).service_time.record(1_000, 2);
+        metrics.worker(1).service_time.record(3_000, 1);
+        metrics
+            .poller()
+            .count_poll(Duration::from_micros(200), false);
+        metrics
+            .poller()
+            .count_poll(Duration::from_millis(300), true);
+
+        let summary = metrics.summary();
+        assert_eq!([1, 2, 1, 0, 0, 0, 0, 0, 0], summary.requests);
+        assert_eq!(1, summary.error_flag_responses);
+        assert_eq!(1, summary.errors.send_failures);
+        assert_eq!(Some(libc::ENOBUFS), summary.errors.last_send_error);
+        assert_eq!([2, 0, 1, 0, 0], summary.errors.request_errors);
+        assert_eq!(
+            Some(RequestError::UnsupportedVersion(9)),
+            summary.errors.last_request_errors[0]
+        );
+        assert_eq!(
+            Some(RequestError::InvalidSize {
+                request_type: 2,
+                size: 4
+            }),
+            summary.errors.last_request_errors[2]
+        );
+        assert_eq!(None, summary.errors.last_request_errors[1]);
+        let p50 = summary.service_time.percentile(50.0);
+        assert!((1_000..=1_000 + 1_000 / 16).contains(&p50), "{}", p50);
+        assert_eq!(3_000, summary.service_time.max());
+        assert_eq!(2, summary.polls);
+        assert_eq!(1, summary.poll_failures);
+        assert_eq!(300_000_000, summary.poll_latency.max());
+    }
+
+    #[test]
+    fn test_metrics_summary_into() {
+        let metrics = Metrics::new(2);
+        metrics.worker(0).count_response(1, false);
+        metrics.worker(1).service_time.record(3_000, 1);
+        metrics.poller().count_poll(Duration::from_millis(3), false);
+
+        // Refilling a summary replaces what it held rather than adding to it
+        let mut summary = MetricsSummary::new();
+        metrics.summary_into(&mut summary);
+        metrics.summary_into(&mut summary);
+        assert_eq!([0, 1, 0, 0, 0, 0, 0, 0, 0], summary.requests);
+        assert_eq!(1, summary.service_time.total);
+        assert_eq!(3_000, summary.service_time.max());
+        assert_eq!(3_000_000, summary.poll_latency.max());
+        assert_eq!(1, summary.polls);
+
+        metrics.worker(1).count_response(1, false);
+        metrics.summary_into(&mut summary);
+        assert_eq!([0, 2, 0, 0, 0, 0, 0, 0, 0], summary.requests);
+        assert_eq!(1, summary.service_time.total);
+        assert_eq!(1, summary.poll_latency.total);
+    }
+}
@@ -0,0 +1,141 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+//! Scheduling of the threads of ClockBoundD, so that a request is not delayed by the thread
+//! answering it being descheduled or page faulting.
+//!
+//! The threads can be pinned to a CPU and run under the SCHED_FIFO real-time policy, and the
+//! memory of the process can be locked. Each of these needs privileges that ClockBoundD may not
+//! have: if one can not be applied, it is logged and ClockBoundD keeps running without it.
+use log::{error, info};
+use std::io;
+
+/// How a thread of ClockBoundD is scheduled.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct ThreadPolicy {
+    /// The CPU the thread is pinned to, or None to let it run on any CPU.
+    pub cpu: Option<usize>,
+    /// The SCHED_FIFO priority the thread runs at, from 1 to 99, or None to keep the default
+    /// policy.
+    pub fifo_priority: Option<i32>,
+}
+
+impl ThreadPolicy {
+    /// Apply the policy to the calling thread. A policy that can not be applied is logged, and
+    /// the thread keeps its default scheduling.
+    ///
+    /// # Arguments
+    ///
+    /// * `thread` - The name of the calling thread, that is logged.
+    pub fn apply(&self, thread: &str) {
+        if let Some(cpu) = self.cpu {
+            match pin_to_cpu(cpu) {
+                Ok(()) => info!("Pinned {} to CPU {}", thread, cpu),
+                Err(e) => error!("Failed to pin {} to CPU {}. Error: {:?}", thread, cpu, e),
+            }
+        }
+        if let Some(priority) = self.fifo_priority {
+            match set_fifo_priority(priority) {
+                Ok(()) => info!(
+                    "Running {} under SCHED_FIFO at priority {}",
+                    thread, priority
+                ),
+                Err(e) => error!(
+                    "Failed to run {} under SCHED_FIFO at priority {}. Error: {:?}",
+                    thread, priority, e
+                ),
+            }
+        }
+    }
+}
+
+/// Pin the calling thread to a CPU.
+///
+/// # Arguments
+///
+/// * `cpu` - The index of the CPU.
+pub fn pin_to_cpu(cpu: usize) -> io::Result<()> {
+    if cpu >= libc::CPU_SETSIZE as usize {
+        return Err(io::Error::from_raw_os_error(libc::EINVAL));
+    }
+    let result = unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        libc::CPU_SET(cpu, &mut set);
+        // A pid of 0 is the calling thread
+        libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set)
+    };
+    if result < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+/// Run the calling thread under the SCHED_FIFO policy. It then runs until it blocks whenever it is
+/// runnable, unless a thread with a higher real-time priority is runnable on its CPU.
+///
+/// # Arguments
+///
+/// * `priority` - The priority, from 1 to 99 on Linux.
+pub fn set_fifo_priority(priority: i32) -> io::Result<()> {
+    let param = libc::sched_param {
+        sched_priority: priority,
+    };
+    let result =
+        unsafe { libc::pthread_setschedparam(libc::pthread_self(), libc::SCHED_FIFO, &param) };
+    if result != 0 {
+        return Err(io::Error::from_raw_os_error(result));
+    }
+    Ok(())
+}
+
+/// Lock all the current and future memory of the process, so that serving a request never page
+/// faults. Every thread stack is then faulted in when the thread is created.
+pub fn lock_memory() -> io::Result<()> {
+    let result = unsafe { libc::mlockall(libc::MCL_CURRENT | libc::MCL_FUTURE) };
+    if result < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::realtime::{pin_to_cpu, set_fifo_priority, ThreadPolicy};
+
+    #[test]
+    fn test_pin_to_cpu_successful() {
+        // The first CPU the tests are allowed to run on
+        let cpu = unsafe {
+            let mut set: libc::cpu_set_t = std::mem::zeroed();
+            libc::sched_getaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &mut set);
+            (0..libc::CPU_SETSIZE as usize)
+                .find(|&cpu| libc::CPU_ISSET(cpu, &set))
+                .unwrap()
+        };
+
+        // Pin a thread of its own, so that the other tests keep running on any CPU
+        let pinned = std::thread::spawn(move || {
+            pin_to_cpu(cpu)?;
+            Ok::<i32, std::io::Error>(unsafe { libc::sched_getcpu() })
+        })
+        .join()
+        .unwrap();
+        assert_eq!(cpu as i32, pinned.unwrap());
+    }
+
+    #[test]
+    fn test_pin_to_cpu_invalid() {
+        assert!(pin_to_cpu(libc::CPU_SETSIZE as usize).is_err());
+    }
+
+    #[test]
+    fn test_set_fifo_priority_invalid() {
+        let result = std::thread::spawn(|| set_fifo_priority(0)).join().unwrap();
+        assert_eq!(Some(libc::EINVAL), result.unwrap_err().raw_os_error());
+    }
+
+    #[test]
+    fn test_apply_default() {
+        // The default policy leaves the thread as it is
+        ThreadPolicy::default().apply("test thread");
+    }
+}
@@ -1,265 +1,840 @@
 // Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
 // SPDX-License-Identifier: GPL-2.0-only
-use crate::ceb::ClockErrorBound;
+use crate::ceb::BoundModel;
 use crate::chrony_poller::LEAP_STATUS_UNSYNCHRONIZED;
-#[cfg(not(test))]
-use crate::tracking::update_root_dispersion;
-use byteorder::{ByteOrder, NetworkEndian, WriteBytesExt};
+use crate::metrics::{HistogramSummary, MetricsSummary};
+use crate::subscribers::SUBSCRIPTION_LEASE_SECS;
+use byteorder::{ByteOrder, NetworkEndian};
 #[cfg(not(test))]
 use chrono::Utc;
-use chrony_candm::reply::Tracking;
-use log::error;
 
-/// The current ClockBound protocol version
+/// The original ClockBound protocol version
 pub const RESPONSE_VERSION: u8 = 1;
 
+/// The ClockBound protocol version with a request id in the header. The request id is echoed
+/// back in the response so that a client can match responses to requests.
+pub const RESPONSE_VERSION_2: u8 = 2;
+
 /// An Error Response to include in the header
 pub const ERROR_RESPONSE: u8 = 0;
 
+/// A Batch Request, testing many timestamps against a single bound
+pub const BATCH_REQUEST: u8 = 4;
+
+/// The maximum number of timestamps a Batch Request can carry. Each one is given a bit of the
+/// before and after bitmaps in the response.
+pub const MAX_BATCH_EPOCHS: usize = 64;
+
+/// A Subscribe Request, asking for the Clock Error Bound model to be pushed whenever it changes
+pub const SUBSCRIBE_REQUEST: u8 = 5;
+
+/// An Update Response, pushed to subscribers when the Clock Error Bound model changes
+pub const UPDATE_RESPONSE: u8 = 6;
+
+/// A Stats Request, asking for the request counters and latency percentiles of ClockBoundD
+pub const STATS_REQUEST: u8 = 7;
+
+/// A Compare Request, testing a timestamp against the bounds and returning the bounds with the
+/// before and after verdicts
+pub const COMPARE_REQUEST: u8 = 8;
+
+/// A flag in the 3rd byte of a Now Request header, asking for the time the request was queued on
+/// the socket to be appended to the response.
+pub const REQUEST_FLAG_QUEUE_DELAY: u8 = 1;
+
+/// The size of the header of a version 1 request or response.
+const HEADER_SIZE: usize = 4;
+
+/// The size of the header of a version 2 request or response, which ends with the request id.
+const HEADER_SIZE_V2: usize = 8;
+
+/// The size of the body of a Batch Request before its timestamps: the count and 2 reserved bytes.
+const BATCH_COUNT_SIZE: usize = 4;
+
+/// The size of the body of a Subscribe or Update Response: the reference time, base Clock Error
+/// Bound and growth rate of the model, and the lease of the subscription.
+const UPDATE_BODY_SIZE: usize = 28;
+
+/// The size of the body of a Stats Response: 25 counters and percentiles of 8 bytes each.
+const STATS_BODY_SIZE: usize = 200;
+
+/// The size of the buffer a request is received into. Large enough for the largest valid request,
+/// a version 2 Batch Request carrying the maximum number of timestamps.
+pub const REQUEST_BUFFER_SIZE: usize = HEADER_SIZE_V2 + BATCH_COUNT_SIZE + 8 * MAX_BATCH_EPOCHS;
+
+/// The size of the buffer a response is built into. Large enough for the largest response, a
+/// version 2 Stats Response.
+pub const RESPONSE_BUFFER_SIZE: usize = HEADER_SIZE_V2 + STATS_BODY_SIZE;
+
+/// Get the size of the header of a request or response of a protocol version.
+///
+/// # Arguments
+///
+/// * `version` - The version of the ClockBound protocol.
+fn header_size(version: u8) -> usize {
+    match version {
+        RESPONSE_VERSION_2 => HEADER_SIZE_V2,
+        _ => HEADER_SIZE,
+    }
+}
+
+/// Why a request was answered with an Error (0) response while the error flag was not set.
+///
+/// Invalid requests are not logged as they are received, so that one misbehaving client cannot
+/// slow every other client down with syslog writes. They are counted instead, and logged in
+/// aggregate from a background thread.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum RequestError {
+    /// The request used a version of the protocol that is not supported.
+    UnsupportedVersion(u8),
+    /// The request type is not valid.
+    InvalidType(u8),
+    /// The request type is valid, but the request is not the size it must be.
+    InvalidSize { request_type: u8, size: usize },
+    /// The count of a Batch Request does not match the timestamps it carries.
+    BatchCountMismatch { count: usize, size: usize },
+    /// The Clock Error Bound could not be evaluated, since Chrony's last update is in the future.
+    BoundUnavailable,
+}
+
+/// The number of kinds of request errors, indexed by RequestError::index.
+pub const REQUEST_ERRORS: usize = 5;
+
+impl RequestError {
+    /// The index of the kind of the error, that it is counted under.
+    pub fn index(&self) -> usize {
+        match self {
+            RequestError::UnsupportedVersion(_) => 0,
+            RequestError::InvalidType(_) => 1,
+            RequestError::InvalidSize { .. } => 2,
+            RequestError::BatchCountMismatch { .. } => 3,
+            RequestError::BoundUnavailable => 4,
+        }
+    }
+
+    /// Pack the details of the error into a u64, to be stored next to its counter.
+    pub fn pack(&self) -> u64 {
+        match *self {
+            RequestError::UnsupportedVersion(version) => version as u64,
+            RequestError::InvalidType(request_type) => request_type as u64,
+            RequestError::InvalidSize { request_type, size } => {
+                (request_type as u64) << 32 | size as u64
+            }
+            RequestError::BatchCountMismatch { count, size } => (count as u64) << 32 | size as u64,
+            RequestError::BoundUnavailable => 0,
+        }
+    }
+
+    /// Unpack an error of a kind from the details packed by pack.
+    ///
+    /// # Arguments
+    ///
+    /// * `index` - The index of the kind of the error.
+    /// * `packed` - The details of the error.
+    pub fn unpack(index: usize, packed: u64) -> RequestError {
+        let (high, low) = ((packed >> 32) as usize, (packed & 0xffff_ffff) as usize);
+        match index {
+            0 => RequestError::UnsupportedVersion(packed as u8),
+            1 => RequestError::InvalidType(packed as u8),
+            2 => RequestError::InvalidSize {
+                request_type: high as u8,
+                size: low,
+            },
+            3 => RequestError::BatchCountMismatch {
+                count: high,
+                size: low,
+            },
+            _ => RequestError::BoundUnavailable,
+        }
+    }
+}
+
+impl std::fmt::Display for RequestError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match *self {
+            RequestError::UnsupportedVersion(version) => write!(
+                f,
+                "The request version {} is not supported. Supported versions: {}, {}",
+                version, RESPONSE_VERSION, RESPONSE_VERSION_2
+            ),
+            RequestError::InvalidType(request_type) => write!(
+                f,
+                "Received invalid request type. Valid types: 1 (Now), 2 (Before), 3 (After), 4 (Batch), 5 (Subscribe), 7 (Stats), 8 (Compare), Received: {}",
+                request_type
+            ),
+            RequestError::InvalidSize { request_type, size } => write!(
+                f,
+                "Received request of type {} with invalid size. Received: {} bytes",
+                request_type, size
+            ),
+            RequestError::BatchCountMismatch { count, size } => write!(
+                f,
+                "Received Batch request with a count of {} timestamps but {} bytes of timestamps",
+                count, size
+            ),
+            RequestError::BoundUnavailable => write!(
+                f,
+                "Clock Error Bound could not be evaluated. Chrony's last update is in the future"
+            ),
+        }
+    }
+}
+
 /// Validate a request.
 ///
-/// Checks if the protocol versions between the client and daemon match.
+/// Checks if the protocol version of the request is supported by the daemon.
 /// Checks if the request type is valid.
 /// Checks if the request is the correct size.
 ///
 /// # Arguments
 ///
 /// * `request_version` - The version of the ClockBound protocol the request is using.
-/// * `request_type` - The request type: Error (0), Now (1), Before (2), After (3).
+/// * `request_type` - The request type: Error (0), Now (1), Before (2), After (3), Batch (4),
+/// Subscribe (5), Stats (7), Compare (8).
 /// * `request_size` - The amount of bytes read from a request received from a client.
 pub fn validate_request(request_version: u8, request_type: u8, request_size: usize) -> bool {
+    check_request(request_version, request_type, request_size).is_ok()
+}
+
+/// Check a request, returning why it is invalid if it is. See validate_request.
+///
+/// # Arguments
+///
+/// * `request_version` - The version of the ClockBound protocol the request is using.
+/// * `request_type` - The request type.
+/// * `request_size` - The amount of bytes read from a request received from a client.
+pub fn check_request(
+    request_version: u8,
+    request_type: u8,
+    request_size: usize,
+) -> Result<(), RequestError> {
     // Validate request version
-    if request_version != RESPONSE_VERSION {
-        error!(
-            "The request version {} does not match the response version {}",
-            request_version, RESPONSE_VERSION
-        );
-        return false;
+    if request_version != RESPONSE_VERSION && request_version != RESPONSE_VERSION_2 {
+        return Err(RequestError::UnsupportedVersion(request_version));
     }
 
+    // Every request starts with a header. A version 2 header adds the request id.
+    let header_size = header_size(request_version);
+
     // Validate request type and size
-    return match request_type {
-        1 => {
-            // Now request. A now request should be the size of just a header which is 4 bytes.
-            if request_size == 4 {
-                return true;
-            }
-            error!(
-                "Received Now request with invalid size. Expected: 4 bytes, Received: {} bytes",
-                request_size
-            );
-            false
-        }
-        2 => {
-            // Before request. A before request should have 12 bytes.
-            // 4 bytes in the header and 8 in the body.
-            if request_size == 12 {
-                return true;
-            }
-            error!(
-                "Received Before request with invalid size. Expected: 12 bytes, Received: {} bytes",
-                request_size
-            );
-            false
-        }
-        3 => {
-            // After request. A after request should have 12 bytes.
-            // 4 bytes in the header and 8 in the body.
-            if request_size == 12 {
-                return true;
-            }
-            error!(
-                "Received After request with invalid size. Expected: 12 bytes, Received: {} bytes",
-                request_size
-            );
-            false
-        }
-        _ => {
-            // Any other request is invalid.
-            error!(
-                "Received invalid request type. Valid types: 1 (Now), 2 (Before), 3 (After), Received: {}",
-                request_type
-            );
-            false
+    let valid_size = match request_type {
+        // Now, Subscribe and Stats requests should be the size of just a header.
+        1 | SUBSCRIBE_REQUEST | STATS_REQUEST => request_size == header_size,
+        // Before, After and Compare requests should have the header and 8 bytes in the body.
+        2 | 3 | COMPARE_REQUEST => request_size == header_size + 8,
+        BATCH_REQUEST => {
+            // A batch request should have the header, 2 bytes for the count and 2 reserved,
+            // followed by 8 bytes for each of its timestamps.
+            let timestamps_offset = header_size + BATCH_COUNT_SIZE;
+            request_size > timestamps_offset
+                && request_size <= timestamps_offset + 8 * MAX_BATCH_EPOCHS
+                && (request_size - timestamps_offset) % 8 == 0
         }
+        // Any other request is invalid.
+        _ => return Err(RequestError::InvalidType(request_type)),
     };
+    match valid_size {
+        true => Ok(()),
+        false => Err(RequestError::InvalidSize {
+            request_type,
+            size: request_size,
+        }),
+    }
+}
+
+/// Check that the count of a Batch Request matches the timestamps it carries.
+///
+/// # Arguments
+///
+/// * `request_body` - The body of the Batch Request, following its header.
+fn check_batch_count(request_body: &[u8]) -> Result<usize, RequestError> {
+    let count = NetworkEndian::read_u16(&request_body[0..2]) as usize;
+    if BATCH_COUNT_SIZE + 8 * count != request_body.len() {
+        return Err(RequestError::BatchCountMismatch {
+            count,
+            size: request_body.len() - BATCH_COUNT_SIZE,
+        });
+    }
+    Ok(count)
+}
+
+/// Find why build_response answered a request with an Error (0) response. Only called for such
+/// responses, off the path of valid requests. A valid request is reported as BoundUnavailable,
+/// which is also what it was refused for if the error flag was set.
+///
+/// # Arguments
+///
+/// * `request` - The request received from a client.
+/// * `request_size` - The amount of bytes read from a request received from a client.
+/// * `model` - The Clock Error Bound model the response was built from.
+/// * `time_nanos` - The system time the response was built at.
+pub fn request_error(
+    request: &[u8; REQUEST_BUFFER_SIZE],
+    request_size: usize,
+    model: &BoundModel,
+    time_nanos: u64,
+) -> RequestError {
+    if model.ceb_nanos_at(time_nanos).is_none() {
+        return RequestError::BoundUnavailable;
+    }
+    if let Err(e) = check_request(request[0], request[1], request_size) {
+        return e;
+    }
+    if request[1] != BATCH_REQUEST {
+        return RequestError::BoundUnavailable;
+    }
+    let header_size = header_size(request[0]);
+    match check_batch_count(&request[header_size..request_size]) {
+        Err(e) => e,
+        Ok(_) => RequestError::BoundUnavailable,
+    }
 }
 
 /// Build a response to send to a client.
 ///
+/// The response is written into a buffer provided by the caller so that no allocation is needed
+/// per request. Returns the size of the response in bytes.
+///
+/// Both version 1 and version 2 requests are supported. A response is built with the same
+/// version as the request, and a version 2 response echoes the request id of the request.
+///
 /// # Arguments
 ///
 /// * `request` - The request received from a client.
 /// * `request_size` - The amount of bytes read from a request received from a client.
-/// * `tracking` - The tracking information received from Chrony.
+/// * `model` - The Clock Error Bound model computed from the tracking information received from Chrony.
 /// * `error_flag` - An error flag indicating if there has been an error when getting the tracking
 /// information from Chrony.
-/// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
+/// * `time_nanos` - The current system time in nanoseconds since the Unix epoch.
+/// * `received_nanos` - The time the kernel received the request in nanoseconds since the Unix
+/// epoch, or `time_nanos` if it is not known.
+/// * `response` - The buffer the response is written into.
 pub fn build_response(
-    request: [u8; 12],
+    request: &[u8; REQUEST_BUFFER_SIZE],
     request_size: usize,
-    tracking: Tracking,
+    model: &BoundModel,
     error_flag: bool,
-    max_clock_error: f64,
-) -> Vec<u8> {
+    time_nanos: u64,
+    received_nanos: u64,
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+) -> usize {
     // The protocol version of the request
     let request_version = request[0];
     // The request type
     let request_type = request[1];
 
-    // The 3rd and 4th bytes are reserved
+    // The 3rd byte holds the flags of the request, the 4th byte is reserved
+    let request_flags = request[2];
+
+    // A version 2 request carries a request id in the 5th to 8th bytes. Only echo it back if the
+    // whole header was received.
+    let response_version =
+        if request_version == RESPONSE_VERSION_2 && request_size >= HEADER_SIZE_V2 {
+            RESPONSE_VERSION_2
+        } else {
+            RESPONSE_VERSION
+        };
+    let request_id = request_id(request);
 
     // Chrony tracking information provides the leap status which can be one of four values:
     // Normal (0), Insert second (1), Delete second (2), or Not synchronised (3)
     // If leap status reports as "Not synchronised" then that means Chrony is not synchronised to a
     // source. A client will want to know if Chrony is synchronised or not so set the sync flag
     // false (1) if unsynchronized; otherwise, true (0).
-    let sync_flag: u8 = match tracking.leap_status {
+    let sync_flag: u8 = match model.leap_status {
         LEAP_STATUS_UNSYNCHRONIZED => 1, // False
         _ => 0,                          // True
     };
 
-    // Don't update the root dispersion when building a response from a test. Updating the root
-    // dispersion incorporates checking the current system time which is difficult to test against.
-    // Updating root dispersion is tested in its own standalone test.
-    #[cfg(not(test))]
-    // If there is an issue updating the root dispersion then send back the header only with the
-    // response type as error.
-    // Even if chronyd is not running the root dispersion will grow based on the last tracking
-    // data received from chronyd. Clients can handle this case by seeing that the error flag is
-    // set to true due to not being able to get tracking data from chronyd.
-    let tracking = match update_root_dispersion(tracking, max_clock_error) {
-        Ok(t) => t,
-        Err(e) => {
-            error!("Root dispersion could not be updated. {:?}", e);
-            // If updating the root dispersion fails, then send back only a header with the
-            // response type as Error (0).
-            return build_response_header(ERROR_RESPONSE, sync_flag);
+    // Evaluate the Clock Error Bound at the current time. If there is an issue evaluating the
+    // bound then send back the header only with the response type as error.
+    // Even if chronyd is not running the bound will grow based on the last tracking data received
+    // from chronyd. Clients can handle this case by seeing that the error flag is set to true due
+    // to not being able to get tracking data from chronyd.
+    let ceb_nanos = match model.ceb_nanos_at(time_nanos) {
+        Some(ceb_nanos) => ceb_nanos,
+        None => {
+            // If evaluating the bound fails, then send back only a header with the response type
+            // as Error (0).
+            return build_response_header(
+                response,
+                response_version,
+                ERROR_RESPONSE,
+                sync_flag,
+                request_id,
+            );
         }
     };
 
+    // Before, After and Batch requests are tested against the bounds at the time the request was
+    // received, so that the time it spent queued on the socket does not make the answer later
+    // than the client asked. If Chrony updated in between, the current bounds are used.
+    let received_nanos = received_nanos.min(time_nanos);
+    let (received_ceb_nanos, received_nanos) = match model.ceb_nanos_at(received_nanos) {
+        Some(received_ceb_nanos) => (received_ceb_nanos, received_nanos),
+        None => (ceb_nanos, time_nanos),
+    };
+
     let is_valid_request = validate_request(request_version, request_type, request_size);
 
-    // If the error flag is true or if the version of the request does not match the response
-    // version; set the response type to Error (0)
-    let response_header = if error_flag || !is_valid_request {
-        build_response_header(ERROR_RESPONSE, sync_flag)
+    // If the error flag is true or if the version of the request is not supported; set the
+    // response type to Error (0)
+    let header_size = if error_flag || !is_valid_request {
+        build_response_header(
+            response,
+            response_version,
+            ERROR_RESPONSE,
+            sync_flag,
+            request_id,
+        )
     } else {
-        build_response_header(request_type, sync_flag)
+        build_response_header(
+            response,
+            response_version,
+            request_type,
+            sync_flag,
+            request_id,
+        )
     };
 
-    let ceb_data = ClockErrorBound::from(tracking);
+    // The body of the request follows its header
+    let request_body = &request[header_size..request_size.max(header_size)];
 
     // Build response based on Request Type
     // Invalid type = Error Response
     // 1 = Now
     // 2 = Before
     // 3 = After
+    // 4 = Batch
+    // 5 = Subscribe
+    // 8 = Compare
     return match request_type {
-        1 => build_response_now(response_header, &ceb_data),
-        2 | 3 => {
+        1 => {
+            let queue_delay = match request_flags & REQUEST_FLAG_QUEUE_DELAY {
+                0 => None,
+                _ => Some(time_nanos - received_nanos),
+            };
+            build_response_now(response, header_size, ceb_nanos, time_nanos, queue_delay)
+        }
+        2 | 3 if request_body.len() >= 8 => {
             // If our request is a before (2) or after (3) request then a body is expected
-            let request_body = NetworkEndian::read_u64(&request[4..12]);
-            build_response_before_after(response_header, &ceb_data, request_body)
+            let time_epoch = NetworkEndian::read_u64(&request_body[0..8]);
+            build_response_before_after(
+                response,
+                header_size,
+                received_ceb_nanos,
+                time_epoch,
+                received_nanos,
+            )
+        }
+        BATCH_REQUEST => build_response_batch(
+            response,
+            header_size,
+            received_ceb_nanos,
+            request_body,
+            received_nanos,
+        ),
+        SUBSCRIBE_REQUEST => build_response_update(response, header_size, model),
+        COMPARE_REQUEST if request_body.len() >= 8 => {
+            let time_epoch = NetworkEndian::read_u64(&request_body[0..8]);
+            build_response_compare(
+                response,
+                header_size,
+                received_ceb_nanos,
+                time_epoch,
+                received_nanos,
+            )
         }
         _ => {
             // If invalid request type then send back the header. The header will return a request
             // type of 0 to indicate an error.
-            response_header
+            header_size
         }
     };
 }
 
-/// Builds the header of a response.
+/// Builds the header of a response. Returns the size of the header in bytes.
 ///
 /// # Arguments:
 ///
-/// * `request_type` - The request type: Error (0), Now (1), Before (2), After (3).
+/// * `response` - The buffer the response is written into.
+/// * `response_version` - The protocol version of the response: 1, or 2 to echo the request id.
+/// * `request_type` - The request type: Error (0), Now (1), Before (2), After (3), Batch (4),
+/// Subscribe (5), Update (6), Stats (7), Compare (8).
 /// * `sync_flag` - A flag indicating if Chrony is synchronized to a source. This flag is set based
 /// on the leap status value from Chrony's tracking data. If the value is reported as unsynchronized
 /// then this flag gets set to false. Otherwise, true.
-fn build_response_header(mut request_type: u8, sync_flag: u8) -> Vec<u8> {
-    let mut response: Vec<u8> = Vec::with_capacity(4);
-    // Send back the response version of ClockBoundD
-    response.push(RESPONSE_VERSION);
-
-    // If the request type is not a valid type then set it to Error (0)
-    let request_types: [u8; 4] = [0, 1, 2, 3];
-    if !request_types.contains(&request_type) {
-        request_type = ERROR_RESPONSE;
-    }
-
-    // Send back the request type. Will be set to Error (0) if an error occurred.
-    response.push(request_type);
+/// * `request_id` - The request id of a version 2 request. Ignored for version 1.
+fn build_response_header(
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+    response_version: u8,
+    request_type: u8,
+    sync_flag: u8,
+    request_id: u32,
+) -> usize {
+    // Send back the response version matching the request
+    response[0] = response_version;
+    // Send back the request type. If the request type is not a valid type then set it to
+    // Error (0).
+    response[1] = match request_type {
+        1 | 2 | 3 | BATCH_REQUEST | SUBSCRIBE_REQUEST | UPDATE_RESPONSE | STATS_REQUEST
+        | COMPARE_REQUEST => request_type,
+        _ => ERROR_RESPONSE,
+    };
     // Set the sync flag based on the Chrony tracking information
-    response.push(sync_flag);
+    response[2] = sync_flag;
     // 4th byte is currently reserved
-    let reserved: u8 = 0;
-    response.push(reserved);
-    response
+    response[3] = 0;
+    if response_version == RESPONSE_VERSION_2 {
+        NetworkEndian::write_u32(&mut response[4..8], request_id);
+    }
+    header_size(response_version)
 }
 
-/// Builds the response of a now request to send to a client.
+/// Builds the body of a now request's response after its header. Returns the size of the
+/// response in bytes.
 ///
 /// # Arguments:
 ///
-/// * `header` - The header of the response.
-/// * `ceb_data` - The Clock Error Bound calculated from the Chrony tracking data.
-fn build_response_now(header: Vec<u8>, ceb_data: &ClockErrorBound) -> Vec<u8> {
-    let mut response: Vec<u8> = header;
-    let (earliest, latest): (u64, u64) = clockbound_now(ceb_data.ceb);
-    response.write_u64::<NetworkEndian>(earliest).unwrap();
-    response.write_u64::<NetworkEndian>(latest).unwrap();
-    response
+/// * `response` - The buffer the response is written into. Already holds the header.
+/// * `header_size` - The size of the header of the response.
+/// * `ceb_nanos` - The Clock Error Bound in nanoseconds calculated from the Chrony tracking data.
+/// * `time_nanos` - The current system time in nanoseconds since the Unix epoch.
+/// * `queue_delay` - The time in nanoseconds the request was queued on the socket, if the client
+/// asked for it.
+fn build_response_now(
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+    header_size: usize,
+    ceb_nanos: u64,
+    time_nanos: u64,
+    queue_delay: Option<u64>,
+) -> usize {
+    let (earliest, latest): (u64, u64) = clockbound_now(ceb_nanos, time_nanos);
+    let body = &mut response[header_size..];
+    NetworkEndian::write_u64(&mut body[0..8], earliest);
+    NetworkEndian::write_u64(&mut body[8..16], latest);
+    match queue_delay {
+        Some(queue_delay) => {
+            NetworkEndian::write_u64(&mut body[16..24], queue_delay);
+            header_size + 24
+        }
+        None => header_size + 16,
+    }
 }
 
-/// Builds the response of a before or after request to send to a client.
+/// Builds the body of a before or after request's response after its header. Returns the size
+/// of the response in bytes.
 ///
 /// # Arguments:
 ///
-/// * `header` - The header of the response.
-/// * `ceb_data` - The ClockErrorBound struct containing the CEB calculated from the Chrony tracking data.
+/// * `response` - The buffer the response is written into. Already holds the header.
+/// * `header_size` - The size of the header of the response.
+/// * `ceb_nanos` - The Clock Error Bound in nanoseconds calculated from the Chrony tracking data.
 /// * `time_epoch` - The timestamp in nanoseconds since the Unix Epoch to compare against.
+/// * `time_nanos` - The current system time in nanoseconds since the Unix epoch.
 fn build_response_before_after(
-    header: Vec<u8>,
-    ceb_data: &ClockErrorBound,
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+    header_size: usize,
+    ceb_nanos: u64,
     time_epoch: u64,
-) -> Vec<u8> {
-    let mut response = header;
-    let (earliest, latest) = clockbound_now(ceb_data.ceb);
+    time_nanos: u64,
+) -> usize {
+    let (earliest, latest) = clockbound_now(ceb_nanos, time_nanos);
     // response[1] holds the response type
     // 2 = Before
     // 3 = After
-    if response[1] == 2 {
-        response
-            .write_u8(clockbound_before(earliest, time_epoch))
-            .unwrap();
-    } else if response[1] == 3 {
-        response
-            .write_u8(clockbound_after(latest, time_epoch))
-            .unwrap();
+    match response[1] {
+        2 => response[header_size] = clockbound_before(earliest, time_epoch),
+        3 => response[header_size] = clockbound_after(latest, time_epoch),
+        // An error response only has the header
+        _ => return header_size,
+    }
+    header_size + 1
+}
+
+/// Builds the body of a compare request's response after its header. Returns the size of the
+/// response in bytes.
+///
+/// The bounds and both verdicts are computed from the same Clock Error Bound and system time, so
+/// that a client ordering an event and recording its interval gets answers that agree.
+///
+/// # Arguments:
+///
+/// * `response` - The buffer the response is written into. Already holds the header.
+/// * `header_size` - The size of the header of the response.
+/// * `ceb_nanos` - The Clock Error Bound in nanoseconds calculated from the Chrony tracking data.
+/// * `time_epoch` - The timestamp in nanoseconds since the Unix Epoch to compare against.
+/// * `time_nanos` - The current system time in nanoseconds since the Unix epoch.
+fn build_response_compare(
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+    header_size: usize,
+    ceb_nanos: u64,
+    time_epoch: u64,
+    time_nanos: u64,
+) -> usize {
+    // An error response only has the header
+    if response[1] != COMPARE_REQUEST {
+        return header_size;
+    }
+
+    let (earliest, latest) = clockbound_now(ceb_nanos, time_nanos);
+    let body = &mut response[header_size..];
+    NetworkEndian::write_u64(&mut body[0..8], earliest);
+    NetworkEndian::write_u64(&mut body[8..16], latest);
+    body[16] = clockbound_before(earliest, time_epoch);
+    body[17] = clockbound_after(latest, time_epoch);
+    header_size + 18
+}
+
+/// Builds the body of a batch request's response after its header. Returns the size of the
+/// response in bytes.
+///
+/// Every timestamp of the request is tested against the same bounds. The result for the nth
+/// timestamp is held in the nth least significant bit of the before and after bitmaps.
+///
+/// # Arguments:
+///
+/// * `response` - The buffer the response is written into. Already holds the header.
+/// * `header_size` - The size of the header of the response.
+/// * `ceb_nanos` - The Clock Error Bound in nanoseconds calculated from the Chrony tracking data.
+/// * `request_body` - The body of the batch request received from a client.
+/// * `time_nanos` - The current system time in nanoseconds since the Unix epoch.
+fn build_response_batch(
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+    header_size: usize,
+    ceb_nanos: u64,
+    request_body: &[u8],
+    time_nanos: u64,
+) -> usize {
+    // An error response only has the header
+    if response[1] != BATCH_REQUEST {
+        return header_size;
+    }
+
+    // The count must match the number of timestamps actually received
+    let count = match check_batch_count(request_body) {
+        Ok(count) => count,
+        Err(_) => {
+            response[1] = ERROR_RESPONSE;
+            return header_size;
+        }
+    };
+
+    let (earliest, latest) = clockbound_now(ceb_nanos, time_nanos);
+    let mut before: u64 = 0;
+    let mut after: u64 = 0;
+    for (i, epoch) in request_body[BATCH_COUNT_SIZE..].chunks_exact(8).enumerate() {
+        let time_epoch = NetworkEndian::read_u64(epoch);
+        before |= u64::from(clockbound_before(earliest, time_epoch)) << i;
+        after |= u64::from(clockbound_after(latest, time_epoch)) << i;
     }
-    response
+
+    let body = &mut response[header_size..];
+    NetworkEndian::write_u64(&mut body[0..8], earliest);
+    NetworkEndian::write_u64(&mut body[8..16], latest);
+    NetworkEndian::write_u16(&mut body[16..18], count as u16);
+    // 2 bytes reserved
+    body[18] = 0;
+    body[19] = 0;
+    NetworkEndian::write_u64(&mut body[20..28], before);
+    NetworkEndian::write_u64(&mut body[28..36], after);
+    header_size + 36
+}
+
+/// Builds the body of a subscribe request's response, or of an update pushed to a subscriber,
+/// after its header. Returns the size of the response in bytes.
+///
+/// The body carries the Clock Error Bound model rather than bounds, so that a subscriber can
+/// evaluate the bounds locally until the next update. The body is also sent with an error
+/// response, in which case the model is the last valid one.
+///
+/// # Arguments:
+///
+/// * `response` - The buffer the response is written into. Already holds the header.
+/// * `header_size` - The size of the header of the response.
+/// * `model` - The Clock Error Bound model computed from the tracking information received from Chrony.
+fn build_response_update(
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+    header_size: usize,
+    model: &BoundModel,
+) -> usize {
+    let body = &mut response[header_size..];
+    NetworkEndian::write_u64(&mut body[0..8], model.ref_time_nanos);
+    NetworkEndian::write_u64(&mut body[8..16], model.base_ceb_nanos);
+    // The growth rate is sent as a f64 of nanoseconds per second, which holds any rate in parts
+    // per billion exactly
+    NetworkEndian::write_u64(&mut body[16..24], (model.growth_ppb as f64).to_bits());
+    NetworkEndian::write_u32(&mut body[24..28], SUBSCRIPTION_LEASE_SECS);
+    header_size + UPDATE_BODY_SIZE
+}
+
+/// Build an update to push to a subscriber. Returns the size of the update in bytes.
+///
+/// # Arguments
+///
+/// * `model` - The Clock Error Bound model computed from the tracking information received from Chrony.
+/// * `error_flag` - An error flag indicating if there has been an error when getting the tracking
+/// information from Chrony.
+/// * `response_version` - The protocol version of the subscriber's subscribe request.
+/// * `request_id` - The request id of the subscriber's subscribe request. Ignored for version 1.
+/// * `response` - The buffer the update is written into.
+pub fn build_update(
+    model: &BoundModel,
+    error_flag: bool,
+    response_version: u8,
+    request_id: u32,
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+) -> usize {
+    let sync_flag: u8 = match model.leap_status {
+        LEAP_STATUS_UNSYNCHRONIZED => 1, // False
+        _ => 0,                          // True
+    };
+    let response_type = if error_flag {
+        ERROR_RESPONSE
+    } else {
+        UPDATE_RESPONSE
+    };
+    let header_size = build_response_header(
+        response,
+        response_version,
+        response_type,
+        sync_flag,
+        request_id,
+    );
+    build_response_update(response, header_size, model)
+}
+
+/// Set the lease of the response to a subscribe request to 0, telling the client that it was not
+/// subscribed. A response without the model, sent if the bound could not be evaluated, is left
+/// as it is.
+///
+/// # Arguments
+///
+/// * `response` - The response to the subscribe request.
+/// * `response_size` - The size of the response in bytes.
+pub fn refuse_subscription(response: &mut [u8; RESPONSE_BUFFER_SIZE], response_size: usize) {
+    if response_size == header_size(response[0]) + UPDATE_BODY_SIZE {
+        NetworkEndian::write_u32(&mut response[response_size - 4..response_size], 0);
+    }
+}
+
+/// Get the request id of a request. Only meaningful for a version 2 request.
+///
+/// # Arguments
+///
+/// * `request` - The request received from a client.
+pub fn request_id(request: &[u8; REQUEST_BUFFER_SIZE]) -> u32 {
+    NetworkEndian::read_u32(&request[4..8])
+}
+
+/// Check if a request is a valid subscribe request, without logging anything.
+///
+/// # Arguments
+///
+/// * `request` - The request received from a client.
+/// * `request_size` - The amount of bytes read from a request received from a client.
+pub fn is_subscribe_request(request: &[u8; REQUEST_BUFFER_SIZE], request_size: usize) -> bool {
+    let request_version = request[0];
+    (request_version == RESPONSE_VERSION || request_version == RESPONSE_VERSION_2)
+        && request[1] == SUBSCRIBE_REQUEST
+        && request_size == header_size(request_version)
+}
+
+/// Check if a request is a valid stats request, without logging anything.
+///
+/// # Arguments
+///
+/// * `request` - The request received from a client.
+/// * `request_size` - The amount of bytes read from a request received from a client.
+pub fn is_stats_request(request: &[u8; REQUEST_BUFFER_SIZE], request_size: usize) -> bool {
+    let request_version = request[0];
+    (request_version == RESPONSE_VERSION || request_version == RESPONSE_VERSION_2)
+        && request[1] == STATS_REQUEST
+        && request_size == header_size(request_version)
+}
+
+/// Build the response to a stats request. Returns the size of the response in bytes.
+///
+/// Stats are sent regardless of the error flag, since they describe ClockBoundD rather than the
+/// clock.
+///
+/// # Arguments
+///
+/// * `request` - The request received from a client. Must be a valid stats request.
+/// * `model` - The Clock Error Bound model, for the sync flag of the response.
+/// * `summary` - The metrics of ClockBoundD summed across threads.
+/// * `response` - The buffer the response is written into.
+pub fn build_response_stats(
+    request: &[u8; REQUEST_BUFFER_SIZE],
+    model: &BoundModel,
+    summary: &MetricsSummary,
+    response: &mut [u8; RESPONSE_BUFFER_SIZE],
+) -> usize {
+    let sync_flag: u8 = match model.leap_status {
+        LEAP_STATUS_UNSYNCHRONIZED => 1, // False
+        _ => 0,                          // True
+    };
+    let header_size = build_response_header(
+        response,
+        request[0],
+        STATS_REQUEST,
+        sync_flag,
+        request_id(request),
+    );
+
+    let percentiles = |histogram: &HistogramSummary| {
+        [
+            histogram.percentile(50.0),
+            histogram.percentile(99.0),
+            histogram.percentile(99.9),
+            histogram.max(),
+        ]
+    };
+    let requests = &summary.requests;
+    let values = [
+        summary.uptime.as_nanos() as u64,
+        requests[ERROR_RESPONSE as usize],
+        requests[1],
+        requests[2],
+        requests[3],
+        requests[BATCH_REQUEST as usize],
+        requests[SUBSCRIBE_REQUEST as usize],
+        requests[STATS_REQUEST as usize],
+        summary.error_flag_responses,
+        summary.errors.send_failures,
+        summary.polls,
+        summary.poll_failures,
+    ]
+    .into_iter()
+    .chain(percentiles(&summary.service_time))
+    .chain(percentiles(&summary.snapshot_age))
+    .chain(percentiles(&summary.poll_latency))
+    // Counters of request types added since are appended, so that older clients still decode the
+    // fields they know
+    .chain([requests[COMPARE_REQUEST as usize]]);
+
+    let body = &mut response[header_size..header_size + STATS_BODY_SIZE];
+    for (field, value) in body.chunks_exact_mut(8).zip(values) {
+        NetworkEndian::write_u64(field, value);
+    }
+    header_size + STATS_BODY_SIZE
 }
 
 /// Takes a Clock Error Bound and generates earliest and latest bounds based on the current system
 /// time.
 ///
-/// Calculation of bounds is computed with [System time - CEB, System time + CEB]
+/// Calculation of bounds is computed with [System time - CEB, System time + CEB], saturating at
+/// the Unix epoch and at the largest representable time rather than wrapping.
 ///
 /// # Arguments:
 ///
-/// * `ceb` - The Clock Error Bound calculated from the Chrony tracking data.
-fn clockbound_now(ceb: f64) -> (u64, u64) {
-    // For testing purposes we will use a mock function to retrieve our timestamp instead of getting
-    // the current time.
-    #[cfg(test)]
-    let time_nanos: u64 = tests::mock_get_epoch_us();
-    #[cfg(not(test))]
-    let time_nanos: u64 = get_epoch_us();
-    // Convert seconds to nanoseconds and round to the nearest nanosecond.
-    let ceb_nanos: u64 = (ceb * 1000000000.0) as u64;
-    return (time_nanos - ceb_nanos, time_nanos + ceb_nanos);
+/// * `ceb_nanos` - The Clock Error Bound in nanoseconds calculated from the Chrony tracking data.
+/// * `time_nanos` - The current system time in nanoseconds since the Unix epoch.
+fn clockbound_now(ceb_nanos: u64, time_nanos: u64) -> (u64, u64) {
+    return (
+        time_nanos.saturating_sub(ceb_nanos),
+        time_nanos.saturating_add(ceb_nanos),
+    );
 }
 
 /// Takes the earliest bound calculated from a now request and compares it against a provided
@@ -292,24 +867,35 @@ fn clockbound_after(latest: u64, time_epoch: u64) -> u8 {
 
 /// Get the current system time in nanoseconds since the Unix epoch.
 #[cfg(not(test))]
-fn get_epoch_us() -> u64 {
+pub fn get_epoch_us() -> u64 {
     let now = Utc::now();
     now.timestamp_nanos() as u64
 }
 
+/// For testing purposes we will use a mock function to retrieve our timestamp instead of getting
+/// the current time.
+#[cfg(test)]
+pub fn get_epoch_us() -> u64 {
+    tests::mock_get_epoch_us()
+}
+
 #[cfg(test)]
 mod tests {
-    use crate::ceb::ClockErrorBound;
+    use crate::ceb::BoundModel;
     use crate::chrony_poller::LEAP_STATUS_UNSYNCHRONIZED;
+    use crate::metrics::Metrics;
     use crate::response::{
-        build_response, build_response_header, clockbound_after, clockbound_before, clockbound_now,
-        validate_request, RESPONSE_VERSION,
+        build_response, build_response_header, build_response_stats, build_update,
+        clockbound_after, clockbound_before, clockbound_now, is_stats_request,
+        is_subscribe_request, request_error, validate_request, RequestError, COMPARE_REQUEST,
+        REQUEST_BUFFER_SIZE, REQUEST_FLAG_QUEUE_DELAY, RESPONSE_BUFFER_SIZE, RESPONSE_VERSION,
+        RESPONSE_VERSION_2, STATS_REQUEST, SUBSCRIBE_REQUEST, UPDATE_RESPONSE,
     };
+    use crate::subscribers::SUBSCRIPTION_LEASE_SECS;
     use crate::tracking::mock_tracking;
     use byteorder::NetworkEndian;
     use byteorder::{ReadBytesExt, WriteBytesExt};
     use chrono::{TimeZone, Utc};
-    use std::convert::TryFrom;
     use std::io::Cursor;
 
     pub fn mock_get_epoch_us() -> u64 {
@@ -318,11 +904,18 @@ mod tests {
         now.timestamp_nanos() as u64
     }
 
+    /// Copy a request into a buffer the size of the one ClockBoundD receives requests into.
+    fn to_request_buffer(request: &[u8]) -> [u8; REQUEST_BUFFER_SIZE] {
+        let mut buffer = [0; REQUEST_BUFFER_SIZE];
+        buffer[..request.len()].copy_from_slice(request);
+        buffer
+    }
+
     #[test]
     fn test_build_response_now_successful() {
         let tracking = mock_tracking();
 
-        let mut request: [u8; 12] = [0; 12];
+        let mut request: [u8; REQUEST_BUFFER_SIZE] = [0; REQUEST_BUFFER_SIZE];
 
         // Now request
         let request_type: u8 = 1;
@@ -334,9 +927,18 @@ mod tests {
         // Command Type
         request[1] = request_type;
 
-        let response = build_response(request, 4, tracking, false, 1.0);
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &request,
+            4,
+            &BoundModel::new(tracking, 1.0),
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
 
-        let mut rdr = Cursor::new(response);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         assert_eq!(request_type, rdr.read_u8().unwrap());
         // Sync flag
@@ -344,8 +946,10 @@ mod tests {
         // Reserved
         assert_eq!(0, rdr.read_u8().unwrap());
         // Get the CEB from mock tracking data
-        let ceb = ClockErrorBound::from(tracking).ceb;
-        let bounds = clockbound_now(ceb);
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
         // Earliest bound
         assert_eq!(bounds.0, rdr.read_u64::<NetworkEndian>().unwrap());
         // Latest bound
@@ -372,22 +976,27 @@ mod tests {
         request.push(0);
 
         // Get the CEB from mock tracking data
-        let ceb = ClockErrorBound::from(tracking).ceb;
-        let bounds = clockbound_now(ceb);
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
         // 0 is the Unix Epoch
         let before_time = 0;
 
         request.write_u64::<NetworkEndian>(before_time).unwrap();
 
-        let response = build_response(
-            <[u8; 12]>::try_from(request).unwrap(),
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
             12,
-            tracking,
+            &BoundModel::new(tracking, 1.0),
             false,
-            1.0,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
         );
 
-        let mut rdr = Cursor::new(response);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         assert_eq!(request_type, rdr.read_u8().unwrap());
         // Sync flag
@@ -400,6 +1009,81 @@ mod tests {
         assert_eq!(before_flag, rdr.read_u8().unwrap());
     }
 
+    #[test]
+    fn test_build_response_received_time() {
+        // Chrony last updated 100 seconds before the mock current time
+        let mut tracking = mock_tracking();
+        tracking.ref_time = (std::time::UNIX_EPOCH
+            + std::time::Duration::from_nanos(mock_get_epoch_us() - 100_000_000_000))
+        .into();
+        let model = BoundModel::new(tracking, 1.0);
+        // The request was received 10 seconds before it is handled
+        let received_nanos = mock_get_epoch_us() - 10_000_000_000;
+
+        // The current time is after the latest bound at the time the request was received
+        let mut request: Vec<u8> = vec![RESPONSE_VERSION, 3, 0, 0];
+        request
+            .write_u64::<NetworkEndian>(mock_get_epoch_us())
+            .unwrap();
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
+            12,
+            &model,
+            false,
+            mock_get_epoch_us(),
+            received_nanos,
+            &mut response,
+        );
+        assert_eq!(5, size);
+        assert_eq!(1, response[4]);
+
+        // But not after the latest bound at the time the request is handled
+        let size = build_response(
+            &to_request_buffer(&request),
+            12,
+            &model,
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
+        assert_eq!(5, size);
+        assert_eq!(0, response[4]);
+
+        // A now request asking for the queue delay gets it after the bounds at the current time
+        let request = to_request_buffer(&[RESPONSE_VERSION, 1, REQUEST_FLAG_QUEUE_DELAY, 0]);
+        let size = build_response(
+            &request,
+            4,
+            &model,
+            false,
+            mock_get_epoch_us(),
+            received_nanos,
+            &mut response,
+        );
+        assert_eq!(28, size);
+        let mut rdr = Cursor::new(&response[4..size]);
+        let ceb = model.ceb_nanos_at(mock_get_epoch_us()).unwrap();
+        let (earliest, latest) = clockbound_now(ceb, mock_get_epoch_us());
+        assert_eq!(earliest, rdr.read_u64::<NetworkEndian>().unwrap());
+        assert_eq!(latest, rdr.read_u64::<NetworkEndian>().unwrap());
+        assert_eq!(10_000_000_000, rdr.read_u64::<NetworkEndian>().unwrap());
+
+        // A now request without the flag is unchanged
+        let request = to_request_buffer(&[RESPONSE_VERSION, 1, 0, 0]);
+        let size = build_response(
+            &request,
+            4,
+            &model,
+            false,
+            mock_get_epoch_us(),
+            received_nanos,
+            &mut response,
+        );
+        assert_eq!(20, size);
+    }
+
     #[test]
     fn test_build_response_before_false_successful() {
         let tracking = mock_tracking();
@@ -420,22 +1104,27 @@ mod tests {
         request.push(0);
 
         // Get the CEB from mock tracking data
-        let ceb = ClockErrorBound::from(tracking).ceb;
-        let bounds = clockbound_now(ceb);
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
         // 1000000000000000001 is one nanosecond more than our mock data of 1000000000000000000
         let before_time = 1000000000000000001;
 
         request.write_u64::<NetworkEndian>(before_time).unwrap();
 
-        let response = build_response(
-            <[u8; 12]>::try_from(request).unwrap(),
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
             12,
-            tracking,
+            &BoundModel::new(tracking, 1.0),
             false,
-            1.0,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
         );
 
-        let mut rdr = Cursor::new(response);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         assert_eq!(request_type, rdr.read_u8().unwrap());
         // Sync flag
@@ -468,22 +1157,27 @@ mod tests {
         request.push(0);
 
         // Get the CEB from mock tracking data
-        let ceb = ClockErrorBound::from(tracking).ceb;
-        let bounds = clockbound_now(ceb);
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
         // 1000000000000000001 is one nanosecond more than our mock data of 1000000000000000000
         let after_time = 1000000000000000001;
 
         request.write_u64::<NetworkEndian>(after_time).unwrap();
 
-        let response = build_response(
-            <[u8; 12]>::try_from(request).unwrap(),
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
             12,
-            tracking,
+            &BoundModel::new(tracking, 1.0),
             false,
-            1.0,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
         );
 
-        let mut rdr = Cursor::new(response);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         assert_eq!(request_type, rdr.read_u8().unwrap());
         // Sync flag
@@ -516,22 +1210,27 @@ mod tests {
         request.push(0);
 
         // Get the CEB from mock tracking data
-        let ceb = ClockErrorBound::from(tracking).ceb;
-        let bounds = clockbound_now(ceb);
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
         // 0 is the Unix Epoch
         let after_time = 0;
 
         request.write_u64::<NetworkEndian>(after_time).unwrap();
 
-        let response = build_response(
-            <[u8; 12]>::try_from(request).unwrap(),
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
             12,
-            tracking,
+            &BoundModel::new(tracking, 1.0),
             false,
-            1.0,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
         );
 
-        let mut rdr = Cursor::new(response);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         assert_eq!(request_type, rdr.read_u8().unwrap());
         // Sync flag
@@ -544,12 +1243,471 @@ mod tests {
         assert_eq!(after_flag, rdr.read_u8().unwrap());
     }
 
+    #[test]
+    fn test_build_response_compare_successful() {
+        let tracking = mock_tracking();
+        let model = BoundModel::new(tracking, 1.0);
+        let ceb = model.ceb_nanos_at(mock_get_epoch_us()).unwrap();
+        let (earliest, latest) = clockbound_now(ceb, mock_get_epoch_us());
+
+        // A timestamp before, within and after the bounds
+        for (time_epoch, before, after) in
+            [(0, 1, 0), (mock_get_epoch_us(), 0, 0), (u64::MAX, 0, 1)]
+        {
+            let mut request: Vec<u8> = vec![RESPONSE_VERSION, COMPARE_REQUEST, 0, 0];
+            request.write_u64::<NetworkEndian>(time_epoch).unwrap();
+            let mut response = [0; RESPONSE_BUFFER_SIZE];
+            let size = build_response(
+                &to_request_buffer(&request),
+                12,
+                &model,
+                false,
+                mock_get_epoch_us(),
+                mock_get_epoch_us(),
+                &mut response,
+            );
+
+            assert_eq!(22, size);
+            let mut rdr = Cursor::new(&response[..size]);
+            assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
+            assert_eq!(COMPARE_REQUEST, rdr.read_u8().unwrap());
+            // Sync flag
+            assert_eq!(0, rdr.read_u8().unwrap());
+            // Reserved
+            assert_eq!(0, rdr.read_u8().unwrap());
+            assert_eq!(earliest, rdr.read_u64::<NetworkEndian>().unwrap());
+            assert_eq!(latest, rdr.read_u64::<NetworkEndian>().unwrap());
+            assert_eq!(before, rdr.read_u8().unwrap());
+            assert_eq!(after, rdr.read_u8().unwrap());
+        }
+    }
+
+    #[test]
+    fn test_build_response_compare_received_time() {
+        // Chrony last updated 100 seconds before the mock current time
+        let mut tracking = mock_tracking();
+        tracking.ref_time = (std::time::UNIX_EPOCH
+            + std::time::Duration::from_nanos(mock_get_epoch_us() - 100_000_000_000))
+        .into();
+        let model = BoundModel::new(tracking, 1.0);
+        // The request was received 10 seconds before it is handled
+        let received_nanos = mock_get_epoch_us() - 10_000_000_000;
+
+        let mut request: Vec<u8> = vec![RESPONSE_VERSION_2, COMPARE_REQUEST, 0, 0];
+        request.write_u32::<NetworkEndian>(7).unwrap();
+        request
+            .write_u64::<NetworkEndian>(mock_get_epoch_us())
+            .unwrap();
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
+            16,
+            &model,
+            false,
+            mock_get_epoch_us(),
+            received_nanos,
+            &mut response,
+        );
+
+        // The bounds and verdicts are both from the time the request was received
+        assert_eq!(26, size);
+        let mut rdr = Cursor::new(&response[4..size]);
+        assert_eq!(7, rdr.read_u32::<NetworkEndian>().unwrap());
+        let ceb = model.ceb_nanos_at(received_nanos).unwrap();
+        let (earliest, latest) = clockbound_now(ceb, received_nanos);
+        assert_eq!(earliest, rdr.read_u64::<NetworkEndian>().unwrap());
+        assert_eq!(latest, rdr.read_u64::<NetworkEndian>().unwrap());
+        assert_eq!(0, rdr.read_u8().unwrap());
+        assert_eq!(1, rdr.read_u8().unwrap());
+    }
+
+    #[test]
+    fn test_build_response_compare_error_flag() {
+        let mut request: Vec<u8> = vec![RESPONSE_VERSION, COMPARE_REQUEST, 0, 0];
+        request.write_u64::<NetworkEndian>(0).unwrap();
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
+            12,
+            &BoundModel::new(mock_tracking(), 1.0),
+            true,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
+
+        // An error response only has the header
+        assert_eq!(4, size);
+        assert_eq!(0, response[1]);
+    }
+
+    #[test]
+    fn test_build_response_batch_successful() {
+        let tracking = mock_tracking();
+
+        let mut request: Vec<u8> = Vec::new();
+
+        // Batch request
+        let request_type: u8 = 4;
+
+        // Create a batch request to test
+        // Header
+        // Version
+        request.push(RESPONSE_VERSION);
+        // Command Type
+        request.push(request_type);
+        // Reserved
+        request.push(0);
+        request.push(0);
+        // Count
+        request.write_u16::<NetworkEndian>(3).unwrap();
+        // Reserved
+        request.push(0);
+        request.push(0);
+
+        // Get the CEB from mock tracking data
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
+        // The Unix Epoch is before the bounds, the mock current time is within the bounds and
+        // u64::MAX is after the bounds
+        request.write_u64::<NetworkEndian>(0).unwrap();
+        request
+            .write_u64::<NetworkEndian>(mock_get_epoch_us())
+            .unwrap();
+        request.write_u64::<NetworkEndian>(u64::MAX).unwrap();
+
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
+            request.len(),
+            &BoundModel::new(tracking, 1.0),
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
+
+        let mut rdr = Cursor::new(&response[..size]);
+        assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
+        assert_eq!(request_type, rdr.read_u8().unwrap());
+        // Sync flag
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // Reserved
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // Earliest bound
+        assert_eq!(bounds.0, rdr.read_u64::<NetworkEndian>().unwrap());
+        // Latest bound
+        assert_eq!(bounds.1, rdr.read_u64::<NetworkEndian>().unwrap());
+        // Count
+        assert_eq!(3, rdr.read_u16::<NetworkEndian>().unwrap());
+        // Reserved
+        assert_eq!(0, rdr.read_u16::<NetworkEndian>().unwrap());
+        // Only the first timestamp is before the bounds
+        assert_eq!(0b001, rdr.read_u64::<NetworkEndian>().unwrap());
+        // Only the last timestamp is after the bounds
+        assert_eq!(0b100, rdr.read_u64::<NetworkEndian>().unwrap());
+    }
+
+    #[test]
+    fn test_build_response_batch_count_mismatch() {
+        let tracking = mock_tracking();
+
+        // A batch request claiming 2 timestamps but only carrying 1
+        let mut request: Vec<u8> = vec![RESPONSE_VERSION, 4, 0, 0, 0, 2, 0, 0];
+        request.write_u64::<NetworkEndian>(0).unwrap();
+
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
+            request.len(),
+            &BoundModel::new(tracking, 1.0),
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
+
+        // Should respond with only a header with an Error (0) response
+        assert_eq!(4, size);
+        assert_eq!(0, response[1]);
+        assert_eq!(
+            RequestError::BatchCountMismatch { count: 2, size: 8 },
+            request_error(
+                &to_request_buffer(&request),
+                request.len(),
+                &BoundModel::new(tracking, 1.0),
+                mock_get_epoch_us()
+            )
+        );
+    }
+
+    #[test]
+    fn test_request_error() {
+        let model = BoundModel::new(mock_tracking(), 1.0);
+        let error = |request: &[u8]| {
+            request_error(
+                &to_request_buffer(request),
+                request.len(),
+                &model,
+                mock_get_epoch_us(),
+            )
+        };
+        assert_eq!(RequestError::UnsupportedVersion(3), error(&[3, 1, 0, 0]));
+        assert_eq!(
+            RequestError::InvalidType(9),
+            error(&[RESPONSE_VERSION, 9, 0, 0])
+        );
+        assert_eq!(
+            RequestError::InvalidSize {
+                request_type: 2,
+                size: 4
+            },
+            error(&[RESPONSE_VERSION, 2, 0, 0])
+        );
+        // A Stats request with a body is a valid type of the wrong size
+        assert_eq!(
+            RequestError::InvalidSize {
+                request_type: STATS_REQUEST,
+                size: 8
+            },
+            error(&[RESPONSE_VERSION, STATS_REQUEST, 0, 0, 0, 0, 0, 0])
+        );
+
+        // Chrony's last update is after the time the response is built at
+        let mut future = mock_tracking();
+        future.ref_time =
+            (std::time::UNIX_EPOCH + std::time::Duration::from_secs(2_000_000_000)).into();
+        let request = to_request_buffer(&[RESPONSE_VERSION, 1, 0, 0]);
+        assert_eq!(
+            RequestError::BoundUnavailable,
+            request_error(
+                &request,
+                4,
+                &BoundModel::new(future, 1.0),
+                mock_get_epoch_us()
+            )
+        );
+
+        // Every kind of error survives being packed next to its counter
+        for e in [
+            RequestError::UnsupportedVersion(3),
+            RequestError::InvalidType(9),
+            RequestError::InvalidSize {
+                request_type: 2,
+                size: 4,
+            },
+            RequestError::BatchCountMismatch { count: 2, size: 8 },
+            RequestError::BoundUnavailable,
+        ] {
+            assert_eq!(e, RequestError::unpack(e.index(), e.pack()));
+        }
+    }
+
+    #[test]
+    fn test_build_response_now_v2_successful() {
+        let tracking = mock_tracking();
+
+        let mut request: Vec<u8> = Vec::new();
+
+        // Now request
+        let request_type: u8 = 1;
+
+        // Create a version 2 now request to test
+        // Header
+        // Version
+        request.push(RESPONSE_VERSION_2);
+        // Command Type
+        request.push(request_type);
+        // Reserved
+        request.push(0);
+        request.push(0);
+        // Request id
+        request.write_u32::<NetworkEndian>(0xdead_beef).unwrap();
+
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
+            8,
+            &BoundModel::new(tracking, 1.0),
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
+
+        assert_eq!(24, size);
+        let mut rdr = Cursor::new(&response[..size]);
+        assert_eq!(RESPONSE_VERSION_2, rdr.read_u8().unwrap());
+        assert_eq!(request_type, rdr.read_u8().unwrap());
+        // Sync flag
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // Reserved
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // The request id is echoed back
+        assert_eq!(0xdead_beef, rdr.read_u32::<NetworkEndian>().unwrap());
+        // Get the CEB from mock tracking data
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
+        // Earliest bound
+        assert_eq!(bounds.0, rdr.read_u64::<NetworkEndian>().unwrap());
+        // Latest bound
+        assert_eq!(bounds.1, rdr.read_u64::<NetworkEndian>().unwrap());
+    }
+
+    #[test]
+    fn test_build_response_before_v2_successful() {
+        let tracking = mock_tracking();
+
+        // Create a version 2 before request to test, testing the Unix Epoch
+        let mut request: Vec<u8> = vec![RESPONSE_VERSION_2, 2, 0, 0];
+        request.write_u32::<NetworkEndian>(7).unwrap();
+        request.write_u64::<NetworkEndian>(0).unwrap();
+
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &to_request_buffer(&request),
+            16,
+            &BoundModel::new(tracking, 1.0),
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
+
+        assert_eq!(9, size);
+        let mut rdr = Cursor::new(&response[..size]);
+        assert_eq!(RESPONSE_VERSION_2, rdr.read_u8().unwrap());
+        assert_eq!(2, rdr.read_u8().unwrap());
+        // Sync flag
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // Reserved
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // The request id is echoed back
+        assert_eq!(7, rdr.read_u32::<NetworkEndian>().unwrap());
+        // Before Flag. 0 < 1000000000000000000 should return 1
+        assert_eq!(1, rdr.read_u8().unwrap());
+    }
+
+    #[test]
+    fn test_build_response_subscribe_successful() {
+        let model = BoundModel::new(mock_tracking(), 1.0);
+
+        // Create a version 2 subscribe request to test
+        let mut request: Vec<u8> = vec![RESPONSE_VERSION_2, SUBSCRIBE_REQUEST, 0, 0];
+        request.write_u32::<NetworkEndian>(9).unwrap();
+        let request = to_request_buffer(&request);
+        assert!(is_subscribe_request(&request, 8));
+        assert!(!is_subscribe_request(&request, 4));
+
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &request,
+            8,
+            &model,
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
+
+        assert_eq!(36, size);
+        let mut rdr = Cursor::new(&response[..size]);
+        assert_eq!(RESPONSE_VERSION_2, rdr.read_u8().unwrap());
+        assert_eq!(SUBSCRIBE_REQUEST, rdr.read_u8().unwrap());
+        // Sync flag
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // Reserved
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // The request id is echoed back
+        assert_eq!(9, rdr.read_u32::<NetworkEndian>().unwrap());
+        // The model, followed by the lease of the subscription
+        assert_eq!(
+            model.ref_time_nanos,
+            rdr.read_u64::<NetworkEndian>().unwrap()
+        );
+        assert_eq!(
+            model.base_ceb_nanos,
+            rdr.read_u64::<NetworkEndian>().unwrap()
+        );
+        assert_eq!(
+            model.growth_ppb as f64,
+            f64::from_bits(rdr.read_u64::<NetworkEndian>().unwrap())
+        );
+        assert_eq!(
+            SUBSCRIPTION_LEASE_SECS,
+            rdr.read_u32::<NetworkEndian>().unwrap()
+        );
+
+        // An update pushed later carries the same body
+        let mut update = [0; RESPONSE_BUFFER_SIZE];
+        let update_size = build_update(&model, false, RESPONSE_VERSION_2, 9, &mut update);
+        assert_eq!(size, update_size);
+        assert_eq!(UPDATE_RESPONSE, update[1]);
+        assert_eq!(response[2..size], update[2..update_size]);
+    }
+
+    #[test]
+    fn test_build_response_stats_successful() {
+        let model = BoundModel::new(mock_tracking(), 1.0);
+        let metrics = Metrics::new(1);
+        metrics.worker(0).count_response(1, false);
+        metrics.worker(0).count_response(1, false);
+        metrics.worker(0).count_response(0, true);
+        metrics.worker(0).count_response(COMPARE_REQUEST, false);
+        metrics.worker(0).service_time.record(2_000, 2);
+
+        // Create a version 2 stats request to test
+        let mut request: Vec<u8> = vec![RESPONSE_VERSION_2, STATS_REQUEST, 0, 0];
+        request.write_u32::<NetworkEndian>(5).unwrap();
+        let request = to_request_buffer(&request);
+        assert!(is_stats_request(&request, 8));
+        assert!(!is_stats_request(&request, 4));
+        assert_eq!(validate_request(RESPONSE_VERSION_2, STATS_REQUEST, 8), true);
+
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response_stats(&request, &model, &metrics.summary(), &mut response);
+
+        assert_eq!(8 + 25 * 8, size);
+        let mut rdr = Cursor::new(&response[..size]);
+        assert_eq!(RESPONSE_VERSION_2, rdr.read_u8().unwrap());
+        assert_eq!(STATS_REQUEST, rdr.read_u8().unwrap());
+        // Sync flag
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // Reserved
+        assert_eq!(0, rdr.read_u8().unwrap());
+        // The request id is echoed back
+        assert_eq!(5, rdr.read_u32::<NetworkEndian>().unwrap());
+        // Uptime
+        rdr.read_u64::<NetworkEndian>().unwrap();
+        let mut counters = [0; 11];
+        for counter in counters.iter_mut() {
+            *counter = rdr.read_u64::<NetworkEndian>().unwrap();
+        }
+        // Invalid, now, before, after, batch, subscribe and stats responses, error flag responses,
+        // send failures, polls and poll failures
+        assert_eq!([0, 2, 0, 0, 0, 0, 0, 1, 0, 0, 0], counters);
+        // Service time p50, p99, p999 and max
+        for _ in 0..4 {
+            assert_eq!(2_000, rdr.read_u64::<NetworkEndian>().unwrap());
+        }
+        // Snapshot age and poll latency percentiles, then compare responses
+        for _ in 0..8 {
+            rdr.read_u64::<NetworkEndian>().unwrap();
+        }
+        assert_eq!(1, rdr.read_u64::<NetworkEndian>().unwrap());
+    }
+
     #[test]
     fn test_build_response_header_error_successful() {
-        // Any request other than 1, 2 or 3 should reply with an Error (0) response
+        // Any request other than a valid request type should reply with an Error (0) response
         let request_type: u8 = 0;
-        let header = build_response_header(request_type, 0);
-        let mut rdr = Cursor::new(header);
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response_header(&mut response, RESPONSE_VERSION, request_type, 0, 0);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         assert_eq!(request_type, rdr.read_u8().unwrap());
         //sync flag
@@ -558,9 +1716,10 @@ mod tests {
         assert_eq!(0, rdr.read_u8().unwrap());
 
         // Test a non 0 value as well.
-        let request_type: u8 = 8;
-        let header = build_response_header(request_type, 0);
-        let mut rdr = Cursor::new(header);
+        let request_type: u8 = 9;
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response_header(&mut response, RESPONSE_VERSION, request_type, 0, 0);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         // Should respond with an Error (0) response
         assert_eq!(0, rdr.read_u8().unwrap());
@@ -580,6 +1739,25 @@ mod tests {
 
         // Valid After request
         assert_eq!(validate_request(RESPONSE_VERSION, 3, 12), true);
+
+        // Valid Batch requests with 1 timestamp and the maximum number of timestamps
+        assert_eq!(validate_request(RESPONSE_VERSION, 4, 16), true);
+        assert_eq!(validate_request(RESPONSE_VERSION, 4, 520), true);
+
+        // Valid Subscribe request
+        assert_eq!(validate_request(RESPONSE_VERSION, 5, 4), true);
+
+        // Valid Compare request
+        assert_eq!(validate_request(RESPONSE_VERSION, 8, 12), true);
+
+        // Stats request with just a header
+        assert_eq!(validate_request(RESPONSE_VERSION, 7, 4), true);
+
+        // Valid version 2 requests, with 4 more bytes in the header for the request id
+        assert_eq!(validate_request(RESPONSE_VERSION_2, 1, 8), true);
+        assert_eq!(validate_request(RESPONSE_VERSION_2, 2, 16), true);
+        assert_eq!(validate_request(RESPONSE_VERSION_2, 3, 16), true);
+        assert_eq!(validate_request(RESPONSE_VERSION_2, 4, 524), true);
     }
 
     #[test]
@@ -598,6 +1776,30 @@ mod tests {
 
         // Invalid After request size
         assert_eq!(validate_request(RESPONSE_VERSION, 3, 4), false);
+
+        // Invalid Batch request sizes: no timestamps, a partial timestamp and too many timestamps
+        assert_eq!(validate_request(RESPONSE_VERSION, 4, 8), false);
+        assert_eq!(validate_request(RESPONSE_VERSION, 4, 20), false);
+        assert_eq!(validate_request(RESPONSE_VERSION, 4, 528), false);
+
+        // Invalid Subscribe request size
+        assert_eq!(validate_request(RESPONSE_VERSION, 5, 12), false);
+
+        // An Update is only ever pushed by ClockBoundD
+        assert_eq!(validate_request(RESPONSE_VERSION, 6, 4), false);
+
+        // Invalid Stats request size
+        assert_eq!(validate_request(RESPONSE_VERSION, 7, 12), false);
+
+        // Invalid Compare request size
+        assert_eq!(validate_request(RESPONSE_VERSION, 8, 4), false);
+
+        // Invalid request type after the last one
+        assert_eq!(validate_request(RESPONSE_VERSION, 9, 12), false);
+
+        // Invalid version 2 request sizes, missing the request id
+        assert_eq!(validate_request(RESPONSE_VERSION_2, 1, 4), false);
+        assert_eq!(validate_request(RESPONSE_VERSION_2, 2, 12), false);
     }
 
     #[test]
@@ -606,7 +1808,7 @@ mod tests {
 
         tracking.leap_status = LEAP_STATUS_UNSYNCHRONIZED;
 
-        let mut request: [u8; 12] = [0; 12];
+        let mut request: [u8; REQUEST_BUFFER_SIZE] = [0; REQUEST_BUFFER_SIZE];
 
         // Now request
         let request_type: u8 = 1;
@@ -618,9 +1820,18 @@ mod tests {
         // Command Type
         request[1] = request_type;
 
-        let response = build_response(request, 4, tracking, false, 1.0);
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        let size = build_response(
+            &request,
+            4,
+            &BoundModel::new(tracking, 1.0),
+            false,
+            mock_get_epoch_us(),
+            mock_get_epoch_us(),
+            &mut response,
+        );
 
-        let mut rdr = Cursor::new(response);
+        let mut rdr = Cursor::new(&response[..size]);
         assert_eq!(RESPONSE_VERSION, rdr.read_u8().unwrap());
         assert_eq!(request_type, rdr.read_u8().unwrap());
         // Sync flag should be false
@@ -629,11 +1840,21 @@ mod tests {
         assert_eq!(0, rdr.read_u8().unwrap());
         // Should still build the body of the response with the sync flag as false
         // Get the CEB from mock tracking data
-        let ceb = ClockErrorBound::from(tracking).ceb;
-        let bounds = clockbound_now(ceb);
+        let ceb = BoundModel::new(tracking, 1.0)
+            .ceb_nanos_at(mock_get_epoch_us())
+            .unwrap();
+        let bounds = clockbound_now(ceb, mock_get_epoch_us());
         // Earliest bound
         assert_eq!(bounds.0, rdr.read_u64::<NetworkEndian>().unwrap());
         // Latest bound
         assert_eq!(bounds.1, rdr.read_u64::<NetworkEndian>().unwrap());
     }
+
+    #[test]
+    fn test_clockbound_now_saturates() {
+        assert_eq!((90, 110), clockbound_now(10, 100));
+        // A bound wider than the time since the Unix epoch does not wrap
+        assert_eq!((0, 200), clockbound_now(100, 100));
+        assert_eq!((u64::MAX - 20, u64::MAX), clockbound_now(10, u64::MAX - 10));
+    }
 }
@@ -0,0 +1,206 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use chrony_candm::reply::Tracking;
+use std::time::{Duration, SystemTime};
+
+/// How long after chronyd's next update is expected to poll for it. Gives chronyd time to apply
+/// the update before it is polled.
+pub const POLL_UPDATE_MARGIN: Duration = Duration::from_millis(50);
+
+/// The shortest time between two polls, so that an update expected at any moment does not turn
+/// into a busy loop.
+pub const MIN_POLL_DELAY: Duration = Duration::from_millis(10);
+
+/// The longest exponential backoff, as a power of two of the poll interval.
+const MAX_BACKOFF_EXPONENT: u32 = 16;
+
+/// The intervals the Chrony poller thread polls chronyd at.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct PollIntervals {
+    /// The interval chronyd is polled at while waiting for an update that is due, and while
+    /// chronyd is not synchronized to a source. The backoff after a failed poll starts from it.
+    pub poll_interval: Duration,
+    /// The longest time between two polls. Bounds how long a failing chronyd goes unnoticed.
+    pub max_poll_interval: Duration,
+}
+
+/// Schedules the polls of chronyd around the updates it applies.
+///
+/// The tracking data only changes when chronyd applies an update, which it does every
+/// `last_update_interval` seconds. chronyd is polled shortly after the next update is expected,
+/// rather than at a fixed interval: between updates the only field that changes is the remaining
+/// correction, which shrinks as chronyd slews the clock, so the last tracking data received gives
+/// a slightly larger bound. If chronyd is unreachable, it is polled again with an exponential
+/// backoff and jitter.
+pub struct PollSchedule {
+    intervals: PollIntervals,
+    /// The number of consecutive failed polls.
+    failures: u32,
+}
+
+impl PollSchedule {
+    /// Create a schedule of polls.
+    ///
+    /// # Arguments
+    ///
+    /// * `intervals` - The intervals chronyd is polled at.
+    pub fn new(intervals: PollIntervals) -> PollSchedule {
+        PollSchedule {
+            intervals,
+            failures: 0,
+        }
+    }
+
+    /// Get the time to wait before the next poll.
+    ///
+    /// # Arguments
+    ///
+    /// * `tracking` - The tracking information received from the last poll, or None if it failed.
+    /// * `now` - The current system time.
+    pub fn next_poll(&mut self, tracking: Option<&Tracking>, now: SystemTime) -> Duration {
+        let delay = match tracking {
+            Some(tracking) => {
+                self.failures = 0;
+                self.after_update(tracking, now)
+            }
+            None => {
+                let delay = self.after_failure(now);
+                self.failures = self.failures.saturating_add(1);
+                delay
+            }
+        };
+        delay
+            .max(MIN_POLL_DELAY)
+            .min(self.intervals.max_poll_interval)
+    }
+
+    /// Get the time to wait for chronyd's next update.
+    fn after_update(&self, tracking: &Tracking, now: SystemTime) -> Duration {
+        // chronyd reports its reference time as the Unix epoch until it first synchronizes
+        let update_interval = f64::from(tracking.last_update_interval);
+        if tracking.ref_time == SystemTime::UNIX_EPOCH
+            || !update_interval.is_finite()
+            || update_interval <= 0.0
+        {
+            return self.intervals.poll_interval;
+        }
+
+        let expected = tracking.ref_time
+            + Duration::from_secs_f64(update_interval.min(u32::MAX as f64))
+            + POLL_UPDATE_MARGIN;
+        match expected.duration_since(now) {
+            Ok(delay) => delay,
+            // The update is overdue. Keep polling until chronyd applies it.
+            Err(_) => self.intervals.poll_interval,
+        }
+    }
+
+    /// Get the time to wait after a failed poll: the poll interval doubled for every consecutive
+    /// failure, less up to a quarter of jitter so that many daemons restarted together do not
+    /// poll chronyd in lockstep.
+    fn after_failure(&self, now: SystemTime) -> Duration {
+        let backoff = self
+            .intervals
+            .poll_interval
+            .saturating_mul(1 << self.failures.min(MAX_BACKOFF_EXPONENT))
+            .min(self.intervals.max_poll_interval);
+        let jitter_range = backoff.as_nanos() as u64 / 4;
+        let jitter = match now.duration_since(SystemTime::UNIX_EPOCH) {
+            Ok(d) if jitter_range > 0 => {
+                Duration::from_nanos(d.subsec_nanos() as u64 % jitter_range)
+            }
+            _ => Duration::ZERO,
+        };
+        backoff - jitter
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::schedule::{PollIntervals, PollSchedule, MIN_POLL_DELAY, POLL_UPDATE_MARGIN};
+    use crate::tracking::mock_tracking;
+    use chrony_candm::common::ChronyFloat;
+    use std::time::{Duration, SystemTime};
+
+    const INTERVALS: PollIntervals = PollIntervals {
+        poll_interval: Duration::from_secs(1),
+        max_poll_interval: Duration::from_secs(16),
+    };
+
+    #[test]
+    fn test_next_poll_after_update() {
+        let mut schedule = PollSchedule::new(INTERVALS);
+        let mut tracking = mock_tracking();
+        tracking.last_update_interval = ChronyFloat::from(8.0_f64);
+
+        // Poll shortly after the next update is expected
+        let now = tracking.ref_time + Duration::from_secs(3);
+        assert_eq!(
+            Duration::from_secs(5) + POLL_UPDATE_MARGIN,
+            schedule.next_poll(Some(&tracking), now)
+        );
+
+        // Never wait longer than the maximum poll interval
+        tracking.last_update_interval = ChronyFloat::from(64.0_f64);
+        assert_eq!(
+            INTERVALS.max_poll_interval,
+            schedule.next_poll(Some(&tracking), now)
+        );
+
+        // Poll at the poll interval while the update is overdue
+        tracking.last_update_interval = ChronyFloat::from(2.0_f64);
+        assert_eq!(
+            INTERVALS.poll_interval,
+            schedule.next_poll(Some(&tracking), now)
+        );
+
+        // Never poll right away, even if the update is due any moment
+        let now = tracking.ref_time + Duration::from_secs(2) + POLL_UPDATE_MARGIN;
+        assert_eq!(MIN_POLL_DELAY, schedule.next_poll(Some(&tracking), now));
+    }
+
+    #[test]
+    fn test_next_poll_unsynchronized() {
+        let mut schedule = PollSchedule::new(INTERVALS);
+        let mut tracking = mock_tracking();
+        tracking.ref_time = SystemTime::UNIX_EPOCH;
+        tracking.last_update_interval = ChronyFloat::from(8.0_f64);
+        assert_eq!(
+            INTERVALS.poll_interval,
+            schedule.next_poll(Some(&tracking), SystemTime::now())
+        );
+
+        // An update interval of 0 means chronyd has applied a single update so far
+        let mut tracking = mock_tracking();
+        tracking.last_update_interval = ChronyFloat::from(0.0_f64);
+        assert_eq!(
+            INTERVALS.poll_interval,
+            schedule.next_poll(Some(&tracking), SystemTime::now())
+        );
+    }
+
+    #[test]
+    fn test_next_poll_backoff() {
+        let mut schedule = PollSchedule::new(INTERVALS);
+        let now = SystemTime::UNIX_EPOCH + Duration::from_nanos(1_000_000_000_999_999_999);
+
+        // The backoff doubles, less up to a quarter of jitter, up to the maximum poll interval
+        for backoff in [1, 2, 4, 8, 16, 16] {
+            let backoff = Duration::from_secs(backoff);
+            let delay = schedule.next_poll(None, now);
+            assert!(delay <= backoff, "{:?} > {:?}", delay, backoff);
+            assert!(
+                delay >= backoff * 3 / 4,
+                "{:?} < {:?}",
+                delay,
+                backoff * 3 / 4
+            );
+        }
+
+        // A successful poll resets the backoff
+        let mut tracking = mock_tracking();
+        tracking.ref_time = SystemTime::UNIX_EPOCH;
+        schedule.next_poll(Some(&tracking), now);
+        assert!(schedule.next_poll(None, now) <= INTERVALS.poll_interval);
+    }
+}
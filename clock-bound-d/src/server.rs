@@ -1,85 +1,742 @@
 // Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
 // SPDX-License-Identifier: GPL-2.0-only
-use crate::response::build_response;
+use crate::metrics::{Metrics, MetricsSummary};
+use crate::response::{
+    build_response, build_response_stats, get_epoch_us, is_stats_request, is_subscribe_request,
+    refuse_subscription, request_error, request_id, RequestError, ERROR_RESPONSE,
+    REQUEST_BUFFER_SIZE, RESPONSE_BUFFER_SIZE,
+};
+use crate::snapshot::{SharedSnapshot, Snapshot};
 use crate::socket;
-use chrony_candm::reply::Tracking;
-use log::warn;
+use crate::subscribers::Subscribers;
+use crate::uring::{Cqe, Ring, Sqe};
 use std::io;
-use tokio::sync::watch::Receiver;
-use uds::UnixDatagramExt;
+use std::os::unix::io::AsRawFd;
+use std::sync::Arc;
+use std::time::Instant;
 
 /// The Unix Datagram Socket file for ClockBoundD
 pub const CLOCKBOUND_SERVER_SOCKET: &str = "clockboundd.sock";
 
-/// ClockBoundServer holds the Tracking data from Chrony and binds to the ClockBoundD unix socket
-/// as a server.
+/// Get the Unix Datagram Socket file served by a ClockBoundD worker.
+///
+/// Worker 0 serves the default ClockBoundD socket so that existing clients are unaffected by the
+/// number of workers. Every other worker serves its own shard socket, clockboundd-<n>.sock.
+///
+/// # Arguments
+///
+/// * `worker` - The index of the worker.
+pub fn worker_socket_path(worker: usize) -> std::path::PathBuf {
+    if worker == 0 {
+        std::path::PathBuf::from(CLOCKBOUND_SERVER_SOCKET)
+    } else {
+        std::path::PathBuf::from(format!("clockboundd-{}.sock", worker))
+    }
+}
+
+/// How a ClockBoundServer receives requests and sends responses.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Engine {
+    /// Blocking recvmsg, or recvmmsg and sendmmsg for a batch size above 1.
+    Blocking,
+    /// An io_uring keeping a receive posted for every request of the batch. Optionally a kernel
+    /// thread polls the submission queue (SQPOLL).
+    IoUring { sqpoll: bool },
+}
+
+/// The minimum number of receives the io_uring engine keeps posted.
+pub const URING_MIN_RECEIVES: usize = 64;
+
+/// The user data of a send completion. The user data of a completion holds the index of the
+/// request in the batch, with this bit set for a send and clear for a receive.
+const URING_SEND: u64 = 1 << 63;
+
+/// ClockBoundServer reads the Clock Error Bound model computed from the Tracking data from Chrony
+/// and binds to the ClockBoundD unix socket as a server.
 pub struct ClockBoundServer {
     socket: std::os::unix::net::UnixDatagram,
-    tracking: Tracking,
+    snapshot: Arc<SharedSnapshot>,
+    subscribers: Arc<Subscribers>,
+    metrics: Arc<Metrics>,
+    // The summary of the metrics that stats requests are answered from, refilled in place so
+    // that a stats request does not allocate
+    stats: MetricsSummary,
+    worker: usize,
+    // Declared before the batch so that the ring is torn down before the buffers it points to
+    uring: Option<Uring>,
+    batch: Batch,
 }
 
-impl ClockBoundServer {
-    /// Initialize ClockBound to contain default Tracking information and bind to the ClockBoundD
-    /// unix socket.
+/// The state of the io_uring engine.
+struct Uring {
+    ring: Ring,
+    // The message headers and buffers of the responses being sent, one per request of the batch.
+    // The receive message headers can not be reused, since a receive is posted again only after
+    // the response was sent.
+    send_msgs: Vec<libc::msghdr>,
+    send_iovecs: Vec<libc::iovec>,
+    completions: Vec<Cqe>,
+}
+
+// As for Batch, the raw pointers only ever point into the buffers of the same server.
+unsafe impl Send for Uring {}
+
+/// The size of the buffer the control messages of a request are received into. Large enough for
+/// the receive timestamp, a timespec.
+const CONTROL_SIZE: usize = 64;
+
+/// The buffers used to receive and respond to a batch of requests with recvmmsg and sendmmsg.
+struct Batch {
+    requests: Vec<[u8; REQUEST_BUFFER_SIZE]>,
+    responses: Vec<[u8; RESPONSE_BUFFER_SIZE]>,
+    response_sizes: Vec<usize>,
+    addrs: Vec<libc::sockaddr_un>,
+    iovecs: Vec<libc::iovec>,
+    // Held as u64s so that the control messages are aligned
+    controls: Vec<[u64; CONTROL_SIZE / 8]>,
+    msgs: Vec<libc::mmsghdr>,
+}
+
+// The raw pointers held by the message headers only ever point into the buffers of the same
+// Batch, and are set up again before every recvmmsg and sendmmsg call.
+unsafe impl Send for Batch {}
+
+impl Batch {
+    /// Allocate the buffers for a batch of up to `batch_size` requests.
+    fn new(batch_size: usize) -> Batch {
+        Batch {
+            requests: vec![[0; REQUEST_BUFFER_SIZE]; batch_size],
+            responses: vec![[0; RESPONSE_BUFFER_SIZE]; batch_size],
+            response_sizes: vec![0; batch_size],
+            addrs: vec![unsafe { std::mem::zeroed() }; batch_size],
+            iovecs: vec![unsafe { std::mem::zeroed() }; batch_size],
+            controls: vec![[0; CONTROL_SIZE / 8]; batch_size],
+            msgs: vec![unsafe { std::mem::zeroed() }; batch_size],
+        }
+    }
+
+    fn len(&self) -> usize {
+        self.requests.len()
+    }
+
+    /// Set up the message headers of the first `count` requests to receive into.
+    fn prepare_recv(&mut self, count: usize) {
+        for i in 0..count {
+            self.prepare_recv_one(i);
+        }
+    }
+
+    /// Set up the message header of a request to receive into.
     ///
     /// # Arguments
     ///
-    /// * `tracking` - The tracking information received from Chrony.
-    pub fn new(tracking: Tracking) -> ClockBoundServer {
-        let socket = socket::create_unix_socket(std::path::Path::new(CLOCKBOUND_SERVER_SOCKET));
+    /// * `i` - The index of the request in the batch.
+    fn prepare_recv_one(&mut self, i: usize) {
+        self.iovecs[i] = libc::iovec {
+            iov_base: self.requests[i].as_mut_ptr() as *mut libc::c_void,
+            iov_len: self.requests[i].len(),
+        };
+        let hdr = &mut self.msgs[i].msg_hdr;
+        hdr.msg_name = &mut self.addrs[i] as *mut libc::sockaddr_un as *mut libc::c_void;
+        hdr.msg_namelen = std::mem::size_of::<libc::sockaddr_un>() as libc::socklen_t;
+        hdr.msg_iov = &mut self.iovecs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = self.controls[i].as_mut_ptr() as *mut libc::c_void;
+        hdr.msg_controllen = CONTROL_SIZE as _;
+        hdr.msg_flags = 0;
+    }
+
+    /// The time the kernel received a request in nanoseconds since the Unix epoch, from its
+    /// SCM_TIMESTAMPNS control message. None if the socket did not time stamp the request.
+    ///
+    /// # Arguments
+    ///
+    /// * `i` - The index of the request in the batch.
+    fn received_nanos(&self, i: usize) -> Option<u64> {
+        let hdr = &self.msgs[i].msg_hdr;
+        unsafe {
+            let mut cmsg = libc::CMSG_FIRSTHDR(hdr);
+            while !cmsg.is_null() {
+                if (*cmsg).cmsg_level == libc::SOL_SOCKET
+                    && (*cmsg).cmsg_type == libc::SCM_TIMESTAMPNS
+                {
+                    let ts =
+                        std::ptr::read_unaligned(libc::CMSG_DATA(cmsg) as *const libc::timespec);
+                    return Some(ts.tv_sec as u64 * 1_000_000_000 + ts.tv_nsec as u64);
+                }
+                cmsg = libc::CMSG_NXTHDR(hdr, cmsg);
+            }
+        }
+        None
+    }
+}
 
-        return ClockBoundServer { socket, tracking };
+impl ClockBoundServer {
+    /// Initialize ClockBound to read the Clock Error Bound model published by the Chrony poller
+    /// thread and bind to a ClockBoundD unix socket.
+    ///
+    /// # Arguments
+    ///
+    /// * `path` - The path of the ClockBoundD unix socket to bind to.
+    /// * `snapshot` - The snapshot of the Clock Error Bound model and error flag published by the
+    /// Chrony poller thread.
+    /// * `batch_size` - The maximum number of requests received and responded to in one batch.
+    /// * `metrics` - The metrics of ClockBoundD, that the server records its requests into and
+    /// answers stats requests from.
+    /// * `worker` - The index of the worker running the server, whose metrics it records into.
+    pub fn new(
+        path: &std::path::Path,
+        snapshot: Arc<SharedSnapshot>,
+        batch_size: usize,
+        metrics: Arc<Metrics>,
+        worker: usize,
+    ) -> ClockBoundServer {
+        let socket = socket::create_unix_socket(path);
+        ClockBoundServer::with_socket(socket, snapshot, batch_size, metrics, worker)
     }
 
-    /// Update Tracking data.
+    /// Initialize ClockBound to read the Clock Error Bound model published by the Chrony poller
+    /// thread on a ClockBoundD unix socket that is already bound, such as a socket passed by
+    /// systemd socket activation.
     ///
     /// # Arguments
     ///
-    /// * `tracking` - The tracking information received from Chrony.
-    pub fn update_tracking(&mut self, tracking: Tracking) {
-        self.tracking = tracking;
+    /// * `socket` - The bound ClockBoundD unix socket.
+    /// * `snapshot` - The snapshot of the Clock Error Bound model and error flag published by the
+    /// Chrony poller thread.
+    /// * `batch_size` - The maximum number of requests received and responded to in one batch.
+    /// * `metrics` - The metrics of ClockBoundD, that the server records its requests into and
+    /// answers stats requests from.
+    /// * `worker` - The index of the worker running the server, whose metrics it records into.
+    pub fn with_socket(
+        socket: std::os::unix::net::UnixDatagram,
+        snapshot: Arc<SharedSnapshot>,
+        batch_size: usize,
+        metrics: Arc<Metrics>,
+        worker: usize,
+    ) -> ClockBoundServer {
+        let subscribers = match socket.try_clone() {
+            Ok(s) => Arc::new(Subscribers::new(s)),
+            Err(e) => {
+                panic!(
+                    "Failed to clone unix socket of worker {}. Error: {:?}",
+                    worker, e
+                )
+            }
+        };
+
+        return ClockBoundServer {
+            socket,
+            snapshot,
+            subscribers,
+            metrics,
+            stats: MetricsSummary::new(),
+            worker,
+            uring: None,
+            batch: Batch::new(batch_size.max(1)),
+        };
+    }
+
+    /// The subscribers of this server's socket, that the Chrony poller thread pushes updates of
+    /// the Clock Error Bound model to.
+    pub fn subscribers(&self) -> Arc<Subscribers> {
+        self.subscribers.clone()
     }
 
     /// Handle a request from a client.
+    pub fn handle_client(&mut self) -> Result<(), io::Error> {
+        let received = self.recv_one()?;
+        self.respond(received);
+        Ok(())
+    }
+
+    /// Count a response that was built. Nothing is logged on the request path: invalid requests
+    /// are counted by why they are invalid, and logged in aggregate by the log summary thread.
+    fn count_response(
+        &self,
+        request: &[u8; REQUEST_BUFFER_SIZE],
+        request_size: usize,
+        response: &[u8; RESPONSE_BUFFER_SIZE],
+        snapshot: &Snapshot,
+        time_nanos: u64,
+    ) {
+        let metrics = self.metrics.worker(self.worker);
+        if response[1] != ERROR_RESPONSE {
+            metrics.count_response(response[1], false);
+            return;
+        }
+        // A valid request is only refused because of the error flag, or because the bound is
+        // unavailable. Invalid requests are counted as invalid whether or not the flag is set.
+        match request_error(request, request_size, &snapshot.model, time_nanos) {
+            RequestError::BoundUnavailable if snapshot.error_flag => {
+                metrics.count_response(ERROR_RESPONSE, true)
+            }
+            error => {
+                metrics.count_response(ERROR_RESPONSE, false);
+                metrics.count_request_error(error);
+            }
+        }
+    }
+
+    /// Record the time since the tracking source's last update for requests served from a
+    /// snapshot. Nothing is recorded while the model is unsynchronized, as there is no last update
+    /// (ref_time is 0) or the model is stale because polling Chrony failed (error flag set).
+    fn record_snapshot_age(&self, snapshot: &Snapshot, time_nanos: u64, requests: u64) {
+        if snapshot.model.ref_time_nanos == 0 || snapshot.error_flag {
+            return;
+        }
+        let age = time_nanos.saturating_sub(snapshot.model.ref_time_nanos);
+        self.metrics
+            .worker(self.worker)
+            .snapshot_age
+            .record(age, requests);
+    }
+
+    /// Handle a batch of requests from clients.
+    ///
+    /// Blocks until at least one request is received, then drains up to the batch size of
+    /// requests that are already pending on the socket with a single recvmmsg call. All responses
+    /// in the batch are built from the same Clock Error Bound model, error flag and system time,
+    /// and are sent back with sendmmsg.
+    pub fn handle_clients_batched(&mut self) -> Result<(), io::Error> {
+        let received = self.recv_batch()?;
+        self.respond(received);
+        Ok(())
+    }
+
+    /// Set up the io_uring engine, after which requests are handled with handle_clients_uring.
+    ///
+    /// A receive is posted for every request of the batch, of at least URING_MIN_RECEIVES
+    /// requests. Receives and sends are then submitted to the ring without a system call per
+    /// datagram.
+    ///
+    /// # Arguments
+    ///
+    /// * `sqpoll` - Whether a kernel thread polls the submission queue of the ring.
+    pub fn enable_uring(&mut self, sqpoll: bool) -> Result<(), io::Error> {
+        let slots = self.batch.len().max(URING_MIN_RECEIVES);
+        let ring = Ring::new(slots as u32, sqpoll)?;
+        self.batch = Batch::new(slots);
+        let mut uring = Uring {
+            ring,
+            send_msgs: vec![unsafe { std::mem::zeroed() }; slots],
+            send_iovecs: vec![unsafe { std::mem::zeroed() }; slots],
+            completions: Vec::with_capacity(slots * 2),
+        };
+        let mut result = Ok(());
+        for i in 0..slots {
+            result = self.post_recv(&mut uring.ring, i);
+            if result.is_err() {
+                break;
+            }
+        }
+        if let Err(e) = result.and_then(|_| uring.ring.submit_and_wait(0)) {
+            // The receives posted so far may have reached the kernel, with SQPOLL as soon as they
+            // were pushed. Tearing down the ring cancels them, but not before it returns, and
+            // waiting for their cancellation on a ring that just failed may never end. Leave the
+            // buffers they point to to the kernel, so that the blocking engine the caller falls
+            // back to receives into new ones.
+            drop(uring);
+            std::mem::forget(std::mem::replace(&mut self.batch, Batch::new(slots)));
+            return Err(e);
+        }
+        self.uring = Some(uring);
+        Ok(())
+    }
+
+    /// Post a receive into a request of the batch to the ring.
     ///
     /// # Arguments
     ///
-    /// * `rx_tracking` - A tokio::sync::watch::channel receiver handle that is used for receiving Chrony
-    /// tracking information from the Chrony Poller thread.
-    /// * `rx_error_flag` - A tokio::sync::watch::channel receiver handle that is used for receiving an
-    /// error flag, indicating that the last Chrony poll failed, from the Chrony Poller thread.
-    /// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
-    pub fn handle_client(
-        &mut self,
-        rx_tracking: Receiver<Tracking>,
-        rx_error_flag: Receiver<bool>,
-        max_clock_error: f64,
-    ) -> Result<(), io::Error> {
-        let mut request: [u8; 12] = [0; 12];
+    /// * `ring` - The ring of the io_uring engine.
+    /// * `i` - The index of the request in the batch.
+    fn post_recv(&mut self, ring: &mut Ring, i: usize) -> Result<(), io::Error> {
+        self.batch.prepare_recv_one(i);
+        let sqe = Sqe::recvmsg(
+            self.socket.as_raw_fd(),
+            &mut self.batch.msgs[i].msg_hdr,
+            i as u64,
+        );
+        // The batch outlives the ring, see the declaration order of ClockBoundServer
+        unsafe { ring.push(sqe) }
+    }
+
+    /// Handle the requests from clients that completed, with the io_uring engine.
+    ///
+    /// Submits the receives and sends queued since the last call and waits for at least one
+    /// operation to complete, with a single system call. Responses to all the requests that
+    /// completed are built from the same Clock Error Bound model, error flag and system time, and
+    /// their sends are queued. A receive is posted again once the response to its request was
+    /// sent.
+    pub fn handle_clients_uring(&mut self) -> Result<(), io::Error> {
+        let mut uring = match self.uring.take() {
+            Some(uring) => uring,
+            None => panic!("The io_uring engine was not enabled"),
+        };
+        let result = self.handle_completions(&mut uring);
+        self.uring = Some(uring);
+        result
+    }
+
+    fn handle_completions(&mut self, uring: &mut Uring) -> Result<(), io::Error> {
+        uring.ring.submit_and_wait(1)?;
+        uring.ring.completions(&mut uring.completions);
+        let received_at = Instant::now();
+
+        let mut snapshot = None;
+        let mut time_nanos = 0;
+        let mut received = 0;
+        let mut result = Ok(());
+        for c in 0..uring.completions.len() {
+            let cqe = uring.completions[c];
+            let i = (cqe.user_data & !URING_SEND) as usize;
+            if cqe.user_data & URING_SEND != 0 {
+                if cqe.res < 0 {
+                    self.metrics
+                        .worker(self.worker)
+                        .count_send_failure(&io::Error::from_raw_os_error(-cqe.res));
+                }
+                // Report the first error once all the completions are handled, so that none of
+                // them is lost
+                result = result.and(self.post_recv(&mut uring.ring, i));
+                continue;
+            }
+            if cqe.res < 0 {
+                // Post the receive again, and report the error once the other completions are
+                // handled
+                result = result.and(Err(io::Error::from_raw_os_error(-cqe.res)));
+                result = result.and(self.post_recv(&mut uring.ring, i));
+                continue;
+            }
 
-        let (request_size, client) = self.socket.recv_from_unix_addr(&mut request)?;
+            // Get the model and error flag from chrony poller thread once for all completions
+            if snapshot.is_none() {
+                snapshot = Some(self.snapshot.load());
+                time_nanos = get_epoch_us();
+            }
+            self.respond_one(i, cqe.res as usize, snapshot.as_ref().unwrap(), time_nanos);
+            received += 1;
+
+            // The client address and its length were filled in by the receive
+            uring.send_iovecs[i] = libc::iovec {
+                iov_base: self.batch.responses[i].as_mut_ptr() as *mut libc::c_void,
+                iov_len: self.batch.response_sizes[i],
+            };
+            let msg = &mut uring.send_msgs[i];
+            msg.msg_name = &mut self.batch.addrs[i] as *mut libc::sockaddr_un as *mut libc::c_void;
+            msg.msg_namelen = self.batch.msgs[i].msg_hdr.msg_namelen;
+            msg.msg_iov = &mut uring.send_iovecs[i];
+            msg.msg_iovlen = 1;
+            let sqe = Sqe::sendmsg(self.socket.as_raw_fd(), msg, i as u64 | URING_SEND);
+            result = result.and(unsafe { uring.ring.push(sqe) });
+        }
+
+        if let Some(snapshot) = snapshot {
+            self.record_snapshot_age(&snapshot, time_nanos, received);
+            // The sends are submitted on the next call, the requests waited until then
+            self.metrics
+                .worker(self.worker)
+                .service_time
+                .record(received_at.elapsed().as_nanos() as u64, received);
+        }
+        result
+    }
+
+    /// Build and send the responses to the first `received` requests of the batch.
+    ///
+    /// Before, After and Batch requests are answered from the time the kernel received them, so
+    /// that time spent queued on the socket does not skew the answer.
+    fn respond(&mut self, received: usize) {
+        let received_at = Instant::now();
 
-        // Get tracking data from chrony poller thread
-        let tracking = *rx_tracking.borrow();
+        // Get the model and error flag from chrony poller thread once for the whole batch
+        let snapshot = self.snapshot.load();
+        let time_nanos = get_epoch_us();
+        self.record_snapshot_age(&snapshot, time_nanos, received as u64);
 
-        // Update the tracking information with the latest information from the chrony poller thread
-        self.update_tracking(tracking.clone());
+        for i in 0..received {
+            let request_size = self.batch.msgs[i].msg_len as usize;
+            self.respond_one(i, request_size, &snapshot, time_nanos);
+        }
 
-        // Get error flag from chrony poller thread
-        let error_flag = *rx_error_flag.borrow();
+        self.send_batch(received);
+        // Every request in the batch waited for the whole batch to be sent
+        self.metrics
+            .worker(self.worker)
+            .service_time
+            .record(received_at.elapsed().as_nanos() as u64, received as u64);
+    }
 
-        let mut response: Vec<u8> = build_response(
-            request,
+    /// Build the response to a request of the batch, and subscribe its client if it is a
+    /// subscribe request.
+    ///
+    /// # Arguments
+    ///
+    /// * `i` - The index of the request in the batch.
+    /// * `request_size` - The size of the request received.
+    /// * `snapshot` - The snapshot the responses of the batch are built from.
+    /// * `time_nanos` - The system time the responses of the batch are built at.
+    fn respond_one(&mut self, i: usize, request_size: usize, snapshot: &Snapshot, time_nanos: u64) {
+        let received_nanos = self.batch.received_nanos(i).unwrap_or(time_nanos);
+        let stats = is_stats_request(&self.batch.requests[i], request_size);
+        if stats {
+            self.metrics.summary_into(&mut self.stats);
+        }
+        self.batch.response_sizes[i] = match stats {
+            true => build_response_stats(
+                &self.batch.requests[i],
+                &snapshot.model,
+                &self.stats,
+                &mut self.batch.responses[i],
+            ),
+            false => build_response(
+                &self.batch.requests[i],
+                request_size,
+                &snapshot.model,
+                snapshot.error_flag,
+                time_nanos,
+                received_nanos,
+                &mut self.batch.responses[i],
+            ),
+        };
+        self.count_response(
+            &self.batch.requests[i],
             request_size,
-            self.tracking,
-            error_flag,
-            max_clock_error,
+            &self.batch.responses[i],
+            snapshot,
+            time_nanos,
         );
 
-        if let Err(e) = self.socket.send_to_unix_addr(&mut response, &client) {
-            warn!("Failed to send response to client. Error: {:?}", e);
+        if is_subscribe_request(&self.batch.requests[i], request_size)
+            && !self.subscribers.subscribe(
+                &self.batch.addrs[i],
+                self.batch.msgs[i].msg_hdr.msg_namelen,
+                self.batch.requests[i][0],
+                request_id(&self.batch.requests[i]),
+                Instant::now(),
+            )
+        {
+            // A client that was not subscribed must not believe it holds a lease
+            refuse_subscription(&mut self.batch.responses[i], self.batch.response_sizes[i]);
         }
+    }
 
-        Ok(())
+    /// Receive up to the batch size of requests, blocking until at least one is received.
+    /// Returns the number of requests received.
+    fn recv_batch(&mut self) -> Result<usize, io::Error> {
+        let batch = &mut self.batch;
+        batch.prepare_recv(batch.len());
+
+        // MSG_WAITFORONE blocks for the first request only, then returns whatever else is
+        // already queued on the socket.
+        let received = unsafe {
+            libc::recvmmsg(
+                self.socket.as_raw_fd(),
+                batch.msgs.as_mut_ptr(),
+                batch.len() as libc::c_uint,
+                libc::MSG_WAITFORONE,
+                std::ptr::null_mut(),
+            )
+        };
+        if received < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(received as usize)
+    }
+
+    /// Receive a single request into the first slot of the batch, blocking until it is received.
+    /// Returns the number of requests received.
+    fn recv_one(&mut self) -> Result<usize, io::Error> {
+        let batch = &mut self.batch;
+        batch.prepare_recv(1);
+        let size = unsafe { libc::recvmsg(self.socket.as_raw_fd(), &mut batch.msgs[0].msg_hdr, 0) };
+        if size < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        batch.msgs[0].msg_len = size as libc::c_uint;
+        Ok(1)
+    }
+
+    /// Send the responses of the first `count` requests of the batch back to their clients.
+    fn send_batch(&mut self, count: usize) {
+        let batch = &mut self.batch;
+        for i in 0..count {
+            // The client address and its length were filled in by recvmmsg
+            batch.iovecs[i] = libc::iovec {
+                iov_base: batch.responses[i].as_mut_ptr() as *mut libc::c_void,
+                iov_len: batch.response_sizes[i],
+            };
+            // Responses carry no control messages
+            batch.msgs[i].msg_hdr.msg_control = std::ptr::null_mut();
+            batch.msgs[i].msg_hdr.msg_controllen = 0;
+        }
+
+        let mut sent = 0;
+        while sent < count {
+            let result = unsafe {
+                libc::sendmmsg(
+                    self.socket.as_raw_fd(),
+                    batch.msgs[sent..].as_mut_ptr(),
+                    (count - sent) as libc::c_uint,
+                    0,
+                )
+            };
+            if result > 0 {
+                sent += result as usize;
+            } else {
+                // sendmmsg only fails when the first message in the slice could not be sent. Skip
+                // that client and carry on with the rest of the batch.
+                self.metrics
+                    .worker(self.worker)
+                    .count_send_failure(&io::Error::last_os_error());
+                sent += 1;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::ceb::BoundModel;
+    use crate::metrics::Metrics;
+    use crate::response::{
+        RequestError, ERROR_RESPONSE, REQUEST_BUFFER_SIZE, RESPONSE_BUFFER_SIZE, RESPONSE_VERSION,
+    };
+    use crate::server::ClockBoundServer;
+    use crate::snapshot::{SharedSnapshot, Snapshot};
+    use crate::subscribers::{MAX_SUBSCRIBERS, SUBSCRIPTION_LEASE_SECS};
+    use crate::tracking::mock_tracking;
+    use byteorder::{ByteOrder, NetworkEndian};
+    use std::os::unix::net::UnixDatagram;
+    use std::sync::Arc;
+
+    // 1000000000000000000 nanoseconds since the unix epoch, as in the response tests
+    const TIME_NANOS: u64 = 1_000_000_000_000_000_000;
+
+    fn test_server(metrics: Arc<Metrics>) -> ClockBoundServer {
+        let model = BoundModel::new(mock_tracking(), 0.0);
+        let snapshot = Arc::new(SharedSnapshot::new(model, false));
+        ClockBoundServer::with_socket(UnixDatagram::unbound().unwrap(), snapshot, 1, metrics, 0)
+    }
+
+    fn to_request_buffer(request: &[u8]) -> [u8; REQUEST_BUFFER_SIZE] {
+        let mut buffer = [0; REQUEST_BUFFER_SIZE];
+        buffer[..request.len()].copy_from_slice(request);
+        buffer
+    }
+
+    #[test]
+    fn test_count_response_error_flag() {
+        let metrics = Arc::new(Metrics::new(1));
+        let server = test_server(metrics.clone());
+        let snapshot = Snapshot {
+            model: BoundModel::new(mock_tracking(), 0.0),
+            error_flag: true,
+            version: 0,
+        };
+        let mut response = [0; RESPONSE_BUFFER_SIZE];
+        response[0] = RESPONSE_VERSION;
+        response[1] = ERROR_RESPONSE;
+
+        // A valid Now request refused because of the error flag
+        let request = to_request_buffer(&[RESPONSE_VERSION, 1, 0, 0]);
+        server.count_response(&request, 4, &response, &snapshot, TIME_NANOS);
+        // An invalid request type, refused whether or not the error flag is set
+        let request = to_request_buffer(&[RESPONSE_VERSION, 42, 0, 0]);
+        server.count_response(&request, 4, &response, &snapshot, TIME_NANOS);
+
+        let summary = metrics.summary();
+        assert_eq!(1, summary.error_flag_responses);
+        assert_eq!(1, summary.requests[0]);
+        assert_eq!([0, 1, 0, 0, 0], summary.errors.request_errors);
+        assert_eq!(
+            Some(RequestError::InvalidType(42)),
+            summary.errors.last_request_errors[1]
+        );
+    }
+
+    /// The address of a client socket bound to an abstract name made of a number.
+    fn client_addr(n: usize) -> (libc::sockaddr_un, libc::socklen_t) {
+        let mut addr: libc::sockaddr_un = unsafe { std::mem::zeroed() };
+        addr.sun_family = libc::AF_UNIX as libc::sa_family_t;
+        for (i, byte) in n.to_be_bytes().iter().enumerate() {
+            addr.sun_path[i + 1] = *byte as libc::c_char;
+        }
+        let addr_len = std::mem::size_of::<libc::sa_family_t>() + 1 + std::mem::size_of::<usize>();
+        (addr, addr_len as libc::socklen_t)
+    }
+
+    /// Respond to a subscribe request from a client, returning the lease of the response.
+    fn subscribe(server: &mut ClockBoundServer, addr: (libc::sockaddr_un, libc::socklen_t)) -> u32 {
+        let snapshot = Snapshot {
+            model: BoundModel::new(mock_tracking(), 0.0),
+            error_flag: false,
+            version: 0,
+        };
+        server.batch.requests[0] = to_request_buffer(&[RESPONSE_VERSION, 5, 0, 0]);
+        server.batch.addrs[0] = addr.0;
+        server.batch.msgs[0].msg_hdr.msg_namelen = addr.1;
+        server.respond_one(0, 4, &snapshot, TIME_NANOS);
+        let size = server.batch.response_sizes[0];
+        assert_eq!(4 + 28, size);
+        NetworkEndian::read_u32(&server.batch.responses[0][size - 4..size])
+    }
+
+    #[test]
+    fn test_subscribe_refused() {
+        let mut server = test_server(Arc::new(Metrics::new(1)));
+
+        // An unbound client has no address that updates could be sent to
+        let (unbound, _) = client_addr(0);
+        let unbound_len = std::mem::size_of::<libc::sa_family_t>() as libc::socklen_t;
+        assert_eq!(0, subscribe(&mut server, (unbound, unbound_len)));
+
+        for n in 0..MAX_SUBSCRIBERS {
+            assert_eq!(
+                SUBSCRIPTION_LEASE_SECS,
+                subscribe(&mut server, client_addr(n))
+            );
+        }
+        // The table is full, but a subscriber can still renew its lease
+        assert_eq!(0, subscribe(&mut server, client_addr(MAX_SUBSCRIBERS)));
+        assert_eq!(
+            SUBSCRIPTION_LEASE_SECS,
+            subscribe(&mut server, client_addr(0))
+        );
+        assert_eq!(MAX_SUBSCRIBERS, server.subscribers.len());
+    }
+
+    #[test]
+    fn test_record_snapshot_age_unsynchronized() {
+        let metrics = Arc::new(Metrics::new(1));
+        let server = test_server(metrics.clone());
+        let synchronized = BoundModel::new(mock_tracking(), 0.0);
+        let age = TIME_NANOS - synchronized.ref_time_nanos;
+
+        // No last update
+        let snapshot = Snapshot {
+            model: BoundModel::unsynchronized(),
+            error_flag: false,
+            version: 0,
+        };
+        server.record_snapshot_age(&snapshot, TIME_NANOS, 1);
+        // Polling Chrony failed
+        let snapshot = Snapshot {
+            model: synchronized,
+            error_flag: true,
+            version: 1,
+        };
+        server.record_snapshot_age(&snapshot, TIME_NANOS, 1);
+        assert_eq!(0, metrics.summary().snapshot_age.max());
+
+        let snapshot = Snapshot {
+            model: synchronized,
+            error_flag: false,
+            version: 2,
+        };
+        server.record_snapshot_age(&snapshot, TIME_NANOS, 3);
+        let summary = metrics.summary();
+        assert!(summary.snapshot_age.max() >= age);
+        assert!(summary.snapshot_age.max() <= age + age / 16);
     }
 }
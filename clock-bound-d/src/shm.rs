@@ -0,0 +1,275 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use crate::chrony_poller::LEAP_STATUS_UNSYNCHRONIZED;
+use chrony_candm::reply::Tracking;
+use log::{error, info};
+use std::fs::OpenOptions;
+use std::io;
+use std::os::unix::fs::{OpenOptionsExt, PermissionsExt};
+use std::os::unix::io::AsRawFd;
+use std::sync::atomic::{fence, AtomicU32, AtomicU64, Ordering};
+use std::time::SystemTime;
+
+/// The shared memory segment file for ClockBoundD
+pub const CLOCKBOUND_SHM_FILE: &str = "clockboundd.shm";
+
+/// Magic number at the start of the shared memory segment ("CLKB").
+pub const SHM_MAGIC: u32 = 0x434c_4b42;
+
+/// The current layout version of the shared memory segment.
+pub const SHM_VERSION: u32 = 1;
+
+/// The layout of the shared memory segment. See PROTOCOL.md for a description of each field.
+///
+/// Every field is an atomic so that readers in other processes never observe a torn value. The
+/// fields are protected as a whole by the `seq` seqlock counter: it is odd while an update is in
+/// progress and incremented to the next even value once the update is complete.
+#[repr(C)]
+pub struct ShmSegment {
+    pub magic: AtomicU32,
+    pub version: AtomicU32,
+    pub seq: AtomicU64,
+    pub ref_time: AtomicU64,
+    pub root_dispersion: AtomicU64,
+    pub current_correction: AtomicU64,
+    pub root_delay: AtomicU64,
+    pub skew_ppm: AtomicU64,
+    pub resid_freq_ppm: AtomicU64,
+    pub max_clock_error: AtomicU64,
+    pub leap_status: AtomicU32,
+    pub error_flag: AtomicU32,
+}
+
+/// ShmWriter owns the memory mapping of the ClockBoundD shared memory segment and publishes the
+/// latest tracking data to it.
+pub struct ShmWriter {
+    segment: *mut ShmSegment,
+}
+
+// The segment is only ever accessed through atomics, so the writer can be handed to the Chrony
+// poller thread.
+unsafe impl Send for ShmWriter {}
+
+impl ShmWriter {
+    /// Create the shared memory segment file at the specified path and map it into memory.
+    ///
+    /// An existing segment file is reused rather than replaced, so that clients which already
+    /// mapped it keep receiving updates after ClockBoundD restarts.
+    ///
+    /// # Arguments
+    ///
+    /// * `path` - The path and filename of the shared memory segment to be created.
+    pub fn create(path: &std::path::Path) -> Result<ShmWriter, io::Error> {
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .mode(0o644)
+            .open(path)?;
+        let size = std::mem::size_of::<ShmSegment>();
+        file.set_len(size as u64)?;
+
+        // Set permissions to rw r r so that an unprivileged process can map the segment for
+        // reading, regardless of the umask.
+        if let Err(e) = file.set_permissions(std::fs::Permissions::from_mode(0o644)) {
+            error!("Failed to set permissions: {}", e);
+        }
+
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                size,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        let writer = ShmWriter {
+            segment: ptr as *mut ShmSegment,
+        };
+        let segment = writer.segment();
+        // A previous instance of ClockBoundD may have been stopped part way through an update.
+        // Round the counter up to the next even value so that readers are not stuck on it.
+        let seq = segment.seq.load(Ordering::Relaxed);
+        segment.seq.store((seq + 1) & !1, Ordering::Release);
+        segment.version.store(SHM_VERSION, Ordering::Relaxed);
+        segment.magic.store(SHM_MAGIC, Ordering::Release);
+
+        info!("Created shared memory segment at path {}", path.display());
+        Ok(writer)
+    }
+
+    fn segment(&self) -> &ShmSegment {
+        unsafe { &*self.segment }
+    }
+
+    /// Publish tracking data to the shared memory segment.
+    ///
+    /// # Arguments
+    ///
+    /// * `tracking` - The tracking information received from Chrony.
+    /// * `error_flag` - An error flag indicating if there has been an error when getting the
+    /// tracking information from Chrony.
+    /// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
+    pub fn publish(&self, tracking: &Tracking, error_flag: bool, max_clock_error: f64) {
+        let segment = self.segment();
+        let ref_time = match tracking.ref_time.duration_since(SystemTime::UNIX_EPOCH) {
+            Ok(d) => d.as_nanos() as u64,
+            Err(_) => 0,
+        };
+
+        let seq = segment.seq.load(Ordering::Relaxed);
+        segment.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+        fence(Ordering::Release);
+
+        segment.ref_time.store(ref_time, Ordering::Relaxed);
+        store_f64(
+            &segment.root_dispersion,
+            f64::from(tracking.root_dispersion),
+        );
+        store_f64(
+            &segment.current_correction,
+            f64::from(tracking.current_correction),
+        );
+        store_f64(&segment.root_delay, f64::from(tracking.root_delay));
+        store_f64(&segment.skew_ppm, f64::from(tracking.skew_ppm));
+        store_f64(&segment.resid_freq_ppm, f64::from(tracking.resid_freq_ppm));
+        store_f64(&segment.max_clock_error, max_clock_error);
+        segment
+            .leap_status
+            .store(u32::from(tracking.leap_status), Ordering::Relaxed);
+        segment
+            .error_flag
+            .store(u32::from(error_flag), Ordering::Relaxed);
+
+        segment.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
+
+    /// Publish that no tracking data was received yet, before chronyd first reports being
+    /// synchronized. The root dispersion is infinite, so clients reading the segment compute
+    /// unbounded bounds, flagged as an error and unsynchronized.
+    ///
+    /// # Arguments
+    ///
+    /// * `max_clock_error` - The assumed maximum frequency error that a system clock can gain between updates in ppm.
+    pub fn publish_unsynchronized(&self, max_clock_error: f64) {
+        let segment = self.segment();
+
+        let seq = segment.seq.load(Ordering::Relaxed);
+        segment.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+        fence(Ordering::Release);
+
+        segment.ref_time.store(0, Ordering::Relaxed);
+        store_f64(&segment.root_dispersion, f64::INFINITY);
+        store_f64(&segment.current_correction, 0.0);
+        store_f64(&segment.root_delay, 0.0);
+        store_f64(&segment.skew_ppm, 0.0);
+        store_f64(&segment.resid_freq_ppm, 0.0);
+        store_f64(&segment.max_clock_error, max_clock_error);
+        segment
+            .leap_status
+            .store(u32::from(LEAP_STATUS_UNSYNCHRONIZED), Ordering::Relaxed);
+        segment.error_flag.store(1, Ordering::Relaxed);
+
+        segment.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
+}
+
+impl Drop for ShmWriter {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(
+                self.segment as *mut libc::c_void,
+                std::mem::size_of::<ShmSegment>(),
+            );
+        }
+    }
+}
+
+/// Store a f64 into an AtomicU64 using its IEEE 754 bit representation.
+fn store_f64(field: &AtomicU64, value: f64) {
+    field.store(value.to_bits(), Ordering::Relaxed);
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::chrony_poller::LEAP_STATUS_UNSYNCHRONIZED;
+    use crate::shm::{ShmSegment, ShmWriter, SHM_MAGIC, SHM_VERSION};
+    use crate::tracking::mock_tracking;
+    use std::sync::atomic::Ordering;
+
+    #[test]
+    fn test_publish_successful() {
+        let path = std::env::temp_dir().join(format!("clockboundd-{}.shm", std::process::id()));
+        let writer = ShmWriter::create(&path).unwrap();
+        let tracking = mock_tracking();
+
+        writer.publish(&tracking, true, 1.0);
+
+        let bytes = std::fs::read(&path).unwrap();
+        assert_eq!(bytes.len(), std::mem::size_of::<ShmSegment>());
+
+        let segment = writer.segment();
+        assert_eq!(SHM_MAGIC, segment.magic.load(Ordering::Relaxed));
+        assert_eq!(SHM_VERSION, segment.version.load(Ordering::Relaxed));
+        // A completed update always leaves the sequence counter even
+        assert_eq!(2, segment.seq.load(Ordering::Relaxed));
+        assert_eq!(
+            1_000_000_000_000_000_000,
+            segment.ref_time.load(Ordering::Relaxed)
+        );
+        assert_eq!(
+            f64::from(tracking.root_dispersion),
+            f64::from_bits(segment.root_dispersion.load(Ordering::Relaxed))
+        );
+        assert_eq!(
+            f64::from(tracking.current_correction),
+            f64::from_bits(segment.current_correction.load(Ordering::Relaxed))
+        );
+        assert_eq!(
+            f64::from(tracking.root_delay),
+            f64::from_bits(segment.root_delay.load(Ordering::Relaxed))
+        );
+        assert_eq!(
+            1.0,
+            f64::from_bits(segment.max_clock_error.load(Ordering::Relaxed))
+        );
+        assert_eq!(1, segment.error_flag.load(Ordering::Relaxed));
+
+        drop(writer);
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn test_publish_unsynchronized_successful() {
+        let path = std::env::temp_dir().join(format!(
+            "clockboundd-unsynchronized-{}.shm",
+            std::process::id()
+        ));
+        let writer = ShmWriter::create(&path).unwrap();
+        writer.publish(&mock_tracking(), false, 1.0);
+
+        writer.publish_unsynchronized(1.0);
+
+        let segment = writer.segment();
+        assert_eq!(4, segment.seq.load(Ordering::Relaxed));
+        assert_eq!(0, segment.ref_time.load(Ordering::Relaxed));
+        assert_eq!(
+            f64::INFINITY,
+            f64::from_bits(segment.root_dispersion.load(Ordering::Relaxed))
+        );
+        assert_eq!(
+            u32::from(LEAP_STATUS_UNSYNCHRONIZED),
+            segment.leap_status.load(Ordering::Relaxed)
+        );
+        assert_eq!(1, segment.error_flag.load(Ordering::Relaxed));
+
+        drop(writer);
+        std::fs::remove_file(&path).unwrap();
+    }
+}
@@ -0,0 +1,182 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use crate::ceb::BoundModel;
+use std::sync::atomic::{fence, AtomicBool, AtomicU32, AtomicU64, Ordering};
+
+/// A consistent copy of the state ClockBoundD builds its responses from.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Snapshot {
+    /// The Clock Error Bound model computed from the tracking information received from Chrony.
+    pub model: BoundModel,
+    /// An error flag indicating if there has been an error when getting the tracking information
+    /// from Chrony.
+    pub error_flag: bool,
+    /// The version of the snapshot. Incremented every time a new snapshot is published.
+    pub version: u64,
+}
+
+/// SharedSnapshot publishes the latest Snapshot from the Chrony poller thread to the threads
+/// handling client requests.
+///
+/// The Clock Error Bound model and error flag are protected as a whole by a seqlock: the `seq`
+/// counter is odd while an update is in progress and incremented to the next even value once the
+/// update is complete. Readers never take a lock; they retry if the counter changed while they
+/// were copying the snapshot. There must only be a single writer.
+pub struct SharedSnapshot {
+    seq: AtomicU64,
+    ref_time_nanos: AtomicU64,
+    base_ceb_nanos: AtomicU64,
+    growth_ppb: AtomicU64,
+    leap_status: AtomicU32,
+    error_flag: AtomicBool,
+}
+
+impl SharedSnapshot {
+    /// Create a SharedSnapshot holding an initial Clock Error Bound model.
+    ///
+    /// # Arguments
+    ///
+    /// * `model` - The Clock Error Bound model computed from the tracking information received from Chrony.
+    /// * `error_flag` - An error flag indicating if there has been an error when getting the
+    /// tracking information from Chrony.
+    pub fn new(model: BoundModel, error_flag: bool) -> SharedSnapshot {
+        SharedSnapshot {
+            seq: AtomicU64::new(0),
+            ref_time_nanos: AtomicU64::new(model.ref_time_nanos),
+            base_ceb_nanos: AtomicU64::new(model.base_ceb_nanos),
+            growth_ppb: AtomicU64::new(model.growth_ppb),
+            leap_status: AtomicU32::new(u32::from(model.leap_status)),
+            error_flag: AtomicBool::new(error_flag),
+        }
+    }
+
+    /// Publish a new Clock Error Bound model and error flag. Must only be called from one thread.
+    ///
+    /// # Arguments
+    ///
+    /// * `model` - The Clock Error Bound model computed from the tracking information received from Chrony.
+    /// * `error_flag` - An error flag indicating if there has been an error when getting the
+    /// tracking information from Chrony.
+    pub fn publish(&self, model: BoundModel, error_flag: bool) {
+        let seq = self.seq.load(Ordering::Relaxed);
+        self.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+        fence(Ordering::Release);
+
+        self.ref_time_nanos
+            .store(model.ref_time_nanos, Ordering::Relaxed);
+        self.base_ceb_nanos
+            .store(model.base_ceb_nanos, Ordering::Relaxed);
+        self.growth_ppb.store(model.growth_ppb, Ordering::Relaxed);
+        self.leap_status
+            .store(u32::from(model.leap_status), Ordering::Relaxed);
+        self.error_flag.store(error_flag, Ordering::Relaxed);
+
+        self.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
+
+    /// Publish a new error flag, keeping the current Clock Error Bound model. Must only be called
+    /// from the same thread as `publish`.
+    ///
+    /// # Arguments
+    ///
+    /// * `error_flag` - An error flag indicating if there has been an error when getting the
+    /// tracking information from Chrony.
+    pub fn publish_error_flag(&self, error_flag: bool) {
+        let model = self.load().model;
+        self.publish(model, error_flag);
+    }
+
+    /// Take a consistent copy of the latest snapshot.
+    pub fn load(&self) -> Snapshot {
+        loop {
+            let seq = self.seq.load(Ordering::Acquire);
+            if seq & 1 == 0 {
+                let snapshot = Snapshot {
+                    model: BoundModel {
+                        ref_time_nanos: self.ref_time_nanos.load(Ordering::Relaxed),
+                        base_ceb_nanos: self.base_ceb_nanos.load(Ordering::Relaxed),
+                        growth_ppb: self.growth_ppb.load(Ordering::Relaxed),
+                        leap_status: self.leap_status.load(Ordering::Relaxed) as u16,
+                    },
+                    error_flag: self.error_flag.load(Ordering::Relaxed),
+                    version: seq / 2,
+                };
+                fence(Ordering::Acquire);
+                if self.seq.load(Ordering::Relaxed) == seq {
+                    return snapshot;
+                }
+            }
+            std::hint::spin_loop();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::ceb::BoundModel;
+    use crate::snapshot::SharedSnapshot;
+    use crate::tracking::mock_tracking;
+    use chrony_candm::common::ChronyFloat;
+    use std::sync::Arc;
+
+    #[test]
+    fn test_publish_successful() {
+        let model = BoundModel::new(mock_tracking(), 1.0);
+        let shared = SharedSnapshot::new(model, false);
+
+        let snapshot = shared.load();
+        assert_eq!(model, snapshot.model);
+        assert_eq!(false, snapshot.error_flag);
+        assert_eq!(0, snapshot.version);
+
+        let mut tracking = mock_tracking();
+        tracking.root_delay = ChronyFloat::from(1.0_f64);
+        let updated = BoundModel::new(tracking, 1.0);
+        shared.publish(updated, false);
+        let snapshot = shared.load();
+        assert_eq!(updated, snapshot.model);
+        assert_eq!(1, snapshot.version);
+
+        // Setting the error flag keeps the last model
+        shared.publish_error_flag(true);
+        let snapshot = shared.load();
+        assert_eq!(updated, snapshot.model);
+        assert_eq!(true, snapshot.error_flag);
+        assert_eq!(2, snapshot.version);
+    }
+
+    #[test]
+    fn test_load_consistent() {
+        let first = BoundModel::new(mock_tracking(), 1.0);
+        let second = BoundModel {
+            ref_time_nanos: first.ref_time_nanos + 1,
+            base_ceb_nanos: first.base_ceb_nanos + 1,
+            growth_ppb: first.growth_ppb + 1,
+            leap_status: 1,
+        };
+        let shared = Arc::new(SharedSnapshot::new(first, false));
+
+        let writer = {
+            let shared = shared.clone();
+            std::thread::spawn(move || {
+                for i in 0..100_000 {
+                    if i % 2 == 0 {
+                        shared.publish(second, true);
+                    } else {
+                        shared.publish(first, false);
+                    }
+                }
+            })
+        };
+
+        // A reader must only ever see one of the published pairs, never a mix of the two
+        for _ in 0..100_000 {
+            let snapshot = shared.load();
+            assert!(
+                (snapshot.model == first && !snapshot.error_flag)
+                    || (snapshot.model == second && snapshot.error_flag)
+            );
+        }
+        writer.join().unwrap();
+    }
+}
@@ -1,15 +1,23 @@
 // Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
 // SPDX-License-Identifier: GPL-2.0-only
-use log::{error, info};
+use log::{error, info, warn};
 use std::fs;
 use std::os::unix::fs::{FileTypeExt, PermissionsExt};
+use std::os::unix::io::{AsRawFd, FromRawFd, RawFd};
 use std::os::unix::net::UnixDatagram;
+use std::path::{Path, PathBuf};
+
+/// The first file descriptor passed by systemd socket activation. The sockets passed are numbered
+/// consecutively from it.
+pub const SD_LISTEN_FDS_START: RawFd = 3;
 
 ///
 /// Create a local Unix Datagram Socket.
 ///
 /// Remove any existing socket file at the exact same path, throwing an error if the removal fails.
 /// Creates a socket and binds to it at the specified path.
+/// Enables SO_TIMESTAMPNS, so that every request is received with the time the kernel received
+/// it.
 ///
 /// # Arguments:
 ///
@@ -39,9 +47,164 @@ pub fn create_unix_socket(path: &std::path::Path) -> UnixDatagram {
         error!("Failed to set permissions: {}", err_permissions);
     };
 
+    enable_receive_timestamps(&sock);
     return sock;
 }
 
+/// Enable SO_TIMESTAMPNS on a socket. Requests are answered from the time they were received if
+/// the socket time stamps them, and from the time they are handled otherwise.
+///
+/// # Arguments:
+///
+/// * `sock`: The socket requests are received on.
+pub fn enable_receive_timestamps(sock: &UnixDatagram) {
+    let enable: libc::c_int = 1;
+    let result = unsafe {
+        libc::setsockopt(
+            sock.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_TIMESTAMPNS,
+            &enable as *const libc::c_int as *const libc::c_void,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if result < 0 {
+        error!(
+            "Failed to enable receive timestamps: {}",
+            std::io::Error::last_os_error()
+        );
+    }
+}
+
+/// Take the Unix Datagram Sockets passed by systemd socket activation, together with the paths
+/// they are bound to.
+///
+/// The sockets are only taken if they were passed to this process, as told by the LISTEN_PID and
+/// LISTEN_FDS environment variables, which are then removed so that they are not inherited by
+/// child processes. Passed sockets that are not Unix Datagram Sockets bound to a path are logged
+/// and closed. SO_TIMESTAMPNS is enabled on every socket taken.
+pub fn listen_fds() -> Vec<(PathBuf, UnixDatagram)> {
+    let count = listen_fds_count(
+        std::env::var("LISTEN_PID").ok().as_deref(),
+        std::env::var("LISTEN_FDS").ok().as_deref(),
+        std::process::id(),
+    );
+    std::env::remove_var("LISTEN_PID");
+    std::env::remove_var("LISTEN_FDS");
+    std::env::remove_var("LISTEN_FDNAMES");
+
+    let mut sockets = Vec::with_capacity(count);
+    for fd in SD_LISTEN_FDS_START..SD_LISTEN_FDS_START.saturating_add(count as RawFd) {
+        // The sockets are passed without close-on-exec set
+        unsafe {
+            libc::fcntl(fd, libc::F_SETFD, libc::FD_CLOEXEC);
+        }
+        if !is_datagram_socket(fd) {
+            error!(
+                "Socket passed as file descriptor {} is not a datagram socket",
+                fd
+            );
+            unsafe {
+                libc::close(fd);
+            }
+            continue;
+        }
+
+        let sock = unsafe { UnixDatagram::from_raw_fd(fd) };
+        let path = match sock.local_addr() {
+            Ok(addr) => match addr.as_pathname() {
+                Some(path) => path.to_path_buf(),
+                None => {
+                    error!(
+                        "Socket passed as file descriptor {} is not bound to a path",
+                        fd
+                    );
+                    continue;
+                }
+            },
+            Err(e) => {
+                error!(
+                    "Socket passed as file descriptor {} is not a Unix socket. Error: {:?}",
+                    fd, e
+                );
+                continue;
+            }
+        };
+        info!(
+            "Inherited unix socket at path {} from socket activation",
+            path.display()
+        );
+        enable_receive_timestamps(&sock);
+        sockets.push((path, sock));
+    }
+    sockets
+}
+
+/// Take the socket passed by systemd socket activation that is bound to a path, if any.
+///
+/// # Arguments:
+///
+/// * `sockets`: The sockets passed by systemd socket activation that are not taken yet.
+/// * `path`: The path of the socket. A relative path is resolved against the working directory.
+pub fn take_listen_fd(
+    sockets: &mut Vec<(PathBuf, UnixDatagram)>,
+    path: &Path,
+) -> Option<UnixDatagram> {
+    let path = match std::env::current_dir() {
+        Ok(dir) => dir.join(path),
+        Err(_) => path.to_path_buf(),
+    };
+    let index = sockets.iter().position(|(bound, _)| *bound == path)?;
+    Some(sockets.swap_remove(index).1)
+}
+
+/// Log the sockets passed by systemd socket activation that no server took, which are closed.
+///
+/// # Arguments:
+///
+/// * `sockets`: The sockets passed by systemd socket activation that are not taken.
+pub fn warn_unused_listen_fds(sockets: Vec<(PathBuf, UnixDatagram)>) {
+    for (path, _) in sockets {
+        warn!(
+            "Closing unix socket at path {} passed by socket activation, which no worker serves",
+            path.display()
+        );
+    }
+}
+
+/// Get the number of sockets passed by systemd socket activation from the LISTEN_PID and
+/// LISTEN_FDS environment variables. Sockets are only passed if LISTEN_PID is this process.
+///
+/// # Arguments:
+///
+/// * `listen_pid`: The value of LISTEN_PID, if set.
+/// * `listen_fds`: The value of LISTEN_FDS, if set.
+/// * `pid`: The id of this process.
+fn listen_fds_count(listen_pid: Option<&str>, listen_fds: Option<&str>, pid: u32) -> usize {
+    match (listen_pid, listen_fds) {
+        (Some(listen_pid), Some(listen_fds)) if listen_pid.parse::<u32>() == Ok(pid) => {
+            listen_fds.parse::<usize>().unwrap_or(0)
+        }
+        _ => 0,
+    }
+}
+
+/// Whether a file descriptor is a datagram socket.
+fn is_datagram_socket(fd: RawFd) -> bool {
+    let mut socket_type: libc::c_int = 0;
+    let mut len = std::mem::size_of::<libc::c_int>() as libc::socklen_t;
+    let result = unsafe {
+        libc::getsockopt(
+            fd,
+            libc::SOL_SOCKET,
+            libc::SO_TYPE,
+            &mut socket_type as *mut libc::c_int as *mut libc::c_void,
+            &mut len,
+        )
+    };
+    result == 0 && socket_type == libc::SOCK_DGRAM
+}
+
 /// Remove the socket file at the path if possible.
 /// Checks if the path exists, then checks if the file is a socket, and removes it.
 /// If the remove succeeds or the path doesn't exist at all, panic since we can not start the daemon
@@ -82,3 +245,51 @@ pub fn remove_socket_file(path: &std::path::Path) {
         path.display()
     );
 }
+
+#[cfg(test)]
+mod tests {
+    use crate::socket::{is_datagram_socket, listen_fds_count, take_listen_fd};
+    use std::os::unix::io::AsRawFd;
+    use std::os::unix::net::{UnixDatagram, UnixStream};
+    use std::path::{Path, PathBuf};
+
+    #[test]
+    fn listen_fds_count_successful() {
+        assert_eq!(listen_fds_count(Some("42"), Some("2"), 42), 2);
+    }
+
+    #[test]
+    fn listen_fds_count_other_process() {
+        // The sockets were passed to a parent process, and the environment inherited
+        assert_eq!(listen_fds_count(Some("41"), Some("2"), 42), 0);
+        assert_eq!(listen_fds_count(None, Some("2"), 42), 0);
+        assert_eq!(listen_fds_count(Some("42"), None, 42), 0);
+        assert_eq!(listen_fds_count(Some("42"), Some("x"), 42), 0);
+    }
+
+    #[test]
+    fn take_listen_fd_successful() {
+        let dir = std::env::current_dir().unwrap();
+        let (a, _) = UnixDatagram::pair().unwrap();
+        let (b, _) = UnixDatagram::pair().unwrap();
+        let mut sockets = vec![
+            (dir.join("clockboundd.sock"), a),
+            (PathBuf::from("/elsewhere/clockboundd-1.sock"), b),
+        ];
+
+        assert!(take_listen_fd(&mut sockets, Path::new("clockboundd.sock")).is_some());
+        assert!(take_listen_fd(&mut sockets, Path::new("clockboundd.sock")).is_none());
+        assert!(take_listen_fd(&mut sockets, Path::new("clockboundd-1.sock")).is_none());
+        assert!(take_listen_fd(&mut sockets, Path::new("/elsewhere/clockboundd-1.sock")).is_some());
+        assert!(sockets.is_empty());
+    }
+
+    #[test]
+    fn is_datagram_socket_successful() {
+        let (datagram, _) = UnixDatagram::pair().unwrap();
+        let (stream, _) = UnixStream::pair().unwrap();
+        assert!(is_datagram_socket(datagram.as_raw_fd()));
+        assert!(!is_datagram_socket(stream.as_raw_fd()));
+        assert!(!is_datagram_socket(-1));
+    }
+}
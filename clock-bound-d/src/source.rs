@@ -0,0 +1,187 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use crate::chrony_poller::LEAP_STATUS_UNSYNCHRONIZED;
+use chrony_candm::common::{ChronyAddr, ChronyFloat};
+use chrony_candm::reply::Tracking;
+use log::error;
+use std::io;
+use std::net::IpAddr;
+use std::time::SystemTime;
+
+/// A leap status value of 1 means a leap second is inserted at the end of the day.
+const LEAP_STATUS_INSERT: u16 = 1;
+
+/// A leap status value of 2 means a leap second is deleted at the end of the day.
+const LEAP_STATUS_DELETE: u16 = 2;
+
+/// The rate the kernel grows its maximum error at between updates, MAXFREQ, in ppm.
+pub const MAXFREQ_PPM: f64 = 500.0;
+
+/// A source of the tracking information the Clock Error Bound model is computed from.
+pub trait TrackingSource {
+    /// Poll the source for tracking information. Returns None if the source could not be
+    /// reached.
+    fn poll(&self) -> Option<Tracking>;
+}
+
+/// The tracking sources ClockBoundD can be started with.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum TrackingSourceKind {
+    /// chronyd, polled through its command port or Unix command socket.
+    Chrony,
+    /// The kernel's NTP state, read with ntp_adjtime.
+    Adjtimex,
+}
+
+/// A tracking source reading the kernel's NTP state with ntp_adjtime.
+///
+/// The NTP daemon disciplining the clock sets the kernel's maximum error when it applies an
+/// update, and the kernel grows it by 500 ppm every second after that. Reading it takes a single
+/// system call and no communication with the NTP daemon, at the cost of a bound that grows faster
+/// between the daemon's updates than the one derived from chronyd's tracking data.
+pub struct AdjtimexSource;
+
+impl TrackingSource for AdjtimexSource {
+    fn poll(&self) -> Option<Tracking> {
+        let mut timex: libc::timex = unsafe { std::mem::zeroed() };
+        // A mode of 0 reads the kernel's NTP state without changing it
+        let state = unsafe { libc::ntp_adjtime(&mut timex) };
+        if state < 0 {
+            error!(
+                "Failed to read the kernel's NTP state. Error: {:?}",
+                io::Error::last_os_error()
+            );
+            return None;
+        }
+        Some(tracking_from_timex(&timex, state, SystemTime::now()))
+    }
+}
+
+/// Convert the kernel's NTP state into tracking information.
+///
+/// The maximum error is the bound at the time the state was read, so it is reported as the root
+/// dispersion with a reference time of now. The remaining offset of the kernel's phase-locked
+/// loop is reported as the current correction.
+///
+/// # Arguments
+///
+/// * `timex` - The kernel's NTP state.
+/// * `state` - The clock state returned by ntp_adjtime.
+/// * `now` - The time the state was read.
+pub fn tracking_from_timex(timex: &libc::timex, state: libc::c_int, now: SystemTime) -> Tracking {
+    let leap_status = if state == libc::TIME_ERROR || timex.status & libc::STA_UNSYNC != 0 {
+        LEAP_STATUS_UNSYNCHRONIZED
+    } else {
+        match state {
+            libc::TIME_INS => LEAP_STATUS_INSERT,
+            libc::TIME_DEL => LEAP_STATUS_DELETE,
+            _ => 0,
+        }
+    };
+
+    // The offset is in nanoseconds if STA_NANO is set, in microseconds otherwise
+    let offset = match timex.status & libc::STA_NANO {
+        0 => timex.offset as f64 / 1_000_000.0,
+        _ => timex.offset as f64 / 1_000_000_000.0,
+    };
+    let zero = ChronyFloat::from(0.0_f64);
+
+    Tracking {
+        ip_addr: ChronyAddr::from(IpAddr::from([0; 4])),
+        current_correction: ChronyFloat::from(offset),
+        freq_ppm: ChronyFloat::from(timex.freq as f64 / 65536.0),
+        last_offset: zero,
+        // The kernel does not know when the NTP daemon's next update is due
+        last_update_interval: zero,
+        leap_status,
+        ref_time: now,
+        ref_id: 0,
+        resid_freq_ppm: zero,
+        rms_offset: zero,
+        root_delay: zero,
+        // The maximum error is in microseconds
+        root_dispersion: ChronyFloat::from(timex.maxerror as f64 / 1_000_000.0),
+        // The kernel's maximum error grows at MAXFREQ, so the bound must grow at least as fast
+        skew_ppm: ChronyFloat::from(MAXFREQ_PPM),
+        stratum: 0,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::ceb::BoundModel;
+    use crate::ceb::NANOS_PER_SEC;
+    use crate::chrony_poller::LEAP_STATUS_UNSYNCHRONIZED;
+    use crate::source::{tracking_from_timex, AdjtimexSource, TrackingSource};
+    use std::time::{Duration, SystemTime};
+
+    fn mock_timex() -> libc::timex {
+        let mut timex: libc::timex = unsafe { std::mem::zeroed() };
+        timex.maxerror = 1500;
+        timex.offset = 250;
+        timex.status = libc::STA_PLL;
+        timex
+    }
+
+    #[test]
+    fn test_tracking_from_timex() {
+        let now = SystemTime::UNIX_EPOCH + Duration::from_secs(1_000_000_000);
+        let tracking = tracking_from_timex(&mock_timex(), libc::TIME_OK, now);
+        assert_eq!(now, tracking.ref_time);
+        assert_eq!(0, tracking.leap_status);
+
+        // The bound at the time the state was read is the maximum error plus the remaining offset
+        let model = BoundModel::new(tracking, 1.0);
+        assert_eq!(1_750_000, model.base_ceb_nanos);
+
+        // The offset is in nanoseconds with STA_NANO
+        let mut timex = mock_timex();
+        timex.status |= libc::STA_NANO;
+        let model = BoundModel::new(tracking_from_timex(&timex, libc::TIME_OK, now), 1.0);
+        assert_eq!(1_500_250, model.base_ceb_nanos);
+    }
+
+    #[test]
+    fn test_tracking_from_timex_growth() {
+        let now = SystemTime::UNIX_EPOCH + Duration::from_secs(1_000_000_000);
+        let model = BoundModel::new(tracking_from_timex(&mock_timex(), libc::TIME_OK, now), 1.0);
+
+        // The bound grows at MAXFREQ, 500 ppm, plus the maximum clock error, 1 ppm
+        assert_eq!(501_000, model.growth_ppb);
+        assert_eq!(
+            Some(1_750_000 + 501_000),
+            model.ceb_nanos_at(model.ref_time_nanos + NANOS_PER_SEC)
+        );
+    }
+
+    #[test]
+    fn test_tracking_from_timex_leap_status() {
+        let now = SystemTime::now();
+        let timex = mock_timex();
+        assert_eq!(
+            1,
+            tracking_from_timex(&timex, libc::TIME_INS, now).leap_status
+        );
+        assert_eq!(
+            2,
+            tracking_from_timex(&timex, libc::TIME_DEL, now).leap_status
+        );
+        assert_eq!(
+            LEAP_STATUS_UNSYNCHRONIZED,
+            tracking_from_timex(&timex, libc::TIME_ERROR, now).leap_status
+        );
+
+        let mut timex = mock_timex();
+        timex.status |= libc::STA_UNSYNC;
+        assert_eq!(
+            LEAP_STATUS_UNSYNCHRONIZED,
+            tracking_from_timex(&timex, libc::TIME_OK, now).leap_status
+        );
+    }
+
+    #[test]
+    fn test_adjtimex_source_poll() {
+        // Reading the kernel's NTP state needs no privileges
+        assert!(AdjtimexSource.poll().is_some());
+    }
+}
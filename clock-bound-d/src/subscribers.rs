@@ -0,0 +1,309 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+use crate::ceb::BoundModel;
+use crate::response::{build_update, RESPONSE_BUFFER_SIZE};
+use log::{info, warn};
+use std::io;
+use std::os::unix::io::AsRawFd;
+use std::os::unix::net::UnixDatagram;
+use std::sync::{Mutex, MutexGuard, PoisonError};
+use std::time::{Duration, Instant};
+
+/// The number of seconds a subscription lasts. A client keeps receiving updates by sending a new
+/// subscribe request before its lease runs out.
+pub const SUBSCRIPTION_LEASE_SECS: u32 = 10;
+
+/// The maximum number of subscribers of a single ClockBoundD socket. Further subscribe requests
+/// are answered with a lease of 0, and no updates are pushed to them.
+pub const MAX_SUBSCRIBERS: usize = 1024;
+
+/// A client that subscribed to updates of the Clock Error Bound model.
+struct Subscriber {
+    /// The address of the client's socket.
+    addr: libc::sockaddr_un,
+    /// The length of the address of the client's socket.
+    addr_len: libc::socklen_t,
+    /// The protocol version of the client's subscribe request.
+    response_version: u8,
+    /// The request id of the client's subscribe request.
+    request_id: u32,
+    /// The time the subscription runs out unless it is renewed.
+    expires: Instant,
+}
+
+impl Subscriber {
+    fn is_addr(&self, addr: &libc::sockaddr_un, addr_len: libc::socklen_t) -> bool {
+        let path_len = addr_len as usize - std::mem::size_of::<libc::sa_family_t>();
+        self.addr_len == addr_len && self.addr.sun_path[..path_len] == addr.sun_path[..path_len]
+    }
+}
+
+/// The subscribers of a ClockBoundD socket.
+///
+/// Subscribers are added by the thread serving the socket and receive updates pushed by the
+/// Chrony poller thread. Updates are sent from the socket the subscribers sent their requests to,
+/// since a client socket connected to ClockBoundD only accepts datagrams from that socket.
+pub struct Subscribers {
+    socket: UnixDatagram,
+    subscribers: Mutex<Vec<Subscriber>>,
+}
+
+impl Subscribers {
+    /// Create an empty set of subscribers of a ClockBoundD socket.
+    ///
+    /// # Arguments
+    ///
+    /// * `socket` - A handle to the ClockBoundD socket the subscribers send their requests to.
+    pub fn new(socket: UnixDatagram) -> Subscribers {
+        Subscribers {
+            socket,
+            subscribers: Mutex::new(Vec::new()),
+        }
+    }
+
+    /// Add a subscriber, or renew its lease if it is already subscribed. Returns false if the
+    /// subscriber could not be added.
+    ///
+    /// # Arguments
+    ///
+    /// * `addr` - The address of the client's socket.
+    /// * `addr_len` - The length of the address of the client's socket.
+    /// * `response_version` - The protocol version of the client's subscribe request.
+    /// * `request_id` - The request id of the client's subscribe request.
+    /// * `now` - The current time.
+    pub fn subscribe(
+        &self,
+        addr: &libc::sockaddr_un,
+        addr_len: libc::socklen_t,
+        response_version: u8,
+        request_id: u32,
+        now: Instant,
+    ) -> bool {
+        // An unbound client socket has no address that updates could be sent to
+        let addr_len_usize = addr_len as usize;
+        if addr_len_usize <= std::mem::size_of::<libc::sa_family_t>()
+            || addr_len_usize > std::mem::size_of::<libc::sockaddr_un>()
+        {
+            return false;
+        }
+
+        let expires = now + Duration::from_secs(SUBSCRIPTION_LEASE_SECS.into());
+        let mut subscribers = self.lock();
+        subscribers.retain(|subscriber| subscriber.expires > now);
+
+        if let Some(subscriber) = subscribers
+            .iter_mut()
+            .find(|subscriber| subscriber.is_addr(addr, addr_len))
+        {
+            subscriber.response_version = response_version;
+            subscriber.request_id = request_id;
+            subscriber.expires = expires;
+            return true;
+        }
+
+        if subscribers.len() >= MAX_SUBSCRIBERS {
+            warn!(
+                "Failed to add subscriber. Already at the maximum of {} subscribers.",
+                MAX_SUBSCRIBERS
+            );
+            return false;
+        }
+        subscribers.push(Subscriber {
+            addr: *addr,
+            addr_len,
+            response_version,
+            request_id,
+            expires,
+        });
+        true
+    }
+
+    /// Push an update of the Clock Error Bound model to every subscriber.
+    ///
+    /// Subscribers whose lease ran out, or whose socket is gone, are removed. An update is never
+    /// waited on: a subscriber that is not keeping up with its socket misses the update.
+    ///
+    /// # Arguments
+    ///
+    /// * `model` - The Clock Error Bound model computed from the tracking information received from Chrony.
+    /// * `error_flag` - An error flag indicating if there has been an error when getting the
+    /// tracking information from Chrony.
+    /// * `now` - The current time.
+    pub fn publish(&self, model: &BoundModel, error_flag: bool, now: Instant) {
+        let mut update: [u8; RESPONSE_BUFFER_SIZE] = [0; RESPONSE_BUFFER_SIZE];
+        let mut subscribers = self.lock();
+        let before = subscribers.len();
+
+        subscribers.retain(|subscriber| {
+            if subscriber.expires <= now {
+                return false;
+            }
+            let update_size = build_update(
+                model,
+                error_flag,
+                subscriber.response_version,
+                subscriber.request_id,
+                &mut update,
+            );
+            match self.send_to(&update[..update_size], subscriber) {
+                Ok(_) => true,
+                Err(e) if e.kind() == io::ErrorKind::WouldBlock => true,
+                Err(e) => {
+                    warn!("Failed to push update to subscriber. Error: {:?}", e);
+                    false
+                }
+            }
+        });
+
+        if subscribers.len() != before {
+            info!(
+                "Removed {} subscribers. Subscribers: {}",
+                before - subscribers.len(),
+                subscribers.len()
+            );
+        }
+    }
+
+    /// The number of subscribers.
+    #[cfg(test)]
+    pub fn len(&self) -> usize {
+        self.lock().len()
+    }
+
+    /// Send a datagram to a subscriber without blocking.
+    fn send_to(&self, buf: &[u8], subscriber: &Subscriber) -> Result<usize, io::Error> {
+        let sent = unsafe {
+            libc::sendto(
+                self.socket.as_raw_fd(),
+                buf.as_ptr() as *const libc::c_void,
+                buf.len(),
+                libc::MSG_DONTWAIT,
+                &subscriber.addr as *const libc::sockaddr_un as *const libc::sockaddr,
+                subscriber.addr_len,
+            )
+        };
+        if sent < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(sent as usize)
+    }
+
+    fn lock(&self) -> MutexGuard<'_, Vec<Subscriber>> {
+        self.subscribers
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::ceb::BoundModel;
+    use crate::subscribers::{Subscribers, SUBSCRIPTION_LEASE_SECS};
+    use crate::tracking::mock_tracking;
+    use std::os::unix::ffi::OsStrExt;
+    use std::os::unix::net::UnixDatagram;
+    use std::path::{Path, PathBuf};
+    use std::time::{Duration, Instant};
+
+    fn socket_path(name: &str) -> PathBuf {
+        let path = std::env::temp_dir().join(format!(
+            "clockboundd-subscribers-{}-{}.sock",
+            std::process::id(),
+            name
+        ));
+        let _ = std::fs::remove_file(&path);
+        path
+    }
+
+    fn sockaddr(path: &Path) -> (libc::sockaddr_un, libc::socklen_t) {
+        let mut addr: libc::sockaddr_un = unsafe { std::mem::zeroed() };
+        addr.sun_family = libc::AF_UNIX as libc::sa_family_t;
+        let bytes = path.as_os_str().as_bytes();
+        for (i, byte) in bytes.iter().enumerate() {
+            addr.sun_path[i] = *byte as libc::c_char;
+        }
+        let addr_len = std::mem::size_of::<libc::sa_family_t>() + bytes.len() + 1;
+        (addr, addr_len as libc::socklen_t)
+    }
+
+    #[test]
+    fn test_subscribe_renews_lease() {
+        let server_path = socket_path("renew-server");
+        let subscribers = Subscribers::new(UnixDatagram::bind(&server_path).unwrap());
+        let (addr, addr_len) = sockaddr(Path::new("/tmp/client.sock"));
+        let now = Instant::now();
+
+        assert!(subscribers.subscribe(&addr, addr_len, 1, 0, now));
+        assert!(subscribers.subscribe(&addr, addr_len, 2, 7, now + Duration::from_secs(1)));
+        assert_eq!(1, subscribers.len());
+
+        // An unbound client can not be subscribed
+        assert!(!subscribers.subscribe(&addr, 2, 1, 0, now));
+        assert_eq!(1, subscribers.len());
+
+        let _ = std::fs::remove_file(&server_path);
+    }
+
+    #[test]
+    fn test_publish_successful() {
+        let server_path = socket_path("publish-server");
+        let client_path = socket_path("publish-client");
+        let subscribers = Subscribers::new(UnixDatagram::bind(&server_path).unwrap());
+        let client = UnixDatagram::bind(&client_path).unwrap();
+        client.connect(&server_path).unwrap();
+        let now = Instant::now();
+
+        let (addr, addr_len) = sockaddr(&client_path);
+        assert!(subscribers.subscribe(&addr, addr_len, 2, 42, now));
+        let model = BoundModel::new(mock_tracking(), 1.0);
+        subscribers.publish(&model, false, now);
+
+        let mut update = [0; 64];
+        let update_size = client.recv(&mut update).unwrap();
+        assert_eq!(8 + 28, update_size);
+        assert_eq!([2, 6, 0, 0, 0, 0, 0, 42], update[..8]);
+        assert_eq!(model.ref_time_nanos.to_be_bytes(), update[8..16]);
+        assert_eq!(model.base_ceb_nanos.to_be_bytes(), update[16..24]);
+        assert_eq!(
+            (model.growth_ppb as f64).to_bits().to_be_bytes(),
+            update[24..32]
+        );
+        assert_eq!(SUBSCRIPTION_LEASE_SECS.to_be_bytes(), update[32..36]);
+
+        // The error flag is sent as an error response with the last valid model
+        subscribers.publish(&model, true, now);
+        let update_size = client.recv(&mut update).unwrap();
+        assert_eq!(8 + 28, update_size);
+        assert_eq!(0, update[1]);
+
+        let _ = std::fs::remove_file(&server_path);
+        let _ = std::fs::remove_file(&client_path);
+    }
+
+    #[test]
+    fn test_publish_removes_subscribers() {
+        let server_path = socket_path("remove-server");
+        let client_path = socket_path("remove-client");
+        let subscribers = Subscribers::new(UnixDatagram::bind(&server_path).unwrap());
+        let client = UnixDatagram::bind(&client_path).unwrap();
+        let now = Instant::now();
+        let model = BoundModel::new(mock_tracking(), 1.0);
+
+        let (addr, addr_len) = sockaddr(&client_path);
+        assert!(subscribers.subscribe(&addr, addr_len, 1, 0, now));
+
+        // A subscriber is removed once its lease runs out
+        let expired = now + Duration::from_secs(SUBSCRIPTION_LEASE_SECS.into());
+        subscribers.publish(&model, false, expired);
+        assert_eq!(0, subscribers.len());
+
+        // A subscriber is removed once its socket is gone
+        assert!(subscribers.subscribe(&addr, addr_len, 1, 0, now));
+        drop(client);
+        let _ = std::fs::remove_file(&client_path);
+        subscribers.publish(&model, false, now);
+        assert_eq!(0, subscribers.len());
+
+        let _ = std::fs::remove_file(&server_path);
+    }
+}
@@ -0,0 +1,439 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: GPL-2.0-only
+//! A minimal io_uring, set up with the raw system calls.
+//!
+//! Only what the ClockBoundD serving engine needs is implemented: a submission queue of recvmsg
+//! and sendmsg operations, a completion queue, and optionally a kernel thread polling the
+//! submission queue (SQPOLL). The structures below mirror include/uapi/linux/io_uring.h.
+use std::io;
+use std::os::unix::io::RawFd;
+use std::sync::atomic::{AtomicU32, Ordering};
+
+const IORING_SETUP_SQPOLL: u32 = 1 << 1;
+const IORING_FEAT_SINGLE_MMAP: u32 = 1 << 0;
+const IORING_ENTER_GETEVENTS: u32 = 1 << 0;
+const IORING_ENTER_SQ_WAKEUP: u32 = 1 << 1;
+const IORING_SQ_NEED_WAKEUP: u32 = 1 << 0;
+const IORING_OFF_SQ_RING: libc::off_t = 0;
+const IORING_OFF_CQ_RING: libc::off_t = 0x8000000;
+const IORING_OFF_SQES: libc::off_t = 0x10000000;
+const IORING_OP_SENDMSG: u8 = 9;
+const IORING_OP_RECVMSG: u8 = 10;
+
+/// How long the SQPOLL kernel thread spins for new submissions before it sleeps, in milliseconds.
+const SQ_THREAD_IDLE: u32 = 1000;
+
+#[repr(C)]
+#[derive(Default)]
+struct SqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    flags: u32,
+    dropped: u32,
+    array: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct CqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    overflow: u32,
+    cqes: u32,
+    flags: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct Params {
+    sq_entries: u32,
+    cq_entries: u32,
+    flags: u32,
+    sq_thread_cpu: u32,
+    sq_thread_idle: u32,
+    features: u32,
+    wq_fd: u32,
+    resv: [u32; 3],
+    sq_off: SqringOffsets,
+    cq_off: CqringOffsets,
+}
+
+/// A submission queue entry.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+pub struct Sqe {
+    opcode: u8,
+    flags: u8,
+    ioprio: u16,
+    fd: i32,
+    off: u64,
+    addr: u64,
+    len: u32,
+    msg_flags: u32,
+    user_data: u64,
+    buf_index: u16,
+    personality: u16,
+    splice_fd_in: i32,
+    addr3: u64,
+    pad: u64,
+}
+
+impl Sqe {
+    /// A recvmsg of one datagram into the buffers described by a message header.
+    ///
+    /// # Arguments
+    ///
+    /// * `fd` - The socket to receive from.
+    /// * `msg` - The message header to receive into. It must stay in place until the operation
+    /// completes.
+    /// * `user_data` - The value the completion of the operation carries.
+    pub fn recvmsg(fd: RawFd, msg: *mut libc::msghdr, user_data: u64) -> Sqe {
+        Sqe {
+            opcode: IORING_OP_RECVMSG,
+            fd,
+            addr: msg as u64,
+            len: 1,
+            user_data,
+            ..Default::default()
+        }
+    }
+
+    /// A sendmsg of one datagram from the buffers described by a message header.
+    ///
+    /// # Arguments
+    ///
+    /// * `fd` - The socket to send from.
+    /// * `msg` - The message header to send. It must stay in place until the operation completes.
+    /// * `user_data` - The value the completion of the operation carries.
+    pub fn sendmsg(fd: RawFd, msg: *const libc::msghdr, user_data: u64) -> Sqe {
+        Sqe {
+            opcode: IORING_OP_SENDMSG,
+            fd,
+            addr: msg as u64,
+            len: 1,
+            user_data,
+            ..Default::default()
+        }
+    }
+}
+
+/// A completion queue entry.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Cqe {
+    /// The user data of the completed operation.
+    pub user_data: u64,
+    /// The result of the operation: the number of bytes transferred, or a negated errno.
+    pub res: i32,
+    flags: u32,
+}
+
+/// A memory mapping of the rings, unmapped on drop.
+struct Mmap {
+    addr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mmap {
+    fn new(fd: RawFd, len: usize, offset: libc::off_t) -> Result<Mmap, io::Error> {
+        let addr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED | libc::MAP_POPULATE,
+                fd,
+                offset,
+            )
+        };
+        if addr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Mmap { addr, len })
+    }
+
+    /// A pointer at an offset into the mapping.
+    fn at<T>(&self, offset: u32) -> *mut T {
+        unsafe { (self.addr as *mut u8).add(offset as usize) as *mut T }
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.addr, self.len);
+        }
+    }
+}
+
+/// An io_uring.
+pub struct Ring {
+    fd: RawFd,
+    sqpoll: bool,
+    // The queues point into these mappings, they are dropped with the ring
+    _sq_map: Mmap,
+    _cq_map: Option<Mmap>,
+    _sqes_map: Mmap,
+    sq_head: *const AtomicU32,
+    sq_tail: *const AtomicU32,
+    sq_flags: *const AtomicU32,
+    sq_mask: u32,
+    sq_entries: u32,
+    sq_array: *mut u32,
+    sqes: *mut Sqe,
+    cq_head: *const AtomicU32,
+    cq_tail: *const AtomicU32,
+    cq_mask: u32,
+    cqes: *const Cqe,
+    // The entries pushed since the last submit
+    pending: u32,
+}
+
+// The raw pointers only ever point into the mappings owned by the ring.
+unsafe impl Send for Ring {}
+
+impl Ring {
+    /// Set up an io_uring.
+    ///
+    /// # Arguments
+    ///
+    /// * `entries` - The size of the submission queue. The completion queue is twice as large.
+    /// * `sqpoll` - Whether a kernel thread polls the submission queue, so that operations are
+    /// submitted without a system call while the thread is awake.
+    pub fn new(entries: u32, sqpoll: bool) -> Result<Ring, io::Error> {
+        let mut params = Params::default();
+        if sqpoll {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = SQ_THREAD_IDLE;
+        }
+        let fd = unsafe {
+            libc::syscall(
+                libc::SYS_io_uring_setup,
+                entries,
+                &mut params as *mut Params,
+            )
+        };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let fd = fd as RawFd;
+
+        match Ring::map(fd, &params, sqpoll) {
+            Ok(ring) => Ok(ring),
+            Err(e) => {
+                unsafe {
+                    libc::close(fd);
+                }
+                Err(e)
+            }
+        }
+    }
+
+    /// Map the rings of an io_uring that was set up.
+    fn map(fd: RawFd, params: &Params, sqpoll: bool) -> Result<Ring, io::Error> {
+        let sq_len = params.sq_off.array as usize + params.sq_entries as usize * 4;
+        let cq_len =
+            params.cq_off.cqes as usize + params.cq_entries as usize * std::mem::size_of::<Cqe>();
+        // Kernels since 5.4 map both rings with a single mapping
+        let single = params.features & IORING_FEAT_SINGLE_MMAP != 0;
+
+        let sq_map = Mmap::new(
+            fd,
+            if single { sq_len.max(cq_len) } else { sq_len },
+            IORING_OFF_SQ_RING,
+        )?;
+        let cq_map = match single {
+            true => None,
+            false => Some(Mmap::new(fd, cq_len, IORING_OFF_CQ_RING)?),
+        };
+        let sqes_map = Mmap::new(
+            fd,
+            params.sq_entries as usize * std::mem::size_of::<Sqe>(),
+            IORING_OFF_SQES,
+        )?;
+
+        let cq = cq_map.as_ref().unwrap_or(&sq_map);
+        let sq_off = &params.sq_off;
+        let cq_off = &params.cq_off;
+        Ok(Ring {
+            fd,
+            sqpoll,
+            sq_head: sq_map.at(sq_off.head),
+            sq_tail: sq_map.at(sq_off.tail),
+            sq_flags: sq_map.at(sq_off.flags),
+            sq_mask: unsafe { *sq_map.at::<u32>(sq_off.ring_mask) },
+            sq_entries: params.sq_entries,
+            sq_array: sq_map.at(sq_off.array),
+            sqes: sqes_map.at(0),
+            cq_head: cq.at(cq_off.head),
+            cq_tail: cq.at(cq_off.tail),
+            cq_mask: unsafe { *cq.at::<u32>(cq_off.ring_mask) },
+            cqes: cq.at(cq_off.cqes),
+            pending: 0,
+            _sq_map: sq_map,
+            _cq_map: cq_map,
+            _sqes_map: sqes_map,
+        })
+    }
+
+    /// Push an entry to the submission queue. It is submitted on the next call to
+    /// submit_and_wait, or as soon as the SQPOLL kernel thread sees it.
+    ///
+    /// # Safety
+    ///
+    /// The buffers the entry points to must stay in place until its operation completes.
+    pub unsafe fn push(&mut self, sqe: Sqe) -> Result<(), io::Error> {
+        // Only this thread writes the tail, the kernel writes the head
+        let tail = (*self.sq_tail).load(Ordering::Relaxed);
+        let head = (*self.sq_head).load(Ordering::Acquire);
+        if tail.wrapping_sub(head) >= self.sq_entries {
+            return Err(io::Error::new(
+                io::ErrorKind::Other,
+                "io_uring submission queue is full",
+            ));
+        }
+        let index = tail & self.sq_mask;
+        *self.sqes.add(index as usize) = sqe;
+        *self.sq_array.add(index as usize) = index;
+        (*self.sq_tail).store(tail.wrapping_add(1), Ordering::Release);
+        self.pending += 1;
+        Ok(())
+    }
+
+    /// Submit the entries pushed since the last submit, and wait until at least `wait`
+    /// operations have completed. Both are done with a single system call, and with SQPOLL no
+    /// system call is made unless the kernel thread has gone to sleep or `wait` is not 0.
+    ///
+    /// # Arguments
+    ///
+    /// * `wait` - The number of completions to wait for.
+    pub fn submit_and_wait(&mut self, wait: u32) -> Result<(), io::Error> {
+        let mut flags = 0;
+        if wait > 0 {
+            flags |= IORING_ENTER_GETEVENTS;
+        }
+        if self.sqpoll {
+            let sq_flags = unsafe { (*self.sq_flags).load(Ordering::Acquire) };
+            if sq_flags & IORING_SQ_NEED_WAKEUP != 0 {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+        }
+        if flags == 0 && (self.sqpoll || self.pending == 0) {
+            self.pending = 0;
+            return Ok(());
+        }
+
+        let result = unsafe {
+            libc::syscall(
+                libc::SYS_io_uring_enter,
+                self.fd,
+                self.pending,
+                wait,
+                flags,
+                std::ptr::null::<libc::sigset_t>(),
+                0,
+            )
+        };
+        if result < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        // Without SQPOLL, the kernel consumes what it was told to submit before returning
+        self.pending = self.pending.saturating_sub(result as u32);
+        if self.sqpoll {
+            self.pending = 0;
+        }
+        Ok(())
+    }
+
+    /// Move the completions that are ready to a vector, replacing its contents.
+    ///
+    /// # Arguments
+    ///
+    /// * `completions` - The vector to move the completions to.
+    pub fn completions(&mut self, completions: &mut Vec<Cqe>) {
+        completions.clear();
+        // Only this thread writes the head, the kernel writes the tail
+        let mut head = unsafe { (*self.cq_head).load(Ordering::Relaxed) };
+        let tail = unsafe { (*self.cq_tail).load(Ordering::Acquire) };
+        while head != tail {
+            completions.push(unsafe { *self.cqes.add((head & self.cq_mask) as usize) });
+            head = head.wrapping_add(1);
+        }
+        unsafe { (*self.cq_head).store(head, Ordering::Release) };
+    }
+}
+
+impl Drop for Ring {
+    fn drop(&mut self) {
+        unsafe {
+            libc::close(self.fd);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::uring::{Cqe, Ring, Sqe};
+    use std::os::unix::io::AsRawFd;
+    use std::os::unix::net::UnixDatagram;
+
+    /// A message header for a single buffer and no address.
+    fn msghdr(iov: &mut libc::iovec) -> libc::msghdr {
+        let mut msg: libc::msghdr = unsafe { std::mem::zeroed() };
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 1;
+        msg
+    }
+
+    #[test]
+    fn test_ring_recvmsg_sendmsg() {
+        let mut ring = match Ring::new(4, false) {
+            Ok(ring) => ring,
+            // io_uring can be disabled, e.g. by the kernel.io_uring_disabled sysctl
+            Err(e) => return eprintln!("Skipping, io_uring is not available: {:?}", e),
+        };
+        let (a, b) = UnixDatagram::pair().unwrap();
+
+        let mut received = [0u8; 8];
+        let mut recv_iov = libc::iovec {
+            iov_base: received.as_mut_ptr() as *mut libc::c_void,
+            iov_len: received.len(),
+        };
+        let mut recv_msg = msghdr(&mut recv_iov);
+        let mut sent = *b"ping";
+        let mut send_iov = libc::iovec {
+            iov_base: sent.as_mut_ptr() as *mut libc::c_void,
+            iov_len: sent.len(),
+        };
+        let send_msg = msghdr(&mut send_iov);
+
+        unsafe {
+            ring.push(Sqe::recvmsg(b.as_raw_fd(), &mut recv_msg, 1))
+                .unwrap();
+            ring.push(Sqe::sendmsg(a.as_raw_fd(), &send_msg, 2))
+                .unwrap();
+        }
+
+        let mut completions: Vec<Cqe> = Vec::new();
+        let mut all: Vec<Cqe> = Vec::new();
+        while all.len() < 2 {
+            ring.submit_and_wait(1).unwrap();
+            ring.completions(&mut completions);
+            all.extend_from_slice(&completions);
+        }
+        all.sort_by_key(|cqe| cqe.user_data);
+        assert_eq!(1, all[0].user_data);
+        assert_eq!(4, all[0].res);
+        assert_eq!(2, all[1].user_data);
+        assert_eq!(4, all[1].res);
+        assert_eq!(b"ping", &received[..4]);
+    }
+}